@@ -27,12 +27,68 @@ let package = Package(
         )
     ],
     targets: [
+        // Realtime DSP engine (C++, no Apple framework dependencies)
+        .target(
+            name: "CPAudioEngine",
+            path: "Sources/CPAudioEngine",
+            sources: [
+                "CPKernels.cpp",
+                "CPEqualizer.cpp",
+                "CPTrackSource.cpp",
+                "CPDecodedAudioCache.cpp",
+                "CPMatrixMixer.cpp",
+                "CPOutputDevice.cpp",
+                "CPClockedOutput.cpp",
+                "CPAlsaOutput.cpp",
+                "CPWavFileDecoder.cpp",
+                "CPGainAutomation.cpp",
+                "CPRoomDelay.cpp",
+                "CPFFT.cpp",
+                "CPFingerprint.cpp",
+                "CPRenderPipeline.cpp",
+                "CPPlayerEngine.cpp"
+            ],
+            publicHeadersPath: "include",
+            cxxSettings: [
+                .define("CP_HAS_ALSA", to: "1", .when(platforms: [.linux]))
+            ],
+            linkerSettings: [
+                .linkedLibrary("asound", .when(platforms: [.linux])),
+                .linkedLibrary("pthread", .when(platforms: [.linux]))
+            ]
+        ),
+        // Headless player: plays a WAV file through the null, WAV file or ALSA output
+        .executableTarget(
+            name: "CPAudioHeadless",
+            dependencies: ["CPAudioEngine"],
+            path: "Sources/CPAudioHeadless",
+            sources: [
+                "main.cpp"
+            ]
+        ),
+        // Offline benchmarks of the engine's hot paths: CPAudioBenchmarks <benchmark> [options]
+        .executableTarget(
+            name: "CPAudioBenchmarks",
+            dependencies: ["CPAudioEngine"],
+            path: "Sources/CPAudioBenchmarks",
+            sources: [
+                "main.cpp"
+            ],
+            linkerSettings: [
+                // The Delay unit the room stage is compared against
+                .linkedFramework("AudioToolbox", .when(platforms: [.macOS, .iOS]))
+            ]
+        ),
         // Objective-C core audio player
         .target(
             name: "CPAudioPlayer",
+            dependencies: ["CPAudioEngine"],
             path: "Sources/CPAudioPlayer",
             sources: [
                 "CPAudioPlayer.mm",
+                "CPExtAudioFileDecoder.mm",
+                "CPRemoteIOOutput.mm",
+                "CPAudioFingerprintIndex.mm",
                 "CPBandEqulizer.m",
                 "CPReverbEngine.m"
             ],
@@ -62,6 +118,9 @@ let package = Package(
             dependencies: ["CPAudioPlayer", "CPAudioPlayerUI"],
             path: "Tests/CPAudioPlayerTests"
         )
+        // Engine tests (C++) render through the C++ stages directly and run under CTest
+        // on any platform: see CMakeLists.txt
     ],
-    swiftLanguageVersions: [.v5]
+    swiftLanguageVersions: [.v5],
+    cxxLanguageStandard: .cxx17
 )
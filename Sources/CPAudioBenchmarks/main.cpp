@@ -0,0 +1,739 @@
+//
+//  main.cpp
+//  CPAudioBenchmarks
+//
+//  Offline benchmarks of the engine's hot paths, on synthetic material so they run anywhere.
+//
+//  CPAudioBenchmarks fingerprint [--songs n] [--queries n] [--threads n]
+//  CPAudioBenchmarks pipeline [--stages n] [--block frames] [--seconds s] [--no-realtime]
+//  CPAudioBenchmarks kernels [--seconds s]
+//  CPAudioBenchmarks room [--seconds s]
+//  CPAudioBenchmarks modes [--seconds s] [--no-realtime]
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "CPClockedOutput.hpp"
+#include "CPDenormals.hpp"
+#include "CPFingerprint.hpp"
+#include "CPKernels.hpp"
+#include "CPOutputDevice.hpp"
+#include "CPPlayerEngine.hpp"
+#include "CPRenderPipeline.hpp"
+#include "CPRoomDelay.hpp"
+#if defined(__APPLE__)
+#include <AudioToolbox/AudioToolbox.h>
+#endif
+
+typedef std::chrono::steady_clock Clock;
+
+static double secondsSince(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static double percentile(std::vector<double> values, double fraction) {
+    if (values.empty()) {
+        return 0;
+    }
+    std::sort(values.begin(), values.end());
+    return values[std::min(values.size() - 1, (size_t)(fraction * values.size()))];
+}
+
+/**
+ A deterministic stand-in for a song: a chord progression of decaying partials with a click
+ on every beat. `gain` and `noise` model a re-encoded or re-mastered copy.
+ */
+class CPSyntheticSong : public CPAudioDecoder {
+public:
+    CPSyntheticSong(uint32_t seed, double sampleRate, double seconds, float gain = 0.5f, float noise = 0)
+    : _seed(seed), _sampleRate(sampleRate), _length((int64_t)(seconds * sampleRate)),
+      _gain(gain), _noise(noise), _position(0), _random(seed * 7919u + 1) {}
+
+    uint32_t channels() const override { return 2; }
+    double sampleRate() const override { return _sampleRate; }
+    int64_t lengthFrames() const override { return _length; }
+    bool seek(int64_t frame) override { _position = frame; return true; }
+
+    uint32_t read(float *const *channels, uint32_t frames) override {
+        frames = (uint32_t)std::min<int64_t>(frames, _length - _position);
+        std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+        for (uint32_t i = 0; i < frames; i++, _position++) {
+            double t = _position / _sampleRate;
+            uint32_t beat = (uint32_t)(t / 0.45);
+            double sinceBeat = t - beat * 0.45;
+            uint32_t chord = (_seed * 31 + beat / 2 * 17) % 24;
+            float sample = 0;
+            for (uint32_t partial = 0; partial < 3; partial++) {
+                double frequency = 110.0 * std::pow(2.0, (chord + partial * 4 + partial / 2 * 3) / 12.0);
+                sample += (float)(std::sin(2 * M_PI * frequency * t) * std::exp(-2.0 * sinceBeat) / (partial + 1));
+            }
+            //A click that is a function of time, so copies at other rates carry the same one
+            float hit = sinceBeat < 0.03 ? (float)(0.3 * std::sin(2 * M_PI * (1500.0 + 40000.0 * sinceBeat) * sinceBeat)) : 0.0f;
+            float value = _gain * (0.5f * sample + hit) + _noise * uniform(_random);
+            channels[0][i] = value;
+            channels[1][i] = value;
+        }
+        return frames;
+    }
+
+private:
+    uint32_t _seed;
+    double _sampleRate;
+    int64_t _length;
+    float _gain;
+    float _noise;
+    int64_t _position;
+    std::mt19937 _random;
+};
+
+/// Plays back audio rendered up front, so benchmarks time the consumer rather than the synthesis.
+class CPBufferedSong : public CPAudioDecoder {
+public:
+    CPBufferedSong(std::shared_ptr<const std::vector<float>> samples, double sampleRate)
+    : _samples(samples), _sampleRate(sampleRate), _position(0) {}
+
+    static std::shared_ptr<const std::vector<float>> render(CPAudioDecoder &decoder) {
+        std::shared_ptr<std::vector<float>> samples(new std::vector<float>((size_t)decoder.lengthFrames()));
+        std::vector<float> right(samples->size());
+        float *channels[2] = { samples->data(), right.data() };
+        decoder.read(channels, (uint32_t)samples->size());
+        return samples;
+    }
+
+    uint32_t channels() const override { return 2; }
+    double sampleRate() const override { return _sampleRate; }
+    int64_t lengthFrames() const override { return (int64_t)_samples->size(); }
+    bool seek(int64_t frame) override { _position = frame; return true; }
+
+    uint32_t read(float *const *channels, uint32_t frames) override {
+        frames = (uint32_t)std::min<int64_t>(frames, lengthFrames() - _position);
+        memcpy(channels[0], _samples->data() + _position, frames * sizeof(float));
+        memcpy(channels[1], _samples->data() + _position, frames * sizeof(float));
+        _position += frames;
+        return frames;
+    }
+
+private:
+    std::shared_ptr<const std::vector<float>> _samples;
+    double _sampleRate;
+    int64_t _position;
+};
+
+static int benchmarkFingerprint(int argc, const char *argv[]) {
+    uint32_t songs = 100000;
+    uint32_t queries = 1000;
+    uint32_t threads = 0;
+    for (int arg = 0; arg < argc; arg++) {
+        bool hasValue = arg + 1 < argc;
+        if (strcmp(argv[arg], "--songs") == 0 && hasValue) {
+            songs = (uint32_t)atoi(argv[++arg]);
+        }
+        else if (strcmp(argv[arg], "--queries") == 0 && hasValue) {
+            queries = (uint32_t)atoi(argv[++arg]);
+        }
+        else if (strcmp(argv[arg], "--threads") == 0 && hasValue) {
+            threads = (uint32_t)atoi(argv[++arg]);
+        }
+    }
+
+    //Analysis at 44.1 kHz, one thread, then the pool. Analysis stops after ~30 s of audio,
+    //so the tracks only need to be a little longer than that.
+    const uint32_t tracks = 16;
+    const double trackSeconds = 40;
+    std::vector<CPFingerprintPool::Opener> openers;
+    for (uint32_t track = 0; track < tracks; track++) {
+        CPSyntheticSong song(track, 44100, trackSeconds);
+        std::shared_ptr<const std::vector<float>> samples = CPBufferedSong::render(song);
+        openers.push_back([samples] {
+            return std::unique_ptr<CPAudioDecoder>(new CPBufferedSong(samples, 44100));
+        });
+    }
+    Clock::time_point start = Clock::now();
+    CPFingerprintPool single(1);
+    std::vector<CPFingerprint> reference = single.analyze(openers);
+    double singleSeconds = secondsSince(start);
+    CPFingerprintPool pool(threads);
+    start = Clock::now();
+    pool.analyze(openers);
+    double poolSeconds = secondsSince(start);
+    printf("analysis          %u tracks, %zu words each\n", tracks, reference[0].words.size());
+    printf("  1 thread        %.3f s (%.1f ms per track)\n", singleSeconds, singleSeconds / tracks * 1e3);
+    printf("  %u threads%*s%.3f s (%.1fx)\n", pool.threads(), pool.threads() < 10 ? 7 : 6, "", poolSeconds, singleSeconds / poolSeconds);
+
+    //Robustness: a quieter, noisier copy at another sample rate against its original and a different track
+    CPSyntheticSong copy(3, 48000, trackSeconds, 0.3f, 0.003f);
+    CPFingerprint copyPrint = CPFingerprinter::analyze(copy);
+    printf("copy distance     %.3f (different track %.3f, match below %.2f)\n",
+           CPFingerprintDistance(copyPrint, reference[3]), CPFingerprintDistance(copyPrint, reference[4]), kCPFingerprintMatchDistance);
+
+    //Index: random fingerprints stand in for a large library, queries are 5% bit-flipped copies
+    std::mt19937 random(42);
+    std::uniform_real_distribution<double> duration(120, 400);
+    std::vector<CPFingerprint> library(songs);
+    for (CPFingerprint &fingerprint : library) {
+        fingerprint.words.resize(CPFingerprinter::kMaxWords);
+        for (uint32_t &word : fingerprint.words) {
+            word = random();
+        }
+        fingerprint.duration = duration(random);
+    }
+    CPFingerprintIndex index;
+    start = Clock::now();
+    for (uint32_t song = 0; song < songs; song++) {
+        index.add(song, library[song]);
+    }
+    double buildSeconds = secondsSince(start);
+    printf("index build       %u songs in %.3f s (%.2f us per song)\n", songs, buildSeconds, buildSeconds / std::max(songs, 1u) * 1e6);
+
+    std::vector<double> lookups;
+    uint32_t found = 0, falseMatches = 0;
+    for (uint32_t query = 0; query < queries && songs > 0; query++) {
+        uint32_t target = random() % songs;
+        CPFingerprint probe = library[target];
+        for (uint32_t &word : probe.words) {
+            for (uint32_t bit = 0; bit < 32; bit++) {
+                if (random() % 100 < 5) {
+                    word ^= 1u << bit;
+                }
+            }
+        }
+        start = Clock::now();
+        std::vector<CPFingerprintMatch> matches = index.query(probe);
+        lookups.push_back(secondsSince(start));
+        for (const CPFingerprintMatch &match : matches) {
+            if (match.id == target) {
+                found++;
+            }
+            else {
+                falseMatches++;
+            }
+        }
+    }
+    printf("lookup            %u queries, mean %.3f ms, p99 %.3f ms\n", (uint32_t)lookups.size(),
+           lookups.empty() ? 0 : std::accumulate(lookups.begin(), lookups.end(), 0.0) / lookups.size() * 1e3, percentile(lookups, 0.99) * 1e3);
+    printf("  recall          %.1f%%, false matches %u\n", lookups.empty() ? 0 : 100.0 * found / lookups.size(), falseMatches);
+    return 0;
+}
+
+/**
+ Stands in for an effect chain too heavy for one core: `units` equal units, each running
+ peaking filters over the block `passes` times. Every unit keeps its own filter state, so
+ units on different stages share nothing.
+ */
+class CPSyntheticChain {
+public:
+    static const uint32_t kUnits = 8;
+
+    CPSyntheticChain(uint32_t channels, double sampleRate) : _channels(channels), _passes(1) {
+        //Alternating boost and cut, so any number of passes stays bounded
+        _boost = CPBiquadPeaking(sampleRate, 1000, 1, 0.5);
+        _cut = CPBiquadPeaking(sampleRate, 1000, 1, -0.5);
+        _states.assign((size_t)kUnits * channels * 2, CPBiquadState { 0, 0 });
+    }
+
+    void setPasses(uint32_t passes) { _passes = std::max(passes, 1u); }
+    uint32_t passes() const { return _passes; }
+
+    void process(uint32_t unit, float *const *channels, uint32_t frames) {
+        for (uint32_t pass = 0; pass < _passes; pass++) {
+            for (uint32_t channel = 0; channel < _channels; channel++) {
+                CPBiquadState *state = &_states[((size_t)unit * _channels + channel) * 2];
+                CPBiquadProcess(pass % 2 == 0 ? _boost : _cut, state[pass % 2], channels[channel], channels[channel], frames);
+            }
+        }
+    }
+
+private:
+    uint32_t _channels;
+    uint32_t _passes;
+    CPBiquadCoefficients _boost;
+    CPBiquadCoefficients _cut;
+    std::vector<CPBiquadState> _states;
+};
+
+struct CPPipelineBench {
+    CPSyntheticChain *chain;
+    uint32_t stages;
+};
+
+static uint32_t renderBenchStage(void *refCon, uint32_t stage, float *const *channels, uint32_t, uint32_t frames) {
+    CPPipelineBench *bench = (CPPipelineBench *)refCon;
+    uint32_t first = stage * CPSyntheticChain::kUnits / bench->stages;
+    uint32_t last = (stage + 1) * CPSyntheticChain::kUnits / bench->stages;
+    for (uint32_t unit = first; unit < last; unit++) {
+        bench->chain->process(unit, channels, frames);
+    }
+    return 0;
+}
+
+//Plays `blocks` periods against a simulated device clock; returns the periods whose block wasn't ready
+static uint64_t runDevice(CPSyntheticChain &chain, const CPPipelineConfig &config, uint32_t blocks, CPPipelineStats *stats) {
+    std::vector<float> samples((size_t)config.channels * config.blockFrames, 0.0f);
+    std::vector<float *> channels(config.channels);
+    for (uint32_t channel = 0; channel < config.channels; channel++) {
+        channels[channel] = samples.data() + (size_t)channel * config.blockFrames;
+    }
+    auto period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(config.blockFrames / config.sampleRate));
+    uint64_t missed = 0;
+    CPPipelineBench bench = { &chain, config.stages };
+    std::unique_ptr<CPRenderPipeline> pipeline;
+    if (config.stages > 0) {
+        pipeline.reset(new CPRenderPipeline(config, &renderBenchStage, &bench));
+    }
+    Clock::time_point deadline = Clock::now() + period;
+    for (uint32_t block = 0; block < blocks; block++) {
+        std::this_thread::sleep_until(deadline - period);
+        if (pipeline != nullptr) {
+            pipeline->pull(channels.data(), config.channels, config.blockFrames);
+        }
+        else {
+            //Serial: the whole chain inside the callback, done before the next one is due
+            for (uint32_t unit = 0; unit < CPSyntheticChain::kUnits; unit++) {
+                chain.process(unit, channels.data(), config.blockFrames);
+            }
+            missed += Clock::now() > deadline;
+        }
+        deadline += period;
+    }
+    if (pipeline != nullptr) {
+        *stats = pipeline->stats();
+        missed = stats->underruns;
+    }
+    return missed;
+}
+
+//Largest chain each stage count sustains, in periods. On a single core host, where stages
+//cannot scale: 0.51 serial, 1.06 with one stage (the block of slack), about 1.1 with two. With n
+//free cores the limit approaches n periods; the report prints the host's core count alongside.
+static int benchmarkPipeline(int argc, const char *argv[]) {
+    CPPipelineConfig config;
+    config.stages = 0;
+    config.blockFrames = 256;
+    config.sampleRate = 48000;
+    double seconds = 0.5;
+    uint32_t cores = std::max(std::thread::hardware_concurrency(), 1u);
+    uint32_t maxStages = std::min(std::max(cores, 2u), kCPPipelineMaxStages);
+    for (int arg = 0; arg < argc; arg++) {
+        bool hasValue = arg + 1 < argc;
+        if (strcmp(argv[arg], "--stages") == 0 && hasValue) {
+            maxStages = std::min(std::max((uint32_t)atoi(argv[++arg]), 1u), kCPPipelineMaxStages);
+        }
+        else if (strcmp(argv[arg], "--block") == 0 && hasValue) {
+            config.blockFrames = std::max((uint32_t)atoi(argv[++arg]), 16u);
+        }
+        else if (strcmp(argv[arg], "--seconds") == 0 && hasValue) {
+            seconds = atof(argv[++arg]);
+        }
+        else if (strcmp(argv[arg], "--no-realtime") == 0) {
+            config.realtimePriority = false;
+        }
+    }
+    double period = config.blockFrames / config.sampleRate;
+    uint32_t blocks = std::max((uint32_t)(seconds / period), 20u);
+    bool realtime = config.realtimePriority && CPPromoteThreadToRealtime(period);
+
+    //Cost of one pass of one unit over a block
+    CPSyntheticChain chain(config.channels, config.sampleRate);
+    std::vector<float> samples((size_t)config.channels * config.blockFrames, 0.25f);
+    float *channels[2] = { samples.data(), samples.data() + config.blockFrames };
+    chain.setPasses(1000);
+    Clock::time_point start = Clock::now();
+    chain.process(0, channels, config.blockFrames);
+    double passSeconds = secondsSince(start) / 1000;
+
+    printf("pipeline          %u units, %u frames at %.0f Hz (%.2f ms per block), %u cores, device thread %s\n",
+           CPSyntheticChain::kUnits, config.blockFrames, config.sampleRate, period * 1e3, cores, realtime ? "realtime" : "normal");
+    printf("  stages  latency  max chain cost        stage load at max\n");
+    for (uint32_t stages = 0; stages <= maxStages; stages++) {
+        config.stages = stages;
+        //Chain cost in block periods; binary search for the most that plays without a miss
+        double low = 0, high = stages + 1.0;
+        CPPipelineStats best = {};
+        bool workersRealtime = true, workersPinned = true;
+        for (uint32_t step = 0; step < 8; step++) {
+            double cost = (low + high) / 2;
+            chain.setPasses((uint32_t)std::max(1.0, cost * period / CPSyntheticChain::kUnits / passSeconds));
+            CPPipelineStats stats = {};
+            if (runDevice(chain, config, blocks, &stats) == 0) {
+                low = cost;
+                best = stats;
+            }
+            else {
+                high = cost;
+            }
+            workersRealtime = workersRealtime && (stages == 0 || stats.realtime);
+            workersPinned = workersPinned && (stages == 0 || stats.pinned);
+        }
+        char load[128] = "";
+        for (uint32_t stage = 0, used = 0; stage < stages; stage++) {
+            used += snprintf(load + used, sizeof(load) - used, "%s%.2f", stage > 0 ? " " : "", best.stageLoad[stage]);
+        }
+        char name[16];
+        snprintf(name, sizeof(name), stages == 0 ? "serial" : "%u", stages);
+        printf("  %-6s  %u blk    %.2f periods (%.1f ms)  %s%s\n", name, stages == 0 ? 0 : stages + 1, low, low * period * 1e3, load,
+               stages == 0 ? "" : workersRealtime && workersPinned ? "" : workersRealtime ? " (not pinned)" : " (not realtime)");
+    }
+    return 0;
+}
+
+//Nanoseconds per frame of `run`, best of several timed batches
+template <class Run>
+static double nanosPerFrame(Run run, uint32_t frames, double seconds) {
+    uint32_t calls = 1;
+    Clock::time_point start = Clock::now();
+    while (secondsSince(start) < 0.002) {
+        run();
+        calls++;
+    }
+    calls = std::max(calls, 1u);
+    double best = 1e30;
+    for (uint32_t batch = 0; batch < 5; batch++) {
+        start = Clock::now();
+        for (uint32_t call = 0; call < calls; call++) {
+            run();
+        }
+        best = std::min(best, secondsSince(start) / calls);
+        if (secondsSince(start) * (5 - batch) > seconds) {
+            break;
+        }
+    }
+    return best * 1e9 / frames;
+}
+
+static int benchmarkKernels(int argc, const char *argv[]) {
+    double seconds = 0.05;
+    for (int arg = 0; arg < argc; arg++) {
+        bool hasValue = arg + 1 < argc;
+        if (strcmp(argv[arg], "--seconds") == 0 && hasValue) {
+            seconds = atof(argv[++arg]);
+        }
+    }
+    CPScopedFlushDenormals flushDenormals;
+    const double sampleRate = 44100;
+    const uint32_t maxFrames = 4096;
+
+    //A seven band preset on the app's bands, and shelves like the player's bass and treble units
+    const float eqFrequencies[] = { 60, 150, 400, 1100, 3100, 8000, 16000 };
+    const float eqGains[] = { 4, 2, -1, -2, 1, 3, 5 };
+    CPBiquadCoefficients eq[7], shelves[2];
+    uint8_t bands[7] = { 0, 1, 2, 3, 4, 5, 6 };
+    for (uint32_t band = 0; band < 7; band++) {
+        eq[band] = CPBiquadPeaking(sampleRate, eqFrequencies[band], 1.5, eqGains[band]);
+    }
+    shelves[0] = CPBiquadLowShelf(sampleRate, 120, 6);
+    shelves[1] = CPBiquadHighShelf(sampleRate, 6000, -3);
+    CPBiquadState state[2][7] = {};
+    CPBiquadState *states[2] = { state[0], state[1] };
+
+    //Stereo matrix with a volume ramp in every coefficient
+    float gains[2 * kCPKernelMaxChannels] = { 0 }, steps[2 * kCPKernelMaxChannels] = { 0 };
+    gains[0] = 0.9f, gains[1] = 0.1f, gains[kCPKernelMaxChannels] = 0.1f, gains[kCPKernelMaxChannels + 1] = 0.9f;
+    for (uint32_t coefficient = 0; coefficient < 2 * kCPKernelMaxChannels; coefficient++) {
+        steps[coefficient] = gains[coefficient] * -1e-5f;
+    }
+
+    std::mt19937 random(7);
+    std::uniform_real_distribution<float> noise(-0.5f, 0.5f);
+    std::vector<float> input(2 * maxFrames), output(2 * maxFrames);
+    for (float &sample : input) {
+        sample = noise(random);
+    }
+    std::vector<int16_t> interleaved(2 * maxFrames);
+    const float *in[2] = { input.data(), input.data() + maxFrames };
+    float *out[2] = { output.data(), output.data() + maxFrames };
+
+    struct Kernel {
+        const char *name;
+        std::function<void(const CPKernelTable &, uint32_t, uint32_t)> run;
+    };
+    const Kernel kernels[] = {
+        { "eq, 7 bands", [&](const CPKernelTable &table, uint32_t channels, uint32_t frames) {
+            table.biquadCascade(eq, bands, 7, states, in, out, channels, frames);
+        } },
+        { "shelves", [&](const CPKernelTable &table, uint32_t channels, uint32_t frames) {
+            table.biquadCascade(shelves, bands, 2, states, in, out, channels, frames);
+        } },
+        { "mix ramp", [&](const CPKernelTable &table, uint32_t channels, uint32_t frames) {
+            table.mixMatrix(in, channels, out, 2, gains, steps, frames, false);
+        } },
+        { "gain ramp", [&](const CPKernelTable &table, uint32_t channels, uint32_t frames) {
+            table.gainRamp(out, channels, 1.0f, 1e-7f, frames);
+        } },
+        { "to int16", [&](const CPKernelTable &table, uint32_t channels, uint32_t frames) {
+            table.interleaveInt16(in, interleaved.data(), channels, frames);
+        } },
+        { "from int16", [&](const CPKernelTable &table, uint32_t channels, uint32_t frames) {
+            table.deinterleaveInt16(interleaved.data(), out, channels, frames);
+        } }
+    };
+
+    std::vector<const CPKernelTable *> tables;
+    for (uint32_t isa = 0; isa < CPKernelISACount; isa++) {
+        if (const CPKernelTable *table = CPKernelsForISA((CPKernelISA)isa, true)) {
+            tables.push_back(table);
+        }
+    }
+    const CPKernelTable &generic = *CPKernelsForISA(tables.front()->isa, false);
+    printf("kernels           ns per frame, speedup over the generic %s build; selected %s\n",
+           CPKernelISAName(generic.isa), CPKernelISAName(CPKernels().isa));
+    printf("  %-12s  ch  frames  generic", "kernel");
+    for (const CPKernelTable *table : tables) {
+        printf("  %14s", CPKernelISAName(table->isa));
+    }
+    printf("\n");
+    //Every specialized size, plus one that has to take the generic path
+    std::vector<uint32_t> sizes(std::begin(kCPKernelBlockSizes), std::end(kCPKernelBlockSizes));
+    sizes.push_back(500);
+    for (const Kernel &kernel : kernels) {
+        for (uint32_t channels = 1; channels <= 2; channels++) {
+            for (uint32_t frames : sizes) {
+                double base = nanosPerFrame([&] { kernel.run(generic, channels, frames); }, frames, seconds);
+                printf("  %-12s  %u   %5u  %7.3f", kernel.name, channels, frames, base);
+                for (const CPKernelTable *table : tables) {
+                    double nanos = nanosPerFrame([&] { kernel.run(*table, channels, frames); }, frames, seconds);
+                    printf("  %7.3f %5.2fx", nanos, base / nanos);
+                }
+                printf("\n");
+            }
+        }
+    }
+    return 0;
+}
+
+#if defined(__APPLE__)
+//Feeds the Delay unit the block being benchmarked
+static OSStatus delayUnitInput(void *refCon, AudioUnitRenderActionFlags *flags, const AudioTimeStamp *timeStamp,
+                               UInt32 bus, UInt32 frames, AudioBufferList *data) {
+    const float *const *input = (const float *const *)refCon;
+    for (UInt32 channel = 0; channel < data->mNumberBuffers; channel++) {
+        memcpy(data->mBuffers[channel].mData, input[channel], frames * sizeof(float));
+    }
+    return noErr;
+}
+
+//Apple's Delay unit in the engine's format, set up the way setRoomSize used to set it
+static AudioUnit newDelayUnit(double sampleRate, uint32_t maxFrames, const float *const *input, float delaySeconds, float wetPercent) {
+    AudioComponentDescription description = { kAudioUnitType_Effect, kAudioUnitSubType_Delay, kAudioUnitManufacturer_Apple, 0, 0 };
+    AudioComponent component = AudioComponentFindNext(nullptr, &description);
+    AudioUnit unit = nullptr;
+    if (component == nullptr || AudioComponentInstanceNew(component, &unit) != noErr) {
+        return nullptr;
+    }
+    AudioStreamBasicDescription format = { 0 };
+    format.mSampleRate = sampleRate;
+    format.mFormatID = kAudioFormatLinearPCM;
+    format.mFormatFlags = kAudioFormatFlagsNativeFloatPacked | kAudioFormatFlagIsNonInterleaved;
+    format.mBitsPerChannel = 32;
+    format.mChannelsPerFrame = 2;
+    format.mFramesPerPacket = 1;
+    format.mBytesPerFrame = sizeof(float);
+    format.mBytesPerPacket = sizeof(float);
+    AURenderCallbackStruct callback = { &delayUnitInput, (void *)input };
+    UInt32 maxFPS = maxFrames;
+    bool ready = AudioUnitSetProperty(unit, kAudioUnitProperty_StreamFormat, kAudioUnitScope_Input, 0, &format, sizeof(format)) == noErr &&
+                 AudioUnitSetProperty(unit, kAudioUnitProperty_StreamFormat, kAudioUnitScope_Output, 0, &format, sizeof(format)) == noErr &&
+                 AudioUnitSetProperty(unit, kAudioUnitProperty_MaximumFramesPerSlice, kAudioUnitScope_Global, 0, &maxFPS, sizeof(maxFPS)) == noErr &&
+                 AudioUnitSetProperty(unit, kAudioUnitProperty_SetRenderCallback, kAudioUnitScope_Input, 0, &callback, sizeof(callback)) == noErr &&
+                 AudioUnitInitialize(unit) == noErr;
+    if (!ready) {
+        AudioComponentInstanceDispose(unit);
+        return nullptr;
+    }
+    AudioUnitSetParameter(unit, kDelayParam_DelayTime, kAudioUnitScope_Global, 0, delaySeconds, 0);
+    AudioUnitSetParameter(unit, kDelayParam_WetDryMix, kAudioUnitScope_Global, 0, wetPercent, 0);
+    return unit;
+}
+#endif
+
+static int benchmarkRoom(int argc, const char *argv[]) {
+    double seconds = 0.2;
+    for (int arg = 0; arg < argc; arg++) {
+        bool hasValue = arg + 1 < argc;
+        if (strcmp(argv[arg], "--seconds") == 0 && hasValue) {
+            seconds = atof(argv[++arg]);
+        }
+    }
+    CPScopedFlushDenormals flushDenormals;
+    const double sampleRate = 44100;
+    const uint32_t maxFrames = 4096;
+    //Room size 0.5 on the player: 0.1 s at 2.5% wet
+    const float delaySeconds = 0.1f, wet = 0.025f;
+
+    std::mt19937 random(11);
+    std::uniform_real_distribution<float> noise(-0.5f, 0.5f);
+    std::vector<float> input(2 * maxFrames), output(2 * maxFrames);
+    for (float &sample : input) {
+        sample = noise(random);
+    }
+    const float *in[2] = { input.data(), input.data() + maxFrames };
+    float *out[2] = { output.data(), output.data() + maxFrames };
+
+    //Every variant does the same work per sample; the glide one has the delay time moving the whole time
+    CPRoomDelay plain(sampleRate, 0.25f), modulated(sampleRate, 0.25f), gliding(sampleRate, 0.25f);
+    for (CPRoomDelay *room : { &plain, &modulated, &gliding }) {
+        room->setDelayTime(delaySeconds);
+        room->setWetDryMix(wet);
+    }
+    modulated.setModulation(0.002f, 0.7f);
+    uint32_t glideBlock = 0;
+    auto runRoom = [&](CPRoomDelay &room, uint32_t frames) {
+        if (&room == &gliding) {
+            room.setDelayTime(glideBlock++ % 2 == 0 ? 0.05f : 0.15f);
+        }
+        for (uint32_t channel = 0; channel < 2; channel++) {
+            memcpy(out[channel], in[channel], frames * sizeof(float));
+        }
+        room.process(out, 2, frames);
+    };
+
+    printf("room delay        stereo, %.2f s at %.1f%% wet, ns per frame\n", delaySeconds, wet * 100);
+#if defined(__APPLE__)
+    printf("  frames  native  modulated  gliding  Delay unit\n");
+#else
+    printf("  frames  native  modulated  gliding\n");
+#endif
+    for (uint32_t frames : { 256u, 512u, 1024u, 4096u }) {
+        double native = nanosPerFrame([&] { runRoom(plain, frames); }, frames, seconds);
+        double withModulation = nanosPerFrame([&] { runRoom(modulated, frames); }, frames, seconds);
+        double withGlide = nanosPerFrame([&] { runRoom(gliding, frames); }, frames, seconds);
+        printf("  %6u  %6.2f  %9.2f  %7.2f", frames, native, withModulation, withGlide);
+#if defined(__APPLE__)
+        AudioUnit unit = newDelayUnit(sampleRate, maxFrames, in, delaySeconds, wet * 100);
+        if (unit != nullptr) {
+            AudioTimeStamp timeStamp = { 0 };
+            timeStamp.mFlags = kAudioTimeStampSampleTimeValid;
+            struct {
+                AudioBufferList list;
+                AudioBuffer second;
+            } buffers;
+            buffers.list.mNumberBuffers = 2;
+            double nanos = nanosPerFrame([&] {
+                for (uint32_t channel = 0; channel < 2; channel++) {
+                    buffers.list.mBuffers[channel] = AudioBuffer { 1, (UInt32)(frames * sizeof(float)), out[channel] };
+                }
+                AudioUnitRenderActionFlags flags = 0;
+                AudioUnitRender(unit, &flags, &timeStamp, 0, frames, &buffers.list);
+                timeStamp.mSampleTime += frames;
+            }, frames, seconds);
+            printf("  %10.2f  %.2fx", nanos, nanos / native);
+            AudioUnitUninitialize(unit);
+            AudioComponentInstanceDispose(unit);
+        }
+        else {
+            printf("  %10s", "n/a");
+        }
+#endif
+        printf("\n");
+    }
+    return 0;
+}
+
+//The room stage as the engine's process callback, standing in for the player's effect stages
+static void roomCallback(void *refCon, float *const *channels, uint32_t numChannels, uint32_t frames) {
+    ((CPRoomDelay *)refCon)->process(channels, numChannels, frames);
+}
+
+static int benchmarkModes(int argc, const char *argv[]) {
+    double seconds = 3;
+    bool realtime = true;
+    for (int arg = 0; arg < argc; arg++) {
+        bool hasValue = arg + 1 < argc;
+        if (strcmp(argv[arg], "--seconds") == 0 && hasValue) {
+            seconds = atof(argv[++arg]);
+        }
+        else if (strcmp(argv[arg], "--no-realtime") == 0) {
+            realtime = false;
+        }
+    }
+    const double sampleRate = 44100;
+    const float eqFrequencies[] = { 60, 150, 400, 1100, 3100, 8000, 16000 };
+    const float eqGains[] = { 4, 2, -1, 0, 2, 4, 5 };
+    //Rendered up front, so what the loader costs is the engine's, not the synthesis
+    CPSyntheticSong synthetic(5, sampleRate, seconds + 2);
+    std::shared_ptr<const std::vector<float>> song = CPBufferedSong::render(synthetic);
+
+    struct Mode {
+        const char *name;
+        CPRenderMode mode;
+        uint32_t periodFrames;
+    };
+    //441 frames is not a multiple of the engine block
+    const Mode modes[] = {
+        { "interactive", CPRenderModeInteractive, 256 },
+        { "interactive", CPRenderModeInteractive, 441 },
+        { "interactive", CPRenderModeInteractive, 1024 },
+        { "background", CPRenderModeBackground, 1024 },
+    };
+    printf("render modes      paced null output, EQ and room stage, %u frame engine blocks, %.0f s each\n", kCPEngineBlockFrames, seconds);
+    printf("  mode         period  render/s  loader/s  underruns  cpu ms per audio minute\n");
+    for (const Mode &mode : modes) {
+        CPRoomDelay room(sampleRate, 0.25f);
+        room.setDelayTime(0.1f);
+        room.setWetDryMix(0.025f);
+        CPOutputConfig config;
+        config.sampleRate = sampleRate;
+        config.periodFrames = mode.periodFrames;
+        config.realtimePriority = realtime;
+        CPPlayerEngine engine(std::unique_ptr<CPOutputDevice>(new CPNullOutput()), config, eqFrequencies, 7);
+        engine.equalizer().setGains(eqGains);
+        engine.setProcessCallback(&roomCallback, &room);
+        engine.setRenderMode(mode.mode);
+        if (!engine.load(std::unique_ptr<CPAudioDecoder>(new CPBufferedSong(song, sampleRate))) || !engine.play()) {
+            fprintf(stderr, "Cannot play through the null output\n");
+            return 1;
+        }
+        //Past the start-up burst and the first refill
+        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+        uint64_t callbacks = engine.output().stats().callbacks;
+        CPTrackSourceStats source = engine.source().stats();
+        std::clock_t cpuStart = std::clock();
+        Clock::time_point start = Clock::now();
+        std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+        double played = secondsSince(start);
+        double cpuSeconds = (double)(std::clock() - cpuStart) / CLOCKS_PER_SEC;
+        callbacks = engine.output().stats().callbacks - callbacks;
+        uint64_t loaderWakeups = engine.source().stats().loaderWakeups - source.loaderWakeups;
+        uint64_t underruns = engine.source().stats().underruns - source.underruns;
+        engine.stop();
+        printf("  %-11s  %6u  %8.1f  %8.1f  %9llu  %23.1f\n", mode.name, engine.output().config().periodFrames,
+               callbacks / played, loaderWakeups / played, (unsigned long long)underruns, cpuSeconds * 1e3 * 60 / played);
+    }
+    return 0;
+}
+
+int main(int argc, const char *argv[]) {
+    std::string benchmark = argc > 1 ? argv[1] : "";
+    if (benchmark == "fingerprint") {
+        return benchmarkFingerprint(argc - 2, argv + 2);
+    }
+    if (benchmark == "pipeline") {
+        return benchmarkPipeline(argc - 2, argv + 2);
+    }
+    if (benchmark == "kernels") {
+        return benchmarkKernels(argc - 2, argv + 2);
+    }
+    if (benchmark == "room") {
+        return benchmarkRoom(argc - 2, argv + 2);
+    }
+    if (benchmark == "modes") {
+        return benchmarkModes(argc - 2, argv + 2);
+    }
+    fprintf(stderr, "usage: CPAudioBenchmarks fingerprint [--songs n] [--queries n] [--threads n]\n"
+                    "       CPAudioBenchmarks pipeline [--stages n] [--block frames] [--seconds s] [--no-realtime]\n"
+                    "       CPAudioBenchmarks kernels [--seconds s]\n"
+                    "       CPAudioBenchmarks room [--seconds s]\n"
+                    "       CPAudioBenchmarks modes [--seconds s] [--no-realtime]\n");
+    return 1;
+}
@@ -0,0 +1,147 @@
+//
+//  CPAlsaOutput.cpp
+//  CPAudioEngine
+//
+//  ALSA playback backend for Linux builds (CP_HAS_ALSA)
+//
+
+#include "include/CPAlsaOutput.hpp"
+
+#if CP_HAS_ALSA
+
+#include <alsa/asoundlib.h>
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include "include/CPKernels.hpp"
+
+CPAlsaOutput::CPAlsaOutput(const std::string &device)
+: _device(device),
+  _pcm(nullptr),
+  _floatSamples(true),
+  _running(false)
+{
+}
+
+CPAlsaOutput::~CPAlsaOutput() {
+    close();
+}
+
+bool CPAlsaOutput::open(const CPOutputConfig &config) {
+    close();
+    if (snd_pcm_open(&_pcm, _device.c_str(), SND_PCM_STREAM_PLAYBACK, 0) < 0) {
+        _pcm = nullptr;
+        return false;
+    }
+    _config = config;
+    snd_pcm_hw_params_t *hardware;
+    snd_pcm_hw_params_alloca(&hardware);
+    snd_pcm_hw_params_any(_pcm, hardware);
+    bool configured = snd_pcm_hw_params_set_access(_pcm, hardware, SND_PCM_ACCESS_RW_INTERLEAVED) == 0;
+    _floatSamples = snd_pcm_hw_params_set_format(_pcm, hardware, SND_PCM_FORMAT_FLOAT_LE) == 0;
+    if (!_floatSamples) {
+        configured = configured && snd_pcm_hw_params_set_format(_pcm, hardware, SND_PCM_FORMAT_S16_LE) == 0;
+    }
+    configured = configured && snd_pcm_hw_params_set_channels(_pcm, hardware, config.channels) == 0;
+    unsigned int rate = (unsigned int)config.sampleRate;
+    configured = configured && snd_pcm_hw_params_set_rate_near(_pcm, hardware, &rate, nullptr) == 0;
+    snd_pcm_uframes_t period = config.periodFrames;
+    snd_pcm_uframes_t bufferFrames = (snd_pcm_uframes_t)config.periodFrames * std::max(config.periods, 2u);
+    configured = configured && snd_pcm_hw_params_set_period_size_near(_pcm, hardware, &period, nullptr) == 0;
+    configured = configured && snd_pcm_hw_params_set_buffer_size_near(_pcm, hardware, &bufferFrames) == 0;
+    configured = configured && snd_pcm_hw_params(_pcm, hardware) == 0;
+    if (!configured) {
+        close();
+        return false;
+    }
+    //Whatever the device granted
+    snd_pcm_hw_params_get_period_size(hardware, &period, nullptr);
+    snd_pcm_hw_params_get_buffer_size(hardware, &bufferFrames);
+    _config.sampleRate = rate;
+    _config.periodFrames = (uint32_t)period;
+    _config.periods = (uint32_t)std::max<snd_pcm_uframes_t>(bufferFrames / period, 1);
+
+    _buffer.assign((size_t)_config.channels * _config.periodFrames, 0.0f);
+    _channels.resize(_config.channels);
+    for (uint32_t channel = 0; channel < _config.channels; channel++) {
+        _channels[channel] = _buffer.data() + (size_t)channel * _config.periodFrames;
+    }
+    _interleaved.assign((size_t)_config.channels * _config.periodFrames * (_floatSamples ? 4 : 2), 0);
+    setLatency((double)bufferFrames / _config.sampleRate);
+    return true;
+}
+
+bool CPAlsaOutput::start() {
+    if (_pcm == nullptr || _running.load()) {
+        return _pcm != nullptr;
+    }
+    resetStats();
+    snd_pcm_prepare(_pcm);
+    _running.store(true);
+    _thread = std::thread(&CPAlsaOutput::renderMain, this);
+    return true;
+}
+
+void CPAlsaOutput::stop() {
+    _running.store(false);
+    if (_thread.joinable()) {
+        _thread.join();
+    }
+    if (_pcm != nullptr) {
+        snd_pcm_drop(_pcm);
+    }
+}
+
+void CPAlsaOutput::close() {
+    stop();
+    if (_pcm != nullptr) {
+        snd_pcm_close(_pcm);
+        _pcm = nullptr;
+    }
+}
+
+void CPAlsaOutput::renderMain() {
+    const uint32_t period = _config.periodFrames;
+    const uint32_t numChannels = _config.channels;
+    const CPKernelTable &kernels = CPKernels();
+    setRealtime(_config.realtimePriority && CPPromoteThreadToRealtime((double)period / _config.sampleRate));
+    while (_running.load(std::memory_order_relaxed)) {
+        render(_channels.data(), period);
+        if (_floatSamples) {
+            kernels.interleaveFloat(_channels.data(), (float *)_interleaved.data(), numChannels, period);
+        }
+        else {
+            kernels.interleaveInt16(_channels.data(), (int16_t *)_interleaved.data(), numChannels, period);
+        }
+
+        //Blocks until the device has room, which is what paces this thread
+        const uint8_t *data = _interleaved.data();
+        size_t frameBytes = (size_t)numChannels * (_floatSamples ? 4 : 2);
+        snd_pcm_uframes_t remaining = period;
+        while (remaining > 0 && _running.load(std::memory_order_relaxed)) {
+            snd_pcm_sframes_t written = snd_pcm_writei(_pcm, data, remaining);
+            if (written == -EAGAIN) {
+                continue;
+            }
+            if (written < 0) {
+                if (written == -EPIPE) {
+                    addXrun();
+                    restartTiming();
+                }
+                if (snd_pcm_recover(_pcm, (int)written, 1) < 0) {
+                    _running.store(false);
+                }
+                continue;
+            }
+            data += (size_t)written * frameBytes;
+            remaining -= (snd_pcm_uframes_t)written;
+        }
+
+        snd_pcm_sframes_t delay = 0;
+        if (snd_pcm_delay(_pcm, &delay) == 0 && delay >= 0) {
+            setLatency((double)delay / _config.sampleRate);
+        }
+    }
+}
+
+#endif /* CP_HAS_ALSA */
@@ -0,0 +1,190 @@
+//
+//  CPClockedOutput.cpp
+//  CPAudioEngine
+//
+//  Backends without hardware behind them: the engine drives its own render thread
+//
+
+#include "include/CPClockedOutput.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include "include/CPKernels.hpp"
+
+#pragma mark Clocked output
+
+CPClockedOutput::CPClockedOutput(bool paced)
+: _paced(paced),
+  _open(false),
+  _running(false)
+{
+}
+
+CPClockedOutput::~CPClockedOutput() {
+    stop();
+}
+
+bool CPClockedOutput::open(const CPOutputConfig &config) {
+    if (_running.load() || config.sampleRate <= 0 || config.channels == 0 || config.periodFrames == 0) {
+        return false;
+    }
+    _config = config;
+    _config.periods = std::max(config.periods, 1u);
+    _buffer.assign((size_t)_config.channels * _config.periodFrames, 0.0f);
+    _channels.resize(_config.channels);
+    for (uint32_t channel = 0; channel < _config.channels; channel++) {
+        _channels[channel] = _buffer.data() + (size_t)channel * _config.periodFrames;
+    }
+    setLatency((double)_config.periods * _config.periodFrames / _config.sampleRate);
+    _open = true;
+    return true;
+}
+
+bool CPClockedOutput::start() {
+    if (!_open || _running.load()) {
+        return _open;
+    }
+    resetStats();
+    _running.store(true);
+    _thread = std::thread(&CPClockedOutput::renderMain, this);
+    return true;
+}
+
+void CPClockedOutput::stop() {
+    _running.store(false);
+    if (_thread.joinable()) {
+        _thread.join();
+    }
+}
+
+void CPClockedOutput::close() {
+    stop();
+    _open = false;
+}
+
+void CPClockedOutput::renderMain() {
+    typedef std::chrono::steady_clock Clock;
+    const double rate = _config.sampleRate;
+    const uint64_t period = _config.periodFrames;
+    const uint64_t bufferFrames = (uint64_t)_config.periods * period;
+    setRealtime(_config.realtimePriority && CPPromoteThreadToRealtime((double)period / rate));
+
+    //The virtual device starts playing once its buffer is full
+    Clock::time_point deviceStart = Clock::now();
+    uint64_t renderedFrames = 0;
+    bool filling = true;
+    while (_running.load(std::memory_order_relaxed)) {
+        render(_channels.data(), (uint32_t)period);
+        consume(_channels.data(), (uint32_t)period);
+        renderedFrames += period;
+        if (!_paced) {
+            continue;
+        }
+        if (filling) {
+            //Back to back while the buffer fills: not callback jitter
+            restartTiming();
+            if (renderedFrames < bufferFrames) {
+                continue;
+            }
+            filling = false;
+            deviceStart = Clock::now();
+        }
+
+        //Frames the device has played, and how far the rendered audio runs ahead of it
+        double played = std::chrono::duration<double>(Clock::now() - deviceStart).count() * rate;
+        double ahead = (double)renderedFrames - played;
+        if (ahead < 0) {
+            //Drained: the device restarts from silence with the buffer refilled
+            addXrun();
+            filling = true;
+            renderedFrames = 0;
+            continue;
+        }
+        setLatency(ahead / rate);
+        //Wake up when the device has room for another period
+        double due = (double)(renderedFrames + period - bufferFrames) / rate;
+        std::this_thread::sleep_until(deviceStart + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(due)));
+    }
+}
+
+#pragma mark WAV file output
+
+CPWavFileOutput::CPWavFileOutput(const std::string &path, Encoding encoding, bool paced)
+: CPClockedOutput(paced),
+  _path(path),
+  _encoding(encoding),
+  _file(nullptr),
+  _framesWritten(0)
+{
+}
+
+CPWavFileOutput::~CPWavFileOutput() {
+    close();
+}
+
+static void putLE(std::FILE *file, uint32_t value, uint32_t bytes) {
+    for (uint32_t byte = 0; byte < bytes; byte++) {
+        std::fputc((int)((value >> (8 * byte)) & 0xff), file);
+    }
+}
+
+void CPWavFileOutput::writeHeader() {
+    uint32_t sampleBytes = _encoding == EncodingFloat32 ? 4 : 2;
+    uint32_t blockAlign = sampleBytes * _config.channels;
+    uint64_t dataBytes = _framesWritten.load() * blockAlign;
+    //RIFF sizes are 32 bit; longer bounces are still readable up to the real end of file
+    uint32_t dataSize = (uint32_t)std::min<uint64_t>(dataBytes, 0xffffffffu - 36);
+    std::fseek(_file, 0, SEEK_SET);
+    std::fwrite("RIFF", 1, 4, _file);
+    putLE(_file, 36 + dataSize, 4);
+    std::fwrite("WAVEfmt ", 1, 8, _file);
+    putLE(_file, 16, 4);
+    putLE(_file, _encoding == EncodingFloat32 ? 3 : 1, 2);
+    putLE(_file, _config.channels, 2);
+    putLE(_file, (uint32_t)_config.sampleRate, 4);
+    putLE(_file, (uint32_t)_config.sampleRate * blockAlign, 4);
+    putLE(_file, blockAlign, 2);
+    putLE(_file, sampleBytes * 8, 2);
+    std::fwrite("data", 1, 4, _file);
+    putLE(_file, dataSize, 4);
+}
+
+bool CPWavFileOutput::open(const CPOutputConfig &config) {
+    close();
+    if (!CPClockedOutput::open(config)) {
+        return false;
+    }
+    _file = std::fopen(_path.c_str(), "wb");
+    if (_file == nullptr) {
+        CPClockedOutput::close();
+        return false;
+    }
+    _framesWritten.store(0);
+    uint32_t sampleBytes = _encoding == EncodingFloat32 ? 4 : 2;
+    _interleaved.assign((size_t)_config.periodFrames * _config.channels * sampleBytes, 0);
+    writeHeader();
+    return true;
+}
+
+void CPWavFileOutput::close() {
+    CPClockedOutput::close();
+    if (_file != nullptr) {
+        writeHeader();
+        std::fclose(_file);
+        _file = nullptr;
+    }
+}
+
+void CPWavFileOutput::consume(const float *const *channels, uint32_t frames) {
+    uint32_t numChannels = _config.channels;
+    if (_encoding == EncodingFloat32) {
+        CPKernels().interleaveFloat(channels, (float *)_interleaved.data(), numChannels, frames);
+    }
+    else {
+        CPKernels().interleaveInt16(channels, (int16_t *)_interleaved.data(), numChannels, frames);
+    }
+    uint32_t sampleBytes = _encoding == EncodingFloat32 ? 4 : 2;
+    std::fwrite(_interleaved.data(), (size_t)sampleBytes * numChannels, frames, _file);
+    _framesWritten.fetch_add(frames, std::memory_order_relaxed);
+}
@@ -0,0 +1,253 @@
+//
+//  CPDecodedAudioCache.cpp
+//  CPAudioEngine
+//
+//  LRU cache of decoded tracks, held as half precision blocks
+//
+
+#include "include/CPDecodedAudioCache.hpp"
+#include <algorithm>
+#include <chrono>
+#include "include/CPAllocationCount.hpp"
+#include "include/CPHalf.hpp"
+
+//Decode granularity of capture and prefetch
+static const uint32_t kCaptureBlockFrames = 4096;
+
+#pragma mark Decoders
+
+/// Reads straight from a cached track.
+class CPDecodedAudioCache::CachedDecoder : public CPAudioDecoder {
+public:
+    CachedDecoder(std::shared_ptr<const Track> track) : _track(std::move(track)), _position(0) {}
+
+    uint32_t channels() const override { return _track->channels; }
+    double sampleRate() const override { return _track->sampleRate; }
+    int64_t lengthFrames() const override { return _track->lengthFrames; }
+
+    uint32_t read(float *const *channels, uint32_t frames) override {
+        frames = (uint32_t)std::min<int64_t>(frames, _track->lengthFrames - _position);
+        for (uint32_t channel = 0; channel < _track->channels; channel++) {
+            CPHalfToFloat(_track->planes[channel].data() + _position, channels[channel], frames);
+        }
+        _position += frames;
+        return frames;
+    }
+
+    bool seek(int64_t frame) override {
+        if (frame < 0 || frame > _track->lengthFrames) {
+            return false;
+        }
+        _position = frame;
+        return true;
+    }
+
+private:
+    std::shared_ptr<const Track> _track;
+    int64_t _position;
+};
+
+/// Passes reads through and packs them into a track, inserted into the cache at end of stream.
+/// The planes grow with the reads, so the memory is committed by whichever thread decodes (the
+/// source's loader) rather than all at once when the track is opened.
+class CPDecodedAudioCache::CaptureDecoder : public CPAudioDecoder {
+public:
+    CaptureDecoder(CPDecodedAudioCache *cache, const std::string &key, std::unique_ptr<CPAudioDecoder> decoder, size_t budgetBytes)
+    : _cache(cache),
+      _key(key),
+      _decoder(std::move(decoder)),
+      _position(0),
+      _limitFrames((int64_t)(budgetBytes / ((size_t)_decoder->channels() * sizeof(uint16_t)))),
+      _track(new Track())
+    {
+        _track->sampleRate = _decoder->sampleRate();
+        _track->channels = _decoder->channels();
+        _track->lengthFrames = 0;
+        _track->decodeSeconds = 0;
+        _track->planes.resize(_track->channels);
+        //The decoder, the track and its plane table
+        CPCountAllocations(3);
+    }
+
+    uint32_t channels() const override { return _decoder->channels(); }
+    double sampleRate() const override { return _decoder->sampleRate(); }
+    int64_t lengthFrames() const override { return _decoder->lengthFrames(); }
+
+    uint32_t read(float *const *channels, uint32_t frames) override {
+        auto start = std::chrono::steady_clock::now();
+        uint32_t read = _decoder->read(channels, frames);
+        if (!_track) {
+            return read;
+        }
+        _track->decodeSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (_position + read > _limitFrames) {
+            //Turned out longer than the budget allows
+            _track.reset();
+            return read;
+        }
+        for (uint32_t channel = 0; channel < _track->channels; channel++) {
+            std::vector<uint16_t> &plane = _track->planes[channel];
+            if (plane.capacity() < (size_t)(_position + read)) {
+                CPCountAllocations();
+            }
+            plane.resize((size_t)(_position + read));
+            CPHalfFromFloat(channels[channel], plane.data() + _position, read);
+        }
+        _position += read;
+        if (read == 0) {
+            finish();
+        }
+        return read;
+    }
+
+    bool seek(int64_t frame) override {
+        if (frame != _position) {
+            _track.reset();
+        }
+        return _decoder->seek(frame);
+    }
+
+private:
+    void finish() {
+        //Growth leaves slack, give it back before the track is shared
+        for (std::vector<uint16_t> &plane : _track->planes) {
+            plane.shrink_to_fit();
+        }
+        _track->lengthFrames = _position;
+        _cache->insert(_key, std::shared_ptr<const Track>(_track.release()));
+    }
+
+    CPDecodedAudioCache *_cache;
+    std::string _key;
+    std::unique_ptr<CPAudioDecoder> _decoder;
+    int64_t _position;
+    int64_t _limitFrames;
+    std::unique_ptr<Track> _track;
+};
+
+#pragma mark Cache
+
+CPDecodedAudioCache::CPDecodedAudioCache(size_t budgetBytes)
+: _budget(budgetBytes),
+  _bytesHeld(0),
+  _hits(0),
+  _misses(0),
+  _decodeSecondsSaved(0)
+{
+}
+
+void CPDecodedAudioCache::setBudget(size_t budgetBytes) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _budget = budgetBytes;
+    evictLocked(_budget);
+}
+
+size_t CPDecodedAudioCache::budget() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _budget;
+}
+
+void CPDecodedAudioCache::evictLocked(size_t budgetBytes) {
+    while (_bytesHeld > budgetBytes && !_recency.empty()) {
+        auto entry = _entries.find(_recency.back());
+        _bytesHeld -= entry->second.track->bytes();
+        _entries.erase(entry);
+        _recency.pop_back();
+    }
+}
+
+void CPDecodedAudioCache::insert(const std::string &key, std::shared_ptr<const Track> track) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (track->bytes() > _budget) {
+        return;
+    }
+    auto existing = _entries.find(key);
+    if (existing != _entries.end()) {
+        _bytesHeld -= existing->second.track->bytes();
+        _recency.erase(existing->second.recency);
+        _entries.erase(existing);
+    }
+    evictLocked(_budget - track->bytes());
+    _recency.push_front(key);
+    _bytesHeld += track->bytes();
+    _entries[key] = Entry { std::move(track), _recency.begin() };
+}
+
+std::unique_ptr<CPAudioDecoder> CPDecodedAudioCache::open(const std::string &key, double sampleRate) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto entry = _entries.find(key);
+    if (entry == _entries.end() || entry->second.track->sampleRate != sampleRate) {
+        _misses++;
+        return nullptr;
+    }
+    _hits++;
+    _decodeSecondsSaved += entry->second.track->decodeSeconds;
+    _recency.splice(_recency.begin(), _recency, entry->second.recency);
+    CPCountAllocations();
+    return std::unique_ptr<CPAudioDecoder>(new CachedDecoder(entry->second.track));
+}
+
+bool CPDecodedAudioCache::fitsBudget(const CPAudioDecoder &decoder) const {
+    size_t bytes = (size_t)decoder.channels() * (size_t)std::max<int64_t>(0, decoder.lengthFrames()) * sizeof(uint16_t);
+    return bytes > 0 && bytes <= budget();
+}
+
+std::unique_ptr<CPAudioDecoder> CPDecodedAudioCache::capture(const std::string &key, std::unique_ptr<CPAudioDecoder> decoder) {
+    if (!fitsBudget(*decoder)) {
+        return decoder;
+    }
+    return std::unique_ptr<CPAudioDecoder>(new CaptureDecoder(this, key, std::move(decoder), budget()));
+}
+
+bool CPDecodedAudioCache::prefetch(const std::string &key, std::unique_ptr<CPAudioDecoder> decoder) {
+    if (contains(key)) {
+        return true;
+    }
+    //Decoding a track the cache would not keep is wasted work
+    if (!fitsBudget(*decoder)) {
+        return false;
+    }
+    std::unique_ptr<CPAudioDecoder> capturing = capture(key, std::move(decoder));
+    std::vector<float> block((size_t)capturing->channels() * kCaptureBlockFrames);
+    std::vector<float *> channels(capturing->channels());
+    for (uint32_t channel = 0; channel < capturing->channels(); channel++) {
+        channels[channel] = block.data() + (size_t)channel * kCaptureBlockFrames;
+    }
+    while (capturing->read(channels.data(), kCaptureBlockFrames) > 0) {
+    }
+    return contains(key);
+}
+
+bool CPDecodedAudioCache::contains(const std::string &key) const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _entries.count(key) > 0;
+}
+
+void CPDecodedAudioCache::remove(const std::string &key) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto entry = _entries.find(key);
+    if (entry == _entries.end()) {
+        return;
+    }
+    _bytesHeld -= entry->second.track->bytes();
+    _recency.erase(entry->second.recency);
+    _entries.erase(entry);
+}
+
+void CPDecodedAudioCache::clear() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _entries.clear();
+    _recency.clear();
+    _bytesHeld = 0;
+}
+
+CPDecodedAudioCacheStats CPDecodedAudioCache::stats() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    CPDecodedAudioCacheStats stats;
+    stats.hits = _hits;
+    stats.misses = _misses;
+    stats.bytesHeld = _bytesHeld;
+    stats.tracks = _entries.size();
+    stats.decodeSecondsSaved = _decodeSecondsSaved;
+    return stats;
+}
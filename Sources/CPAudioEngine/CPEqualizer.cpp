@@ -0,0 +1,198 @@
+//
+//  CPEqualizer.cpp
+//  CPAudioEngine
+//
+//  Native band equalizer driven by precomputed, immutable coefficient banks
+//
+
+#include "include/CPEqualizer.hpp"
+#include <algorithm>
+#include <cstring>
+
+//Same bandwidth CPBandEqulizer used to set on the NBandEQ unit
+static const double kBandwidthOctaves = 1.5;
+
+CPEqualizer::CPEqualizer(const float *frequencies, uint32_t numBands, double sampleRate, uint32_t bankCapacity)
+: _kernels(CPKernels()),
+  _sampleRate(sampleRate),
+  _numBands(std::min(numBands, kCPEqualizerMaxBands)),
+  _bankCapacity(bankCapacity),
+  _banks(bankCapacity + kScratchBanks),
+  _slots(bankCapacity + kScratchBanks, SlotFree),
+  _nextScratch(0),
+  _activeState(0),
+  _fadePosition(0)
+{
+    memset(_frequencies, 0, sizeof(_frequencies));
+    memcpy(_frequencies, frequencies, _numBands * sizeof(float));
+    memset(_state, 0, sizeof(_state));
+    memset(_fadeBuffer, 0, sizeof(_fadeBuffer));
+
+    //Start on a flat scratch bank
+    float flat[kCPEqualizerMaxBands] = { 0 };
+    CPEqualizerBank *initial = &_banks[_bankCapacity];
+    compile(*initial, flat);
+    _slots[_bankCapacity] = SlotUsed;
+    _pending.store(initial);
+    _adopting.store(nullptr);
+    _active.store(initial);
+    _fading.store(nullptr);
+}
+
+void CPEqualizer::compile(CPEqualizerBank &bank, const float *gains) const {
+    bank.numBands = _numBands;
+    bank.isFlat = true;
+    bank.numActiveBands = 0;
+    for (uint32_t band = 0; band < kCPEqualizerMaxBands; band++) {
+        float gain = band < _numBands ? gains[band] : 0.0f;
+        bank.gains[band] = gain;
+        bank.sections[band] = CPBiquadPeaking(_sampleRate, _frequencies[band], kBandwidthOctaves, gain);
+        if (gain != 0.0f) {
+            bank.isFlat = false;
+            bank.activeBands[bank.numActiveBands++] = (uint8_t)band;
+        }
+    }
+}
+
+#pragma mark Control thread
+
+bool CPEqualizer::isReferenced(const CPEqualizerBank *bank) const {
+    //Read active before fading: the renderer stores fading before it replaces active
+    return bank == _pending.load() || bank == _adopting.load() || bank == _active.load() || bank == _fading.load();
+}
+
+void CPEqualizer::reclaimRetiredBanks() {
+    for (uint32_t slot = 0; slot < _bankCapacity; slot++) {
+        if (_slots[slot] == SlotRetired && !isReferenced(&_banks[slot])) {
+            _slots[slot] = SlotFree;
+        }
+    }
+}
+
+int CPEqualizer::compileBank(const float *gains) {
+    reclaimRetiredBanks();
+    for (uint32_t slot = 0; slot < _bankCapacity; slot++) {
+        if (_slots[slot] == SlotFree) {
+            compile(_banks[slot], gains);
+            _slots[slot] = SlotUsed;
+            return (int)slot;
+        }
+    }
+    return kInvalidBank;
+}
+
+void CPEqualizer::removeBank(int bank) {
+    if (bank < 0 || (uint32_t)bank >= _bankCapacity || _slots[bank] != SlotUsed) {
+        return;
+    }
+    _slots[bank] = isReferenced(&_banks[bank]) ? SlotRetired : SlotFree;
+}
+
+bool CPEqualizer::applyBank(int bank) {
+    if (bank < 0 || (uint32_t)bank >= _bankCapacity || _slots[bank] != SlotUsed) {
+        return false;
+    }
+    _pending.store(&_banks[bank]);
+    return true;
+}
+
+void CPEqualizer::setGains(const float *gains) {
+    //Pending stays put while this runs, so the renderer can only be holding it, the active and fading
+    //banks, and one older pending bank it announced in _adopting and is about to drop. That is four at
+    //most, so one of the five scratch banks is always free and the edit is never lost.
+    for (uint32_t attempt = 0; attempt < kScratchBanks; attempt++) {
+        uint32_t slot = _bankCapacity + _nextScratch;
+        _nextScratch = (_nextScratch + 1) % kScratchBanks;
+        CPEqualizerBank *bank = &_banks[slot];
+        if (isReferenced(bank)) {
+            continue;
+        }
+        compile(*bank, gains);
+        _slots[slot] = SlotUsed;
+        _pending.store(bank);
+        return;
+    }
+}
+
+float CPEqualizer::gainForBand(uint32_t band) const {
+    if (band >= _numBands) {
+        return 0.0f;
+    }
+    return _pending.load()->gains[band];
+}
+
+#pragma mark Render thread
+
+void CPEqualizer::adopt(const CPEqualizerBank *bank) {
+    const CPEqualizerBank *previous = _active.load(std::memory_order_relaxed);
+    //Order matters for isReferenced(): fading must be visible before active moves on
+    _fading.store(previous);
+    //The incoming bank continues from the outgoing filter memory so the crossfade starts in phase
+    uint32_t next = 1 - _activeState;
+    memcpy(_state[next], _state[_activeState], sizeof(_state[next]));
+    for (uint32_t band = 0; band < kCPEqualizerMaxBands; band++) {
+        if (bank->gains[band] == 0.0f) {
+            for (uint32_t channel = 0; channel < kCPEqualizerMaxChannels; channel++) {
+                _state[next][channel][band] = CPBiquadState { 0.0f, 0.0f };
+            }
+        }
+    }
+    _activeState = next;
+    _fadePosition = 0;
+    _active.store(bank);
+}
+
+void CPEqualizer::process(float *const *channels, uint32_t numChannels, uint32_t frames) {
+    const CPEqualizerBank *active = _active.load(std::memory_order_relaxed);
+    const CPEqualizerBank *fading = _fading.load(std::memory_order_relaxed);
+    //A swap requested during a crossfade waits for the crossfade to finish
+    if (fading == nullptr) {
+        const CPEqualizerBank *pending = _pending.load();
+        if (pending != active) {
+            //Announce the bank, then check it is still pending. Either the control thread sees it in
+            //isReferenced() and leaves it alone, or it has moved on and the bank is picked up next block.
+            _adopting.store(pending);
+            if (_pending.load() == pending) {
+                adopt(pending);
+                fading = active;
+                active = pending;
+            }
+            _adopting.store(nullptr);
+        }
+    }
+    if (fading == nullptr && active->isFlat) {
+        return;
+    }
+
+    numChannels = std::min(numChannels, kCPEqualizerMaxChannels);
+    uint32_t fadeFrames = fading ? std::min(frames, kCPEqualizerCrossfadeFrames - _fadePosition) : 0;
+    CPBiquadState *activeState[kCPEqualizerMaxChannels];
+    CPBiquadState *fadeState[kCPEqualizerMaxChannels];
+    float *fadeBuffer[kCPEqualizerMaxChannels];
+    for (uint32_t channel = 0; channel < numChannels; channel++) {
+        activeState[channel] = _state[_activeState][channel];
+        fadeState[channel] = _state[1 - _activeState][channel];
+        fadeBuffer[channel] = _fadeBuffer[channel];
+    }
+    if (fadeFrames > 0) {
+        _kernels.biquadCascade(fading->sections, fading->activeBands, fading->numActiveBands, fadeState,
+                               channels, fadeBuffer, numChannels, fadeFrames);
+    }
+    _kernels.biquadCascade(active->sections, active->activeBands, active->numActiveBands, activeState,
+                           channels, channels, numChannels, frames);
+    for (uint32_t channel = 0; channel < numChannels; channel++) {
+        float *samples = channels[channel];
+        const float *faded = _fadeBuffer[channel];
+        for (uint32_t i = 0; i < fadeFrames; i++) {
+            float mix = (float)(_fadePosition + i + 1) / (float)kCPEqualizerCrossfadeFrames;
+            samples[i] = faded[i] + mix * (samples[i] - faded[i]);
+        }
+    }
+
+    if (fading != nullptr) {
+        _fadePosition += fadeFrames;
+        if (_fadePosition >= kCPEqualizerCrossfadeFrames) {
+            _fading.store(nullptr);
+        }
+    }
+}
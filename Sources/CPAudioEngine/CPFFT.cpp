@@ -0,0 +1,143 @@
+//
+//  CPFFT.cpp
+//  CPAudioEngine
+//
+//  Power-of-two real FFT for analysis (fingerprinting), vectorised with SSE / NEON
+//
+
+#include "include/CPFFT.hpp"
+#include <cmath>
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#elif defined(__SSE__) || defined(__x86_64__)
+#include <xmmintrin.h>
+#endif
+
+CPRealFFT::CPRealFFT(uint32_t size)
+: _size(size),
+  _half(size / 2),
+  _bitReverse(size / 2),
+  _twiddleReal(size / 2),
+  _twiddleImag(size / 2),
+  _unpackReal(size / 2),
+  _unpackImag(size / 2),
+  _real(size / 2),
+  _imag(size / 2)
+{
+    uint32_t bits = 0;
+    while ((1u << bits) < _half) {
+        bits++;
+    }
+    for (uint32_t i = 0; i < _half; i++) {
+        uint32_t reversed = 0;
+        for (uint32_t bit = 0; bit < bits; bit++) {
+            reversed |= ((i >> bit) & 1u) << (bits - 1 - bit);
+        }
+        _bitReverse[i] = reversed;
+    }
+    for (uint32_t span = 1; span < _half; span *= 2) {
+        for (uint32_t j = 0; j < span; j++) {
+            double angle = -M_PI * j / span;
+            _twiddleReal[span - 1 + j] = (float)std::cos(angle);
+            _twiddleImag[span - 1 + j] = (float)std::sin(angle);
+        }
+    }
+    for (uint32_t k = 0; k < _half; k++) {
+        double angle = -2.0 * M_PI * k / size;
+        _unpackReal[k] = (float)std::cos(angle);
+        _unpackImag[k] = (float)std::sin(angle);
+    }
+}
+
+//In-place radix-2 decimation in time over the packed input
+void CPRealFFT::transform(const float *in) {
+    float *re = _real.data();
+    float *im = _imag.data();
+    for (uint32_t i = 0; i < _half; i++) {
+        uint32_t n = _bitReverse[i];
+        re[i] = in[2 * n];
+        im[i] = in[2 * n + 1];
+    }
+    for (uint32_t span = 1; span < _half; span *= 2) {
+        const float *wr = _twiddleReal.data() + span - 1;
+        const float *wi = _twiddleImag.data() + span - 1;
+        for (uint32_t start = 0; start < _half; start += 2 * span) {
+            float *ar = re + start, *ai = im + start;
+            float *br = ar + span, *bi = ai + span;
+            uint32_t j = 0;
+#if defined(__aarch64__)
+            for (; j + 4 <= span; j += 4) {
+                float32x4_t xr = vld1q_f32(br + j), xi = vld1q_f32(bi + j);
+                float32x4_t cr = vld1q_f32(wr + j), ci = vld1q_f32(wi + j);
+                float32x4_t tr = vfmsq_f32(vmulq_f32(xr, cr), xi, ci);
+                float32x4_t ti = vfmaq_f32(vmulq_f32(xr, ci), xi, cr);
+                float32x4_t yr = vld1q_f32(ar + j), yi = vld1q_f32(ai + j);
+                vst1q_f32(br + j, vsubq_f32(yr, tr));
+                vst1q_f32(bi + j, vsubq_f32(yi, ti));
+                vst1q_f32(ar + j, vaddq_f32(yr, tr));
+                vst1q_f32(ai + j, vaddq_f32(yi, ti));
+            }
+#elif defined(__SSE__) || defined(__x86_64__)
+            for (; j + 4 <= span; j += 4) {
+                __m128 xr = _mm_loadu_ps(br + j), xi = _mm_loadu_ps(bi + j);
+                __m128 cr = _mm_loadu_ps(wr + j), ci = _mm_loadu_ps(wi + j);
+                __m128 tr = _mm_sub_ps(_mm_mul_ps(xr, cr), _mm_mul_ps(xi, ci));
+                __m128 ti = _mm_add_ps(_mm_mul_ps(xr, ci), _mm_mul_ps(xi, cr));
+                __m128 yr = _mm_loadu_ps(ar + j), yi = _mm_loadu_ps(ai + j);
+                _mm_storeu_ps(br + j, _mm_sub_ps(yr, tr));
+                _mm_storeu_ps(bi + j, _mm_sub_ps(yi, ti));
+                _mm_storeu_ps(ar + j, _mm_add_ps(yr, tr));
+                _mm_storeu_ps(ai + j, _mm_add_ps(yi, ti));
+            }
+#endif
+            for (; j < span; j++) {
+                float tr = br[j] * wr[j] - bi[j] * wi[j];
+                float ti = br[j] * wi[j] + bi[j] * wr[j];
+                br[j] = ar[j] - tr;
+                bi[j] = ai[j] - ti;
+                ar[j] += tr;
+                ai[j] += ti;
+            }
+        }
+    }
+}
+
+void CPRealFFT::forward(const float *in, float *real, float *imag) {
+    transform(in);
+    const float *re = _real.data();
+    const float *im = _imag.data();
+    real[0] = re[0] + im[0];
+    imag[0] = 0.0f;
+    real[_half] = re[0] - im[0];
+    imag[_half] = 0.0f;
+    //X[k] = E[k] + W^k O[k], with E and O the spectra of the even and odd samples
+    for (uint32_t k = 1; k < _half; k++) {
+        float zr = re[k], zi = im[k];
+        float cr = re[_half - k], ci = -im[_half - k];
+        float er = 0.5f * (zr + cr), ei = 0.5f * (zi + ci);
+        float orr = 0.5f * (zi - ci), oi = -0.5f * (zr - cr);
+        float wr = _unpackReal[k], wi = _unpackImag[k];
+        real[k] = er + orr * wr - oi * wi;
+        imag[k] = ei + orr * wi + oi * wr;
+    }
+}
+
+void CPRealFFT::powerSpectrum(const float *in, float *power) {
+    transform(in);
+    const float *re = _real.data();
+    const float *im = _imag.data();
+    float dc = re[0] + im[0];
+    float nyquist = re[0] - im[0];
+    power[0] = dc * dc;
+    power[_half] = nyquist * nyquist;
+    for (uint32_t k = 1; k < _half; k++) {
+        float zr = re[k], zi = im[k];
+        float cr = re[_half - k], ci = -im[_half - k];
+        float er = 0.5f * (zr + cr), ei = 0.5f * (zi + ci);
+        float orr = 0.5f * (zi - ci), oi = -0.5f * (zr - cr);
+        float wr = _unpackReal[k], wi = _unpackImag[k];
+        float xr = er + orr * wr - oi * wi;
+        float xi = ei + orr * wi + oi * wr;
+        power[k] = xr * xr + xi * xi;
+    }
+}
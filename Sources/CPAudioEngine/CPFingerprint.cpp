@@ -0,0 +1,505 @@
+//
+//  CPFingerprint.cpp
+//  CPAudioEngine
+//
+//  Acoustic fingerprints for duplicate detection at import: streaming analysis, LSH index, worker pool
+//
+
+#include "include/CPFingerprint.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+static const uint32_t kFingerprintMagic = 0x31465043;  //"CPF1"
+//Frames quieter than this (mean square, about -60 dBFS) before the first sound are skipped
+static const float kSilenceEnergy = 1e-6f;
+static const float kEmptyBandLevel = 0.01f;
+//Alignments tried either side when comparing, in words
+static const int kMaxWordOffset = 4;
+static const uint32_t kMinOverlapWords = 16;
+static const uint32_t kAnalysisBlockFrames = 4096;
+//Frames are twice the hop, zero padded to a power of two
+static const double kHopSeconds = 0.0232;
+
+#pragma mark Fingerprint
+
+static void appendWord(std::vector<uint8_t> &bytes, uint32_t word) {
+    for (int shift = 0; shift < 32; shift += 8) {
+        bytes.push_back((uint8_t)(word >> shift));
+    }
+}
+
+static uint32_t readWord(const uint8_t *bytes) {
+    return (uint32_t)bytes[0] | (uint32_t)bytes[1] << 8 | (uint32_t)bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+}
+
+std::vector<uint8_t> CPFingerprint::serialize() const {
+    std::vector<uint8_t> bytes;
+    bytes.reserve(12 + words.size() * 4);
+    appendWord(bytes, kFingerprintMagic);
+    appendWord(bytes, (uint32_t)std::llround(std::max(duration, 0.0) * 1000.0));
+    appendWord(bytes, (uint32_t)words.size());
+    for (uint32_t word : words) {
+        appendWord(bytes, word);
+    }
+    return bytes;
+}
+
+bool CPFingerprint::deserialize(const uint8_t *bytes, size_t length, CPFingerprint &fingerprint) {
+    if (bytes == nullptr || length < 12 || readWord(bytes) != kFingerprintMagic) {
+        return false;
+    }
+    uint32_t count = readWord(bytes + 8);
+    if (count > (length - 12) / 4) {
+        return false;
+    }
+    fingerprint.duration = readWord(bytes + 4) / 1000.0;
+    fingerprint.words.resize(count);
+    for (uint32_t i = 0; i < count; i++) {
+        fingerprint.words[i] = readWord(bytes + 12 + i * 4);
+    }
+    return true;
+}
+
+float CPFingerprintDistance(const CPFingerprint &a, const CPFingerprint &b) {
+    int sizeA = (int)a.words.size();
+    int sizeB = (int)b.words.size();
+    int minOverlap = std::min<int>(std::min(sizeA, sizeB), kMinOverlapWords);
+    if (minOverlap == 0) {
+        return 1.0f;
+    }
+    float best = 1.0f;
+    for (int offset = -kMaxWordOffset; offset <= kMaxWordOffset; offset++) {
+        int start = std::max(0, -offset);
+        int end = std::min(sizeA, sizeB - offset);
+        if (end - start < minOverlap) {
+            continue;
+        }
+        uint32_t errors = 0;
+        for (int i = start; i < end; i++) {
+            errors += (uint32_t)__builtin_popcount(a.words[i] ^ b.words[i + offset]);
+        }
+        best = std::min(best, (float)errors / (32.0f * (end - start)));
+    }
+    return best;
+}
+
+#pragma mark Analysis
+
+static uint32_t nextPowerOfTwo(uint32_t value) {
+    uint32_t power = 8;
+    while (power < value) {
+        power *= 2;
+    }
+    return power;
+}
+
+CPFingerprinter::CPFingerprinter(double sampleRate)
+: _sampleRate(sampleRate),
+  _resampleStep(sampleRate / kCPFingerprintSampleRate),
+  _resamplePosition(0),
+  _previousSample(0),
+  _inputFrames(0),
+  _hop((uint32_t)std::lround(kCPFingerprintSampleRate * kHopSeconds)),
+  _frameLength(2 * _hop),
+  _fft(nextPowerOfTwo(_frameLength)),
+  _window(_frameLength),
+  _frame(_frameLength),
+  _frameFill(0),
+  _windowed(_fft.size()),
+  _power(_fft.bins()),
+  _bandEdges(kBands + 1),
+  _pitchClass(_fft.bins(), -1),
+  _mono(kAnalysisBlockFrames),
+  _started(false),
+  _wordFrames(0),
+  _hasPrevious(false)
+{
+    //4th order Butterworth ahead of the resampling; identity when the input is at or below the analysis rate
+    _lowpass[0] = CPBiquadLowpass(sampleRate, 0.45 * kCPFingerprintSampleRate, 0.541);
+    _lowpass[1] = CPBiquadLowpass(sampleRate, 0.45 * kCPFingerprintSampleRate, 1.307);
+    memset(_lowpassState, 0, sizeof(_lowpassState));
+    memset(_bandEnergy, 0, sizeof(_bandEnergy));
+    memset(_chroma, 0, sizeof(_chroma));
+    memset(_previousDifference, 0, sizeof(_previousDifference));
+
+    for (uint32_t i = 0; i < _frameLength; i++) {
+        _window[i] = (float)(0.5 - 0.5 * std::cos(2.0 * M_PI * i / _frameLength));
+    }
+    double binWidth = kCPFingerprintSampleRate / _fft.size();
+    for (uint32_t band = 0; band <= kBands; band++) {
+        double frequency = 300.0 * std::pow(10.0, (double)band / kBands);
+        uint32_t bin = (uint32_t)std::lround(frequency / binWidth);
+        _bandEdges[band] = band > 0 ? std::max(bin, _bandEdges[band - 1] + 1) : bin;
+    }
+    double chromaTop = 5000.0;
+    for (uint32_t bin = 1; bin < _fft.bins(); bin++) {
+        double frequency = bin * binWidth;
+        if (frequency >= 100.0 && frequency <= chromaTop) {
+            long semitone = std::lround(12.0 * std::log2(frequency / 440.0)) + 9;    //0 is C
+            _pitchClass[bin] = (int8_t)(((semitone % 12) + 12) % 12);
+        }
+    }
+}
+
+void CPFingerprinter::process(const float *const *channels, uint32_t numChannels, uint32_t frames) {
+    _inputFrames += frames;
+    if (isFull() || numChannels == 0) {
+        return;
+    }
+    float channelGain = 1.0f / numChannels;
+    for (uint32_t offset = 0; offset < frames; ) {
+        uint32_t block = std::min(frames - offset, kAnalysisBlockFrames);
+        float *mono = _mono.data();
+        memcpy(mono, channels[0] + offset, block * sizeof(float));
+        for (uint32_t channel = 1; channel < numChannels; channel++) {
+            const float *in = channels[channel] + offset;
+            for (uint32_t i = 0; i < block; i++) {
+                mono[i] += in[i];
+            }
+        }
+        CPBiquadProcess(_lowpass[0], _lowpassState[0], mono, mono, block);
+        CPBiquadProcess(_lowpass[1], _lowpassState[1], mono, mono, block);
+        //Linear interpolation is enough on a signal low passed well below the input's Nyquist;
+        //every input rate ends up on the same analysis grid, so copies at other rates line up
+        double position = _resamplePosition;
+        for (; position < block - 1; position += _resampleStep) {
+            int64_t index = (int64_t)std::floor(position);
+            float a = index < 0 ? _previousSample : mono[index];
+            float b = mono[index + 1];
+            _frame[_frameFill++] = (a + (b - a) * (float)(position - index)) * channelGain;
+            if (_frameFill == _frameLength) {
+                analyzeFrame();
+                memmove(_frame.data(), _frame.data() + _hop, (_frameLength - _hop) * sizeof(float));
+                _frameFill -= _hop;
+                if (isFull()) {
+                    return;
+                }
+            }
+        }
+        _resamplePosition = position - block;
+        _previousSample = mono[block - 1];
+        offset += block;
+    }
+}
+
+void CPFingerprinter::analyzeFrame() {
+    const float *frame = _frame.data();
+    if (!_started) {
+        float energy = 0;
+        for (uint32_t i = 0; i < _frameLength; i++) {
+            energy += frame[i] * frame[i];
+        }
+        if (energy / _frameLength < kSilenceEnergy) {
+            return;
+        }
+        _started = true;
+    }
+    for (uint32_t i = 0; i < _frameLength; i++) {
+        _windowed[i] = frame[i] * _window[i];
+    }
+    _fft.powerSpectrum(_windowed.data(), _power.data());
+    const float *power = _power.data();
+    for (uint32_t band = 0; band < kBands; band++) {
+        float energy = 0;
+        for (uint32_t bin = _bandEdges[band]; bin < _bandEdges[band + 1]; bin++) {
+            energy += power[bin];
+        }
+        _bandEnergy[band] += energy;
+    }
+    for (uint32_t bin = 0; bin < _fft.bins(); bin++) {
+        if (_pitchClass[bin] >= 0) {
+            _chroma[_pitchClass[bin]] += power[bin];
+        }
+    }
+    if (++_wordFrames == kFramesPerWord) {
+        emitWord();
+    }
+}
+
+void CPFingerprinter::emitWord() {
+    uint32_t word = 0;
+    //Bands 20 dB under the average read as level, so noise in empty bands doesn't flip their bits
+    float floor = 1e-9f;
+    for (uint32_t band = 0; band < kBands; band++) {
+        floor += kEmptyBandLevel * _bandEnergy[band] / kBands;
+    }
+    float level[kBands];
+    for (uint32_t band = 0; band < kBands; band++) {
+        level[band] = std::log(_bandEnergy[band] + floor);
+    }
+    for (uint32_t band = 0; band + 1 < kBands; band++) {
+        float difference = level[band] - level[band + 1];
+        float change = _hasPrevious ? difference - _previousDifference[band] : difference;
+        if (change > 0) {
+            word |= 1u << band;
+        }
+        _previousDifference[band] = difference;
+    }
+    float mean = 0;
+    for (uint32_t pitch = 0; pitch < 12; pitch++) {
+        mean += _chroma[pitch];
+    }
+    mean /= 12;
+    for (uint32_t pitch = 0; pitch < 12; pitch++) {
+        if (_chroma[pitch] > mean) {
+            word |= 1u << (kBands - 1 + pitch);
+        }
+    }
+    _fingerprint.words.push_back(word);
+    _hasPrevious = true;
+    _wordFrames = 0;
+    memset(_bandEnergy, 0, sizeof(_bandEnergy));
+    memset(_chroma, 0, sizeof(_chroma));
+}
+
+CPFingerprint CPFingerprinter::finish() {
+    CPFingerprint fingerprint = _fingerprint;
+    fingerprint.duration = _sampleRate > 0 ? _inputFrames / _sampleRate : 0;
+    return fingerprint;
+}
+
+CPFingerprint CPFingerprinter::analyze(CPAudioDecoder &decoder) {
+    CPFingerprinter fingerprinter(decoder.sampleRate());
+    uint32_t numChannels = decoder.channels();
+    std::vector<std::vector<float>> buffers(numChannels, std::vector<float>(kAnalysisBlockFrames));
+    std::vector<float *> channels(numChannels);
+    for (uint32_t channel = 0; channel < numChannels; channel++) {
+        channels[channel] = buffers[channel].data();
+    }
+    int64_t length = decoder.lengthFrames();
+    while (!(fingerprinter.isFull() && length >= 0)) {
+        uint32_t frames = decoder.read(channels.data(), kAnalysisBlockFrames);
+        if (frames == 0) {
+            break;
+        }
+        fingerprinter.process(channels.data(), numChannels, frames);
+    }
+    CPFingerprint fingerprint = fingerprinter.finish();
+    if (length >= 0) {
+        fingerprint.duration = length / decoder.sampleRate();
+    }
+    return fingerprint;
+}
+
+#pragma mark Index
+
+CPFingerprintIndex::CPFingerprintIndex() {
+    //Fixed sampling, so keys stay comparable across launches
+    uint32_t state = 0x2545F491u;
+    for (uint32_t table = 0; table < kTables; table++) {
+        for (uint32_t bit = 0; bit < kKeyBits; bit++) {
+            uint16_t position;
+            bool taken;
+            do {
+                state = state * 1664525u + 1013904223u;
+                position = (uint16_t)((state >> 8) % (kSignatureWords * 32));
+                taken = std::find(_bitPositions[table], _bitPositions[table] + bit, position) != _bitPositions[table] + bit;
+            } while (taken);
+            _bitPositions[table][bit] = position;
+        }
+    }
+}
+
+bool CPFingerprintIndex::keys(const CPFingerprint &fingerprint, int shift, uint32_t *keys) const {
+    if (fingerprint.empty()) {
+        return false;
+    }
+    //Short fingerprints are padded with zero words, the same way for a copy
+    uint32_t signature[kSignatureWords];
+    int start = (int)kSignatureStart + shift;
+    for (uint32_t word = 0; word < kSignatureWords; word++) {
+        int index = start + (int)word;
+        signature[word] = index >= 0 && index < (int)fingerprint.words.size() ? fingerprint.words[index] : 0;
+    }
+    for (uint32_t table = 0; table < kTables; table++) {
+        uint32_t key = 0;
+        for (uint32_t bit = 0; bit < kKeyBits; bit++) {
+            uint16_t position = _bitPositions[table][bit];
+            key |= ((signature[position / 32] >> (position % 32)) & 1u) << bit;
+        }
+        keys[table] = table << kKeyBits | key;
+    }
+    return true;
+}
+
+void CPFingerprintIndex::add(uint64_t id, const CPFingerprint &fingerprint) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto existing = _slots.find(id);
+    if (existing != _slots.end()) {
+        removeSlotLocked(existing->second);
+        _slots.erase(existing);
+    }
+    Entry entry;
+    if (!keys(fingerprint, 0, entry.keys)) {
+        return;
+    }
+    entry.id = id;
+    entry.fingerprint = fingerprint;
+    entry.live = true;
+    uint32_t slot;
+    if (!_freeSlots.empty()) {
+        slot = _freeSlots.back();
+        _freeSlots.pop_back();
+        _entries[slot] = std::move(entry);
+    }
+    else {
+        slot = (uint32_t)_entries.size();
+        _entries.push_back(std::move(entry));
+    }
+    for (uint32_t table = 0; table < kTables; table++) {
+        _buckets[_entries[slot].keys[table]].push_back(slot);
+    }
+    _slots[id] = slot;
+}
+
+void CPFingerprintIndex::removeSlotLocked(uint32_t slot) {
+    Entry &entry = _entries[slot];
+    for (uint32_t table = 0; table < kTables; table++) {
+        auto bucket = _buckets.find(entry.keys[table]);
+        if (bucket == _buckets.end()) {
+            continue;
+        }
+        std::vector<uint32_t> &slots = bucket->second;
+        auto found = std::find(slots.begin(), slots.end(), slot);
+        if (found != slots.end()) {
+            *found = slots.back();
+            slots.pop_back();
+        }
+        if (slots.empty()) {
+            _buckets.erase(bucket);
+        }
+    }
+    entry.live = false;
+    entry.fingerprint = CPFingerprint();
+    _freeSlots.push_back(slot);
+}
+
+bool CPFingerprintIndex::remove(uint64_t id) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto existing = _slots.find(id);
+    if (existing == _slots.end()) {
+        return false;
+    }
+    removeSlotLocked(existing->second);
+    _slots.erase(existing);
+    return true;
+}
+
+void CPFingerprintIndex::clear() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _entries.clear();
+    _freeSlots.clear();
+    _slots.clear();
+    _buckets.clear();
+}
+
+size_t CPFingerprintIndex::size() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _slots.size();
+}
+
+std::vector<CPFingerprintMatch> CPFingerprintIndex::query(const CPFingerprint &fingerprint, float maxDistance) const {
+    std::vector<CPFingerprintMatch> matches;
+    std::vector<uint32_t> candidates;
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (int shift = -1; shift <= 1; shift++) {
+        uint32_t probe[kTables];
+        if (!keys(fingerprint, shift, probe)) {
+            return matches;
+        }
+        for (uint32_t table = 0; table < kTables; table++) {
+            auto bucket = _buckets.find(probe[table]);
+            if (bucket != _buckets.end()) {
+                candidates.insert(candidates.end(), bucket->second.begin(), bucket->second.end());
+            }
+        }
+    }
+    std::sort(candidates.begin(), candidates.end());
+    candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+    for (uint32_t slot : candidates) {
+        const Entry &entry = _entries[slot];
+        if (!entry.live) {
+            continue;
+        }
+        //Same recording, same length: allow for padding and encoder delay
+        double a = entry.fingerprint.duration, b = fingerprint.duration;
+        if (a > 0 && b > 0 && std::fabs(a - b) > std::max(1.0, 0.01 * std::max(a, b))) {
+            continue;
+        }
+        float distance = CPFingerprintDistance(fingerprint, entry.fingerprint);
+        if (distance <= maxDistance) {
+            matches.push_back(CPFingerprintMatch { entry.id, distance });
+        }
+    }
+    std::sort(matches.begin(), matches.end(), [](const CPFingerprintMatch &a, const CPFingerprintMatch &b) {
+        return a.distance < b.distance;
+    });
+    return matches;
+}
+
+#pragma mark Worker pool
+
+CPFingerprintPool::CPFingerprintPool(uint32_t threads)
+: _running(true)
+{
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (uint32_t i = 0; i < threads; i++) {
+        _workers.emplace_back(&CPFingerprintPool::work, this);
+    }
+}
+
+CPFingerprintPool::~CPFingerprintPool() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _running = false;
+    }
+    _wake.notify_all();
+    for (std::thread &worker : _workers) {
+        worker.join();
+    }
+}
+
+void CPFingerprintPool::work() {
+    while (true) {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _wake.wait(lock, [this] { return !_running || !_jobs.empty(); });
+            if (_jobs.empty()) {
+                return;
+            }
+            job = std::move(_jobs.front());
+            _jobs.pop_front();
+        }
+        job();
+    }
+}
+
+std::vector<CPFingerprint> CPFingerprintPool::analyze(const std::vector<Opener> &tracks) {
+    std::vector<CPFingerprint> results(tracks.size());
+    std::mutex doneMutex;
+    std::condition_variable done;
+    size_t remaining = tracks.size();
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (size_t i = 0; i < tracks.size(); i++) {
+            _jobs.push_back([&, i] {
+                std::unique_ptr<CPAudioDecoder> decoder = tracks[i]();
+                if (decoder != nullptr) {
+                    results[i] = CPFingerprinter::analyze(*decoder);
+                }
+                std::lock_guard<std::mutex> doneLock(doneMutex);
+                if (--remaining == 0) {
+                    done.notify_all();
+                }
+            });
+        }
+    }
+    _wake.notify_all();
+    std::unique_lock<std::mutex> lock(doneMutex);
+    done.wait(lock, [&] { return remaining == 0; });
+    return results;
+}
@@ -0,0 +1,213 @@
+//
+//  CPGainAutomation.cpp
+//  CPAudioEngine
+//
+//  Sample-accurate gain lane: scheduled ramp segments applied on the render thread
+//
+
+#include "include/CPGainAutomation.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+//Exponential fades run to -80 dB, then land on the target
+static const float kExponentialFloor = 1e-4f;
+
+CPGainAutomation::CPGainAutomation(double sampleRate, float gain)
+: _kernels(CPKernels()),
+  _sampleRate(sampleRate),
+  _eventCallback(nullptr),
+  _eventRefCon(nullptr),
+  _commandWrite(0),
+  _commandRead(0),
+  _queuedSegments(0),
+  _gain(gain),
+  _active(false),
+  _queueHead(0),
+  _queueCount(0),
+  _published(gain)
+{
+    memset(&_current, 0, sizeof(_current));
+    memset(_queue, 0, sizeof(_queue));
+    memset(_commands, 0, sizeof(_commands));
+}
+
+#pragma mark Control thread
+
+bool CPGainAutomation::post(const Command &command) {
+    std::lock_guard<std::mutex> lock(_postMutex);
+    uint32_t write = _commandWrite.load(std::memory_order_relaxed);
+    if (write - _commandRead.load(std::memory_order_acquire) >= kCommands) {
+        return false;
+    }
+    if (command.type != CommandReset) {
+        if (_queuedSegments.load() >= kMaxSegments) {
+            return false;
+        }
+        _queuedSegments.fetch_add(1);
+    }
+    _commands[write % kCommands] = command;
+    _commandWrite.store(write + 1, std::memory_order_release);
+    return true;
+}
+
+bool CPGainAutomation::schedule(const CPGainSegment &segment) {
+    return post(Command { CommandAppend, segment });
+}
+
+bool CPGainAutomation::rampTo(float target, double seconds, CPGainCurve curve, uint32_t event) {
+    return post(Command { CommandReplace, CPGainSegment { target, seconds, curve, event } });
+}
+
+void CPGainAutomation::reset(float gain) {
+    post(Command { CommandReset, CPGainSegment { gain, 0, CPGainCurveLinear, 0 } });
+}
+
+bool CPGainAutomation::isIdle() const {
+    return _queuedSegments.load() == 0 &&
+        _commandRead.load(std::memory_order_acquire) == _commandWrite.load(std::memory_order_acquire);
+}
+
+#pragma mark Render thread
+
+void CPGainAutomation::drainCommands() {
+    uint32_t read = _commandRead.load(std::memory_order_relaxed);
+    uint32_t write = _commandWrite.load(std::memory_order_acquire);
+    for (; read != write; read++) {
+        const Command &command = _commands[read % kCommands];
+        if (command.type != CommandAppend) {
+            //Replace and reset drop everything still to play
+            uint32_t dropped = _queueCount + (_active ? 1 : 0);
+            _queueCount = 0;
+            _active = false;
+            _queuedSegments.fetch_sub(dropped);
+            if (command.type == CommandReset) {
+                _gain = command.segment.target;
+                continue;
+            }
+        }
+        Segment &segment = _queue[(_queueHead + _queueCount) % kMaxSegments];
+        segment.target = std::max(command.segment.target, 0.0f);
+        segment.curve = command.segment.curve;
+        segment.event = command.segment.event;
+        segment.length = (uint64_t)std::llround(std::max(command.segment.seconds, 0.0) * _sampleRate);
+        segment.position = 0;
+        _queueCount++;
+    }
+    _commandRead.store(read, std::memory_order_release);
+    if (!_active) {
+        beginNext();
+    }
+}
+
+bool CPGainAutomation::beginNext() {
+    while (_queueCount > 0) {
+        _current = _queue[_queueHead];
+        _queueHead = (_queueHead + 1) % kMaxSegments;
+        _queueCount--;
+        _current.start = _gain;
+        if (_current.curve == CPGainCurveHold) {
+            _current.target = _gain;
+        }
+        if (_current.length > 0) {
+            _active = true;
+            return true;
+        }
+        //Zero length: a jump
+        _gain = _current.target;
+        _queuedSegments.fetch_sub(1);
+        if (_current.event != 0 && _eventCallback != nullptr) {
+            _eventCallback(_eventRefCon, _current.event);
+        }
+    }
+    _active = false;
+    return false;
+}
+
+float CPGainAutomation::evaluate(const Segment &segment, uint64_t position) const {
+    if (position >= segment.length) {
+        return segment.target;
+    }
+    float x = (float)((double)position / (double)segment.length);
+    switch (segment.curve) {
+        case CPGainCurveLinear:
+            return segment.start + (segment.target - segment.start) * x;
+        case CPGainCurveExponential: {
+            float from = std::max(segment.start, kExponentialFloor);
+            float to = std::max(segment.target, kExponentialFloor);
+            return from * std::pow(to / from, x);
+        }
+        case CPGainCurveSCurve:
+            return segment.start + (segment.target - segment.start) * (0.5f - 0.5f * std::cos((float)M_PI * x));
+        case CPGainCurveHold:
+            return segment.start;
+    }
+    return segment.target;
+}
+
+static void applyRamp(const CPKernelTable &kernels, float *const *channels, uint32_t numChannels, uint32_t offset, uint32_t frames, float from, float to) {
+    float step = (to - from) / (float)frames;
+    if (step == 0.0f && from == 1.0f) {
+        return;
+    }
+    if (step == 0.0f && from == 0.0f) {
+        for (uint32_t channel = 0; channel < numChannels; channel++) {
+            memset(channels[channel] + offset, 0, frames * sizeof(float));
+        }
+        return;
+    }
+    float *shifted[kCPKernelMaxChannels];
+    for (uint32_t first = 0; first < numChannels; first += kCPKernelMaxChannels) {
+        uint32_t count = std::min(numChannels - first, kCPKernelMaxChannels);
+        for (uint32_t channel = 0; channel < count; channel++) {
+            shifted[channel] = channels[first + channel] + offset;
+        }
+        kernels.gainRamp(shifted, count, from, step, frames);
+    }
+}
+
+void CPGainAutomation::process(float *const *channels, uint32_t numChannels, uint32_t frames) {
+    if (_commandRead.load(std::memory_order_relaxed) != _commandWrite.load(std::memory_order_relaxed)) {
+        drainCommands();
+    }
+    if (!_active) {
+        if (_gain != 1.0f) {
+            applyRamp(_kernels, channels, numChannels, 0, frames, _gain, _gain);
+        }
+        _published.store(_gain, std::memory_order_relaxed);
+        return;
+    }
+
+    uint32_t offset = 0;
+    while (offset < frames) {
+        if (!_active) {
+            applyRamp(_kernels, channels, numChannels, offset, frames - offset, _gain, _gain);
+            break;
+        }
+        uint32_t run = (uint32_t)std::min<uint64_t>(frames - offset, _current.length - _current.position);
+        //Linear is exact per sample; curves are exact every kCurveStride frames and linear in between
+        uint32_t stride = _current.curve == CPGainCurveLinear ? run : kCurveStride;
+        for (uint32_t done = 0; done < run; ) {
+            uint32_t piece = std::min(stride, run - done);
+            float from = evaluate(_current, _current.position);
+            float to = evaluate(_current, _current.position + piece);
+            applyRamp(_kernels, channels, numChannels, offset + done, piece, from, to);
+            _current.position += piece;
+            done += piece;
+        }
+        offset += run;
+        if (_current.position >= _current.length) {
+            _gain = _current.target;
+            _active = false;
+            _queuedSegments.fetch_sub(1);
+            if (_current.event != 0 && _eventCallback != nullptr) {
+                _eventCallback(_eventRefCon, _current.event);
+            }
+            beginNext();
+        }
+        else {
+            _gain = evaluate(_current, _current.position);
+        }
+    }
+    _published.store(_gain, std::memory_order_relaxed);
+}
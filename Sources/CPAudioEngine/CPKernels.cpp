@@ -0,0 +1,537 @@
+//
+//  CPKernels.cpp
+//  CPAudioEngine
+//
+//  Hot-loop kernels specialized for channel count and block size, dispatched on the CPU's ISA
+//
+
+#include "include/CPKernels.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <type_traits>
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#elif defined(__x86_64__)
+#include <cpuid.h>
+#include <emmintrin.h>
+#endif
+
+//Kernel bodies are inlined into each ISA's wrappers below, so each wrapper compiles them for its own target
+#define CP_KERNEL_INLINE inline __attribute__((always_inline))
+
+#pragma mark Kernels
+
+//Template arguments of 0 stand for "given at run time": <0, 0> is the generic fallback
+
+typedef float CPFloat4 __attribute__((vector_size(16)));
+
+/**
+ Four biquad lanes advanced together: C channels of G = 4 / C consecutive bands. Band k of the
+ group works on the sample band k - 1 finished the step before, so the lanes never wait on each
+ other and one vector operation advances all four; the group's output trails its input by G - 1
+ steps, which the first and last G - 1 steps of a block fill and drain one lane at a time.
+ */
+struct CPBiquadLanes {
+    alignas(16) float b0[4], b1[4], b2[4], a1[4], a2[4];
+    alignas(16) float z1[4], z2[4], y[4];
+};
+
+static CP_KERNEL_INLINE CPFloat4 loadLanes(const float *lanes) {
+    CPFloat4 value;
+    memcpy(&value, lanes, sizeof(value));
+    return value;
+}
+
+template <uint32_t C>
+static CP_KERNEL_INLINE void biquadLaneStep(CPBiquadLanes &lanes, const float *const *source, float *const *out, uint32_t step, uint32_t frames) {
+    const uint32_t G = 4 / C;
+    //From the last lane down, so y[lane - C] still holds the previous step's output
+    for (uint32_t next = 4; next > 0; next--) {
+        uint32_t lane = next - 1;
+        uint32_t k = lane / C;
+        uint32_t channel = lane % C;
+        if (step < k || step - k >= frames) {
+            continue;
+        }
+        float x = k == 0 ? source[channel][step] : lanes.y[lane - C];
+        float y = lanes.b0[lane] * x + lanes.z1[lane];
+        lanes.z1[lane] = (lanes.b1[lane] * x + lanes.z2[lane]) - lanes.a1[lane] * y;
+        lanes.z2[lane] = lanes.b2[lane] * x - lanes.a2[lane] * y;
+        lanes.y[lane] = y;
+        if (k == G - 1) {
+            out[channel][step - k] = y;
+        }
+    }
+}
+
+template <uint32_t C, uint32_t F>
+static CP_KERNEL_INLINE void biquadCascadeKernel(const CPBiquadCoefficients *sections, const uint8_t *bands, uint32_t numBands,
+                                                 CPBiquadState *const *state, const float *const *in, float *const *out,
+                                                 uint32_t numChannels, uint32_t frames) {
+    const uint32_t n = F ? F : frames;
+    if (C == 0 || C > 2) {
+        //One band over the block at a time, like CPBiquadProcess
+        for (uint32_t channel = 0; channel < numChannels; channel++) {
+            const float *source = in[channel];
+            for (uint32_t band = 0; band < numBands; band++) {
+                CPBiquadProcess(sections[bands[band]], state[channel][bands[band]], source, out[channel], n);
+                source = out[channel];
+            }
+            if (source != out[channel]) {
+                memcpy(out[channel], source, n * sizeof(float));
+            }
+        }
+        return;
+    }
+    if (numBands == 0) {
+        for (uint32_t channel = 0; channel < numChannels; channel++) {
+            if (in[channel] != out[channel]) {
+                memcpy(out[channel], in[channel], n * sizeof(float));
+            }
+        }
+        return;
+    }
+
+    constexpr uint32_t L = C == 2 ? 2 : 1;     //C, once the generic path above is ruled out
+    const uint32_t G = 4 / L;
+    const float *const *source = in;
+    for (uint32_t first = 0; first < numBands; first += G) {
+        //A short last group runs identity sections in its spare lanes
+        CPBiquadLanes lanes;
+        for (uint32_t lane = 0; lane < 4; lane++) {
+            uint32_t k = lane / L;
+            CPBiquadCoefficients c = first + k < numBands ? sections[bands[first + k]] : CPBiquadIdentity();
+            CPBiquadState z = first + k < numBands ? state[lane % L][bands[first + k]] : CPBiquadState { 0.0f, 0.0f };
+            lanes.b0[lane] = c.b0;
+            lanes.b1[lane] = c.b1;
+            lanes.b2[lane] = c.b2;
+            lanes.a1[lane] = c.a1;
+            lanes.a2[lane] = c.a2;
+            lanes.z1[lane] = z.z1;
+            lanes.z2[lane] = z.z2;
+            lanes.y[lane] = 0.0f;
+        }
+
+        uint32_t step = 0;
+        for (; step < G - 1; step++) {
+            biquadLaneStep<L>(lanes, source, out, step, n);
+        }
+        const CPFloat4 b0 = loadLanes(lanes.b0), b1 = loadLanes(lanes.b1), b2 = loadLanes(lanes.b2);
+        const CPFloat4 a1 = loadLanes(lanes.a1), a2 = loadLanes(lanes.a2);
+        CPFloat4 z1 = loadLanes(lanes.z1), z2 = loadLanes(lanes.z2), y = loadLanes(lanes.y);
+        const float *left = source[0];
+        const float *right = source[L - 1];
+        for (; step < n; step++) {
+            CPFloat4 x = L == 2 ? CPFloat4 { left[step], right[step], y[0], y[1] } : CPFloat4 { left[step], y[0], y[1], y[2] };
+            y = b0 * x + z1;
+            z1 = (b1 * x + z2) - a1 * y;
+            z2 = b2 * x - a2 * y;
+            out[0][step - (G - 1)] = y[4 - L];
+            if (L == 2) {
+                out[1][step - (G - 1)] = y[3];
+            }
+        }
+        memcpy(lanes.z1, &z1, sizeof(z1));
+        memcpy(lanes.z2, &z2, sizeof(z2));
+        memcpy(lanes.y, &y, sizeof(y));
+        for (step = std::max(step, G - 1); step < n + G - 1; step++) {
+            biquadLaneStep<L>(lanes, source, out, step, n);
+        }
+
+        for (uint32_t lane = 0; lane < 4; lane++) {
+            uint32_t k = lane / L;
+            if (first + k < numBands) {
+                state[lane % L][bands[first + k]] = CPBiquadState { lanes.z1[lane], lanes.z2[lane] };
+            }
+        }
+        source = out;
+    }
+}
+
+//GCC only trusts __restrict on parameters, so every loop that needs it takes its buffers as arguments
+
+template <uint32_t In, uint32_t F, bool Accumulate>
+static CP_KERNEL_INLINE void mixStereoKernel(const float *__restrict left, const float *__restrict right,
+                                             float *__restrict outLeft, float *__restrict outRight,
+                                             const float *gains, const float *steps, uint32_t frames) {
+    const uint32_t n = F ? F : frames;
+    const float g00 = gains[0], g01 = gains[1], s00 = steps[0], s01 = steps[1];
+    const float g10 = gains[kCPKernelMaxChannels], g11 = gains[kCPKernelMaxChannels + 1];
+    const float s10 = steps[kCPKernelMaxChannels], s11 = steps[kCPKernelMaxChannels + 1];
+    for (uint32_t i = 0; i < n; i++) {
+        float position = (float)i;
+        float mixLeft = (g00 + position * s00) * left[i];
+        float mixRight = (g10 + position * s10) * left[i];
+        if (In == 2) {
+            mixLeft += (g01 + position * s01) * right[i];
+            mixRight += (g11 + position * s11) * right[i];
+        }
+        outLeft[i] = Accumulate ? outLeft[i] + mixLeft : mixLeft;
+        outRight[i] = Accumulate ? outRight[i] + mixRight : mixRight;
+    }
+}
+
+static CP_KERNEL_INLINE void mixRowKernel(const float *__restrict input, float *__restrict output, float gain, float step, uint32_t frames, bool accumulate) {
+    if (accumulate) {
+        for (uint32_t i = 0; i < frames; i++) {
+            output[i] += (gain + (float)i * step) * input[i];
+        }
+    }
+    else {
+        for (uint32_t i = 0; i < frames; i++) {
+            output[i] = (gain + (float)i * step) * input[i];
+        }
+    }
+}
+
+template <uint32_t In, uint32_t F>
+static CP_KERNEL_INLINE void mixMatrixKernel(const float *const *in, uint32_t inChannels, float *const *out, uint32_t outChannels,
+                                             const float *gains, const float *steps, uint32_t frames, bool accumulate) {
+    if (In == 1 || In == 2) {
+        //Mono or stereo into stereo: one pass reads every input once and writes both outputs
+        if (accumulate) {
+            mixStereoKernel<In, F, true>(in[0], in[In - 1], out[0], out[1], gains, steps, frames);
+        }
+        else {
+            mixStereoKernel<In, F, false>(in[0], in[In - 1], out[0], out[1], gains, steps, frames);
+        }
+        return;
+    }
+    //One input into one output at a time, skipping silent coefficients
+    for (uint32_t o = 0; o < outChannels; o++) {
+        bool written = accumulate;
+        for (uint32_t i = 0; i < inChannels; i++) {
+            float gain = gains[o * kCPKernelMaxChannels + i];
+            float step = steps[o * kCPKernelMaxChannels + i];
+            if (gain != 0.0f || step != 0.0f) {
+                mixRowKernel(in[i], out[o], gain, step, frames, written);
+                written = true;
+            }
+        }
+        if (!written) {
+            memset(out[o], 0, frames * sizeof(float));
+        }
+    }
+}
+
+template <uint32_t F>
+static CP_KERNEL_INLINE void gainRampStereoKernel(float *__restrict left, float *__restrict right, float gain, float step, uint32_t frames) {
+    const uint32_t n = F ? F : frames;
+    for (uint32_t i = 0; i < n; i++) {
+        float g = gain + (float)i * step;
+        left[i] *= g;
+        right[i] *= g;
+    }
+}
+
+template <uint32_t C, uint32_t F>
+static CP_KERNEL_INLINE void gainRampKernel(float *const *channels, uint32_t numChannels, float gain, float step, uint32_t frames) {
+    if (C == 2) {
+        gainRampStereoKernel<F>(channels[0], channels[1], gain, step, frames);
+        return;
+    }
+    const uint32_t n = F ? F : frames;
+    for (uint32_t channel = 0; channel < (C ? C : numChannels); channel++) {
+        float *samples = channels[channel];
+        for (uint32_t i = 0; i < n; i++) {
+            samples[i] *= gain + (float)i * step;
+        }
+    }
+}
+
+//Conversions go frame by frame for one and two channels, so stereo becomes a vector shuffle, and
+//channel by channel with a stride for any other count
+
+static CP_KERNEL_INLINE float sampleToFloat(float sample) {
+    return sample;
+}
+
+static CP_KERNEL_INLINE float sampleToFloat(int16_t sample) {
+    return (float)sample * (1.0f / 32768.0f);
+}
+
+static CP_KERNEL_INLINE void floatToSample(float sample, float &out) {
+    out = sample;
+}
+
+static CP_KERNEL_INLINE void floatToSample(float sample, int16_t &out) {
+    out = (int16_t)std::lrintf(std::min(std::max(sample, -1.0f), 1.0f) * 32767.0f);
+}
+
+template <uint32_t C, uint32_t F, class Sample>
+static CP_KERNEL_INLINE void deinterleavePairKernel(const Sample *__restrict in, float *__restrict left, float *__restrict right, uint32_t frames) {
+    const uint32_t n = F ? F : frames;
+    for (uint32_t i = 0; i < n; i++) {
+        left[i] = sampleToFloat(in[i * C]);
+        if (C == 2) {
+            right[i] = sampleToFloat(in[i * C + 1]);
+        }
+    }
+}
+
+template <uint32_t C, uint32_t F, class Sample>
+static CP_KERNEL_INLINE void interleavePairKernel(const float *__restrict left, const float *__restrict right, Sample *__restrict out, uint32_t frames) {
+    const uint32_t n = F ? F : frames;
+    for (uint32_t i = 0; i < n; i++) {
+        floatToSample(left[i], out[i * C]);
+        if (C == 2) {
+            floatToSample(right[i], out[i * C + 1]);
+        }
+    }
+}
+
+//Compilers won't vectorize IEEE min and max or lrintf on their own, so the int16 path is written
+//out; the conversion rounds to nearest even like lrintf. AVX tiers run it VEX encoded.
+template <uint32_t C, uint32_t F>
+static CP_KERNEL_INLINE void interleavePairKernel(const float *__restrict left, const float *__restrict right, int16_t *__restrict out, uint32_t frames) {
+    const uint32_t n = F ? F : frames;
+    uint32_t i = 0;
+#if defined(__aarch64__)
+    float32x4_t scale = vdupq_n_f32(32767.0f);
+    float32x4_t low = vdupq_n_f32(-32767.0f);
+    for (; i + 4 <= n; i += 4) {
+        int16x4_t l = vqmovn_s32(vcvtnq_s32_f32(vmaxq_f32(vminq_f32(vmulq_f32(vld1q_f32(left + i), scale), scale), low)));
+        if (C == 2) {
+            int16x4_t r = vqmovn_s32(vcvtnq_s32_f32(vmaxq_f32(vminq_f32(vmulq_f32(vld1q_f32(right + i), scale), scale), low)));
+            vst2_s16(out + 2 * i, int16x4x2_t { { l, r } });
+        }
+        else {
+            vst1_s16(out + i, l);
+        }
+    }
+#elif defined(__x86_64__)
+    __m128 scale = _mm_set1_ps(32767.0f);
+    __m128 low = _mm_set1_ps(-32767.0f);
+    for (; i + 4 <= n; i += 4) {
+        __m128i l = _mm_cvtps_epi32(_mm_max_ps(_mm_min_ps(_mm_mul_ps(_mm_loadu_ps(left + i), scale), scale), low));
+        if (C == 2) {
+            __m128i r = _mm_cvtps_epi32(_mm_max_ps(_mm_min_ps(_mm_mul_ps(_mm_loadu_ps(right + i), scale), scale), low));
+            _mm_storeu_si128((__m128i *)(out + 2 * i), _mm_packs_epi32(_mm_unpacklo_epi32(l, r), _mm_unpackhi_epi32(l, r)));
+        }
+        else {
+            _mm_storel_epi64((__m128i *)(out + i), _mm_packs_epi32(l, l));
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        floatToSample(left[i], out[i * C]);
+        if (C == 2) {
+            floatToSample(right[i], out[i * C + 1]);
+        }
+    }
+}
+
+template <uint32_t C, uint32_t F, class Sample>
+static CP_KERNEL_INLINE void deinterleaveKernel(const Sample *in, float *const *out, uint32_t numChannels, uint32_t frames) {
+    if (C == 1 || C == 2) {
+        deinterleavePairKernel<C, F>(in, out[0], C == 2 ? out[1] : nullptr, frames);
+        return;
+    }
+    for (uint32_t channel = 0; channel < numChannels; channel++) {
+        float *samples = out[channel];
+        for (uint32_t i = 0; i < frames; i++) {
+            samples[i] = sampleToFloat(in[(size_t)i * numChannels + channel]);
+        }
+    }
+}
+
+template <uint32_t C, uint32_t F, class Sample>
+static CP_KERNEL_INLINE void interleaveKernel(const float *const *in, Sample *out, uint32_t numChannels, uint32_t frames) {
+    if (C == 1 || C == 2) {
+        interleavePairKernel<C, F>(in[0], in[C - 1], out, frames);
+        return;
+    }
+    for (uint32_t channel = 0; channel < numChannels; channel++) {
+        const float *samples = in[channel];
+        for (uint32_t i = 0; i < frames; i++) {
+            floatToSample(samples[i], out[(size_t)i * numChannels + channel]);
+        }
+    }
+}
+
+#pragma mark ISA variants
+
+//One set of wrappers per ISA. Each instantiates the kernels inside a function compiled for that
+//target; the dispatch below only ever calls the set the CPU was found to support.
+#define CP_KERNEL_VARIANT(Name, Target) \
+    struct Name { \
+        template <uint32_t C, uint32_t F, class... Args> Target static void biquadCascade(Args... args) { biquadCascadeKernel<C, F>(args...); } \
+        template <uint32_t C, uint32_t F, class... Args> Target static void mixMatrix(Args... args) { mixMatrixKernel<C, F>(args...); } \
+        template <uint32_t C, uint32_t F, class... Args> Target static void gainRamp(Args... args) { gainRampKernel<C, F>(args...); } \
+        template <uint32_t C, uint32_t F, class... Args> Target static void deinterleaveInt16(Args... args) { deinterleaveKernel<C, F>(args...); } \
+        template <uint32_t C, uint32_t F, class... Args> Target static void deinterleaveFloat(Args... args) { deinterleaveKernel<C, F>(args...); } \
+        template <uint32_t C, uint32_t F, class... Args> Target static void interleaveInt16(Args... args) { interleaveKernel<C, F>(args...); } \
+        template <uint32_t C, uint32_t F, class... Args> Target static void interleaveFloat(Args... args) { interleaveKernel<C, F>(args...); } \
+    };
+
+CP_KERNEL_VARIANT(CPKernelsBaseline, )
+#if defined(__x86_64__)
+CP_KERNEL_VARIANT(CPKernelsAVX2, __attribute__((target("avx2,fma"))))
+CP_KERNEL_VARIANT(CPKernelsAVX512, __attribute__((target("avx512f,avx512vl,avx2,fma"))))
+#endif
+
+#if defined(__x86_64__)
+static const CPKernelISA kBaselineISA = CPKernelISASSE2;
+#elif defined(__aarch64__)
+static const CPKernelISA kBaselineISA = CPKernelISANEON;
+#else
+static const CPKernelISA kBaselineISA = CPKernelISAScalar;
+#endif
+
+#pragma mark Dispatch
+
+template <class Body>
+static inline void withChannels(uint32_t channels, Body body) {
+    switch (channels) {
+        case 1: body(std::integral_constant<uint32_t, 1>()); break;
+        case 2: body(std::integral_constant<uint32_t, 2>()); break;
+        default: body(std::integral_constant<uint32_t, 0>()); break;
+    }
+}
+
+template <class Body>
+static inline void withBlockSize(uint32_t frames, Body body) {
+    switch (frames) {
+        case 64: body(std::integral_constant<uint32_t, 64>()); break;
+        case 128: body(std::integral_constant<uint32_t, 128>()); break;
+        case 256: body(std::integral_constant<uint32_t, 256>()); break;
+        case 512: body(std::integral_constant<uint32_t, 512>()); break;
+        case 1024: body(std::integral_constant<uint32_t, 1024>()); break;
+        case 4096: body(std::integral_constant<uint32_t, 4096>()); break;
+        default: body(std::integral_constant<uint32_t, 0>()); break;
+    }
+}
+
+//Picks the instantiation for the call's channel count and block size, once per call
+#define CP_KERNEL_DISPATCH(Kernel, channels, frames, ...) \
+    if (!Specialized) { \
+        ISA::template Kernel<0, 0>(__VA_ARGS__); \
+        return; \
+    } \
+    withChannels(channels, [&](auto c) { \
+        withBlockSize(frames, [&](auto f) { \
+            ISA::template Kernel<decltype(c)::value, decltype(f)::value>(__VA_ARGS__); \
+        }); \
+    });
+
+template <class ISA, bool Specialized>
+struct CPKernelDispatch {
+    static void biquadCascade(const CPBiquadCoefficients *sections, const uint8_t *bands, uint32_t numBands,
+                              CPBiquadState *const *state, const float *const *in, float *const *out,
+                              uint32_t numChannels, uint32_t frames) {
+        CP_KERNEL_DISPATCH(biquadCascade, numChannels, frames, sections, bands, numBands, state, in, out, numChannels, frames)
+    }
+
+    static void mixMatrix(const float *const *in, uint32_t inChannels, float *const *out, uint32_t outChannels,
+                          const float *gains, const float *steps, uint32_t frames, bool accumulate) {
+        //Only stereo outputs have a specialized mix
+        CP_KERNEL_DISPATCH(mixMatrix, outChannels == 2 ? inChannels : 0, frames, in, inChannels, out, outChannels, gains, steps, frames, accumulate)
+    }
+
+    static void gainRamp(float *const *channels, uint32_t numChannels, float gain, float step, uint32_t frames) {
+        CP_KERNEL_DISPATCH(gainRamp, numChannels, frames, channels, numChannels, gain, step, frames)
+    }
+
+    static void deinterleaveInt16(const int16_t *in, float *const *out, uint32_t numChannels, uint32_t frames) {
+        CP_KERNEL_DISPATCH(deinterleaveInt16, numChannels, frames, in, out, numChannels, frames)
+    }
+
+    static void deinterleaveFloat(const float *in, float *const *out, uint32_t numChannels, uint32_t frames) {
+        CP_KERNEL_DISPATCH(deinterleaveFloat, numChannels, frames, in, out, numChannels, frames)
+    }
+
+    static void interleaveInt16(const float *const *in, int16_t *out, uint32_t numChannels, uint32_t frames) {
+        CP_KERNEL_DISPATCH(interleaveInt16, numChannels, frames, in, out, numChannels, frames)
+    }
+
+    static void interleaveFloat(const float *const *in, float *out, uint32_t numChannels, uint32_t frames) {
+        CP_KERNEL_DISPATCH(interleaveFloat, numChannels, frames, in, out, numChannels, frames)
+    }
+
+    static CPKernelTable table(CPKernelISA isa) {
+        return CPKernelTable {
+            isa, Specialized,
+            &biquadCascade, &mixMatrix, &gainRamp,
+            &deinterleaveInt16, &deinterleaveFloat, &interleaveInt16, &interleaveFloat
+        };
+    }
+};
+
+#pragma mark Selection
+
+#if defined(__x86_64__)
+static uint64_t readXCR0() {
+    uint32_t low, high;
+    __asm__ volatile("xgetbv" : "=a"(low), "=d"(high) : "c"(0));
+    return ((uint64_t)high << 32) | low;
+}
+#endif
+
+CPKernelISA CPKernelBestISA() {
+#if defined(__x86_64__)
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        return CPKernelISASSE2;
+    }
+    //The CPU having AVX is not enough: the OS has to save the wider registers across context switches
+    if (!(ecx & bit_OSXSAVE) || !(ecx & bit_AVX) || !(ecx & bit_FMA)) {
+        return CPKernelISASSE2;
+    }
+    uint64_t xcr0 = readXCR0();
+    if ((xcr0 & 0x6) != 0x6 || !__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) || !(ebx & bit_AVX2)) {
+        return CPKernelISASSE2;
+    }
+    //Opmask and both halves of the 512 bit register file
+    if ((ebx & bit_AVX512F) && (ebx & bit_AVX512VL) && (xcr0 & 0xe0) == 0xe0) {
+        return CPKernelISAAVX512;
+    }
+    return CPKernelISAAVX2;
+#else
+    return kBaselineISA;
+#endif
+}
+
+const char *CPKernelISAName(CPKernelISA isa) {
+    switch (isa) {
+        case CPKernelISAScalar: return "scalar";
+        case CPKernelISANEON: return "neon";
+        case CPKernelISASSE2: return "sse2";
+        case CPKernelISAAVX2: return "avx2";
+        case CPKernelISAAVX512: return "avx512";
+        default: return "unknown";
+    }
+}
+
+const CPKernelTable *CPKernelsForISA(CPKernelISA isa, bool specialized) {
+    static const CPKernelTable baseline[2] = {
+        CPKernelDispatch<CPKernelsBaseline, false>::table(kBaselineISA),
+        CPKernelDispatch<CPKernelsBaseline, true>::table(kBaselineISA)
+    };
+#if defined(__x86_64__)
+    static const CPKernelTable avx2[2] = {
+        CPKernelDispatch<CPKernelsAVX2, false>::table(CPKernelISAAVX2),
+        CPKernelDispatch<CPKernelsAVX2, true>::table(CPKernelISAAVX2)
+    };
+    static const CPKernelTable avx512[2] = {
+        CPKernelDispatch<CPKernelsAVX512, false>::table(CPKernelISAAVX512),
+        CPKernelDispatch<CPKernelsAVX512, true>::table(CPKernelISAAVX512)
+    };
+    static const CPKernelISA best = CPKernelBestISA();
+    if (isa > best) {
+        return nullptr;
+    }
+    if (isa == CPKernelISAAVX2) {
+        return &avx2[specialized];
+    }
+    if (isa == CPKernelISAAVX512) {
+        return &avx512[specialized];
+    }
+#endif
+    return isa == kBaselineISA ? &baseline[specialized] : nullptr;
+}
+
+const CPKernelTable &CPKernels() {
+    static const CPKernelTable &kernels = *CPKernelsForISA(CPKernelBestISA());
+    return kernels;
+}
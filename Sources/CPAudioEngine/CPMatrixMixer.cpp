@@ -0,0 +1,243 @@
+//
+//  CPMatrixMixer.cpp
+//  CPAudioEngine
+//
+//  In x out gain matrix with the standard downmixes, balance, pre-gain and volume folded in
+//
+
+#include "include/CPMatrixMixer.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include "include/CPVector.hpp"
+
+static const float kMinus3dB = 0.70710678f;
+
+enum Speaker { SpeakerL, SpeakerR, SpeakerC, SpeakerLFE, SpeakerLs, SpeakerRs, SpeakerCs };
+
+//Speaker of each input channel by channel count
+static const Speaker kLayouts[kCPMixerMaxChannels + 1][kCPMixerMaxChannels] = {
+    {},
+    { SpeakerC },
+    { SpeakerL, SpeakerR },
+    { SpeakerL, SpeakerR, SpeakerC },
+    { SpeakerL, SpeakerR, SpeakerLs, SpeakerRs },
+    { SpeakerL, SpeakerR, SpeakerC, SpeakerLs, SpeakerRs },
+    { SpeakerL, SpeakerR, SpeakerC, SpeakerLFE, SpeakerLs, SpeakerRs },
+    { SpeakerL, SpeakerR, SpeakerC, SpeakerLFE, SpeakerLs, SpeakerRs, SpeakerCs },
+    { SpeakerL, SpeakerR, SpeakerC, SpeakerLFE, SpeakerLs, SpeakerRs, SpeakerLs, SpeakerRs },
+};
+
+//Stereo downmix gains {left, right} of each speaker
+static void stereoGains(Speaker speaker, float *left, float *right) {
+    switch (speaker) {
+        case SpeakerL:   *left = 1.0f;       *right = 0.0f;       break;
+        case SpeakerR:   *left = 0.0f;       *right = 1.0f;       break;
+        case SpeakerC:   *left = kMinus3dB;  *right = kMinus3dB;  break;
+        case SpeakerLFE: *left = 0.0f;       *right = 0.0f;       break;
+        case SpeakerLs:  *left = kMinus3dB;  *right = 0.0f;       break;
+        case SpeakerRs:  *left = 0.0f;       *right = kMinus3dB;  break;
+        case SpeakerCs:  *left = 0.5f;       *right = 0.5f;       break;
+        default:         *left = 0.0f;       *right = 0.0f;       break;
+    }
+}
+
+CPMatrixMixer::CPMatrixMixer(uint32_t outChannels)
+: _outChannels(std::min(std::max(outChannels, 1u), kCPMixerMaxChannels)),
+  _balance(0.0f),
+  _preGainDb(0.0f),
+  _volume(1.0f),
+  _nextSlot(0),
+  _kernels(CPKernels()),
+  _pending(nullptr),
+  _adopting(nullptr),
+  _active(nullptr),
+  _previous(nullptr),
+  _blockFrames(1)
+{
+    memset(_slots, 0, sizeof(_slots));
+    publish();
+    _active.store(_pending.load());
+}
+
+#pragma mark Control thread
+
+bool CPMatrixMixer::isReferenced(const CPMixMatrices *matrices) const {
+    //Read active before previous: the renderer stores previous before it replaces active
+    return matrices == _pending.load() || matrices == _adopting.load() || matrices == _active.load() || matrices == _previous.load();
+}
+
+void CPMatrixMixer::publish() {
+    CPMixMatrices *matrices = nullptr;
+    //Four slots always leave one that is not pending, active or ramping out
+    for (uint32_t attempt = 0; attempt < kSlots && matrices == nullptr; attempt++) {
+        uint32_t slot = _nextSlot;
+        _nextSlot = (_nextSlot + 1) % kSlots;
+        if (!isReferenced(&_slots[slot])) {
+            matrices = &_slots[slot];
+        }
+    }
+    if (matrices == nullptr) {
+        return;
+    }
+
+    float rowGain[kCPMixerMaxChannels];
+    float level = std::pow(10.0f, _preGainDb / 20.0f) * _volume;
+    for (uint32_t out = 0; out < _outChannels; out++) {
+        rowGain[out] = level;
+    }
+    if (_outChannels == 2) {
+        rowGain[0] *= _balance > 0.0f ? 1.0f - _balance : 1.0f;
+        rowGain[1] *= _balance < 0.0f ? 1.0f + _balance : 1.0f;
+    }
+
+    memset(matrices->gains, 0, sizeof(matrices->gains));
+    for (uint32_t inChannels = 1; inChannels <= kCPMixerMaxChannels; inChannels++) {
+        float (*gains)[kCPMixerMaxChannels] = matrices->gains[inChannels];
+        for (uint32_t in = 0; in < inChannels; in++) {
+            float left, right;
+            stereoGains(kLayouts[inChannels][in], &left, &right);
+            if (inChannels == 1) {
+                left = right = 1.0f;
+            }
+            if (_outChannels == 2) {
+                gains[0][in] = left;
+                gains[1][in] = right;
+            }
+            else if (_outChannels == 1) {
+                gains[0][in] = inChannels == 1 ? 1.0f : 0.5f * (left + right);
+            }
+            else if (in < _outChannels) {
+                //Wider outputs: pass channels straight through
+                gains[in][in] = 1.0f;
+            }
+        }
+        bool isIdentity = inChannels == _outChannels;
+        for (uint32_t out = 0; out < _outChannels; out++) {
+            //A downmix row is scaled to sum to at most 1, so full scale on every input cannot clip
+            float sum = 0.0f;
+            for (uint32_t in = 0; in < inChannels; in++) {
+                sum += gains[out][in];
+            }
+            float scale = rowGain[out] / std::max(sum, 1.0f);
+            for (uint32_t in = 0; in < inChannels; in++) {
+                gains[out][in] *= scale;
+                if (gains[out][in] != (in == out ? 1.0f : 0.0f)) {
+                    isIdentity = false;
+                }
+            }
+        }
+        matrices->isIdentity[inChannels] = isIdentity;
+    }
+    _pending.store(matrices);
+}
+
+void CPMatrixMixer::setBalance(float balance) {
+    _balance = std::min(std::max(balance, -1.0f), 1.0f);
+    publish();
+}
+
+void CPMatrixMixer::setPreGain(float decibels) {
+    _preGainDb = decibels;
+    publish();
+}
+
+void CPMatrixMixer::setVolume(float volume) {
+    _volume = std::max(volume, 0.0f);
+    publish();
+}
+
+void CPMatrixMixer::matrix(uint32_t inChannels, float gains[kCPMixerMaxChannels][kCPMixerMaxChannels]) const {
+    inChannels = std::min(std::max(inChannels, 1u), kCPMixerMaxChannels);
+    memcpy(gains, _pending.load()->gains[inChannels], sizeof(float) * kCPMixerMaxChannels * kCPMixerMaxChannels);
+}
+
+#pragma mark Render thread
+
+void CPMatrixMixer::beginBlock(uint32_t blockFrames) {
+    const CPMixMatrices *active = _active.load(std::memory_order_relaxed);
+    const CPMixMatrices *pending = _pending.load();
+    _blockFrames = std::max(blockFrames, 1u);
+    bool adopted = false;
+    if (pending != active) {
+        //Announce the set, then check it is still pending, as CPEqualizer does with its banks
+        _adopting.store(pending);
+        if (_pending.load() == pending) {
+            //Order matters for isReferenced(): previous must be visible before active moves on
+            _previous.store(active);
+            _active.store(pending);
+            adopted = true;
+        }
+        _adopting.store(nullptr);
+    }
+    if (!adopted && _previous.load(std::memory_order_relaxed) != nullptr) {
+        _previous.store(nullptr);
+    }
+}
+
+void CPMatrixMixer::mixRun(const float *const *in, uint32_t inChannels, float *const *out, uint32_t offset, uint32_t frames,
+                           float gain, float gainStep, bool accumulate) const {
+    const CPMixMatrices *active = _active.load(std::memory_order_relaxed);
+    const CPMixMatrices *previous = _previous.load(std::memory_order_relaxed);
+    const float (*to)[kCPMixerMaxChannels] = active->gains[inChannels];
+    float endGain = gain + gainStep * (float)frames;
+
+    if (previous == nullptr && gainStep == 0.0f && gain == 1.0f && active->isIdentity[inChannels]) {
+        for (uint32_t channel = 0; channel < inChannels; channel++) {
+            if (accumulate) {
+                CPVectorScaleAdd(in[channel], out[channel], 1.0f, frames);
+            }
+            else {
+                memcpy(out[channel], in[channel], frames * sizeof(float));
+            }
+        }
+        return;
+    }
+
+    //Matrix ramp across the block, multiplied by the run's own gain ramp. The product is
+    //linearised per run, which is inaudible at block lengths.
+    float startPosition = (float)offset / (float)_blockFrames;
+    float endPosition = (float)(offset + frames) / (float)_blockFrames;
+    float gains[kCPMixerMaxChannels][kCPMixerMaxChannels];
+    float steps[kCPMixerMaxChannels][kCPMixerMaxChannels];
+    for (uint32_t o = 0; o < _outChannels; o++) {
+        for (uint32_t i = 0; i < inChannels; i++) {
+            float startCoefficient = to[o][i];
+            float endCoefficient = to[o][i];
+            if (previous != nullptr) {
+                float from = previous->gains[inChannels][o][i];
+                startCoefficient = from + (to[o][i] - from) * startPosition;
+                endCoefficient = from + (to[o][i] - from) * endPosition;
+            }
+            startCoefficient *= gain;
+            endCoefficient *= endGain;
+            gains[o][i] = startCoefficient;
+            steps[o][i] = (endCoefficient - startCoefficient) / (float)frames;
+        }
+    }
+    _kernels.mixMatrix(in, inChannels, out, _outChannels, gains[0], steps[0], frames, accumulate);
+}
+
+void CPMatrixMixer::mix(const float *const *in, uint32_t inChannels, float *const *out, uint32_t offset, uint32_t frames,
+                        float gain, float gainStep, uint32_t accumulateFrames) const {
+    if (frames == 0) {
+        return;
+    }
+    inChannels = std::min(std::max(inChannels, 1u), kCPMixerMaxChannels);
+    uint32_t accumulate = std::min(accumulateFrames, frames);
+    if (accumulate > 0) {
+        mixRun(in, inChannels, out, offset, accumulate, gain, gainStep, true);
+    }
+    if (accumulate < frames) {
+        const float *shiftedIn[kCPMixerMaxChannels];
+        float *shiftedOut[kCPMixerMaxChannels];
+        for (uint32_t channel = 0; channel < inChannels; channel++) {
+            shiftedIn[channel] = in[channel] + accumulate;
+        }
+        for (uint32_t channel = 0; channel < _outChannels; channel++) {
+            shiftedOut[channel] = out[channel] + accumulate;
+        }
+        mixRun(shiftedIn, inChannels, shiftedOut, offset + accumulate, frames - accumulate,
+               gain + gainStep * (float)accumulate, gainStep, false);
+    }
+}
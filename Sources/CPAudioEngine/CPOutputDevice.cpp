@@ -0,0 +1,99 @@
+//
+//  CPOutputDevice.cpp
+//  CPAudioEngine
+//
+//  Output backend interface: whatever pulls rendered audio out of the engine
+//
+
+#include "include/CPOutputDevice.hpp"
+#if defined(__APPLE__)
+#include <mach/mach.h>
+#include <mach/mach_time.h>
+#include <mach/thread_policy.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+bool CPPromoteThreadToRealtime(double periodSeconds) {
+#if defined(__APPLE__)
+    mach_timebase_info_data_t timebase;
+    mach_timebase_info(&timebase);
+    double ticksPerSecond = 1e9 * timebase.denom / timebase.numer;
+    thread_time_constraint_policy_data_t policy;
+    policy.period = (uint32_t)(periodSeconds * ticksPerSecond);
+    policy.computation = (uint32_t)(periodSeconds * 0.5 * ticksPerSecond);
+    policy.constraint = (uint32_t)(periodSeconds * ticksPerSecond);
+    policy.preemptible = 1;
+    return thread_policy_set(mach_thread_self(), THREAD_TIME_CONSTRAINT_POLICY,
+                             (thread_policy_t)&policy, THREAD_TIME_CONSTRAINT_POLICY_COUNT) == KERN_SUCCESS;
+#elif defined(__linux__)
+    //Below the kernel's own threads, above everything else; needs CAP_SYS_NICE or an rtprio limit.
+    //SCHED_FIFO has no notion of a period.
+    (void)periodSeconds;
+    sched_param parameters = {};
+    parameters.sched_priority = sched_get_priority_max(SCHED_FIFO) - 10;
+    return pthread_setschedparam(pthread_self(), SCHED_FIFO, &parameters) == 0;
+#else
+    (void)periodSeconds;
+    return false;
+#endif
+}
+
+CPOutputDevice::CPOutputDevice()
+: _callback(nullptr),
+  _refCon(nullptr),
+  _timing(false),
+  _lastFrames(0),
+  _latency(0),
+  _jitterSum(0),
+  _maxJitter(0),
+  _intervals(0),
+  _callbacks(0),
+  _xruns(0),
+  _realtime(false)
+{
+}
+
+void CPOutputDevice::resetStats() {
+    _timing = false;
+    _jitterSum.store(0);
+    _maxJitter.store(0);
+    _intervals.store(0);
+    _callbacks.store(0);
+    _xruns.store(0);
+}
+
+CPOutputStats CPOutputDevice::stats() const {
+    CPOutputStats stats;
+    uint64_t intervals = _intervals.load();
+    stats.latency = (double)_latency.load() / 1e9;
+    stats.jitter = intervals > 0 ? (double)_jitterSum.load() / 1e9 / (double)intervals : 0.0;
+    stats.maxJitter = (double)_maxJitter.load() / 1e9;
+    stats.callbacks = _callbacks.load();
+    stats.xruns = _xruns.load();
+    stats.realtime = _realtime.load();
+    return stats;
+}
+
+void CPOutputDevice::render(float *const *channels, uint32_t frames) {
+    auto now = std::chrono::steady_clock::now();
+    if (_timing) {
+        //Deviation from when this callback was due, given the size of the previous one
+        int64_t interval = std::chrono::duration_cast<std::chrono::nanoseconds>(now - _lastCallback).count();
+        int64_t expected = (int64_t)((double)_lastFrames / _config.sampleRate * 1e9);
+        int64_t deviation = interval > expected ? interval - expected : expected - interval;
+        _jitterSum.fetch_add(deviation, std::memory_order_relaxed);
+        _intervals.fetch_add(1, std::memory_order_relaxed);
+        if (deviation > _maxJitter.load(std::memory_order_relaxed)) {
+            _maxJitter.store(deviation, std::memory_order_relaxed);
+        }
+    }
+    _lastCallback = now;
+    _lastFrames = frames;
+    _timing = true;
+    _callbacks.fetch_add(1, std::memory_order_relaxed);
+    if (_callback != nullptr) {
+        _callback(_refCon, channels, _config.channels, frames);
+    }
+}
@@ -0,0 +1,491 @@
+//
+//  CPPlayerEngine.cpp
+//  CPAudioEngine
+//
+//  The player without any platform in it: source, mixer and EQ rendering into an output backend
+//
+
+#include "include/CPPlayerEngine.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <thread>
+#include "include/CPDenormals.hpp"
+#include "include/CPKernels.hpp"
+
+//Fade applied when playback starts or stops, long enough not to click
+static const double kDeclickSeconds = 0.01;
+//Each chain unit is timed every this many blocks; reading the clock around every unit costs more than the light ones
+static const uint32_t kUnitTimingInterval = 16;
+//Weight of the newest timed block in the smoothed cost of each chain unit
+static const float kUnitCostSmoothing = 0.25f;
+
+CPPlayerEngine::CPPlayerEngine(std::unique_ptr<CPOutputDevice> output, const CPOutputConfig &config,
+                               const float *eqFrequencies, uint32_t eqBands)
+: _output(std::move(output)),
+  _open(false),
+  _renderMode(CPRenderModeInteractive),
+  _periodFrames(config.periodFrames),
+  _periods(config.periods),
+  _source(nullptr),
+  _processUnitCount(0),
+  _pipelineStages(0),
+  _carrySamples((size_t)kCPMixerMaxChannels * kCPEngineBlockFrames),
+  _carryOffset(0),
+  _carryFlags(0),
+  _carryFrames(0),
+  _completionCallback(nullptr),
+  _completionRefCon(nullptr),
+  _firstAudioDelay(0),
+  _awaitingFirstAudio(false)
+{
+    //Picks the kernel set for this CPU here, so the render thread never does
+    CPKernels();
+    _output->setRenderCallback(&renderCallback, this);
+    _open = _output->open(config);
+    //A device that failed to open still reports the requested format, so the engine stays usable
+    _mixer.reset(new CPMatrixMixer(channels()));
+    _equalizer.reset(new CPEqualizer(eqFrequencies, eqBands, sampleRate()));
+    _automation.reset(new CPGainAutomation(sampleRate()));
+    _transport.reset(new CPGainAutomation(sampleRate()));
+    for (uint32_t unit = 0; unit <= kMaxProcessCallbacks; unit++) {
+        _unitCost[unit].store(0.0f);
+        _unitBlocks[unit] = 0;
+    }
+    for (uint32_t channel = 0; channel < kCPMixerMaxChannels; channel++) {
+        _carry[channel] = _carrySamples.data() + (size_t)channel * kCPEngineBlockFrames;
+    }
+}
+
+CPPlayerEngine::~CPPlayerEngine() {
+    _output->close();
+    //Workers finish the blocks they hold, which may still pull the source
+    releasePipeline();
+    delete _source.load();
+}
+
+#pragma mark Control thread
+
+CPTrackSource &CPPlayerEngine::source() {
+    std::lock_guard<std::mutex> lock(_sourceMutex);
+    CPTrackSource *source = _source.load();
+    if (source == nullptr) {
+        source = new CPTrackSource(sampleRate(), *_mixer);
+        source->setTrackEndCallback(&trackEndCallback, this);
+        source->setReadAhead(_renderMode == CPRenderModeBackground ? CPReadAheadBatched : CPReadAheadEager);
+        source->setOutputBuffer(_output->config().periodFrames, _output->config().periods);
+        _source.store(source, std::memory_order_release);
+    }
+    return *source;
+}
+
+bool CPPlayerEngine::startWithFadeIn() {
+    //The fade in has to meet audio, not the pipeline's warm-up silence
+    if (_pipeline != nullptr) {
+        _pipeline->prime(2.0 * _pipeline->latencyFrames() / sampleRate() + 0.05);
+    }
+    _transport->reset(0.0f);
+    _transport->rampTo(1.0f, kDeclickSeconds);
+    return _output->start();
+}
+
+void CPPlayerEngine::fadeOutAndStop() {
+    if (isPlaying()) {
+        _transport->rampTo(0.0f, kDeclickSeconds);
+        //The render thread finishes the fade within a period or two; don't hang on a stalled device
+        const CPOutputConfig &config = _output->config();
+        double wait = kDeclickSeconds + 2.0 * config.periodFrames * std::max(config.periods, 1u) / config.sampleRate + 0.02;
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(wait);
+        while (!_transport->isIdle() && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    _output->stop();
+    //The workers may still be rendering blocks; nothing the chain reads may change until they are done
+    if (_pipeline != nullptr) {
+        _pipeline->waitUntilIdle(2.0 * _pipeline->latencyFrames() / sampleRate() + 0.05);
+    }
+}
+
+void CPPlayerEngine::flushPipeline() {
+    if (_pipeline != nullptr) {
+        _pipeline->waitUntilIdle(2.0 * _pipeline->latencyFrames() / sampleRate() + 0.05);
+        _pipeline->flush();
+    }
+    _carryFrames.store(0);
+}
+
+uint64_t CPPlayerEngine::releasePipeline() {
+    if (_pipeline == nullptr) {
+        return 0;
+    }
+    //Drain, then join: the destructor returns once every worker has finished the blocks it still
+    //holds, even if the drain timed out. Workers find their share of the chain in _pipelineStages
+    //and _stageFirstUnit, never through _pipeline, so nulling it while they finish is safe.
+    _pipeline->waitUntilIdle(2.0 * _pipeline->latencyFrames() / sampleRate() + 0.05);
+    uint64_t queued = _pipeline->queuedFrames();
+    _pipeline.reset();
+    _pipelineStages = 0;
+    return queued;
+}
+
+void CPPlayerEngine::rebuildPipeline(uint32_t stages) {
+    //Rewind the source over audio it rendered that will now never be played
+    uint64_t queued = releasePipeline();
+    CPTrackSource *source = _source.load();
+    if (queued > 0 && source != nullptr && source->hasTrack()) {
+        //The output is stopped, so cut straight to the rewound position: a crossfade would start
+        //from the dropped audio
+        bool rendering = source->isRendering();
+        source->setRendering(false);
+        source->seek(std::max<int64_t>(source->position() - (int64_t)queued, 0));
+        source->setRendering(rendering);
+    }
+    if (stages == 0) {
+        return;
+    }
+
+    //Contiguous runs of units with the smallest possible maximum cost per stage. Units that
+    //have never run count equally.
+    uint32_t units = 1 + _processUnitCount.load(std::memory_order_acquire);
+    double cost[kMaxProcessCallbacks + 1];
+    double prefix[kMaxProcessCallbacks + 2] = { 0 };
+    for (uint32_t unit = 0; unit < units; unit++) {
+        cost[unit] = std::max((double)_unitCost[unit].load(std::memory_order_relaxed), 1e-6);
+        prefix[unit + 1] = prefix[unit] + cost[unit];
+    }
+    //best[k][i]: max stage cost of units [0, i) in k stages; split[k][i]: where the last stage starts
+    double best[kCPPipelineMaxStages + 1][kMaxProcessCallbacks + 2];
+    uint32_t split[kCPPipelineMaxStages + 1][kMaxProcessCallbacks + 2];
+    for (uint32_t i = 0; i <= units; i++) {
+        best[1][i] = prefix[i];
+        split[1][i] = 0;
+    }
+    for (uint32_t k = 2; k <= stages; k++) {
+        for (uint32_t i = k; i <= units; i++) {
+            best[k][i] = INFINITY;
+            for (uint32_t j = k - 1; j < i; j++) {
+                double candidate = std::max(best[k - 1][j], prefix[i] - prefix[j]);
+                if (candidate < best[k][i]) {
+                    best[k][i] = candidate;
+                    split[k][i] = j;
+                }
+            }
+        }
+    }
+    _stageFirstUnit[stages] = units;
+    for (uint32_t k = stages, end = units; k >= 1; k--) {
+        _stageFirstUnit[k - 1] = split[k][end];
+        end = split[k][end];
+    }
+
+    const CPOutputConfig &output = _output->config();
+    CPPipelineConfig config;
+    config.stages = stages;
+    config.channels = output.channels;
+    //At least a period per block, in whole engine blocks
+    config.blockFrames = (output.periodFrames + kCPEngineBlockFrames - 1) / kCPEngineBlockFrames * kCPEngineBlockFrames;
+    config.sampleRate = output.sampleRate;
+    config.realtimePriority = output.realtimePriority;
+    //Everything renderStage() reads is in place before the workers start, and stays put until they are joined
+    _pipelineStages = stages;
+    _pipeline.reset(new CPRenderPipeline(config, &renderStage, this));
+}
+
+bool CPPlayerEngine::reopenOutput(uint32_t periodFrames, uint32_t periods) {
+    CPOutputConfig config = _output->config();
+    config.periodFrames = periodFrames;
+    config.periods = periods;
+    bool wasPlaying = isPlaying();
+    fadeOutAndStop();
+    _output->close();
+    _open = _output->open(config);
+    if (hasSource()) {
+        //Switches are primed for what the device granted
+        _source.load()->setOutputBuffer(_output->config().periodFrames, _output->config().periods);
+    }
+    //Blocks follow the period
+    if (_pipeline != nullptr) {
+        rebuildPipeline(_pipeline->config().stages);
+    }
+    if (wasPlaying && _open) {
+        startWithFadeIn();
+    }
+    return _open;
+}
+
+bool CPPlayerEngine::setOutputPeriod(uint32_t periodFrames, uint32_t periods) {
+    _periodFrames = periodFrames;
+    _periods = periods;
+    if (_renderMode == CPRenderModeBackground) {
+        return _open;
+    }
+    return reopenOutput(periodFrames, periods);
+}
+
+bool CPPlayerEngine::setRenderMode(CPRenderMode mode) {
+    if (mode == _renderMode) {
+        return _open;
+    }
+    _renderMode = mode;
+    bool background = mode == CPRenderModeBackground;
+    if (hasSource()) {
+        _source.load()->setReadAhead(background ? CPReadAheadBatched : CPReadAheadEager);
+    }
+    return reopenOutput(background ? std::max(_periodFrames, kCPEngineBackgroundPeriodFrames) : _periodFrames, _periods);
+}
+
+void CPPlayerEngine::setEqualizerFrequencies(const float *frequencies, uint32_t numBands) {
+    //The render thread reads the equalizer, so only swap it while stopped
+    bool wasPlaying = isPlaying();
+    fadeOutAndStop();
+    _equalizer.reset(new CPEqualizer(frequencies, numBands, sampleRate()));
+    if (wasPlaying) {
+        startWithFadeIn();
+    }
+}
+
+void CPPlayerEngine::setProcessCallback(ProcessCallback callback, void *refCon) {
+    //Slots in use are rewritten, so nothing may be rendering them
+    bool wasPlaying = isPlaying();
+    fadeOutAndStop();
+    _processUnitCount.store(0, std::memory_order_release);
+    if (callback != nullptr) {
+        addProcessCallback(callback, refCon);
+    }
+    if (wasPlaying) {
+        startWithFadeIn();
+    }
+}
+
+bool CPPlayerEngine::addProcessCallback(ProcessCallback callback, void *refCon) {
+    //Only this thread writes; the render threads see the slot once the count that covers it
+    uint32_t count = _processUnitCount.load(std::memory_order_relaxed);
+    if (count == kMaxProcessCallbacks) {
+        return false;
+    }
+    _processUnits[count] = ProcessUnit { callback, refCon };
+    _processUnitCount.store(count + 1, std::memory_order_release);
+    return true;
+}
+
+bool CPPlayerEngine::setPipelineStages(uint32_t stages) {
+    stages = std::min(stages, std::min(kCPPipelineMaxStages, 1 + _processUnitCount.load(std::memory_order_relaxed)));
+    if (stages == pipelineStages()) {
+        return true;
+    }
+    bool wasPlaying = isPlaying();
+    fadeOutAndStop();
+    rebuildPipeline(stages);
+    if (wasPlaying) {
+        startWithFadeIn();
+    }
+    return true;
+}
+
+double CPPlayerEngine::pipelineLatency() const {
+    return _pipeline != nullptr ? _pipeline->latencyFrames() / sampleRate() : 0;
+}
+
+CPPipelineStats CPPlayerEngine::pipelineStats() const {
+    return _pipeline != nullptr ? _pipeline->stats() : CPPipelineStats {};
+}
+
+void CPPlayerEngine::setCompletionCallback(CompletionCallback callback, void *refCon) {
+    _completionCallback = callback;
+    _completionRefCon = refCon;
+}
+
+bool CPPlayerEngine::load(std::unique_ptr<CPAudioDecoder> decoder, int64_t startFrame) {
+    if (decoder == nullptr || decoder->sampleRate() != sampleRate()) {
+        return false;
+    }
+    //While playing the source crossfades behind the pipelined audio; while not, that audio is stale
+    if (!isPlaying()) {
+        flushPipeline();
+    }
+    return source().attach(std::move(decoder), startFrame);
+}
+
+bool CPPlayerEngine::play() {
+    if (!_open || !hasTrack()) {
+        return false;
+    }
+    if (isPlaying()) {
+        return true;
+    }
+    _playRequest = std::chrono::steady_clock::now();
+    _awaitingFirstAudio.store(true);
+    source().setRendering(true);
+    if (!startWithFadeIn()) {
+        source().setRendering(false);
+        return false;
+    }
+    return true;
+}
+
+void CPPlayerEngine::pause() {
+    fadeOutAndStop();
+    if (hasSource()) {
+        _source.load()->setRendering(false);
+    }
+}
+
+void CPPlayerEngine::stop() {
+    pause();
+    if (hasSource()) {
+        _source.load()->detach();
+    }
+    flushPipeline();
+}
+
+bool CPPlayerEngine::setPlaybackTime(double seconds) {
+    if (!hasTrack()) {
+        return false;
+    }
+    if (!isPlaying()) {
+        flushPipeline();
+    }
+    return _source.load()->seek((int64_t)(seconds * sampleRate()));
+}
+
+double CPPlayerEngine::currentPlaybackTime() const {
+    CPTrackSource *source = _source.load();
+    if (source == nullptr) {
+        return 0;
+    }
+    //The source runs ahead of the output by whatever the pipeline holds and the rest of a carried block
+    int64_t position = source->position() - (int64_t)_carryFrames.load(std::memory_order_relaxed);
+    if (_pipeline != nullptr) {
+        position -= (int64_t)_pipeline->queuedFrames();
+    }
+    return (double)std::max<int64_t>(position, 0) / sampleRate();
+}
+
+double CPPlayerEngine::duration() const {
+    CPTrackSource *source = _source.load();
+    return source != nullptr && source->lengthFrames() > 0 ? (double)source->lengthFrames() / sampleRate() : 0;
+}
+
+double CPPlayerEngine::timeToFirstAudio() const {
+    if (_awaitingFirstAudio.load(std::memory_order_acquire)) {
+        return 0;
+    }
+    return (double)_firstAudioDelay.load(std::memory_order_relaxed) / 1e9;
+}
+
+#pragma mark Render thread
+
+void CPPlayerEngine::trackEndCallback(void *refCon) {
+    CPPlayerEngine *engine = (CPPlayerEngine *)refCon;
+    if (engine->_completionCallback != nullptr) {
+        engine->_completionCallback(engine->_completionRefCon);
+    }
+}
+
+uint32_t CPPlayerEngine::renderUnits(uint32_t first, uint32_t last, float *const *channels, uint32_t numChannels, uint32_t frames) {
+    uint32_t flags = 0;
+    float *block[kCPMixerMaxChannels];
+    numChannels = std::min(numChannels, kCPMixerMaxChannels);
+    const uint32_t blockFrames = kCPEngineBlockFrames;
+    for (uint32_t done = 0; done < frames; done += blockFrames) {
+        for (uint32_t channel = 0; channel < numChannels; channel++) {
+            block[channel] = channels[channel] + done;
+        }
+        for (uint32_t unit = first; unit < last; unit++) {
+            bool timed = _unitBlocks[unit]++ % kUnitTimingInterval == 0;
+            std::chrono::steady_clock::time_point start;
+            if (timed) {
+                start = std::chrono::steady_clock::now();
+            }
+            if (unit == 0) {
+                CPTrackSource *source = _source.load(std::memory_order_acquire);
+                if (source != nullptr && source->render(block, numChannels, blockFrames) > 0) {
+                    flags |= kBlockHasTrack;
+                }
+                else if (source == nullptr) {
+                    for (uint32_t channel = 0; channel < numChannels; channel++) {
+                        memset(block[channel], 0, blockFrames * sizeof(float));
+                    }
+                }
+                _equalizer->process(block, numChannels, blockFrames);
+            }
+            else {
+                const ProcessUnit &process = _processUnits[unit - 1];
+                process.callback(process.refCon, block, numChannels, blockFrames);
+            }
+            if (timed) {
+                float seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+                float cost = _unitCost[unit].load(std::memory_order_relaxed);
+                _unitCost[unit].store(cost + kUnitCostSmoothing * (seconds - cost), std::memory_order_relaxed);
+            }
+        }
+    }
+    return flags;
+}
+
+void CPPlayerEngine::noteFirstAudio(bool rendered) {
+    if (rendered && _awaitingFirstAudio.load(std::memory_order_relaxed)) {
+        auto delay = std::chrono::steady_clock::now() - _playRequest;
+        _firstAudioDelay.store(std::chrono::duration_cast<std::chrono::nanoseconds>(delay).count(), std::memory_order_relaxed);
+        _awaitingFirstAudio.store(false, std::memory_order_release);
+    }
+}
+
+//A worker's share of the chain; units added after the split run in the last stage
+uint32_t CPPlayerEngine::renderStage(void *refCon, uint32_t stage, float *const *channels, uint32_t numChannels, uint32_t frames) {
+    CPPlayerEngine *engine = (CPPlayerEngine *)refCon;
+    uint32_t last = stage + 1 == engine->_pipelineStages ? 1 + engine->_processUnitCount.load(std::memory_order_acquire) : engine->_stageFirstUnit[stage + 1];
+    return engine->renderUnits(engine->_stageFirstUnit[stage], last, channels, numChannels, frames);
+}
+
+uint32_t CPPlayerEngine::renderBlock(float *const *block, uint32_t numChannels) {
+    if (_pipeline != nullptr) {
+        return _pipeline->pull(block, numChannels, kCPEngineBlockFrames);
+    }
+    return renderUnits(0, 1 + _processUnitCount.load(std::memory_order_acquire), block, numChannels, kCPEngineBlockFrames);
+}
+
+//Source, native EQ, whatever the host processes (here or from the pipeline) in whole engine blocks,
+//then the gain lanes over what is played, whatever the size of the callback
+void CPPlayerEngine::renderCallback(void *refCon, float *const *channels, uint32_t numChannels, uint32_t frames) {
+    CPPlayerEngine *engine = (CPPlayerEngine *)refCon;
+    CPScopedFlushDenormals flushDenormals;
+    uint32_t flags = 0;
+    float *out[kCPMixerMaxChannels];
+    numChannels = std::min(numChannels, kCPMixerMaxChannels);
+    for (uint32_t done = 0, chunk; done < frames; done += chunk) {
+        for (uint32_t channel = 0; channel < numChannels; channel++) {
+            out[channel] = channels[channel] + done;
+        }
+        uint32_t carried = engine->_carryFrames.load(std::memory_order_relaxed);
+        if (carried > 0) {
+            //The rest of the block the previous callback ended in
+            chunk = std::min(frames - done, carried);
+            for (uint32_t channel = 0; channel < numChannels; channel++) {
+                memcpy(out[channel], engine->_carry[channel] + engine->_carryOffset, chunk * sizeof(float));
+            }
+            engine->_carryOffset += chunk;
+            engine->_carryFrames.store(carried - chunk, std::memory_order_relaxed);
+            flags |= engine->_carryFlags;
+        }
+        else if (frames - done >= kCPEngineBlockFrames) {
+            chunk = kCPEngineBlockFrames;
+            flags |= engine->renderBlock(out, numChannels);
+        }
+        else {
+            //Less than a block left: render a whole one aside and keep what this callback has no room for
+            chunk = frames - done;
+            engine->_carryFlags = engine->renderBlock(engine->_carry, numChannels);
+            for (uint32_t channel = 0; channel < numChannels; channel++) {
+                memcpy(out[channel], engine->_carry[channel], chunk * sizeof(float));
+            }
+            engine->_carryOffset = chunk;
+            engine->_carryFrames.store(kCPEngineBlockFrames - chunk, std::memory_order_relaxed);
+            flags |= engine->_carryFlags;
+        }
+        engine->_transport->process(out, numChannels, chunk);
+        engine->_automation->process(out, numChannels, chunk);
+    }
+    engine->noteFirstAudio((flags & kBlockHasTrack) != 0);
+}
@@ -0,0 +1,307 @@
+//
+//  CPRenderPipeline.cpp
+//  CPAudioEngine
+//
+//  Pipelined rendering: the chain split into stages on pinned realtime workers, a block apart
+//
+
+#include "include/CPRenderPipeline.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include "include/CPDenormals.hpp"
+#include "include/CPOutputDevice.hpp"
+#if defined(__APPLE__)
+#include <mach/mach.h>
+#include <mach/thread_policy.h>
+#include <pthread.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+//Queue checks an idle worker makes before parking; a block usually arrives well within a period
+static const uint32_t kSpinChecks = 256;
+
+bool CPPinThreadToCore(uint32_t core) {
+    uint32_t cores = std::max(std::thread::hardware_concurrency(), 1u);
+    core %= cores;
+#if defined(__APPLE__)
+    //Threads with different tags are kept on different L2 caches where the scheduler can
+    thread_affinity_policy_data_t policy = { (integer_t)core + 1 };
+    return thread_policy_set(pthread_mach_thread_np(pthread_self()), THREAD_AFFINITY_POLICY,
+                             (thread_policy_t)&policy, THREAD_AFFINITY_POLICY_COUNT) == KERN_SUCCESS;
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
+
+#pragma mark CPSemaphore
+
+#if defined(__APPLE__)
+CPSemaphore::CPSemaphore() {
+    semaphore_create(mach_task_self(), &_semaphore, SYNC_POLICY_FIFO, 0);
+}
+
+CPSemaphore::~CPSemaphore() {
+    semaphore_destroy(mach_task_self(), _semaphore);
+}
+
+void CPSemaphore::signal() {
+    semaphore_signal(_semaphore);
+}
+
+void CPSemaphore::wait() {
+    semaphore_wait(_semaphore);
+}
+#else
+CPSemaphore::CPSemaphore() {
+    sem_init(&_semaphore, 0, 0);
+}
+
+CPSemaphore::~CPSemaphore() {
+    sem_destroy(&_semaphore);
+}
+
+void CPSemaphore::signal() {
+    sem_post(&_semaphore);
+}
+
+void CPSemaphore::wait() {
+    while (sem_wait(&_semaphore) != 0 && errno == EINTR) {
+    }
+}
+#endif
+
+#pragma mark CPRenderPipeline
+
+CPRenderPipeline::CPRenderPipeline(const CPPipelineConfig &config, StageCallback callback, void *refCon)
+: _config(config),
+  _callback(callback),
+  _refCon(refCon),
+  _running(true),
+  _inFlight(0),
+  _realtimeWorkers(0),
+  _pinnedWorkers(0),
+  _renderedFrames(0),
+  _playedFrames(0),
+  _playedBlocks(0),
+  _underruns(0),
+  _current(kNoBlock),
+  _offset(0),
+  _primed(false),
+  _starved(false)
+{
+    _config.stages = std::min(std::max(_config.stages, 1u), kCPPipelineMaxStages);
+    _config.blockFrames = std::max(_config.blockFrames, 1u);
+    if (_config.latencyBlocks == 0) {
+        _config.latencyBlocks = _config.stages + 1;
+    }
+    _config.latencyBlocks = std::max(_config.latencyBlocks, _config.stages);
+    _blocks = _config.latencyBlocks;
+
+    size_t blockSamples = (size_t)_config.channels * _config.blockFrames;
+    _samples.assign(blockSamples * _blocks, 0.0f);
+    _channels.resize((size_t)_blocks * _config.channels);
+    for (uint32_t block = 0; block < _blocks; block++) {
+        for (uint32_t channel = 0; channel < _config.channels; channel++) {
+            _channels[(size_t)block * _config.channels + channel] = _samples.data() + block * blockSamples + (size_t)channel * _config.blockFrames;
+        }
+    }
+    _blockFlags.assign(_blocks, 0);
+    for (uint32_t queue = 0; queue <= _config.stages; queue++) {
+        _queues[queue].reset(_blocks);
+    }
+    for (uint32_t stage = 0; stage < kCPPipelineMaxStages; stage++) {
+        _busyNanos[stage].store(0);
+        _stageBlocks[stage].store(0);
+    }
+    //Every block starts out idle; the first pull() sends them all into the first stage
+    _idle.reserve(_blocks);
+    for (uint32_t block = 0; block < _blocks; block++) {
+        _idle.push_back(block);
+    }
+    for (uint32_t stage = 0; stage < _config.stages; stage++) {
+        _workers.emplace_back(&CPRenderPipeline::work, this, stage);
+    }
+}
+
+CPRenderPipeline::~CPRenderPipeline() {
+    _running.store(false);
+    for (uint32_t stage = 0; stage < _config.stages; stage++) {
+        _wake[stage].signal();
+    }
+    for (std::thread &worker : _workers) {
+        worker.join();
+    }
+}
+
+#pragma mark Control thread
+
+uint64_t CPRenderPipeline::queuedFrames() const {
+    uint64_t played = _playedFrames.load(std::memory_order_acquire);
+    uint64_t rendered = _renderedFrames.load(std::memory_order_acquire);
+    return rendered > played ? rendered - played : 0;
+}
+
+CPPipelineStats CPRenderPipeline::stats() const {
+    CPPipelineStats stats = {};
+    stats.stages = _config.stages;
+    stats.latencyBlocks = _config.latencyBlocks;
+    stats.blocks = _playedBlocks.load(std::memory_order_relaxed);
+    stats.underruns = _underruns.load(std::memory_order_relaxed);
+    double period = _config.blockFrames / _config.sampleRate;
+    for (uint32_t stage = 0; stage < _config.stages; stage++) {
+        uint64_t blocks = _stageBlocks[stage].load(std::memory_order_relaxed);
+        stats.stageLoad[stage] = blocks > 0 ? _busyNanos[stage].load(std::memory_order_relaxed) / 1e9 / blocks / period : 0;
+    }
+    stats.realtime = _realtimeWorkers.load() == _config.stages;
+    stats.pinned = _pinnedWorkers.load() == _config.stages;
+    return stats;
+}
+
+bool CPRenderPipeline::prime(double timeoutSeconds) {
+    submitIdle();
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(timeoutSeconds);
+    while (_current == kNoBlock && _queues[_config.stages].size() == 0) {
+        if (std::chrono::steady_clock::now() >= deadline) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+    return true;
+}
+
+bool CPRenderPipeline::waitUntilIdle(double timeoutSeconds) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(timeoutSeconds);
+    while (_inFlight.load(std::memory_order_acquire) > 0) {
+        if (std::chrono::steady_clock::now() >= deadline) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(500));
+    }
+    return true;
+}
+
+void CPRenderPipeline::flush() {
+    uint32_t block;
+    while (_queues[_config.stages].pop(block)) {
+        _idle.push_back(block);
+    }
+    if (_current != kNoBlock) {
+        _idle.push_back(_current);
+        _current = kNoBlock;
+    }
+    _offset = 0;
+    _primed = false;
+    _playedFrames.store(_renderedFrames.load());
+}
+
+#pragma mark Workers
+
+void CPRenderPipeline::work(uint32_t stage) {
+    CPScopedFlushDenormals flushDenormals;
+    if (_config.realtimePriority && CPPromoteThreadToRealtime(_config.blockFrames / _config.sampleRate)) {
+        _realtimeWorkers.fetch_add(1);
+    }
+    if (CPPinThreadToCore(_config.firstCore + stage)) {
+        _pinnedWorkers.fetch_add(1);
+    }
+    CPBlockQueue &input = _queues[stage];
+    CPBlockQueue &output = _queues[stage + 1];
+    bool last = stage + 1 == _config.stages;
+    while (true) {
+        uint32_t block = kNoBlock;
+        for (uint32_t check = 0; check < kSpinChecks && !input.pop(block); check++) {
+        }
+        if (block == kNoBlock) {
+            if (!_running.load(std::memory_order_acquire)) {
+                return;
+            }
+            _wake[stage].wait();
+            continue;
+        }
+        auto start = std::chrono::steady_clock::now();
+        _blockFlags[block] |= _callback(_refCon, stage, &_channels[(size_t)block * _config.channels], _config.channels, _config.blockFrames);
+        auto busy = std::chrono::steady_clock::now() - start;
+        _busyNanos[stage].fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(busy).count(), std::memory_order_relaxed);
+        _stageBlocks[stage].fetch_add(1, std::memory_order_relaxed);
+        if (stage == 0) {
+            _renderedFrames.fetch_add(_config.blockFrames, std::memory_order_release);
+        }
+        //Every queue holds all blocks, so a push can't fail
+        output.push(block);
+        if (last) {
+            _inFlight.fetch_sub(1, std::memory_order_release);
+        }
+        else {
+            _wake[stage + 1].signal();
+        }
+    }
+}
+
+#pragma mark Render thread
+
+void CPRenderPipeline::submitIdle() {
+    while (!_idle.empty()) {
+        uint32_t block = _idle.back();
+        _idle.pop_back();
+        _blockFlags[block] = 0;
+        _inFlight.fetch_add(1, std::memory_order_relaxed);
+        _queues[0].push(block);
+        _wake[0].signal();
+    }
+}
+
+uint32_t CPRenderPipeline::pull(float *const *channels, uint32_t numChannels, uint32_t frames) {
+    submitIdle();
+    uint32_t flags = 0;
+    uint32_t written = 0;
+    while (written < frames) {
+        if (_current == kNoBlock) {
+            if (!_queues[_config.stages].pop(_current)) {
+                break;
+            }
+            _offset = 0;
+        }
+        uint32_t chunk = std::min(frames - written, _config.blockFrames - _offset);
+        float *const *block = &_channels[(size_t)_current * _config.channels];
+        for (uint32_t channel = 0; channel < numChannels; channel++) {
+            if (channel < _config.channels) {
+                memcpy(channels[channel] + written, block[channel] + _offset, chunk * sizeof(float));
+            }
+            else {
+                memset(channels[channel] + written, 0, chunk * sizeof(float));
+            }
+        }
+        flags |= _blockFlags[_current];
+        _offset += chunk;
+        written += chunk;
+        if (_offset == _config.blockFrames) {
+            _idle.push_back(_current);
+            _current = kNoBlock;
+            _playedBlocks.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    _playedFrames.fetch_add(written, std::memory_order_release);
+    if (written < frames) {
+        for (uint32_t channel = 0; channel < numChannels; channel++) {
+            memset(channels[channel] + written, 0, (frames - written) * sizeof(float));
+        }
+        //Before the first block is through, the silence is warm-up, not an underrun. The engine
+        //pulls a callback in several blocks, and a stall spans callbacks: count each run of them once.
+        if (_primed && !_starved) {
+            _underruns.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    _starved = written < frames;
+    _primed = _primed || written > 0;
+    submitIdle();
+    return flags;
+}
@@ -0,0 +1,176 @@
+//
+//  CPRoomDelay.cpp
+//  CPAudioEngine
+//
+//  Modulated fractional delay with damped feedback, the native replacement of the Delay unit
+//
+
+#include "include/CPRoomDelay.hpp"
+#include <algorithm>
+#include <cmath>
+
+//Time constant of the delay time, feedback and mix glides
+static const double kGlideSeconds = 0.1;
+//Fastest the delay time glides, in samples per sample: echoes bend by at most 10% in pitch
+static const float kMaxDelaySlew = 0.1f;
+static const float kMaxFeedback = 0.98f;
+//Lagrange taps reach one sample closer than the delay, which must not be the one being written
+static const float kMinDelaySamples = 2.0f;
+
+CPRoomDelay::CPRoomDelay(double sampleRate, float maxDelaySeconds, uint32_t channels)
+: _sampleRate(sampleRate),
+  _maxDelaySeconds(std::max(maxDelaySeconds, 0.0f)),
+  _channels(std::min(std::max(channels, 1u), kCPRoomDelayMaxChannels)),
+  _dampingFrequency(0.0f),
+  _delayTime(0.0f),
+  _feedback(0.5f),
+  _damping(0.0f),
+  _wet(0.0f),
+  _modulationDepth(0.0f),
+  _modulationRate(0.0f),
+  _write(0),
+  _minDelay(kMinDelaySamples),
+  _smoothing((float)(1.0 - std::exp(-1.0 / (kGlideSeconds * sampleRate)))),
+  _chunkRetain((float)std::exp(-(double)kChunkFrames / (kGlideSeconds * sampleRate))),
+  _currentDelay(kMinDelaySamples),
+  _currentFeedback(0.5f),
+  _currentWet(0.0f),
+  _lfoCos(1.0f),
+  _lfoSin(0.0f),
+  _started(false)
+{
+    //Longest delay, deepest modulation and the taps beyond the read position, rounded up to a power of two
+    _maxDelay = std::max((float)(_maxDelaySeconds * sampleRate), kMinDelaySamples);
+    uint32_t reach = (uint32_t)std::ceil(_maxDelay + kCPRoomDelayMaxModulationSeconds * sampleRate) + 4;
+    uint32_t size = 1;
+    while (size < reach) {
+        size *= 2;
+    }
+    _ringMask = size - 1;
+    _ring.assign((size_t)size * _channels, 0.0f);
+    std::fill(_damped, _damped + kCPRoomDelayMaxChannels, 0.0f);
+    setDampingFrequency(15000.0f);
+}
+
+#pragma mark Control thread
+
+void CPRoomDelay::setDelayTime(float seconds) {
+    _delayTime.store(std::min(std::max(seconds, 0.0f), _maxDelaySeconds), std::memory_order_relaxed);
+}
+
+void CPRoomDelay::setFeedback(float feedback) {
+    _feedback.store(std::min(std::max(feedback, 0.0f), kMaxFeedback), std::memory_order_relaxed);
+}
+
+void CPRoomDelay::setDampingFrequency(float hertz) {
+    _dampingFrequency = std::max(hertz, 10.0f);
+    //At or above Nyquist the feedback path is left unfiltered
+    double damping = _dampingFrequency >= _sampleRate * 0.5 ? 0.0 : std::exp(-2.0 * M_PI * _dampingFrequency / _sampleRate);
+    _damping.store((float)damping, std::memory_order_relaxed);
+}
+
+void CPRoomDelay::setWetDryMix(float mix) {
+    _wet.store(std::min(std::max(mix, 0.0f), 1.0f), std::memory_order_relaxed);
+}
+
+void CPRoomDelay::setModulation(float depthSeconds, float rateHertz) {
+    float depth = std::min(std::max(depthSeconds, 0.0f), kCPRoomDelayMaxModulationSeconds);
+    _modulationDepth.store((float)(depth * _sampleRate), std::memory_order_relaxed);
+    float rate = std::min(std::max(rateHertz, 0.0f), kCPRoomDelayMaxModulationHertz);
+    _modulationRate.store((float)(2.0 * M_PI * rate / _sampleRate), std::memory_order_relaxed);
+}
+
+#pragma mark Render thread
+
+void CPRoomDelay::reset() {
+    std::fill(_ring.begin(), _ring.end(), 0.0f);
+    std::fill(_damped, _damped + kCPRoomDelayMaxChannels, 0.0f);
+    _started = false;
+}
+
+void CPRoomDelay::process(float *const *channels, uint32_t numChannels, uint32_t frames) {
+    numChannels = std::min(numChannels, _channels);
+    const float targetDelay = std::min(std::max(_delayTime.load(std::memory_order_relaxed) * (float)_sampleRate, _minDelay), _maxDelay);
+    const float targetFeedback = _feedback.load(std::memory_order_relaxed);
+    const float targetWet = _wet.load(std::memory_order_relaxed);
+    const float damping = _damping.load(std::memory_order_relaxed);
+    const float undamped = 1.0f - damping;
+    const float depth = _modulationDepth.load(std::memory_order_relaxed);
+    const float rate = _modulationRate.load(std::memory_order_relaxed);
+    const float chunkCos = std::cos(rate * kChunkFrames), chunkSin = std::sin(rate * kChunkFrames);
+    const uint32_t ringSize = _ringMask + 1;
+    if (!_started) {
+        //Settings made before the first block apply from its first sample, without a glide
+        _currentDelay = targetDelay;
+        _currentFeedback = targetFeedback;
+        _currentWet = targetWet;
+        _started = true;
+    }
+
+    //The glides and the modulation are worked out at the ends of each chunk and ramp linearly in
+    //between, which is smooth at these rates and keeps the per-sample work free of serial chains.
+    //Read positions and gains are the same on every channel, so they are worked out once per chunk.
+    int32_t taps[kChunkFrames];
+    float h0[kChunkFrames], h1[kChunkFrames], h2[kChunkFrames], h3[kChunkFrames];
+    float feedback[kChunkFrames], wet[kChunkFrames];
+    for (uint32_t done = 0; done < frames; ) {
+        uint32_t chunk = std::min(frames - done, kChunkFrames);
+        bool full = chunk == kChunkFrames;
+        float retain = full ? _chunkRetain : std::pow(1.0f - _smoothing, (float)chunk);
+        float rotateCos = full ? chunkCos : std::cos(rate * chunk);
+        float rotateSin = full ? chunkSin : std::sin(rate * chunk);
+        float startDelay = std::max(_currentDelay + depth * _lfoSin, _minDelay);
+        float startFeedback = _currentFeedback, startWet = _currentWet;
+        float glide = (targetDelay - _currentDelay) * (1.0f - retain);
+        float slew = kMaxDelaySlew * (float)chunk;
+        _currentDelay += std::min(std::max(glide, -slew), slew);
+        _currentFeedback = targetFeedback + (_currentFeedback - targetFeedback) * retain;
+        _currentWet = targetWet + (_currentWet - targetWet) * retain;
+        float lfoCos = _lfoCos * rotateCos - _lfoSin * rotateSin;
+        _lfoSin = _lfoSin * rotateCos + _lfoCos * rotateSin;
+        _lfoCos = lfoCos;
+        float endDelay = std::max(_currentDelay + depth * _lfoSin, _minDelay);
+        float delayStep = (endDelay - startDelay) / (float)chunk;
+        float feedbackStep = (_currentFeedback - startFeedback) / (float)chunk;
+        float wetStep = (_currentWet - startWet) / (float)chunk;
+
+        //Always a whole chunk: a fixed trip count lets the compiler vectorize it
+        const int32_t write = (int32_t)(_write + ringSize + 1);
+        for (uint32_t i = 0; i < kChunkFrames; i++) {
+            float position = (float)(i + 1);
+            float delay = startDelay + position * delayStep;
+            int32_t whole = (int32_t)delay;
+            float f = delay - (float)whole;
+            //Third order Lagrange through the samples whole - 1 ... whole + 2 back, at whole + f
+            taps[i] = (write + (int32_t)i - whole) & (int32_t)_ringMask;
+            h0[i] = -f * (f - 1.0f) * (f - 2.0f) * (1.0f / 6.0f);
+            h1[i] = (f + 1.0f) * (f - 1.0f) * (f - 2.0f) * 0.5f;
+            h2[i] = -(f + 1.0f) * f * (f - 2.0f) * 0.5f;
+            h3[i] = (f + 1.0f) * f * (f - 1.0f) * (1.0f / 6.0f);
+            feedback[i] = startFeedback + position * feedbackStep;
+            wet[i] = startWet + position * wetStep;
+        }
+        for (uint32_t channel = 0; channel < numChannels; channel++) {
+            float *ring = &_ring[(size_t)channel * ringSize];
+            float *samples = channels[channel] + done;
+            float damped = _damped[channel];
+            for (uint32_t i = 0; i < chunk; i++) {
+                uint32_t tap = (uint32_t)taps[i];
+                float delayed = h0[i] * ring[tap] + h1[i] * ring[(tap - 1) & _ringMask] +
+                                h2[i] * ring[(tap - 2) & _ringMask] + h3[i] * ring[(tap - 3) & _ringMask];
+                //Only one multiply-add on the recursive path
+                damped = damping * damped + undamped * delayed;
+                float dry = samples[i];
+                ring[(_write + i) & _ringMask] = dry + feedback[i] * damped;
+                samples[i] = dry + wet[i] * (delayed - dry);
+            }
+            _damped[channel] = damped;
+        }
+        _write = (_write + chunk) & _ringMask;
+        done += chunk;
+    }
+    //Keep the phasor on the unit circle; rounding would otherwise let its amplitude drift
+    float norm = 1.0f / std::sqrt(_lfoCos * _lfoCos + _lfoSin * _lfoSin);
+    _lfoCos *= norm;
+    _lfoSin *= norm;
+}
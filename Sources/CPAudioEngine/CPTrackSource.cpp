@@ -0,0 +1,475 @@
+//
+//  CPTrackSource.cpp
+//  CPAudioEngine
+//
+//  Persistent source stage: tracks are attached to preallocated decks and crossfaded in
+//
+
+#include "include/CPTrackSource.hpp"
+#include <algorithm>
+#include <cmath>
+#include "include/CPAllocationCount.hpp"
+
+//Length of the crossfade between the outgoing and incoming track
+static const double kSwitchFadeSeconds = 0.010;
+//Longest the batched loader sleeps, so a deck that starts loading on its own is not left waiting
+static const double kBatchedMaxWaitSeconds = 1.0;
+
+//Largest power of two not above `frames`
+static uint32_t floorPowerOfTwo(size_t frames) {
+    uint32_t capacity = 1;
+    while ((size_t)capacity * 2 <= frames) {
+        capacity *= 2;
+    }
+    return capacity;
+}
+
+CPTrackSource::CPTrackSource(double sampleRate, CPMatrixMixer &mixer, uint32_t ringFrames)
+: _sampleRate(sampleRate),
+  _mixer(mixer),
+  _channels(mixer.outChannels()),
+  _deckSamples((size_t)2 * ringFrames),
+  _fadeFrames(std::max<uint32_t>(1, (uint32_t)(sampleRate * kSwitchFadeSeconds))),
+  _arena((size_t)kDecks * 2 * ringFrames),
+  _quit(false),
+  _rendering(false),
+  _loaderInterval(20),
+  _readAhead(CPReadAheadEager),
+  _primeFrames(kPrimeFrames),
+  _currentDeck(kNoDeck),
+  _currentLength(0),
+  _allocations(0),
+  _allocationsLastSwitch(0),
+  _trackEndGeneration(0),
+  _trackEndCallback(nullptr),
+  _trackEndRefCon(nullptr),
+  _pendingDeck(kNoDeck),
+  _activeDeck(kNoDeck),
+  _writtenFrames(0),
+  _lastSwitchLatency(0),
+  _switches(0),
+  _underruns(0),
+  _loaderWakeups(0)
+{
+    for (uint32_t index = 0; index < kDecks; index++) {
+        Deck &deck = _decks[index];
+        deck.state.store(DeckIdle);
+        deck.memory = _arena.carve(_deckSamples);
+        deck.ring.attach(deck.memory, 2, ringFrames);
+        deck.endOfStream.store(false);
+        deck.startFrame = 0;
+        deck.framesRendered.store(0);
+        deck.refilling = false;
+        deck.fadePosition = 0;
+        deck.started = false;
+        deck.endReported = false;
+        deck.starved = false;
+    }
+    _loader = std::thread(&CPTrackSource::loaderMain, this);
+}
+
+CPTrackSource::~CPTrackSource() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _quit = true;
+    }
+    _wake.notify_all();
+    _loader.join();
+}
+
+#pragma mark Control thread
+
+void CPTrackSource::setTrackEndCallback(TrackEndCallback callback, void *refCon) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    //The render thread reads the pair without the lock and retries if the generation moved
+    _trackEndGeneration.fetch_add(1);
+    _trackEndCallback.store(callback);
+    _trackEndRefCon.store(refCon);
+    _trackEndGeneration.fetch_add(1);
+}
+
+void CPTrackSource::setReadAhead(CPReadAhead readAhead) {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _readAhead = readAhead;
+    }
+    //Let the loader work out its next wait under the new policy (an attach may be waiting too)
+    _wake.notify_all();
+}
+
+CPReadAhead CPTrackSource::readAhead() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _readAhead;
+}
+
+void CPTrackSource::setOutputBuffer(uint32_t periodFrames, uint32_t periods) {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        //A switch can land at the start of a refill burst, which then runs a period past it
+        _primeFrames = std::max(kPrimeFrames, std::max(periods + 1, kPrimePeriods) * periodFrames);
+    }
+    _wake.notify_all();
+}
+
+void CPTrackSource::setRendering(bool rendering) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _rendering = rendering;
+    if (!rendering) {
+        //Render callbacks have stopped: settle whatever the render thread had not picked up yet
+        int pending = _pendingDeck.exchange(kNoDeck);
+        if (pending != kNoDeck) {
+            applyLocked(pending);
+        }
+        for (uint32_t index = 0; index < kDecks; index++) {
+            if (_decks[index].state.load() == DeckFading) {
+                releaseDeckLocked((int)index);
+            }
+        }
+    }
+}
+
+bool CPTrackSource::isRendering() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _rendering;
+}
+
+int CPTrackSource::claimDeckLocked(std::unique_lock<std::mutex> &lock) {
+    for (int attempt = 0; attempt < 100; attempt++) {
+        for (uint32_t index = 0; index < kDecks; index++) {
+            uint32_t idle = DeckIdle;
+            if (_decks[index].state.compare_exchange_strong(idle, DeckLoading)) {
+                return (int)index;
+            }
+        }
+        if (!_rendering) {
+            break;
+        }
+        //Every spare deck is still fading out; that takes at most a few render cycles. The render
+        //thread cannot signal, so poll, but without holding up the loader or the other accessors.
+        _wake.wait_for(lock, std::chrono::milliseconds(1));
+    }
+    return kNoDeck;
+}
+
+void CPTrackSource::releaseDeckLocked(int deck) {
+    _decks[deck].decoder.reset();
+    _decks[deck].state.store(DeckIdle);
+}
+
+uint32_t CPTrackSource::lowWaterLocked(const Deck &deck) const {
+    //Half the ring, unless the output's buffer needs more; never more than the ring holds
+    return std::max(deck.ring.capacity() / 2, std::min(_primeFrames, deck.ring.capacity()));
+}
+
+uint32_t CPTrackSource::fillLocked(Deck &deck, uint32_t frames) {
+    uint32_t filled = 0;
+    float *channels[kCPMixerMaxChannels];
+    while (filled < frames && deck.decoder && !deck.endOfStream.load(std::memory_order_relaxed)) {
+        uint32_t region = deck.ring.writeRegion(channels, frames - filled);
+        if (region == 0) {
+            break;
+        }
+        uint32_t read = deck.decoder->read(channels, region);
+        if (read == 0) {
+            deck.endOfStream.store(true, std::memory_order_release);
+            break;
+        }
+        deck.ring.commitWrite(read);
+        filled += read;
+    }
+    return filled;
+}
+
+void CPTrackSource::applyLocked(int deck) {
+    //Only called while no render callback can run
+    if (_activeDeck >= 0) {
+        releaseDeckLocked(_activeDeck);
+    }
+    _activeDeck = deck == kDetach ? kNoDeck : deck;
+    if (_activeDeck >= 0) {
+        Deck &active = _decks[_activeDeck];
+        active.fadePosition = _fadeFrames;
+        //Switch latency is only sampled for switches made while rendering
+        active.started = true;
+        active.endReported = false;
+        active.starved = false;
+        active.state.store(DeckActive);
+    }
+}
+
+void CPTrackSource::publishLocked(int deck) {
+    if (!_rendering) {
+        applyLocked(deck);
+        return;
+    }
+    int replaced = _pendingDeck.exchange(deck, std::memory_order_acq_rel);
+    if (replaced >= 0) {
+        //Superseded before the render thread ever saw it
+        releaseDeckLocked(replaced);
+    }
+}
+
+bool CPTrackSource::attachLocked(std::unique_lock<std::mutex> &lock, std::unique_ptr<CPAudioDecoder> &decoder, int64_t startFrame) {
+    int index = claimDeckLocked(lock);
+    if (index == kNoDeck) {
+        return false;
+    }
+    Deck &deck = _decks[index];
+    deck.requestTime = std::chrono::steady_clock::now();
+    if (startFrame > 0 && !decoder->seek(startFrame)) {
+        startFrame = 0;
+    }
+    deck.decoder = std::move(decoder);
+    //Same memory for any channel count, wider tracks just buffer fewer frames
+    uint32_t trackChannels = deck.decoder->channels();
+    deck.ring.attach(deck.memory, trackChannels, floorPowerOfTwo(_deckSamples / trackChannels));
+    deck.endOfStream.store(false);
+    deck.startFrame = startFrame;
+    deck.framesRendered.store(0);
+    //Decode enough up front that the render callbacks right after the switch never outrun the loader
+    fillLocked(deck, _primeFrames);
+    _currentDeck = index;
+    _currentLength = deck.decoder->lengthFrames();
+    publishLocked(index);
+    return true;
+}
+
+void CPTrackSource::countSwitchAllocationsLocked() {
+    //Everything counted on this thread since its previous switch: the decoder was opened just before
+    _allocationsLastSwitch = CPTakeAllocations();
+    _allocations += _allocationsLastSwitch;
+}
+
+bool CPTrackSource::attach(std::unique_ptr<CPAudioDecoder> decoder, int64_t startFrame) {
+    if (!decoder || decoder->channels() == 0 || decoder->channels() > kCPMixerMaxChannels || decoder->sampleRate() != _sampleRate) {
+        return false;
+    }
+    bool attached;
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        attached = attachLocked(lock, decoder, startFrame);
+        countSwitchAllocationsLocked();
+    }
+    _wake.notify_one();
+    return attached;
+}
+
+void CPTrackSource::detach() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _currentDeck = kNoDeck;
+    _currentLength = 0;
+    publishLocked(kDetach);
+}
+
+bool CPTrackSource::seek(int64_t frame) {
+    bool attached;
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        int current = _currentDeck;
+        if (current < 0 || !_decks[current].decoder) {
+            return false;
+        }
+        //The outgoing deck keeps its buffered frames for the fade, it no longer needs the decoder
+        std::unique_ptr<CPAudioDecoder> decoder = std::move(_decks[current].decoder);
+        attached = attachLocked(lock, decoder, frame);
+        //Claiming a deck may have dropped the lock; only hand the decoder back if nothing moved on
+        if (!attached && _currentDeck == current && !_decks[current].decoder) {
+            _decks[current].decoder = std::move(decoder);
+        }
+        countSwitchAllocationsLocked();
+    }
+    _wake.notify_one();
+    return attached;
+}
+
+uint32_t CPTrackSource::trackChannels() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _currentDeck < 0 ? 0 : _decks[_currentDeck].ring.channels();
+}
+
+int64_t CPTrackSource::position() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_currentDeck < 0) {
+        return 0;
+    }
+    const Deck &deck = _decks[_currentDeck];
+    return deck.startFrame + deck.framesRendered.load(std::memory_order_relaxed);
+}
+
+CPTrackSourceStats CPTrackSource::stats() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    CPTrackSourceStats stats;
+    stats.lastSwitchLatency = (double)_lastSwitchLatency.load() / 1e9;
+    stats.switches = _switches.load();
+    stats.allocations = _allocations;
+    stats.allocationsLastSwitch = _allocationsLastSwitch;
+    stats.underruns = _underruns.load();
+    stats.loaderWakeups = _loaderWakeups.load();
+    return stats;
+}
+
+void CPTrackSource::loaderMain() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (!_quit) {
+        //Top up in chunks and drop the lock in between so attach() never waits on a long decode
+        bool batched = _readAhead == CPReadAheadBatched;
+        bool more = false;
+        for (uint32_t index = 0; index < kDecks; index++) {
+            Deck &deck = _decks[index];
+            uint32_t state = deck.state.load();
+            if (state == DeckLoading || state == DeckActive) {
+                //Batched, a deck is left alone until it drains to its low water mark, then filled right up
+                if (batched && !deck.refilling && deck.ring.readable() > lowWaterLocked(deck)) {
+                    continue;
+                }
+                deck.refilling = fillLocked(deck, kLoaderChunkFrames) == kLoaderChunkFrames;
+                more = more || deck.refilling;
+            }
+        }
+        if (more) {
+            lock.unlock();
+            std::this_thread::yield();
+            lock.lock();
+            continue;
+        }
+        std::chrono::duration<double> wait = _loaderInterval;
+        if (batched) {
+            //Until the first ring that is still being read drains to its low water mark
+            double seconds = kBatchedMaxWaitSeconds;
+            for (uint32_t index = 0; index < kDecks; index++) {
+                Deck &deck = _decks[index];
+                uint32_t state = deck.state.load();
+                if ((state == DeckLoading || state == DeckActive) && !deck.endOfStream.load()) {
+                    int64_t spare = (int64_t)deck.ring.readable() - (int64_t)lowWaterLocked(deck);
+                    seconds = std::min(seconds, (double)spare / _sampleRate);
+                }
+            }
+            wait = std::max(wait, std::chrono::duration<double>(seconds));
+        }
+        _wake.wait_for(lock, wait);
+        _loaderWakeups.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+#pragma mark Render thread
+
+uint32_t CPTrackSource::mixDeck(Deck &deck, float *const *out, uint32_t offset, uint32_t frames, float gain, float gainStep) {
+    //The ring may wrap, so this takes up to two contiguous runs
+    const float *in[kCPMixerMaxChannels];
+    float *shifted[kCPMixerMaxChannels];
+    uint32_t done = 0;
+    while (done < frames) {
+        uint32_t run = deck.ring.readRegion(in, frames - done);
+        if (run == 0) {
+            break;
+        }
+        uint32_t start = offset + done;
+        for (uint32_t channel = 0; channel < _channels; channel++) {
+            shifted[channel] = out[channel] + start;
+        }
+        uint32_t accumulate = _writtenFrames > start ? _writtenFrames - start : 0;
+        _mixer.mix(in, deck.ring.channels(), shifted, start, run, gain + gainStep * (float)done, gainStep, accumulate);
+        deck.ring.commitRead(run);
+        done += run;
+    }
+    _writtenFrames = std::max(_writtenFrames, offset + done);
+    return done;
+}
+
+uint32_t CPTrackSource::renderDeck(Deck &deck, float *const *out, uint32_t frames, bool fadeIn) {
+    uint32_t done = 0;
+    uint32_t fadeRemaining = _fadeFrames - std::min(deck.fadePosition, _fadeFrames);
+    if (fadeRemaining > 0) {
+        float step = 1.0f / (float)_fadeFrames;
+        float progress = (float)deck.fadePosition * step;
+        uint32_t ramp = std::min(frames, fadeRemaining);
+        done = fadeIn ? mixDeck(deck, out, 0, ramp, progress, step)
+                      : mixDeck(deck, out, 0, ramp, 1.0f - progress, -step);
+        deck.fadePosition += done;
+    }
+    if (fadeIn && done < frames && deck.fadePosition >= _fadeFrames) {
+        done += mixDeck(deck, out, done, frames - done, 1.0f, 0.0f);
+    }
+
+    if (!fadeIn) {
+        if (deck.fadePosition >= _fadeFrames || deck.ring.readable() == 0) {
+            deck.state.store(DeckIdle, std::memory_order_release);
+        }
+        return 0;
+    }
+    if (done > 0 && !deck.started) {
+        deck.started = true;
+        _lastSwitchLatency.store(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - deck.requestTime).count());
+        _switches.fetch_add(1, std::memory_order_relaxed);
+    }
+    deck.framesRendered.store(deck.framesRendered.load(std::memory_order_relaxed) + done, std::memory_order_relaxed);
+    //A shortfall that lasts several blocks is one underrun. Only the active deck gets here: a fading
+    //deck running dry is the end of its fade, not an underrun.
+    bool starved = done < frames && !deck.endOfStream.load(std::memory_order_acquire);
+    if (starved && !deck.starved) {
+        _underruns.fetch_add(1, std::memory_order_relaxed);
+    }
+    deck.starved = starved;
+    if (done < frames && !starved && deck.ring.readable() == 0 && !deck.endReported) {
+        deck.endReported = reportTrackEnd();
+    }
+    return done;
+}
+
+bool CPTrackSource::reportTrackEnd() {
+    uint32_t generation = _trackEndGeneration.load();
+    TrackEndCallback callback = _trackEndCallback.load();
+    void *refCon = _trackEndRefCon.load();
+    if ((generation & 1) != 0 || _trackEndGeneration.load() != generation) {
+        //Caught setTrackEndCallback() halfway, try again next block
+        return false;
+    }
+    if (callback != nullptr) {
+        callback(refCon);
+    }
+    return true;
+}
+
+uint32_t CPTrackSource::render(float *const *out, uint32_t channels, uint32_t frames) {
+    //Decks overwrite the block where nothing has been written yet, so a single deck costs one pass
+    _mixer.beginBlock(frames);
+    _writtenFrames = 0;
+
+    if (_pendingDeck.load(std::memory_order_relaxed) != kNoDeck) {
+        int pending = _pendingDeck.exchange(kNoDeck, std::memory_order_acq_rel);
+        if (pending != kNoDeck) {
+            if (_activeDeck >= 0) {
+                Deck &outgoing = _decks[_activeDeck];
+                outgoing.fadePosition = 0;
+                outgoing.state.store(DeckFading, std::memory_order_release);
+            }
+            _activeDeck = pending == kDetach ? kNoDeck : pending;
+            if (_activeDeck >= 0) {
+                Deck &incoming = _decks[_activeDeck];
+                incoming.fadePosition = 0;
+                incoming.started = false;
+                incoming.endReported = false;
+                incoming.starved = false;
+                incoming.state.store(DeckActive, std::memory_order_release);
+            }
+        }
+    }
+
+    uint32_t rendered = 0;
+    if (channels == _channels) {
+        for (uint32_t index = 0; index < kDecks; index++) {
+            Deck &deck = _decks[index];
+            uint32_t state = deck.state.load(std::memory_order_acquire);
+            if (state == DeckActive && (int)index == _activeDeck) {
+                rendered = renderDeck(deck, out, frames, true);
+            }
+            else if (state == DeckFading) {
+                renderDeck(deck, out, frames, false);
+            }
+        }
+    }
+    for (uint32_t channel = 0; channel < channels; channel++) {
+        memset(out[channel] + _writtenFrames, 0, (frames - _writtenFrames) * sizeof(float));
+    }
+    return rendered;
+}
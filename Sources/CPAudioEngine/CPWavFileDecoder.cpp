@@ -0,0 +1,161 @@
+//
+//  CPWavFileDecoder.cpp
+//  CPAudioEngine
+//
+//  Portable WAV reader, so the engine can play files where ExtAudioFile is not available
+//
+
+#include "include/CPWavFileDecoder.hpp"
+#include <algorithm>
+#include <cstring>
+#include "include/CPAllocationCount.hpp"
+
+static const uint16_t kFormatPCM = 1;
+static const uint16_t kFormatFloat = 3;
+static const uint16_t kFormatExtensible = 0xfffe;
+static const uint32_t kMaxChannels = 8;
+
+static uint32_t readLE(const uint8_t *bytes, uint32_t count) {
+    uint32_t value = 0;
+    for (uint32_t byte = 0; byte < count; byte++) {
+        value |= (uint32_t)bytes[byte] << (8 * byte);
+    }
+    return value;
+}
+
+std::unique_ptr<CPAudioDecoder> CPWavFileDecoder::open(const std::string &path) {
+    std::FILE *file = std::fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        return nullptr;
+    }
+    uint8_t header[12];
+    if (std::fread(header, 1, 12, file) != 12 || memcmp(header, "RIFF", 4) != 0 || memcmp(header + 8, "WAVE", 4) != 0) {
+        std::fclose(file);
+        return nullptr;
+    }
+
+    uint16_t format = 0;
+    uint32_t channels = 0, sampleRate = 0, bitsPerSample = 0;
+    bool haveFormat = false;
+    //Walk the chunks up to "data"; anything else (LIST, fact, ...) is skipped
+    uint8_t chunk[8];
+    while (std::fread(chunk, 1, 8, file) == 8) {
+        uint32_t size = readLE(chunk + 4, 4);
+        if (memcmp(chunk, "fmt ", 4) == 0 && size >= 16) {
+            uint8_t fmt[40] = {};
+            uint32_t length = std::min<uint32_t>(size, sizeof(fmt));
+            if (std::fread(fmt, 1, length, file) != length) {
+                break;
+            }
+            format = (uint16_t)readLE(fmt, 2);
+            channels = readLE(fmt + 2, 2);
+            sampleRate = readLE(fmt + 4, 4);
+            bitsPerSample = readLE(fmt + 14, 2);
+            if (format == kFormatExtensible && length >= 26) {
+                //Sub format GUID starts with the plain format tag
+                format = (uint16_t)readLE(fmt + 24, 2);
+            }
+            haveFormat = true;
+            std::fseek(file, (long)(size - length + (size & 1)), SEEK_CUR);
+        }
+        else if (memcmp(chunk, "data", 4) == 0) {
+            bool supported = haveFormat && channels >= 1 && channels <= kMaxChannels && sampleRate > 0 &&
+                ((format == kFormatPCM && (bitsPerSample == 16 || bitsPerSample == 24 || bitsPerSample == 32)) ||
+                 (format == kFormatFloat && bitsPerSample == 32));
+            if (!supported) {
+                break;
+            }
+            uint32_t sampleBytes = bitsPerSample / 8;
+            long dataOffset = std::ftell(file);
+            //Streamed files can carry a placeholder size; trust the file length then
+            std::fseek(file, 0, SEEK_END);
+            int64_t available = (int64_t)std::ftell(file) - dataOffset;
+            int64_t dataBytes = size == 0 || size == 0xffffffffu ? available : std::min<int64_t>(size, available);
+            int64_t lengthFrames = dataBytes / (sampleBytes * channels);
+            std::fseek(file, dataOffset, SEEK_SET);
+            CPCountAllocations();
+            return std::unique_ptr<CPAudioDecoder>(new CPWavFileDecoder(file, channels, sampleRate, sampleBytes,
+                                                                        format == kFormatFloat, dataOffset, lengthFrames));
+        }
+        else {
+            std::fseek(file, (long)(size + (size & 1)), SEEK_CUR);
+        }
+    }
+    std::fclose(file);
+    return nullptr;
+}
+
+CPWavFileDecoder::CPWavFileDecoder(std::FILE *file, uint32_t channels, double sampleRate, uint32_t sampleBytes, bool isFloat,
+                                   long dataOffset, int64_t lengthFrames)
+: _file(file),
+  _channels(channels),
+  _sampleRate(sampleRate),
+  _sampleBytes(sampleBytes),
+  _isFloat(isFloat),
+  _dataOffset(dataOffset),
+  _lengthFrames(lengthFrames),
+  _position(0),
+  _kernels(CPKernels())
+{
+}
+
+CPWavFileDecoder::~CPWavFileDecoder() {
+    std::fclose(_file);
+}
+
+uint32_t CPWavFileDecoder::read(float *const *channels, uint32_t frames) {
+    frames = (uint32_t)std::min<int64_t>(frames, _lengthFrames - _position);
+    size_t frameBytes = (size_t)_sampleBytes * _channels;
+    if (_block.size() < frames * frameBytes) {
+        CPCountAllocations();
+        _block.resize(frames * frameBytes);
+    }
+    frames = (uint32_t)std::fread(_block.data(), frameBytes, frames, _file);
+    const uint8_t *in = _block.data();
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    //The common formats are host order already and go through the conversion kernels
+    if (_isFloat || _sampleBytes == 2) {
+        if (_isFloat) {
+            _kernels.deinterleaveFloat((const float *)in, channels, _channels, frames);
+        }
+        else {
+            _kernels.deinterleaveInt16((const int16_t *)in, channels, _channels, frames);
+        }
+        _position += frames;
+        return frames;
+    }
+#endif
+    for (uint32_t frame = 0; frame < frames; frame++) {
+        for (uint32_t channel = 0; channel < _channels; channel++) {
+            float sample;
+            if (_isFloat) {
+                memcpy(&sample, in, sizeof(float));
+            }
+            else if (_sampleBytes == 2) {
+                sample = (float)(int16_t)readLE(in, 2) * (1.0f / 32768.0f);
+            }
+            else if (_sampleBytes == 3) {
+                //Sign extend from the top of a 32 bit word
+                sample = (float)((int32_t)(readLE(in, 3) << 8) >> 8) * (1.0f / 8388608.0f);
+            }
+            else {
+                sample = (float)((double)(int32_t)readLE(in, 4) * (1.0 / 2147483648.0));
+            }
+            channels[channel][frame] = sample;
+            in += _sampleBytes;
+        }
+    }
+    _position += frames;
+    return frames;
+}
+
+bool CPWavFileDecoder::seek(int64_t frame) {
+    if (frame < 0 || frame > _lengthFrames) {
+        return false;
+    }
+    if (std::fseek(_file, _dataOffset + (long)(frame * _sampleBytes * _channels), SEEK_SET) != 0) {
+        return false;
+    }
+    _position = frame;
+    return true;
+}
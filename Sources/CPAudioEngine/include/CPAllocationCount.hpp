@@ -0,0 +1,36 @@
+//
+//  CPAllocationCount.hpp
+//  CPAudioEngine
+//
+//  Per thread count of the allocations a track switch makes
+//
+
+#ifndef CPAllocationCount_hpp
+#define CPAllocationCount_hpp
+
+#include <cstdint>
+
+/**
+ Decoders, their buffers and cache captures count what they allocate where they allocate it.
+ Opening a track and attaching it happen on the same (control) thread, so the source takes the
+ count when a switch ends and reports it as the cost of that switch. Allocations on other threads
+ (the loader growing a capture, a prefetch queue) are never taken by a switch.
+ Inline rather than static, so every translation unit shares the one counter.
+ */
+inline uint64_t &CPThreadAllocations() {
+    static thread_local uint64_t count = 0;
+    return count;
+}
+
+inline void CPCountAllocations(uint64_t count = 1) {
+    CPThreadAllocations() += count;
+}
+
+/// Allocations counted on this thread since the previous call.
+inline uint64_t CPTakeAllocations() {
+    uint64_t count = CPThreadAllocations();
+    CPThreadAllocations() = 0;
+    return count;
+}
+
+#endif /* CPAllocationCount_hpp */
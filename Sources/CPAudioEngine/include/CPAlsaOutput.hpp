@@ -0,0 +1,52 @@
+//
+//  CPAlsaOutput.hpp
+//  CPAudioEngine
+//
+//  ALSA playback backend for Linux builds (CP_HAS_ALSA)
+//
+
+#ifndef CPAlsaOutput_hpp
+#define CPAlsaOutput_hpp
+
+#if CP_HAS_ALSA
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include "CPOutputDevice.hpp"
+
+typedef struct _snd_pcm snd_pcm_t;
+
+/**
+ Blocking writes from a render thread of our own. The period and buffer sizes are negotiated with
+ the device, config() reports what it granted. Latency is the device's delay (snd_pcm_delay) at the
+ time each period is queued; underruns are recovered from and counted as xruns.
+ */
+class CPAlsaOutput : public CPOutputDevice {
+public:
+    CPAlsaOutput(const std::string &device = "default");
+    ~CPAlsaOutput() override;
+
+    bool open(const CPOutputConfig &config) override;
+    bool start() override;
+    void stop() override;
+    void close() override;
+    bool isRunning() const override { return _running.load(); }
+
+private:
+    void renderMain();
+
+    std::string _device;
+    snd_pcm_t *_pcm;
+    bool _floatSamples;             //else 16 bit, when the device has no float support
+    std::vector<float> _buffer;
+    std::vector<float *> _channels;
+    std::vector<uint8_t> _interleaved;
+    std::thread _thread;
+    std::atomic<bool> _running;
+};
+
+#endif /* CP_HAS_ALSA */
+
+#endif /* CPAlsaOutput_hpp */
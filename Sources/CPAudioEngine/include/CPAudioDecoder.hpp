@@ -0,0 +1,29 @@
+//
+//  CPAudioDecoder.hpp
+//  CPAudioEngine
+//
+//  Platform decoders deliver float audio to the engine through this interface
+//
+
+#ifndef CPAudioDecoder_hpp
+#define CPAudioDecoder_hpp
+
+#include <cstdint>
+
+/**
+ Decodes a track into non-interleaved float frames at the engine sample rate.
+ Only ever used from one thread at a time (the control thread while priming, then the loader thread).
+ */
+class CPAudioDecoder {
+public:
+    virtual ~CPAudioDecoder() {}
+    virtual uint32_t channels() const = 0;
+    virtual double sampleRate() const = 0;
+    /// Length in output frames, or -1 when unknown
+    virtual int64_t lengthFrames() const = 0;
+    /// Reads up to `frames` frames. Returns the number read, 0 at the end of the track.
+    virtual uint32_t read(float *const *channels, uint32_t frames) = 0;
+    virtual bool seek(int64_t frame) = 0;
+};
+
+#endif /* CPAudioDecoder_hpp */
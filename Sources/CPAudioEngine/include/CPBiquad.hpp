@@ -0,0 +1,129 @@
+//
+//  CPBiquad.hpp
+//  CPAudioEngine
+//
+//  Second order filter sections used by the native equalizer stages
+//
+
+#ifndef CPBiquad_hpp
+#define CPBiquad_hpp
+
+#include <cmath>
+#include <cstdint>
+
+/// Normalised coefficients (a0 == 1) of one second order section.
+struct CPBiquadCoefficients {
+    float b0, b1, b2;
+    float a1, a2;
+};
+
+/// Transposed direct form II state of one section on one channel.
+struct CPBiquadState {
+    float z1, z2;
+};
+
+static inline CPBiquadCoefficients CPBiquadIdentity() {
+    return CPBiquadCoefficients { 1.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+}
+
+/// Peaking filter (RBJ cookbook), bandwidth given in octaves like kAUNBandEQParam_Bandwidth.
+static inline CPBiquadCoefficients CPBiquadPeaking(double sampleRate, double frequency, double bandwidth, double gainDb) {
+    if (gainDb == 0.0 || frequency <= 0.0 || frequency >= sampleRate * 0.5) {
+        return CPBiquadIdentity();
+    }
+    double A = std::pow(10.0, gainDb / 40.0);
+    double w0 = 2.0 * M_PI * frequency / sampleRate;
+    double sinW0 = std::sin(w0);
+    double alpha = sinW0 * std::sinh(M_LN2 / 2.0 * bandwidth * w0 / sinW0);
+    double a0 = 1.0 + alpha / A;
+    CPBiquadCoefficients c;
+    c.b0 = (float)((1.0 + alpha * A) / a0);
+    c.b1 = (float)((-2.0 * std::cos(w0)) / a0);
+    c.b2 = (float)((1.0 - alpha * A) / a0);
+    c.a1 = c.b1;
+    c.a2 = (float)((1.0 - alpha / A) / a0);
+    return c;
+}
+
+/// Low pass (RBJ cookbook). Two sections with q 0.541 and 1.307 make a 4th order Butterworth.
+static inline CPBiquadCoefficients CPBiquadLowpass(double sampleRate, double frequency, double q) {
+    if (frequency <= 0.0 || frequency >= sampleRate * 0.5) {
+        return CPBiquadIdentity();
+    }
+    double w0 = 2.0 * M_PI * frequency / sampleRate;
+    double cosW0 = std::cos(w0);
+    double alpha = std::sin(w0) / (2.0 * q);
+    double a0 = 1.0 + alpha;
+    CPBiquadCoefficients c;
+    c.b0 = (float)((1.0 - cosW0) / 2.0 / a0);
+    c.b1 = (float)((1.0 - cosW0) / a0);
+    c.b2 = c.b0;
+    c.a1 = (float)((-2.0 * cosW0) / a0);
+    c.a2 = (float)((1.0 - alpha) / a0);
+    return c;
+}
+
+//The shelves mirror the player's bass and treble units so the kernels benchmark can time shelf
+//sections; the player itself still runs the LowShelfFilter and HighShelfFilter units.
+
+/// Low shelf (RBJ cookbook, slope 1), the curve of the LowShelfFilter unit for the same cutoff and gain.
+static inline CPBiquadCoefficients CPBiquadLowShelf(double sampleRate, double frequency, double gainDb) {
+    if (gainDb == 0.0 || frequency <= 0.0 || frequency >= sampleRate * 0.5) {
+        return CPBiquadIdentity();
+    }
+    double A = std::pow(10.0, gainDb / 40.0);
+    double w0 = 2.0 * M_PI * frequency / sampleRate;
+    double cosW0 = std::cos(w0);
+    double shelf = std::sqrt(2.0 * A) * std::sin(w0);       //2 sqrt(A) alpha at slope 1
+    double a0 = (A + 1.0) + (A - 1.0) * cosW0 + shelf;
+    CPBiquadCoefficients c;
+    c.b0 = (float)(A * ((A + 1.0) - (A - 1.0) * cosW0 + shelf) / a0);
+    c.b1 = (float)(2.0 * A * ((A - 1.0) - (A + 1.0) * cosW0) / a0);
+    c.b2 = (float)(A * ((A + 1.0) - (A - 1.0) * cosW0 - shelf) / a0);
+    c.a1 = (float)(-2.0 * ((A - 1.0) + (A + 1.0) * cosW0) / a0);
+    c.a2 = (float)(((A + 1.0) + (A - 1.0) * cosW0 - shelf) / a0);
+    return c;
+}
+
+/// High shelf (RBJ cookbook, slope 1), the curve of the HighShelfFilter unit for the same cutoff and gain.
+static inline CPBiquadCoefficients CPBiquadHighShelf(double sampleRate, double frequency, double gainDb) {
+    if (gainDb == 0.0 || frequency <= 0.0 || frequency >= sampleRate * 0.5) {
+        return CPBiquadIdentity();
+    }
+    double A = std::pow(10.0, gainDb / 40.0);
+    double w0 = 2.0 * M_PI * frequency / sampleRate;
+    double cosW0 = std::cos(w0);
+    double shelf = std::sqrt(2.0 * A) * std::sin(w0);       //2 sqrt(A) alpha at slope 1
+    double a0 = (A + 1.0) - (A - 1.0) * cosW0 + shelf;
+    CPBiquadCoefficients c;
+    c.b0 = (float)(A * ((A + 1.0) + (A - 1.0) * cosW0 + shelf) / a0);
+    c.b1 = (float)(-2.0 * A * ((A - 1.0) + (A + 1.0) * cosW0) / a0);
+    c.b2 = (float)(A * ((A + 1.0) + (A - 1.0) * cosW0 - shelf) / a0);
+    c.a1 = (float)(2.0 * ((A - 1.0) - (A + 1.0) * cosW0) / a0);
+    c.a2 = (float)(((A + 1.0) - (A - 1.0) * cosW0 - shelf) / a0);
+    return c;
+}
+
+static inline float CPBiquadTick(const CPBiquadCoefficients &c, CPBiquadState &s, float x) {
+    float y = c.b0 * x + s.z1;
+    s.z1 = c.b1 * x - c.a1 * y + s.z2;
+    s.z2 = c.b2 * x - c.a2 * y;
+    return y;
+}
+
+/// Runs one section over a block. `in` and `out` may alias.
+static inline void CPBiquadProcess(const CPBiquadCoefficients &c, CPBiquadState &s, const float *in, float *out, uint32_t frames) {
+    float z1 = s.z1, z2 = s.z2;
+    const float b0 = c.b0, b1 = c.b1, b2 = c.b2, a1 = c.a1, a2 = c.a2;
+    for (uint32_t i = 0; i < frames; i++) {
+        float x = in[i];
+        float y = b0 * x + z1;
+        z1 = b1 * x - a1 * y + z2;
+        z2 = b2 * x - a2 * y;
+        out[i] = y;
+    }
+    s.z1 = z1;
+    s.z2 = z2;
+}
+
+#endif /* CPBiquad_hpp */
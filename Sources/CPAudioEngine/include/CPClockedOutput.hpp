@@ -0,0 +1,89 @@
+//
+//  CPClockedOutput.hpp
+//  CPAudioEngine
+//
+//  Backends without hardware behind them: the engine drives its own render thread
+//
+
+#ifndef CPClockedOutput_hpp
+#define CPClockedOutput_hpp
+
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+#include "CPOutputDevice.hpp"
+
+/**
+ Runs a render thread that models a device with a `periods * periodFrames` buffer: the buffer is
+ filled at start, then one period is rendered each time the virtual device has played one.
+ Latency is measured as how far the rendered audio runs ahead of the wall clock; a period that
+ renders too late to keep the buffer from draining counts as an xrun.
+ Unpaced, periods are rendered back to back as fast as the engine allows (offline bounces, benchmarks).
+ */
+class CPClockedOutput : public CPOutputDevice {
+public:
+    CPClockedOutput(bool paced);
+    ~CPClockedOutput() override;
+
+    bool open(const CPOutputConfig &config) override;
+    bool start() override;
+    void stop() override;
+    void close() override;
+    bool isRunning() const override { return _running.load(); }
+
+protected:
+    //Render thread
+    /// Receives each rendered period.
+    virtual void consume(const float *const *channels, uint32_t frames) = 0;
+
+private:
+    void renderMain();
+
+    bool _paced;
+    bool _open;
+    std::vector<float> _buffer;
+    std::vector<float *> _channels;
+    std::thread _thread;
+    std::atomic<bool> _running;
+};
+
+/// Discards the audio. Headless playback and load tests.
+class CPNullOutput : public CPClockedOutput {
+public:
+    CPNullOutput(bool paced = true) : CPClockedOutput(paced) {}
+    //Stop the render thread before consume() goes away
+    ~CPNullOutput() override { stop(); }
+
+protected:
+    void consume(const float *const *, uint32_t) override {}
+};
+
+/// Writes the audio to a WAV file, 32 bit float or 16 bit PCM. Unpaced by default: an offline bounce.
+class CPWavFileOutput : public CPClockedOutput {
+public:
+    enum Encoding { EncodingFloat32, EncodingPCM16 };
+
+    CPWavFileOutput(const std::string &path, Encoding encoding = EncodingFloat32, bool paced = false);
+    ~CPWavFileOutput() override;
+
+    /// Creates the file; the header is completed on close().
+    bool open(const CPOutputConfig &config) override;
+    void close() override;
+    uint64_t framesWritten() const { return _framesWritten.load(); }
+
+protected:
+    void consume(const float *const *channels, uint32_t frames) override;
+
+private:
+    void writeHeader();
+
+    std::string _path;
+    Encoding _encoding;
+    std::FILE *_file;
+    std::vector<uint8_t> _interleaved;
+    std::atomic<uint64_t> _framesWritten;
+};
+
+#endif /* CPClockedOutput_hpp */
@@ -0,0 +1,89 @@
+//
+//  CPDecodedAudioCache.hpp
+//  CPAudioEngine
+//
+//  LRU cache of decoded tracks, held as half precision blocks
+//
+
+#ifndef CPDecodedAudioCache_hpp
+#define CPDecodedAudioCache_hpp
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "CPAudioDecoder.hpp"
+
+struct CPDecodedAudioCacheStats {
+    uint64_t hits;
+    uint64_t misses;
+    size_t bytesHeld;
+    size_t tracks;
+    double decodeSecondsSaved;      //decode time the hits would have cost
+};
+
+/**
+ Tracks are captured while they are decoded for playback (or prefetched) and kept, up to a
+ memory budget, as planar float16. A cached track opens without I/O, seeks anywhere in O(1)
+ and is expanded back to float in blocks as the source stage reads it.
+ Decoders handed out by the cache must not outlive it.
+ */
+class CPDecodedAudioCache {
+public:
+    CPDecodedAudioCache(size_t budgetBytes);
+
+    /// Evicts least recently used tracks until the cache fits the new budget.
+    void setBudget(size_t budgetBytes);
+    size_t budget() const;
+
+    /// A decoder reading the cached track, or nullptr (counted as a miss) if `key` is not held
+    /// at `sampleRate`. The track keeps the channel count it was captured with.
+    std::unique_ptr<CPAudioDecoder> open(const std::string &key, double sampleRate);
+    /// Wraps a freshly opened decoder so the track is captured as it is read from the start.
+    /// The capture is dropped if the track is seeked or would not fit the budget.
+    std::unique_ptr<CPAudioDecoder> capture(const std::string &key, std::unique_ptr<CPAudioDecoder> decoder);
+    /// Decodes the whole track into the cache now, unless it cannot fit. Meant for a background queue.
+    bool prefetch(const std::string &key, std::unique_ptr<CPAudioDecoder> decoder);
+    bool contains(const std::string &key) const;
+    void remove(const std::string &key);
+    void clear();
+    CPDecodedAudioCacheStats stats() const;
+
+    /// Immutable once inserted; shared with the decoders reading it.
+    struct Track {
+        double sampleRate;
+        uint32_t channels;
+        int64_t lengthFrames;
+        double decodeSeconds;
+        std::vector<std::vector<uint16_t>> planes;  //one per channel, lengthFrames each
+        size_t bytes() const { return (size_t)channels * (size_t)lengthFrames * sizeof(uint16_t); }
+    };
+
+private:
+    class CaptureDecoder;
+    class CachedDecoder;
+    typedef std::list<std::string> Recency;
+    struct Entry {
+        std::shared_ptr<const Track> track;
+        Recency::iterator recency;
+    };
+
+    /// Whether a capture of the track could fit the budget at all
+    bool fitsBudget(const CPAudioDecoder &decoder) const;
+    void insert(const std::string &key, std::shared_ptr<const Track> track);
+    void evictLocked(size_t budgetBytes);
+
+    mutable std::mutex _mutex;
+    size_t _budget;
+    size_t _bytesHeld;
+    Recency _recency;                   //most recently used first
+    std::unordered_map<std::string, Entry> _entries;
+    uint64_t _hits;
+    uint64_t _misses;
+    double _decodeSecondsSaved;
+};
+
+#endif /* CPDecodedAudioCache_hpp */
@@ -0,0 +1,55 @@
+//
+//  CPDenormals.hpp
+//  CPAudioEngine
+//
+//  Flush-to-zero / denormals-are-zero for the render thread
+//
+
+#ifndef CPDenormals_hpp
+#define CPDenormals_hpp
+
+#include <cstdint>
+#if defined(__SSE__) || defined(__x86_64__)
+#include <xmmintrin.h>
+#endif
+
+/**
+ Decaying filter and delay-line state would otherwise end up in denormal range, which is many
+ times slower to process on most CPUs. Enables FTZ/DAZ for the scope of one render callback and
+ restores the host thread's mode afterwards.
+ */
+class CPScopedFlushDenormals {
+public:
+    CPScopedFlushDenormals() {
+#if defined(__aarch64__)
+        __asm__ __volatile__("mrs %0, fpcr" : "=r"(_saved));
+        //FZ: flushes both denormal inputs and results on AArch64
+        uint64_t mode = _saved | (1ULL << 24);
+        __asm__ __volatile__("msr fpcr, %0" : : "r"(mode));
+#elif defined(__SSE__) || defined(__x86_64__)
+        _saved = _mm_getcsr();
+        //FTZ (bit 15) and DAZ (bit 6)
+        _mm_setcsr(_saved | 0x8040);
+#endif
+    }
+
+    ~CPScopedFlushDenormals() {
+#if defined(__aarch64__)
+        __asm__ __volatile__("msr fpcr, %0" : : "r"(_saved));
+#elif defined(__SSE__) || defined(__x86_64__)
+        _mm_setcsr(_saved);
+#endif
+    }
+
+    CPScopedFlushDenormals(const CPScopedFlushDenormals &) = delete;
+    CPScopedFlushDenormals &operator=(const CPScopedFlushDenormals &) = delete;
+
+private:
+#if defined(__aarch64__)
+    uint64_t _saved;
+#else
+    uint32_t _saved;
+#endif
+};
+
+#endif /* CPDenormals_hpp */
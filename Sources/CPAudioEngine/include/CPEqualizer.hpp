@@ -0,0 +1,93 @@
+//
+//  CPEqualizer.hpp
+//  CPAudioEngine
+//
+//  Native band equalizer driven by precomputed, immutable coefficient banks
+//
+
+#ifndef CPEqualizer_hpp
+#define CPEqualizer_hpp
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+#include "CPBiquad.hpp"
+#include "CPKernels.hpp"
+
+static const uint32_t kCPEqualizerMaxBands = 16;
+static const uint32_t kCPEqualizerMaxChannels = 2;
+/// Length of the old/new filter crossfade applied when a bank is swapped in.
+static const uint32_t kCPEqualizerCrossfadeFrames = 64;
+
+/// A compiled preset: gains plus the matching peaking sections. Never modified while published.
+struct CPEqualizerBank {
+    uint32_t numBands;
+    bool isFlat;
+    float gains[kCPEqualizerMaxBands];
+    CPBiquadCoefficients sections[kCPEqualizerMaxBands];
+    uint32_t numActiveBands;
+    uint8_t activeBands[kCPEqualizerMaxBands];      //bands with a non-zero gain, in order
+};
+
+/**
+ Presets are compiled once into banks held in a pool that is allocated up front. Applying a
+ preset publishes the bank pointer to the render thread with a single atomic store; the render
+ thread picks it up at the next block and crossfades the old and new filter outputs.
+ Neither side allocates after construction.
+ */
+class CPEqualizer {
+public:
+    static const int kInvalidBank = -1;
+
+    CPEqualizer(const float *frequencies, uint32_t numBands, double sampleRate, uint32_t bankCapacity = 64);
+
+    //Control thread
+    /// Compiles `gains` (numBands values, dB) into a free bank. Returns kInvalidBank when the pool is full.
+    int compileBank(const float *gains);
+    /// Returns a bank to the pool. Banks still referenced by the renderer are reclaimed later.
+    void removeBank(int bank);
+    /// Publishes a compiled bank, O(1).
+    bool applyBank(int bank);
+    /// Compiles `gains` into a scratch bank and publishes it. Used for live band edits.
+    void setGains(const float *gains);
+    /// Gain of `band` in the most recently published bank.
+    float gainForBand(uint32_t band) const;
+    uint32_t numBands() const { return _numBands; }
+    double sampleRate() const { return _sampleRate; }
+
+    //Render thread
+    /// Filters non-interleaved float channels in place.
+    void process(float *const *channels, uint32_t numChannels, uint32_t frames);
+
+private:
+    enum SlotState : uint8_t { SlotFree, SlotUsed, SlotRetired };
+    static const uint32_t kScratchBanks = 5;         //pending, adopting, active and fading, plus one free
+
+    void compile(CPEqualizerBank &bank, const float *gains) const;
+    bool isReferenced(const CPEqualizerBank *bank) const;
+    void reclaimRetiredBanks();
+    void adopt(const CPEqualizerBank *bank);
+
+    const CPKernelTable &_kernels;
+    double _sampleRate;
+    uint32_t _numBands;
+    float _frequencies[kCPEqualizerMaxBands];
+    uint32_t _bankCapacity;
+    std::vector<CPEqualizerBank> _banks;    //bankCapacity preset slots followed by kScratchBanks scratch slots
+    std::vector<uint8_t> _slots;
+    uint32_t _nextScratch;
+
+    //Written by the control thread only
+    std::atomic<const CPEqualizerBank *> _pending;
+    //Written by the render thread only
+    std::atomic<const CPEqualizerBank *> _adopting;     //pending bank being taken over, see process()
+    std::atomic<const CPEqualizerBank *> _active;
+    std::atomic<const CPEqualizerBank *> _fading;
+
+    CPBiquadState _state[2][kCPEqualizerMaxChannels][kCPEqualizerMaxBands];
+    uint32_t _activeState;
+    uint32_t _fadePosition;
+    float _fadeBuffer[kCPEqualizerMaxChannels][kCPEqualizerCrossfadeFrames];
+};
+
+#endif /* CPEqualizer_hpp */
@@ -0,0 +1,48 @@
+//
+//  CPFFT.hpp
+//  CPAudioEngine
+//
+//  Power-of-two real FFT for analysis (fingerprinting), vectorised with SSE / NEON
+//
+
+#ifndef CPFFT_hpp
+#define CPFFT_hpp
+
+#include <cstdint>
+#include <vector>
+
+/**
+ Real input of `size` samples is transformed as a complex FFT of size / 2 (even samples real,
+ odd samples imaginary), then unpacked into bins 0 ... size / 2. Data is kept split
+ (separate real and imaginary arrays) so every butterfly stage from a span of 4 up runs 4 wide.
+ Twiddles and the bit reversal table are computed once; transforms do not allocate.
+ One instance per thread.
+ */
+class CPRealFFT {
+public:
+    /// `size` is a power of two, at least 8.
+    explicit CPRealFFT(uint32_t size);
+
+    uint32_t size() const { return _size; }
+    uint32_t bins() const { return _half + 1; }
+
+    /// Bins 0 ... size / 2 of `in`; `real` and `imag` hold bins() values.
+    void forward(const float *in, float *real, float *imag);
+    /// |X[k]|^2 for bins 0 ... size / 2.
+    void powerSpectrum(const float *in, float *power);
+
+private:
+    void transform(const float *in);
+
+    uint32_t _size;
+    uint32_t _half;                     //size of the complex transform
+    std::vector<uint32_t> _bitReverse;
+    std::vector<float> _twiddleReal;    //stage with span h starts at h - 1
+    std::vector<float> _twiddleImag;
+    std::vector<float> _unpackReal;     //e^(-2 pi i k / size)
+    std::vector<float> _unpackImag;
+    std::vector<float> _real;
+    std::vector<float> _imag;
+};
+
+#endif /* CPFFT_hpp */
@@ -0,0 +1,183 @@
+//
+//  CPFingerprint.hpp
+//  CPAudioEngine
+//
+//  Acoustic fingerprints for duplicate detection at import: streaming analysis, LSH index, worker pool
+//
+
+#ifndef CPFingerprint_hpp
+#define CPFingerprint_hpp
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "CPAudioDecoder.hpp"
+#include "CPBiquad.hpp"
+#include "CPFFT.hpp"
+
+/// Rate the analysis runs at; decoders can deliver it directly, anything else is resampled.
+static const double kCPFingerprintSampleRate = 11025.0;
+/// Bit error rate up to which two fingerprints are reported as the same recording
+static const float kCPFingerprintMatchDistance = 0.2f;
+
+/**
+ One 32 bit word per ~186 ms of audio, starting at the first non-silent frame and covering
+ up to ~30 s. Bits 0-19 are the signs of the change over time of the energy differences
+ between 21 adjacent log-spaced bands (300 Hz - 3 kHz), which locate the spectral peaks;
+ bits 20-31 mark the pitch classes above the mean of the word's chroma vector.
+ Both survive re-encoding and level changes, so a copy differs in a few percent of its bits.
+ */
+struct CPFingerprint {
+    std::vector<uint32_t> words;
+    double duration;                    //seconds, of the whole track
+
+    CPFingerprint() : duration(0) {}
+    bool empty() const { return words.empty(); }
+
+    /// Compact little-endian form for storing with the library: magic, duration (ms), count, words.
+    std::vector<uint8_t> serialize() const;
+    static bool deserialize(const uint8_t *bytes, size_t length, CPFingerprint &fingerprint);
+};
+
+/// Bit error rate of the best alignment of `a` and `b` within a few words, 1 if they can't be compared.
+float CPFingerprintDistance(const CPFingerprint &a, const CPFingerprint &b);
+
+/**
+ Streaming analysis: feed decoded audio at any rate and channel count, in blocks of any size.
+ Input is downmixed, low passed and resampled to kCPFingerprintSampleRate, then analysed in
+ Hann windowed frames of ~46 ms every ~23 ms.
+ */
+class CPFingerprinter {
+public:
+    static const uint32_t kMaxWords = 160;
+
+    explicit CPFingerprinter(double sampleRate);
+
+    void process(const float *const *channels, uint32_t numChannels, uint32_t frames);
+    /// All words are filled; further input only counts towards the duration.
+    bool isFull() const { return _fingerprint.words.size() >= kMaxWords; }
+    /// The fingerprint of everything processed so far.
+    CPFingerprint finish();
+
+    /// Decodes `decoder` from the start in a single pass. Stops reading once the fingerprint is
+    /// full when the decoder knows its length, which then gives the duration.
+    static CPFingerprint analyze(CPAudioDecoder &decoder);
+
+private:
+    static const uint32_t kBands = 21;
+    static const uint32_t kFramesPerWord = 8;
+
+    void analyzeFrame();
+    void emitWord();
+
+    double _sampleRate;
+    double _resampleStep;               //input frames per analysis sample
+    double _resamplePosition;           //of the next analysis sample, relative to the block start
+    float _previousSample;
+    CPBiquadCoefficients _lowpass[2];
+    CPBiquadState _lowpassState[2];
+    uint64_t _inputFrames;
+
+    uint32_t _hop;
+    uint32_t _frameLength;
+    CPRealFFT _fft;
+    std::vector<float> _window;
+    std::vector<float> _frame;          //decimated samples waiting to be analysed
+    uint32_t _frameFill;
+    std::vector<float> _windowed;       //zero padded to the FFT size
+    std::vector<float> _power;
+    std::vector<uint32_t> _bandEdges;   //kBands + 1 bins
+    std::vector<int8_t> _pitchClass;    //per bin, -1 outside the chroma range
+    std::vector<float> _mono;
+
+    bool _started;                      //past the leading silence
+    uint32_t _wordFrames;
+    float _bandEnergy[kBands];
+    float _chroma[12];
+    float _previousDifference[kBands - 1];
+    bool _hasPrevious;
+    CPFingerprint _fingerprint;
+};
+
+struct CPFingerprintMatch {
+    uint64_t id;
+    float distance;
+};
+
+/**
+ Locality sensitive index over the fingerprints of a library. Each fingerprint is keyed by
+ 16 bit samples of its first words (one sample per table, 16 tables); a lookup probes every
+ table at the word boundary and one word either side, then ranks the few candidates by bit
+ error rate. Sampled bits of a copy agree with high probability, unrelated tracks only
+ collide by chance, so a lookup touches a few dozen fingerprints however large the library.
+ Thread safe.
+ */
+class CPFingerprintIndex {
+public:
+    CPFingerprintIndex();
+
+    /// Adds or replaces the fingerprint for `id`. Empty fingerprints are not indexed.
+    void add(uint64_t id, const CPFingerprint &fingerprint);
+    bool remove(uint64_t id);
+    void clear();
+    size_t size() const;
+    /// Indexed fingerprints within `maxDistance` whose durations agree, closest first.
+    std::vector<CPFingerprintMatch> query(const CPFingerprint &fingerprint, float maxDistance = kCPFingerprintMatchDistance) const;
+
+private:
+    static const uint32_t kTables = 16;
+    static const uint32_t kKeyBits = 16;
+    static const uint32_t kSignatureStart = 2;      //skips the onset
+    static const uint32_t kSignatureWords = 8;
+
+    struct Entry {
+        uint64_t id;
+        CPFingerprint fingerprint;
+        uint32_t keys[kTables];
+        bool live;
+    };
+
+    bool keys(const CPFingerprint &fingerprint, int shift, uint32_t *keys) const;
+    void removeSlotLocked(uint32_t slot);
+
+    uint16_t _bitPositions[kTables][kKeyBits];
+    mutable std::mutex _mutex;
+    std::vector<Entry> _entries;
+    std::vector<uint32_t> _freeSlots;
+    std::unordered_map<uint64_t, uint32_t> _slots;
+    std::unordered_map<uint32_t, std::vector<uint32_t>> _buckets;   //table << 16 | key -> slots
+};
+
+/**
+ Fixed set of worker threads that fingerprint a batch of files in parallel, one file per
+ worker at a time. Workers park on a condition variable between batches.
+ */
+class CPFingerprintPool {
+public:
+    typedef std::function<std::unique_ptr<CPAudioDecoder>()> Opener;
+
+    /// 0 uses one worker per hardware thread.
+    explicit CPFingerprintPool(uint32_t threads = 0);
+    ~CPFingerprintPool();
+
+    uint32_t threads() const { return (uint32_t)_workers.size(); }
+    /// Blocks until every track is analysed. Results are in order, empty where `open` returned nullptr.
+    std::vector<CPFingerprint> analyze(const std::vector<Opener> &tracks);
+
+private:
+    void work();
+
+    std::vector<std::thread> _workers;
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::deque<std::function<void()>> _jobs;
+    bool _running;
+};
+
+#endif /* CPFingerprint_hpp */
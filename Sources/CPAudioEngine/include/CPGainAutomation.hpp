@@ -0,0 +1,110 @@
+//
+//  CPGainAutomation.hpp
+//  CPAudioEngine
+//
+//  Sample-accurate gain lane: scheduled ramp segments applied on the render thread
+//
+
+#ifndef CPGainAutomation_hpp
+#define CPGainAutomation_hpp
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include "CPKernels.hpp"
+
+enum CPGainCurve : uint32_t {
+    CPGainCurveLinear,          //linear in amplitude
+    CPGainCurveExponential,     //linear in dB, fades to silence through -80 dB
+    CPGainCurveSCurve,          //raised cosine, no corners at either end
+    CPGainCurveHold             //keeps the gain where the previous segment left it
+};
+
+struct CPGainSegment {
+    float target;               //linear gain at the end of the segment
+    double seconds;
+    CPGainCurve curve;
+    uint32_t event;             //reported through the event callback when the segment completes, 0 for none
+};
+
+/**
+ Segments are queued from the control thread and played back to back on the render thread,
+ each starting from the gain the previous one ended at, with sample-accurate boundaries even
+ mid-block. Nothing needs to run on the control thread while a lane plays out: a 30 minute
+ sleep fade is two segments and one event.
+ Commands travel through a fixed ring, so neither side allocates or blocks.
+ */
+class CPGainAutomation {
+public:
+    typedef void (*EventCallback)(void *refCon, uint32_t event);
+
+    static const uint32_t kMaxSegments = 32;
+
+    CPGainAutomation(double sampleRate, float gain = 1.0f);
+
+    //Control thread
+    /// Appends `segment` after the queued ones. False when the queue is full.
+    bool schedule(const CPGainSegment &segment);
+    /// Drops the queued segments and ramps from wherever the gain is now.
+    bool rampTo(float target, double seconds, CPGainCurve curve = CPGainCurveLinear, uint32_t event = 0);
+    /// Drops the queued segments and jumps to `gain`.
+    void reset(float gain);
+    /// Gain at the end of the last rendered block
+    float gain() const { return _published.load(std::memory_order_relaxed); }
+    /// No segment queued or playing
+    bool isIdle() const;
+    /// Called on the render thread; set before the lane is processed.
+    void setEventCallback(EventCallback callback, void *refCon) { _eventCallback = callback; _eventRefCon = refCon; }
+
+    //Render thread
+    /// Multiplies non-interleaved channels in place. A lane idle at unity costs one check.
+    void process(float *const *channels, uint32_t numChannels, uint32_t frames);
+
+private:
+    enum CommandType : uint32_t { CommandAppend, CommandReplace, CommandReset };
+    struct Command {
+        CommandType type;
+        CPGainSegment segment;
+    };
+    struct Segment {
+        float start;
+        float target;
+        CPGainCurve curve;
+        uint32_t event;
+        uint64_t length;        //frames
+        uint64_t position;
+    };
+    static const uint32_t kCommands = kMaxSegments * 2;
+    //Exponential and S-curve segments are evaluated exactly every kCurveStride frames, so they
+    //reach the gain ramp kernel in pieces shorter than any of its block-size specializations;
+    //only linear ramps and steady gains run whole blocks through those
+    static const uint32_t kCurveStride = 32;
+
+    bool post(const Command &command);
+    void drainCommands();
+    bool beginNext();
+    float evaluate(const Segment &segment, uint64_t position) const;
+
+    const CPKernelTable &_kernels;
+    double _sampleRate;
+    EventCallback _eventCallback;
+    void *_eventRefCon;
+
+    //Control thread to render thread
+    std::mutex _postMutex;
+    Command _commands[kCommands];
+    std::atomic<uint32_t> _commandWrite;
+    std::atomic<uint32_t> _commandRead;
+    std::atomic<uint32_t> _queuedSegments;      //posted appends not yet finished
+
+    //Render thread
+    float _gain;
+    bool _active;
+    Segment _current;
+    Segment _queue[kMaxSegments];
+    uint32_t _queueHead;
+    uint32_t _queueCount;
+    std::atomic<float> _published;
+};
+
+#endif /* CPGainAutomation_hpp */
@@ -0,0 +1,120 @@
+//
+//  CPHalf.hpp
+//  CPAudioEngine
+//
+//  float <-> IEEE half precision block conversion for the decoded-audio cache
+//
+
+#ifndef CPHalf_hpp
+#define CPHalf_hpp
+
+#include <cstdint>
+#include <cstring>
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#elif defined(__F16C__)
+#include <immintrin.h>
+#endif
+
+static inline uint16_t CPHalfFromFloatScalar(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint32_t sign = (bits >> 16) & 0x8000;
+    int32_t exponent = (int32_t)((bits >> 23) & 0xff) - 127 + 15;
+    uint32_t mantissa = bits & 0x7fffff;
+    if (exponent >= 31) {
+        //Overflow and inf/nan saturate to inf, audio never gets there
+        return (uint16_t)(sign | 0x7c00 | (((bits >> 23) & 0xff) == 0xff && mantissa ? 0x200 : 0));
+    }
+    if (exponent <= 0) {
+        if (exponent < -10) {
+            return (uint16_t)sign;
+        }
+        mantissa |= 0x800000;
+        uint32_t shift = (uint32_t)(14 - exponent);
+        uint32_t half = mantissa >> shift;
+        uint32_t remainder = mantissa & ((1u << shift) - 1);
+        uint32_t midpoint = 1u << (shift - 1);
+        if (remainder > midpoint || (remainder == midpoint && (half & 1))) {
+            half++;
+        }
+        return (uint16_t)(sign | half);
+    }
+    uint32_t half = sign | ((uint32_t)exponent << 10) | (mantissa >> 13);
+    uint32_t remainder = mantissa & 0x1fff;
+    //Round to nearest even; a carry into the exponent is still the correct result
+    if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1))) {
+        half++;
+    }
+    return (uint16_t)half;
+}
+
+static inline float CPHalfToFloatScalar(uint16_t half) {
+    uint32_t sign = (uint32_t)(half & 0x8000) << 16;
+    uint32_t exponent = (half >> 10) & 0x1f;
+    uint32_t mantissa = half & 0x3ff;
+    uint32_t bits;
+    if (exponent == 0) {
+        if (mantissa == 0) {
+            bits = sign;
+        }
+        else {
+            //Subnormal half: renormalise
+            exponent = 127 - 15 + 1;
+            while ((mantissa & 0x400) == 0) {
+                mantissa <<= 1;
+                exponent--;
+            }
+            bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+        }
+    }
+    else if (exponent == 31) {
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    }
+    else {
+        bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+    }
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/// Packs `count` floats into half precision.
+static inline void CPHalfFromFloat(const float *in, uint16_t *out, size_t count) {
+    size_t i = 0;
+#if defined(__aarch64__)
+    for (; i + 8 <= count; i += 8) {
+        float16x8_t packed = vcombine_f16(vcvt_f16_f32(vld1q_f32(in + i)), vcvt_f16_f32(vld1q_f32(in + i + 4)));
+        vst1q_u16(out + i, vreinterpretq_u16_f16(packed));
+    }
+#elif defined(__F16C__)
+    for (; i + 8 <= count; i += 8) {
+        __m128i packed = _mm256_cvtps_ph(_mm256_loadu_ps(in + i), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128((__m128i *)(out + i), packed);
+    }
+#endif
+    for (; i < count; i++) {
+        out[i] = CPHalfFromFloatScalar(in[i]);
+    }
+}
+
+/// Expands `count` half precision samples to float. This is the cache's hot path.
+static inline void CPHalfToFloat(const uint16_t *in, float *out, size_t count) {
+    size_t i = 0;
+#if defined(__aarch64__)
+    for (; i + 8 <= count; i += 8) {
+        float16x8_t packed = vreinterpretq_f16_u16(vld1q_u16(in + i));
+        vst1q_f32(out + i, vcvt_f32_f16(vget_low_f16(packed)));
+        vst1q_f32(out + i + 4, vcvt_f32_f16(vget_high_f16(packed)));
+    }
+#elif defined(__F16C__)
+    for (; i + 8 <= count; i += 8) {
+        _mm256_storeu_ps(out + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(in + i))));
+    }
+#endif
+    for (; i < count; i++) {
+        out[i] = CPHalfToFloatScalar(in[i]);
+    }
+}
+
+#endif /* CPHalf_hpp */
@@ -0,0 +1,68 @@
+//
+//  CPKernels.hpp
+//  CPAudioEngine
+//
+//  Hot-loop kernels specialized for channel count and block size, dispatched on the CPU's ISA
+//
+
+#ifndef CPKernels_hpp
+#define CPKernels_hpp
+
+#include <cstdint>
+#include "CPBiquad.hpp"
+
+enum CPKernelISA : uint32_t {
+    CPKernelISAScalar,          //baseline of architectures without a SIMD tier
+    CPKernelISANEON,            //baseline on arm64
+    CPKernelISASSE2,            //baseline on x86_64
+    CPKernelISAAVX2,            //AVX2 + FMA
+    CPKernelISAAVX512,          //AVX-512 F/VL + FMA
+    CPKernelISACount
+};
+
+static const uint32_t kCPKernelMaxChannels = 8;
+
+/// Block sizes the kernels are specialized for; any other size takes the generic path.
+static const uint32_t kCPKernelBlockSizes[] = { 64, 128, 256, 512, 1024, 4096 };
+
+/**
+ The engine's inner loops, each built as templates over channel count (mono, stereo) and block
+ size (kCPKernelBlockSizes), so the compiler sees constant trip counts and no per-sample channel
+ branches, plus a generic instantiation for everything else. The whole set is compiled once per
+ ISA the architecture has and the best one the CPU and OS support is picked on first use, which
+ CPPlayerEngine makes happen when it is constructed, never on the render thread.
+
+ Channel buffers are non-interleaved. Unless stated otherwise, inputs and outputs must not alias.
+ */
+struct CPKernelTable {
+    CPKernelISA isa;
+    bool specialized;           //false for the generic-only tables the benchmarks compare against
+
+    /// Runs `sections[bands[0]]`, `sections[bands[1]]` ... in series; state[channel][band] is the
+    /// state of each band. `in` and `out` may be the same buffers. No bands copies `in` to `out`.
+    void (*biquadCascade)(const CPBiquadCoefficients *sections, const uint8_t *bands, uint32_t numBands,
+                          CPBiquadState *const *state, const float *const *in, float *const *out,
+                          uint32_t numChannels, uint32_t frames);
+    /// out[o] (+)= sum over i of (gains[o][i] + n * steps[o][i]) * in[i] for frame n; stores
+    /// instead of adding when `accumulate` is false. Rows are kCPKernelMaxChannels wide.
+    void (*mixMatrix)(const float *const *in, uint32_t inChannels, float *const *out, uint32_t outChannels,
+                      const float *gains, const float *steps, uint32_t frames, bool accumulate);
+    /// In place, channels[c][n] *= gain + n * step
+    void (*gainRamp)(float *const *channels, uint32_t numChannels, float gain, float step, uint32_t frames);
+
+    //Interleaved <-> non-interleaved format conversion; int16 is host order, clipped and rounded to nearest on the way out
+    void (*deinterleaveInt16)(const int16_t *in, float *const *out, uint32_t numChannels, uint32_t frames);
+    void (*deinterleaveFloat)(const float *in, float *const *out, uint32_t numChannels, uint32_t frames);
+    void (*interleaveInt16)(const float *const *in, int16_t *out, uint32_t numChannels, uint32_t frames);
+    void (*interleaveFloat)(const float *const *in, float *out, uint32_t numChannels, uint32_t frames);
+};
+
+/// Kernels for the best ISA of this CPU, selected on the first call
+const CPKernelTable &CPKernels();
+/// Kernels for `isa`, generic-only when `specialized` is false. nullptr when this build or CPU lacks `isa`.
+const CPKernelTable *CPKernelsForISA(CPKernelISA isa, bool specialized = true);
+/// Best ISA this CPU and OS support, from CPUID on x86
+CPKernelISA CPKernelBestISA();
+const char *CPKernelISAName(CPKernelISA isa);
+
+#endif /* CPKernels_hpp */
@@ -0,0 +1,85 @@
+//
+//  CPMatrixMixer.hpp
+//  CPAudioEngine
+//
+//  In x out gain matrix with the standard downmixes, balance, pre-gain and volume folded in
+//
+
+#ifndef CPMatrixMixer_hpp
+#define CPMatrixMixer_hpp
+
+#include <atomic>
+#include <cstdint>
+#include "CPKernels.hpp"
+
+static const uint32_t kCPMixerMaxChannels = kCPKernelMaxChannels;
+
+/// One matrix per possible input channel count, all for the same settings. Immutable once published.
+struct CPMixMatrices {
+    float gains[kCPMixerMaxChannels + 1][kCPMixerMaxChannels][kCPMixerMaxChannels];   //[inChannels][out][in]
+    bool isIdentity[kCPMixerMaxChannels + 1];
+};
+
+/**
+ Input channels are taken to be in WAVE/SMPTE order (L R C LFE Ls Rs, 7.1 adds Lb Rb) and are
+ downmixed with ITU-R BS.775 coefficients: centre and surrounds at -3 dB, LFE dropped. Each
+ downmix row is then normalised to sum to at most 1, so the fold-down cannot clip. Mono
+ feeds every output at unity. Balance, loudness pre-gain and volume scale the output rows, so
+ one pass applies all of them; stereo in and out at unity is a plain copy.
+
+ Settings are compiled into a matrix set published to the render thread with one atomic store.
+ The block that picks a new set up ramps every gain from the old set, so changes never click.
+ */
+class CPMatrixMixer {
+public:
+    CPMatrixMixer(uint32_t outChannels = 2);
+
+    //Control thread
+    /// -1 (left only) ... 1 (right only)
+    void setBalance(float balance);
+    float balance() const { return _balance; }
+    /// Loudness normalisation gain in dB, applied ahead of volume
+    void setPreGain(float decibels);
+    float preGain() const { return _preGainDb; }
+    /// Linear, 0 ... 1
+    void setVolume(float volume);
+    float volume() const { return _volume; }
+    uint32_t outChannels() const { return _outChannels; }
+    /// Current matrix for `inChannels`, for inspection
+    void matrix(uint32_t inChannels, float gains[kCPMixerMaxChannels][kCPMixerMaxChannels]) const;
+
+    //Render thread
+    /// Picks up settings published since the last block. Call once per render cycle.
+    void beginBlock(uint32_t blockFrames);
+    /// Mixes `frames` frames of `in` into `out`. `offset` is where the run starts inside the current
+    /// block, `gain` an extra per-run gain ramping by `gainStep` per frame (crossfades).
+    /// The first `accumulateFrames` frames of the run are added to `out`, the rest overwrite it.
+    void mix(const float *const *in, uint32_t inChannels, float *const *out, uint32_t offset, uint32_t frames,
+             float gain, float gainStep, uint32_t accumulateFrames) const;
+
+private:
+    static const uint32_t kSlots = 4;
+
+    void publish();
+    bool isReferenced(const CPMixMatrices *matrices) const;
+    void mixRun(const float *const *in, uint32_t inChannels, float *const *out, uint32_t offset, uint32_t frames,
+                float gain, float gainStep, bool accumulate) const;
+
+    uint32_t _outChannels;
+    float _balance;
+    float _preGainDb;
+    float _volume;
+    CPMixMatrices _slots[kSlots];
+    uint32_t _nextSlot;
+    const CPKernelTable &_kernels;
+
+    //Written by the control thread only
+    std::atomic<const CPMixMatrices *> _pending;
+    //Written by the render thread only
+    std::atomic<const CPMixMatrices *> _adopting;       //pending set being taken over, see beginBlock()
+    std::atomic<const CPMixMatrices *> _active;
+    std::atomic<const CPMixMatrices *> _previous;
+    uint32_t _blockFrames;
+};
+
+#endif /* CPMatrixMixer_hpp */
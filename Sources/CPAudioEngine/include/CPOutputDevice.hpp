@@ -0,0 +1,88 @@
+//
+//  CPOutputDevice.hpp
+//  CPAudioEngine
+//
+//  Output backend interface: whatever pulls rendered audio out of the engine
+//
+
+#ifndef CPOutputDevice_hpp
+#define CPOutputDevice_hpp
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+struct CPOutputConfig {
+    double sampleRate = 44100.0;
+    uint32_t channels = 2;
+    uint32_t periodFrames = 512;        //frames per render callback
+    uint32_t periods = 2;               //device buffer = periods * periodFrames
+    bool realtimePriority = true;       //promote the render thread to realtime scheduling
+};
+
+struct CPOutputStats {
+    double latency;                     //seconds from render to the speaker, as measured by the backend
+    double jitter;                      //mean deviation of callback intervals from the nominal period, seconds
+    double maxJitter;
+    uint64_t callbacks;
+    uint64_t xruns;                     //missed deadlines / buffer underruns
+    bool realtime;                      //render thread actually got realtime priority
+};
+
+/// Tries to give the calling thread realtime scheduling for a render loop with the given period.
+bool CPPromoteThreadToRealtime(double periodSeconds);
+
+/**
+ A backend owns the render thread (or is driven by the OS's) and calls render() once per
+ period with non-interleaved float buffers. The base class times those calls, so every backend
+ reports callback jitter the same way; backends report latency and xruns themselves.
+ */
+class CPOutputDevice {
+public:
+    typedef void (*RenderCallback)(void *refCon, float *const *channels, uint32_t numChannels, uint32_t frames);
+
+    CPOutputDevice();
+    virtual ~CPOutputDevice() {}
+
+    //Control thread
+    /// Must be set before open()
+    void setRenderCallback(RenderCallback callback, void *refCon) { _callback = callback; _refCon = refCon; }
+    /// Negotiates `config` with the device; config() returns what was actually granted.
+    virtual bool open(const CPOutputConfig &config) = 0;
+    virtual bool start() = 0;
+    virtual void stop() = 0;
+    virtual void close() = 0;
+    virtual bool isRunning() const = 0;
+    const CPOutputConfig &config() const { return _config; }
+    CPOutputStats stats() const;
+
+protected:
+    //Render thread
+    /// Renders `frames` frames into `channels` and records the callback's timing.
+    void render(float *const *channels, uint32_t frames);
+    void setLatency(double seconds) { _latency.store((int64_t)(seconds * 1e9), std::memory_order_relaxed); }
+    void addXrun() { _xruns.fetch_add(1, std::memory_order_relaxed); }
+    void setRealtime(bool realtime) { _realtime.store(realtime, std::memory_order_relaxed); }
+    /// Don't count the gap before the next callback, e.g. after a deliberate prefill burst
+    void restartTiming() { _timing = false; }
+    /// Clears timing, call when (re)starting
+    void resetStats();
+
+    CPOutputConfig _config;
+
+private:
+    RenderCallback _callback;
+    void *_refCon;
+    std::chrono::steady_clock::time_point _lastCallback;
+    bool _timing;
+    uint32_t _lastFrames;                       //size of the previous callback, which the interval since covers
+    std::atomic<int64_t> _latency;
+    std::atomic<int64_t> _jitterSum;
+    std::atomic<int64_t> _maxJitter;
+    std::atomic<uint64_t> _intervals;
+    std::atomic<uint64_t> _callbacks;
+    std::atomic<uint64_t> _xruns;
+    std::atomic<bool> _realtime;
+};
+
+#endif /* CPOutputDevice_hpp */
@@ -0,0 +1,182 @@
+//
+//  CPPlayerEngine.hpp
+//  CPAudioEngine
+//
+//  The player without any platform in it: source, mixer and EQ rendering into an output backend
+//
+
+#ifndef CPPlayerEngine_hpp
+#define CPPlayerEngine_hpp
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "CPAudioDecoder.hpp"
+#include "CPEqualizer.hpp"
+#include "CPGainAutomation.hpp"
+#include "CPMatrixMixer.hpp"
+#include "CPOutputDevice.hpp"
+#include "CPRenderPipeline.hpp"
+#include "CPTrackSource.hpp"
+
+/// Frames the chain renders at a time, always whole blocks, so process callbacks see one size and a
+/// block's buffers stay in the L1 cache across units. A callback that ends partway through a block
+/// gets the rest of it at the start of the next.
+static const uint32_t kCPEngineBlockFrames = 512;
+/// Period the background render mode asks the output for; the interactive period is kept if longer.
+static const uint32_t kCPEngineBackgroundPeriodFrames = 4096;
+
+enum CPRenderMode {
+    CPRenderModeInteractive,            //the period the host asked for, read-ahead topped up continuously
+    CPRenderModeBackground              //long periods and batched read-ahead: fewest wakeups, no UI waiting on it
+};
+
+/**
+ Owns the output device and everything rendered into it. Per period the render thread runs the
+ source (every deck through the matrix mixer), the band EQ, the host's process callback (where
+ platform effect units run), then the gain automation lane. Play and pause start and stop the
+ device behind a short fade, so neither clicks; the source keeps its decks, so resuming and
+ seeking (crossfaded by the source) never rebuild anything.
+ The same engine drives RemoteIO on iOS and the null, WAV file and ALSA backends elsewhere.
+
+ When the chain costs more than one core can render in a period, setPipelineStages() splits
+ it (source and EQ, then each process callback) into stages on their own worker threads; see
+ CPRenderPipeline. The gain lanes stay on the output thread, so fades remain exact to the
+ sample of what is heard, and the playback time accounts for the audio still in the pipeline.
+
+ Whatever the period, the chain runs in whole blocks of kCPEngineBlockFrames: a period that is not a
+ multiple of it plays part of a block rendered in the callback before, which adds less than a block of
+ latency. The gain lanes run on what is played, not on blocks. The background render mode
+ trades latency, which nobody is waiting on when no UI is visible, for fewer wakeups: the output runs
+ at kCPEngineBackgroundPeriodFrames and the source refills its rings in batches.
+ */
+class CPPlayerEngine {
+public:
+    typedef void (*CompletionCallback)(void *refCon);
+    typedef void (*ProcessCallback)(void *refCon, float *const *channels, uint32_t numChannels, uint32_t frames);
+
+    /// Opens `output` with `config`; the engine runs at the sample rate and channel count it grants.
+    CPPlayerEngine(std::unique_ptr<CPOutputDevice> output, const CPOutputConfig &config,
+                   const float *eqFrequencies, uint32_t eqBands);
+    ~CPPlayerEngine();
+
+    //Control thread
+    bool isOpen() const { return _open; }
+    double sampleRate() const { return _output->config().sampleRate; }
+    uint32_t channels() const { return _output->config().channels; }
+    CPOutputDevice &output() { return *_output; }
+    CPMatrixMixer &mixer() { return *_mixer; }
+    CPEqualizer &equalizer() { return *_equalizer; }
+    /// Scheduled fades: sleep timers, fade in / out. Applied after everything else.
+    CPGainAutomation &automation() { return *_automation; }
+    /// The source is created on first use; it owns a loader thread and the deck arena.
+    CPTrackSource &source();
+    bool hasSource() const { return _source.load() != nullptr; }
+
+    /// Re-opens the device with new period settings, keeping rate and channels. Resumes if it was playing.
+    /// In the background mode the period is kept for the return to interactive.
+    bool setOutputPeriod(uint32_t periodFrames, uint32_t periods);
+    /// Re-opens the device with the mode's period and sets the source's read-ahead. Resumes if it was playing.
+    bool setRenderMode(CPRenderMode mode);
+    CPRenderMode renderMode() const { return _renderMode; }
+    /// Replaces the band EQ. Briefly stops the output if it is running.
+    void setEqualizerFrequencies(const float *frequencies, uint32_t numBands);
+    /// Run after the EQ on the render thread; replaces any added callbacks. Briefly stops the output if it is running.
+    void setProcessCallback(ProcessCallback callback, void *refCon);
+    /// Runs after the callbacks set so far. Each callback is a unit the pipeline can give a stage of its own.
+    /// May be called while playing: the render threads pick the callback up from their next block.
+    bool addProcessCallback(ProcessCallback callback, void *refCon);
+    /// Renders the chain in `stages` stages on worker threads, trading one block of latency per
+    /// stage, or in the output callback for 0. Stages are balanced by the measured cost of each unit.
+    /// Briefly stops the output if it is running.
+    bool setPipelineStages(uint32_t stages);
+    uint32_t pipelineStages() const { return _pipeline != nullptr ? _pipeline->config().stages : 0; }
+    /// Output latency the pipeline adds, whole blocks (seconds); 0 when not pipelined
+    double pipelineLatency() const;
+    CPPipelineStats pipelineStats() const;
+    /// Called on the render thread when the current track has played out; when pipelined, when the
+    /// first stage has rendered its end, pipelineLatency() before it is heard.
+    void setCompletionCallback(CompletionCallback callback, void *refCon);
+
+    /// Switches to a track; the decoder must run at sampleRate(). Crossfades if playing.
+    bool load(std::unique_ptr<CPAudioDecoder> decoder, int64_t startFrame = 0);
+    bool hasTrack() const { return hasSource() && _source.load()->hasTrack(); }
+    bool play();
+    /// Keeps the track, its position and buffered audio.
+    void pause();
+    void stop();
+    bool isPlaying() const { return _output->isRunning(); }
+    bool setPlaybackTime(double seconds);
+    double currentPlaybackTime() const;
+    double duration() const;
+    /// Time from play() on a stopped engine to the first rendered frame of the track, 0 until measured
+    double timeToFirstAudio() const;
+
+private:
+    static const uint32_t kMaxProcessCallbacks = 8;
+    //Pipeline block flags
+    static const uint32_t kBlockHasTrack = 1;
+
+    struct ProcessUnit {
+        ProcessCallback callback;
+        void *refCon;
+    };
+
+    static void renderCallback(void *refCon, float *const *channels, uint32_t numChannels, uint32_t frames);
+    static uint32_t renderStage(void *refCon, uint32_t stage, float *const *channels, uint32_t numChannels, uint32_t frames);
+    static void trackEndCallback(void *refCon);
+    /// Runs units [first, last) of the chain (0 is source and EQ) one engine block at a time over a whole
+    /// number of blocks, returns kBlockHasTrack if the source rendered.
+    uint32_t renderUnits(uint32_t first, uint32_t last, float *const *channels, uint32_t numChannels, uint32_t frames);
+    /// One engine block of the chain, from the pipeline or rendered in place
+    uint32_t renderBlock(float *const *block, uint32_t numChannels);
+    void noteFirstAudio(bool rendered);
+    bool startWithFadeIn();
+    void fadeOutAndStop();
+    /// Replaces the pipeline for the current output config; output stopped.
+    void rebuildPipeline(uint32_t stages);
+    /// Drains and joins the workers, then drops the pipeline. Returns the frames it had rendered but not played.
+    uint64_t releasePipeline();
+    /// Drops pipelined and carried audio that was rendered but not played, e.g. before a paused engine seeks
+    void flushPipeline();
+    /// Re-opens the device at `periodFrames`, keeping rate and channels; resumes if it was playing.
+    bool reopenOutput(uint32_t periodFrames, uint32_t periods);
+
+    std::unique_ptr<CPOutputDevice> _output;
+    bool _open;
+    CPRenderMode _renderMode;
+    uint32_t _periodFrames;                     //interactive period, as requested
+    uint32_t _periods;
+    std::unique_ptr<CPMatrixMixer> _mixer;
+    std::unique_ptr<CPEqualizer> _equalizer;
+    std::unique_ptr<CPGainAutomation> _automation;
+    std::unique_ptr<CPGainAutomation> _transport;   //play / pause de-click fades
+    std::mutex _sourceMutex;
+    std::atomic<CPTrackSource *> _source;
+    ProcessUnit _processUnits[kMaxProcessCallbacks];
+    std::atomic<uint32_t> _processUnitCount;    //published after the slot it covers
+    std::atomic<float> _unitCost[kMaxProcessCallbacks + 1];     //seconds per engine block, smoothed; unit 0 is source and EQ
+    uint32_t _unitBlocks[kMaxProcessCallbacks + 1];             //blocks each unit has rendered; its thread only
+    std::unique_ptr<CPRenderPipeline> _pipeline;
+    //Read by the workers, written only while there are none
+    uint32_t _pipelineStages;
+    uint32_t _stageFirstUnit[kCPPipelineMaxStages + 1];         //stage s runs units [first[s], first[s + 1])
+    //The block a callback ended partway through, played out by the next. Render thread, except that
+    //the control thread drops it while the output is stopped.
+    std::vector<float> _carrySamples;
+    float *_carry[kCPMixerMaxChannels];
+    uint32_t _carryOffset;
+    uint32_t _carryFlags;
+    std::atomic<uint32_t> _carryFrames;         //not played yet
+    CompletionCallback _completionCallback;
+    void *_completionRefCon;
+
+    std::chrono::steady_clock::time_point _playRequest;
+    std::atomic<int64_t> _firstAudioDelay;      //nanoseconds, published by the render thread
+    std::atomic<bool> _awaitingFirstAudio;
+};
+
+#endif /* CPPlayerEngine_hpp */
@@ -0,0 +1,193 @@
+//
+//  CPRenderPipeline.hpp
+//  CPAudioEngine
+//
+//  Pipelined rendering: the chain split into stages on pinned realtime workers, a block apart
+//
+
+#ifndef CPRenderPipeline_hpp
+#define CPRenderPipeline_hpp
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+#if defined(__APPLE__)
+#include <mach/semaphore.h>
+#else
+#include <semaphore.h>
+#endif
+
+static const uint32_t kCPPipelineMaxStages = 8;
+
+/// Pins the calling thread to `core`. On Apple platforms this is an affinity hint, unsupported on iOS.
+bool CPPinThreadToCore(uint32_t core);
+
+/// Counting semaphore a realtime thread can signal without taking a lock: Mach on Apple, POSIX elsewhere.
+class CPSemaphore {
+public:
+    CPSemaphore();
+    ~CPSemaphore();
+    CPSemaphore(const CPSemaphore &) = delete;
+    CPSemaphore &operator=(const CPSemaphore &) = delete;
+
+    void signal();
+    void wait();
+
+private:
+#if defined(__APPLE__)
+    semaphore_t _semaphore;
+#else
+    sem_t _semaphore;
+#endif
+};
+
+/**
+ Wait-free single producer / single consumer queue of block indices. Neither side ever waits
+ on the other: push fails when full, pop when empty. Capacity is a power of two.
+ */
+class CPBlockQueue {
+public:
+    CPBlockQueue() : _mask(0), _head(0), _tail(0) {}
+
+    /// Only valid while neither side is active
+    void reset(uint32_t capacity) {
+        uint32_t size = 1;
+        while (size < capacity) {
+            size *= 2;
+        }
+        _slots.assign(size, 0);
+        _mask = size - 1;
+        _head.store(0);
+        _tail.store(0);
+    }
+
+    uint32_t size() const { return _tail.load(std::memory_order_acquire) - _head.load(std::memory_order_acquire); }
+
+    bool push(uint32_t block) {
+        uint32_t tail = _tail.load(std::memory_order_relaxed);
+        if (tail - _head.load(std::memory_order_acquire) > _mask) {
+            return false;
+        }
+        _slots[tail & _mask] = block;
+        _tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(uint32_t &block) {
+        uint32_t head = _head.load(std::memory_order_relaxed);
+        if (head == _tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        block = _slots[head & _mask];
+        _head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    std::vector<uint32_t> _slots;
+    uint32_t _mask;
+    alignas(64) std::atomic<uint32_t> _head;
+    alignas(64) std::atomic<uint32_t> _tail;
+};
+
+struct CPPipelineConfig {
+    uint32_t stages = 2;
+    uint32_t channels = 2;
+    uint32_t blockFrames = 512;
+    double sampleRate = 44100.0;
+    uint32_t latencyBlocks = 0;         //blocks in flight ahead of the output, at least `stages`; 0 for stages + 1
+    bool realtimePriority = true;
+    uint32_t firstCore = 1;             //stage s runs on core (firstCore + s) % cores, leaving core 0 to the device thread
+};
+
+struct CPPipelineStats {
+    uint32_t stages;
+    uint32_t latencyBlocks;
+    uint64_t blocks;                    //played out
+    uint64_t underruns;                 //times the output found no finished block, however many pulls it stayed empty
+    double stageLoad[kCPPipelineMaxStages];     //mean fraction of a block period each stage was busy
+    bool realtime;                      //every worker got realtime priority
+    bool pinned;                        //every worker got pinned to its core
+};
+
+/**
+ Runs a chain that does not fit in one render callback as `stages` stages, each on its own
+ worker thread with realtime priority, pinned to its own core. Fixed-size blocks go through
+ the stages in order over wait-free queues, so stage s works on block n while stage s + 1 works
+ on block n - 1: every stage gets a whole block period, and the chain may cost up to `stages`
+ periods. In exchange the output plays latencyBlocks blocks behind the first stage.
+
+ The output thread only ever pops finished blocks, copies them out and sends played blocks back
+ into the first stage; an empty queue means silence and an underrun, never a wait. Workers
+ never take a lock or allocate while they hold a block; an idle worker spins briefly, then parks
+ on its semaphore until the stage before it hands it a block.
+ */
+class CPRenderPipeline {
+public:
+    /// Processes stage `stage` of the chain in place. The returned flags travel with the block to pull().
+    typedef uint32_t (*StageCallback)(void *refCon, uint32_t stage, float *const *channels, uint32_t numChannels, uint32_t frames);
+
+    CPRenderPipeline(const CPPipelineConfig &config, StageCallback callback, void *refCon);
+    ~CPRenderPipeline();
+
+    const CPPipelineConfig &config() const { return _config; }
+    /// Whole blocks the output trails the first stage by, in frames
+    uint32_t latencyFrames() const { return _config.latencyBlocks * _config.blockFrames; }
+    /// Frames the first stage has processed that have not been played yet; exact, unlike latencyFrames()
+    /// during warm-up, after underruns and while paused.
+    uint64_t queuedFrames() const;
+    CPPipelineStats stats() const;
+
+    //Control thread, while pull() is not being called
+    /// Starts every idle block through the stages and waits until the first one is finished, so
+    /// the output starts with audio instead of warm-up silence. False on timeout.
+    bool prime(double timeoutSeconds);
+    /// Waits until no stage holds a block. False if the workers didn't drain within `timeoutSeconds`.
+    bool waitUntilIdle(double timeoutSeconds);
+    /// Drops rendered audio that has not been played; the next pull() starts the pipeline afresh.
+    /// Call after waitUntilIdle().
+    void flush();
+
+    //Render thread
+    /// Fills `frames` frames from finished blocks, silence where none is ready, and returns the OR
+    /// of the flags of the blocks it played from. Played blocks go straight back into the first stage.
+    uint32_t pull(float *const *channels, uint32_t numChannels, uint32_t frames);
+
+private:
+    static const uint32_t kNoBlock = UINT32_MAX;
+
+    void work(uint32_t stage);
+    void submitIdle();
+
+    CPPipelineConfig _config;
+    StageCallback _callback;
+    void *_refCon;
+    uint32_t _blocks;
+    std::vector<float> _samples;
+    std::vector<float *> _channels;         //per block, config.channels pointers
+    std::vector<uint32_t> _blockFlags;
+
+    CPBlockQueue _queues[kCPPipelineMaxStages + 1];    //input of each stage, then the finished blocks
+    CPSemaphore _wake[kCPPipelineMaxStages];
+    std::vector<std::thread> _workers;
+    std::atomic<bool> _running;
+    std::atomic<uint32_t> _inFlight;        //blocks in a stage's queue or being processed
+    std::atomic<uint32_t> _realtimeWorkers;
+    std::atomic<uint32_t> _pinnedWorkers;
+    std::atomic<uint64_t> _busyNanos[kCPPipelineMaxStages];
+    std::atomic<uint64_t> _stageBlocks[kCPPipelineMaxStages];
+    std::atomic<uint64_t> _renderedFrames;  //through the first stage
+    std::atomic<uint64_t> _playedFrames;
+    std::atomic<uint64_t> _playedBlocks;
+    std::atomic<uint64_t> _underruns;
+
+    //Render thread
+    std::vector<uint32_t> _idle;            //played blocks waiting to be resubmitted
+    uint32_t _current;                      //block being played
+    uint32_t _offset;                       //frames of it already played
+    bool _primed;                           //played something since the last flush
+    bool _starved;                          //the last pull ran out of finished blocks
+};
+
+#endif /* CPRenderPipeline_hpp */
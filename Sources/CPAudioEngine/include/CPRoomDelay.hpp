@@ -0,0 +1,96 @@
+//
+//  CPRoomDelay.hpp
+//  CPAudioEngine
+//
+//  Modulated fractional delay with damped feedback, the native replacement of the Delay unit
+//
+
+#ifndef CPRoomDelay_hpp
+#define CPRoomDelay_hpp
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+static const uint32_t kCPRoomDelayMaxChannels = 8;
+/// Deepest modulation setModulation() accepts; the ring is sized for the maximum delay plus this.
+static const float kCPRoomDelayMaxModulationSeconds = 0.005f;
+/// Fastest modulation setModulation() accepts; above a few Hz it stops sounding like a room and turns to vibrato.
+static const float kCPRoomDelayMaxModulationHertz = 5.0f;
+
+/**
+ A feedback delay line read at fractional positions. Each channel's ring buffer is allocated up front
+ for the longest delay, so nothing is allocated after construction and every sample costs the same
+ whatever the settings: a four tap Lagrange read, a one-pole damping filter in the feedback path,
+ and the wet/dry mix in the same loop.
+
+ Settings are published to the render thread as atomics. Delay time, feedback and wet/dry mix
+ glide to their new values, so a changed delay time bends the pitch of the echoes, like tape and
+ by at most 10%, instead of jumping to another point of the ring and clicking. The optional
+ modulation is a slow sine on the read position. Defaults match the Delay unit's: 50%
+ feedback, damping at 15 kHz, no modulation, fully dry.
+ */
+class CPRoomDelay {
+public:
+    CPRoomDelay(double sampleRate, float maxDelaySeconds = 2.0f, uint32_t channels = 2);
+
+    //Control thread
+    /// Clamped to 0 ... maxDelaySeconds; delays under two samples read two samples back.
+    void setDelayTime(float seconds);
+    float delayTime() const { return _delayTime.load(std::memory_order_relaxed); }
+    /// Fraction of the delayed signal fed back, 0 ... 0.98
+    void setFeedback(float feedback);
+    float feedback() const { return _feedback.load(std::memory_order_relaxed); }
+    /// Cutoff of the low pass in the feedback path; each echo is duller than the one before.
+    void setDampingFrequency(float hertz);
+    float dampingFrequency() const { return _dampingFrequency; }
+    /// 0 (dry) ... 1 (wet only)
+    void setWetDryMix(float mix);
+    float wetDryMix() const { return _wet.load(std::memory_order_relaxed); }
+    /// Sine modulation of the delay time, `depthSeconds` either way at `rateHertz` (up to
+    /// kCPRoomDelayMaxModulationHertz). 0 depth turns it off.
+    void setModulation(float depthSeconds, float rateHertz);
+    float maxDelayTime() const { return _maxDelaySeconds; }
+    double sampleRate() const { return _sampleRate; }
+
+    //Render thread
+    /// Processes non-interleaved float channels in place. Channels beyond the constructor's pass through.
+    void process(float *const *channels, uint32_t numChannels, uint32_t frames);
+    /// Empties the delay line, for a stage resuming after it idled with old audio still in the ring.
+    /// The next block takes the current settings without a glide.
+    void reset();
+
+private:
+    //Frames the glides and modulation ramp linearly over
+    static const uint32_t kChunkFrames = 64;
+
+    double _sampleRate;
+    float _maxDelaySeconds;
+    uint32_t _channels;
+    float _dampingFrequency;
+
+    //Written by the control thread only
+    std::atomic<float> _delayTime;
+    std::atomic<float> _feedback;
+    std::atomic<float> _damping;            //one-pole coefficient of the feedback low pass
+    std::atomic<float> _wet;
+    std::atomic<float> _modulationDepth;    //samples
+    std::atomic<float> _modulationRate;     //radians per sample
+
+    //Render thread
+    std::vector<float> _ring;               //_channels rings of _ringMask + 1 samples
+    uint32_t _ringMask;
+    uint32_t _write;
+    float _minDelay;                        //samples
+    float _maxDelay;
+    float _smoothing;                       //per sample coefficient of the parameter glides
+    float _chunkRetain;                     //(1 - _smoothing)^kChunkFrames
+    float _currentDelay;                    //samples
+    float _currentFeedback;
+    float _currentWet;
+    float _lfoCos, _lfoSin;                 //modulation phasor
+    float _damped[kCPRoomDelayMaxChannels]; //feedback low pass state
+    bool _started;
+};
+
+#endif /* CPRoomDelay_hpp */
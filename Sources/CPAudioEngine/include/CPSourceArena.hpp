@@ -0,0 +1,105 @@
+//
+//  CPSourceArena.hpp
+//  CPAudioEngine
+//
+//  Preallocated sample memory and the single producer/consumer rings carved out of it
+//
+
+#ifndef CPSourceArena_hpp
+#define CPSourceArena_hpp
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+/// One contiguous allocation made when the engine is created; every source buffer is a slice of it.
+class CPSourceArena {
+public:
+    CPSourceArena(size_t samples) : _storage(samples, 0.0f), _used(0) {}
+
+    /// Hands out `samples` floats, or nullptr once the arena is exhausted. Construction time only.
+    float *carve(size_t samples) {
+        if (_used + samples > _storage.size()) {
+            return nullptr;
+        }
+        float *slice = _storage.data() + _used;
+        _used += samples;
+        return slice;
+    }
+
+    size_t bytes() const { return _storage.size() * sizeof(float); }
+
+private:
+    std::vector<float> _storage;
+    size_t _used;
+};
+
+/**
+ Planar ring of frames. One writer (control or loader thread, serialised by the owner) and one
+ reader (render thread). Capacity must be a power of two.
+ */
+class CPFrameRing {
+public:
+    CPFrameRing() : _samples(nullptr), _channels(0), _capacity(0), _mask(0), _readPosition(0), _writePosition(0) {}
+
+    void attach(float *samples, uint32_t channels, uint32_t capacity) {
+        _samples = samples;
+        _channels = channels;
+        _capacity = capacity;
+        _mask = capacity - 1;
+        reset();
+    }
+
+    /// Only valid while no reader is active
+    void reset() {
+        _readPosition.store(0);
+        _writePosition.store(0);
+    }
+
+    uint32_t channels() const { return _channels; }
+    uint32_t capacity() const { return _capacity; }
+    uint32_t readable() const { return (uint32_t)(_writePosition.load(std::memory_order_acquire) - _readPosition.load(std::memory_order_relaxed)); }
+    uint32_t writable() const { return _capacity - (uint32_t)(_writePosition.load(std::memory_order_relaxed) - _readPosition.load(std::memory_order_acquire)); }
+
+    /// Contiguous writable region of at most `frames` frames
+    uint32_t writeRegion(float **channels, uint32_t frames) {
+        uint64_t position = _writePosition.load(std::memory_order_relaxed);
+        uint32_t offset = (uint32_t)(position & _mask);
+        frames = std::min(frames, std::min(writable(), _capacity - offset));
+        for (uint32_t channel = 0; channel < _channels; channel++) {
+            channels[channel] = _samples + (size_t)channel * _capacity + offset;
+        }
+        return frames;
+    }
+
+    void commitWrite(uint32_t frames) {
+        _writePosition.store(_writePosition.load(std::memory_order_relaxed) + frames, std::memory_order_release);
+    }
+
+    /// Contiguous readable region of at most `frames` frames
+    uint32_t readRegion(const float **channels, uint32_t frames) const {
+        uint64_t position = _readPosition.load(std::memory_order_relaxed);
+        uint32_t offset = (uint32_t)(position & _mask);
+        frames = std::min(frames, std::min(readable(), _capacity - offset));
+        for (uint32_t channel = 0; channel < _channels; channel++) {
+            channels[channel] = _samples + (size_t)channel * _capacity + offset;
+        }
+        return frames;
+    }
+
+    void commitRead(uint32_t frames) {
+        _readPosition.store(_readPosition.load(std::memory_order_relaxed) + frames, std::memory_order_release);
+    }
+
+private:
+    float *_samples;
+    uint32_t _channels;
+    uint32_t _capacity;
+    uint32_t _mask;
+    std::atomic<uint64_t> _readPosition;
+    std::atomic<uint64_t> _writePosition;
+};
+
+#endif /* CPSourceArena_hpp */
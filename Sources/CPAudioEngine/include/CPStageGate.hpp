@@ -0,0 +1,129 @@
+//
+//  CPStageGate.hpp
+//  CPAudioEngine
+//
+//  Per block decision whether an effect stage has to run
+//
+
+#ifndef CPStageGate_hpp
+#define CPStageGate_hpp
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+
+/// -90 dBFS: below this a block, or what a stage adds to it, counts as silent.
+static const float kCPSilenceThreshold = 3.1623e-5f;
+
+/// True if every sample of the block is below `threshold`.
+static inline bool CPIsSilent(const float *const *channels, uint32_t numChannels, uint32_t frames, float threshold = kCPSilenceThreshold) {
+    for (uint32_t channel = 0; channel < numChannels; channel++) {
+        const float *samples = channels[channel];
+        for (uint32_t i = 0; i < frames; i++) {
+            if (std::fabs(samples[i]) >= threshold) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ Stages start out neutral, and a neutral stage is skipped: its input passes through untouched.
+ Stages with a tail (delay, reverb) keep running after they turn neutral or their input goes
+ silent, until what they add to the signal has stayed below kCPSilenceThreshold for the hold
+ time. Then they idle until audible input, or a non-neutral setting, comes back.
+ */
+class CPStageGate {
+public:
+    CPStageGate(bool hasTail, double sampleRate, double holdSeconds = 0.1)
+    : _hasTail(hasTail),
+      _holdFrames((uint32_t)std::max(1.0, sampleRate * holdSeconds)),
+      _neutral(true),
+      _running(false),
+      _resumed(false),
+      _inputSilent(true),
+      _quietFrames(0),
+      _skippedBlocks(0),
+      _oversizeBlocks(0) {}
+
+    //Control thread
+    /// Anything the render thread needs for the stage must be set up before the stage turns non-neutral.
+    void setNeutral(bool neutral) { _neutral.store(neutral, std::memory_order_release); }
+    bool isNeutral() const { return _neutral.load(std::memory_order_relaxed); }
+    bool hasTail() const { return _hasTail; }
+    /// Blocks shouldProcess() let pass untouched, the stage being neutral or idle.
+    uint64_t skippedBlocks() const { return _skippedBlocks.load(std::memory_order_relaxed); }
+    /// Blocks passed through because they did not fit the stage, see countOversizeBlock().
+    uint64_t oversizeBlocks() const { return _oversizeBlocks.load(std::memory_order_relaxed); }
+
+    //Render thread
+    /// `input` is only scanned for silence when the answer depends on it, for a tail stage that is
+    /// not neutral; a neutral stage costs one flag check.
+    bool shouldProcess(const float *const *input, uint32_t numChannels, uint32_t frames) {
+        bool neutral = _neutral.load(std::memory_order_acquire);
+        bool wasRunning = _running;
+        if (!_hasTail) {
+            _running = !neutral;
+        }
+        else {
+            _inputSilent = neutral || CPIsSilent(input, numChannels, frames);
+            if (!_inputSilent) {
+                _running = true;
+                _quietFrames = 0;
+            }
+        }
+        _resumed = _running && !wasRunning;
+        if (!_running) {
+            _skippedBlocks.store(_skippedBlocks.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+        return _running;
+    }
+    /// The stage could not take the block (longer than its buffers) and passed it through instead.
+    void countOversizeBlock() {
+        _oversizeBlocks.store(_oversizeBlocks.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+    /// The last shouldProcess() started the stage after it had idled (or on its first block);
+    /// whatever state the stage kept from before is stale.
+    bool resumed() const { return _resumed; }
+
+    /// Feeds a processed block back to a tail stage; `input` is what the stage was given.
+    void observe(const float *const *input, const float *const *output, uint32_t numChannels, uint32_t frames) {
+        if (!_hasTail || !_running) {
+            return;
+        }
+        if (!_neutral.load(std::memory_order_relaxed) && !_inputSilent) {
+            return;
+        }
+        //Only what the stage adds counts as tail
+        bool quiet = true;
+        for (uint32_t channel = 0; channel < numChannels && quiet; channel++) {
+            for (uint32_t i = 0; i < frames; i++) {
+                if (std::fabs(output[channel][i] - input[channel][i]) >= kCPSilenceThreshold) {
+                    quiet = false;
+                    break;
+                }
+            }
+        }
+        _quietFrames = quiet ? _quietFrames + frames : 0;
+        if (_quietFrames >= _holdFrames) {
+            _running = false;
+        }
+    }
+
+private:
+    bool _hasTail;
+    uint32_t _holdFrames;
+    std::atomic<bool> _neutral;
+    //Render thread
+    bool _running;
+    bool _resumed;
+    bool _inputSilent;
+    uint32_t _quietFrames;
+    //Written by the render thread only, read anywhere
+    std::atomic<uint64_t> _skippedBlocks;
+    std::atomic<uint64_t> _oversizeBlocks;
+};
+
+#endif /* CPStageGate_hpp */
@@ -0,0 +1,167 @@
+//
+//  CPTrackSource.hpp
+//  CPAudioEngine
+//
+//  Persistent source stage: tracks are attached to preallocated decks and crossfaded in
+//
+
+#ifndef CPTrackSource_hpp
+#define CPTrackSource_hpp
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "CPAudioDecoder.hpp"
+#include "CPMatrixMixer.hpp"
+#include "CPSourceArena.hpp"
+
+struct CPTrackSourceStats {
+    double lastSwitchLatency;           //seconds from attach() to the first rendered frame of the new track
+    uint64_t switches;
+    uint64_t allocations;               //allocations counted on the switch path (decoders, their buffers, captures), see CPAllocationCount.hpp
+    uint64_t allocationsLastSwitch;     //of which made by the most recent attach() or seek(), opening the decoder included
+    uint64_t underruns;                 //times the current track's ring ran dry, however many blocks it stayed dry
+    uint64_t loaderWakeups;             //times the loader thread woke from its wait
+};
+
+/// How the loader keeps the deck rings filled.
+enum CPReadAhead {
+    CPReadAheadEager,                   //tops up every few milliseconds, rings stay nearly full
+    CPReadAheadBatched                  //lets a ring drain to half, then refills it in one go
+};
+
+/**
+ The source never tears down: all ring memory comes from one arena allocated up front, a
+ loader thread keeps the rings topped up, and switching track (or seeking) primes a spare
+ deck and hands it to the render thread, which fades the old deck out while the new one
+ fades in.
+ Tracks keep their own channel count (up to kCPMixerMaxChannels); every deck is read through the
+ matrix mixer, so downmix, balance, volume and the crossfade gain cost one pass.
+ */
+class CPTrackSource {
+public:
+    typedef void (*TrackEndCallback)(void *refCon);
+
+    static const uint32_t kDecks = 3;
+
+    /// Output channels are the mixer's. `ringFrames` is the per-deck buffer length for stereo tracks.
+    CPTrackSource(double sampleRate, CPMatrixMixer &mixer, uint32_t ringFrames = 1 << 16);
+    ~CPTrackSource();
+
+    //Control thread
+    /// Tell the source whether render() may currently be called. While stopped, switches apply immediately.
+    void setRendering(bool rendering);
+    bool isRendering() const;
+    /// Primes a spare deck from `decoder` at `startFrame` and switches to it. The decoder must run at
+    /// the source sample rate with 1 to kCPMixerMaxChannels channels.
+    bool attach(std::unique_ptr<CPAudioDecoder> decoder, int64_t startFrame = 0);
+    /// Fades out and drops the current track.
+    void detach();
+    bool hasTrack() const { return _currentDeck >= 0; }
+    /// Re-primes the current track at `frame` on a spare deck and crossfades to it.
+    bool seek(int64_t frame);
+    /// Frames of the current track rendered so far (including the start offset)
+    int64_t position() const;
+    int64_t lengthFrames() const { return _currentLength; }
+    double sampleRate() const { return _sampleRate; }
+    uint32_t channels() const { return _channels; }
+    /// Channel count of the current track
+    uint32_t trackChannels() const;
+    void setTrackEndCallback(TrackEndCallback callback, void *refCon);
+    /// Batched read-ahead decodes in long runs and wakes the loader a few times a second at most,
+    /// instead of fifty; for when no UI is visible and wakeups matter more than refill latency.
+    void setReadAhead(CPReadAhead readAhead);
+    CPReadAhead readAhead() const;
+    /// The output's period and how many periods its buffer holds. A device asks for its whole buffer
+    /// back to back when it starts or recovers, so switches are primed for that and a period more,
+    /// and batched read-ahead never lets a ring drain below it.
+    void setOutputBuffer(uint32_t periodFrames, uint32_t periods);
+    CPTrackSourceStats stats() const;
+
+    //Render thread
+    /// Writes `frames` frames of source audio (silence when nothing is attached) into `out`.
+    /// Returns how many of them came from the current track.
+    uint32_t render(float *const *out, uint32_t channels, uint32_t frames);
+
+private:
+    enum DeckState : uint32_t { DeckIdle, DeckLoading, DeckActive, DeckFading };
+    static const int kNoDeck = -1;
+    static const int kDetach = -2;
+    static const uint32_t kPrimeFrames = 4096;
+    static const uint32_t kPrimePeriods = 3;
+    static const uint32_t kLoaderChunkFrames = 8192;
+
+    struct Deck {
+        std::atomic<uint32_t> state;
+        float *memory;                              //this deck's slice of the arena
+        CPFrameRing ring;
+        std::unique_ptr<CPAudioDecoder> decoder;    //guarded by _mutex
+        std::atomic<bool> endOfStream;
+        int64_t startFrame;
+        std::atomic<int64_t> framesRendered;
+        std::chrono::steady_clock::time_point requestTime;
+        bool refilling;                             //loader thread, batched read-ahead
+        //Render thread only
+        uint32_t fadePosition;
+        bool started;
+        bool endReported;
+        bool starved;                               //the deck's last active block ran out of audio
+    };
+
+    int claimDeckLocked(std::unique_lock<std::mutex> &lock);
+    void releaseDeckLocked(int deck);
+    bool attachLocked(std::unique_lock<std::mutex> &lock, std::unique_ptr<CPAudioDecoder> &decoder, int64_t startFrame);
+    void countSwitchAllocationsLocked();
+    void publishLocked(int deck);
+    void applyLocked(int deck);
+    uint32_t fillLocked(Deck &deck, uint32_t frames);
+    uint32_t lowWaterLocked(const Deck &deck) const;
+    void loaderMain();
+    uint32_t mixDeck(Deck &deck, float *const *out, uint32_t offset, uint32_t frames, float gain, float gainStep);
+    uint32_t renderDeck(Deck &deck, float *const *out, uint32_t frames, bool fadeIn);
+    bool reportTrackEnd();
+
+    double _sampleRate;
+    CPMatrixMixer &_mixer;
+    uint32_t _channels;
+    size_t _deckSamples;
+    uint32_t _fadeFrames;
+    CPSourceArena _arena;
+    Deck _decks[kDecks];
+
+    mutable std::mutex _mutex;
+    std::condition_variable _wake;
+    std::thread _loader;
+    bool _quit;
+    bool _rendering;
+    std::chrono::milliseconds _loaderInterval;
+    CPReadAhead _readAhead;
+    uint32_t _primeFrames;
+
+    //Control thread
+    int _currentDeck;
+    int64_t _currentLength;
+    uint64_t _allocations;
+    uint64_t _allocationsLastSwitch;
+    //Read by the render thread: odd while the pair is being replaced
+    std::atomic<uint32_t> _trackEndGeneration;
+    std::atomic<TrackEndCallback> _trackEndCallback;
+    std::atomic<void *> _trackEndRefCon;
+
+    //Handed from the control thread to the render thread
+    std::atomic<int> _pendingDeck;
+    //Render thread
+    int _activeDeck;
+    uint32_t _writtenFrames;                        //frames of the output block already holding audio
+
+    std::atomic<int64_t> _lastSwitchLatency;
+    std::atomic<uint64_t> _switches;
+    std::atomic<uint64_t> _underruns;
+    std::atomic<uint64_t> _loaderWakeups;
+};
+
+#endif /* CPTrackSource_hpp */
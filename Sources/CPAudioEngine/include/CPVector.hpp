@@ -0,0 +1,83 @@
+//
+//  CPVector.hpp
+//  CPAudioEngine
+//
+//  Small SIMD kernels shared by the mixer and source stages
+//
+
+#ifndef CPVector_hpp
+#define CPVector_hpp
+
+#include <cstdint>
+#include <cstring>
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#elif defined(__SSE__) || defined(__x86_64__)
+#include <xmmintrin.h>
+#endif
+
+/// out[i] = gain * in[i]
+static inline void CPVectorScale(const float *in, float *out, float gain, uint32_t frames) {
+    uint32_t i = 0;
+#if defined(__aarch64__)
+    float32x4_t g = vdupq_n_f32(gain);
+    for (; i + 4 <= frames; i += 4) {
+        vst1q_f32(out + i, vmulq_f32(vld1q_f32(in + i), g));
+    }
+#elif defined(__SSE__) || defined(__x86_64__)
+    __m128 g = _mm_set1_ps(gain);
+    for (; i + 4 <= frames; i += 4) {
+        _mm_storeu_ps(out + i, _mm_mul_ps(_mm_loadu_ps(in + i), g));
+    }
+#endif
+    for (; i < frames; i++) {
+        out[i] = gain * in[i];
+    }
+}
+
+/// out[i] += gain * in[i]
+static inline void CPVectorScaleAdd(const float *in, float *out, float gain, uint32_t frames) {
+    uint32_t i = 0;
+#if defined(__aarch64__)
+    float32x4_t g = vdupq_n_f32(gain);
+    for (; i + 4 <= frames; i += 4) {
+        vst1q_f32(out + i, vfmaq_f32(vld1q_f32(out + i), vld1q_f32(in + i), g));
+    }
+#elif defined(__SSE__) || defined(__x86_64__)
+    __m128 g = _mm_set1_ps(gain);
+    for (; i + 4 <= frames; i += 4) {
+        _mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i), _mm_mul_ps(_mm_loadu_ps(in + i), g)));
+    }
+#endif
+    for (; i < frames; i++) {
+        out[i] += gain * in[i];
+    }
+}
+
+/// out[i] (+)= (gain + i * step) * in[i]; stores instead of adding when `accumulate` is false.
+static inline void CPVectorRamp(const float *in, float *out, float gain, float step, uint32_t frames, bool accumulate) {
+    uint32_t i = 0;
+#if defined(__aarch64__)
+    float32x4_t g = { gain, gain + step, gain + 2 * step, gain + 3 * step };
+    float32x4_t g4 = vdupq_n_f32(4 * step);
+    for (; i + 4 <= frames; i += 4) {
+        float32x4_t base = accumulate ? vld1q_f32(out + i) : vdupq_n_f32(0.0f);
+        vst1q_f32(out + i, vfmaq_f32(base, vld1q_f32(in + i), g));
+        g = vaddq_f32(g, g4);
+    }
+#elif defined(__SSE__) || defined(__x86_64__)
+    __m128 g = _mm_setr_ps(gain, gain + step, gain + 2 * step, gain + 3 * step);
+    __m128 g4 = _mm_set1_ps(4 * step);
+    for (; i + 4 <= frames; i += 4) {
+        __m128 base = accumulate ? _mm_loadu_ps(out + i) : _mm_setzero_ps();
+        _mm_storeu_ps(out + i, _mm_add_ps(base, _mm_mul_ps(_mm_loadu_ps(in + i), g)));
+        g = _mm_add_ps(g, g4);
+    }
+#endif
+    for (; i < frames; i++) {
+        float value = (gain + (float)i * step) * in[i];
+        out[i] = accumulate ? out[i] + value : value;
+    }
+}
+
+#endif /* CPVector_hpp */
@@ -0,0 +1,50 @@
+//
+//  CPWavFileDecoder.hpp
+//  CPAudioEngine
+//
+//  Portable WAV reader, so the engine can play files where ExtAudioFile is not available
+//
+
+#ifndef CPWavFileDecoder_hpp
+#define CPWavFileDecoder_hpp
+
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+#include "CPAudioDecoder.hpp"
+#include "CPKernels.hpp"
+
+/**
+ Reads 16, 24 and 32 bit integer and 32 bit float PCM. There is no sample rate conversion:
+ the file is played at its own rate, so it must match the engine's.
+ */
+class CPWavFileDecoder : public CPAudioDecoder {
+public:
+    /// Returns nullptr if the file is not a WAV file in one of the supported encodings.
+    static std::unique_ptr<CPAudioDecoder> open(const std::string &path);
+    ~CPWavFileDecoder() override;
+
+    uint32_t channels() const override { return _channels; }
+    double sampleRate() const override { return _sampleRate; }
+    int64_t lengthFrames() const override { return _lengthFrames; }
+    uint32_t read(float *const *channels, uint32_t frames) override;
+    bool seek(int64_t frame) override;
+
+private:
+    CPWavFileDecoder(std::FILE *file, uint32_t channels, double sampleRate, uint32_t sampleBytes, bool isFloat,
+                     long dataOffset, int64_t lengthFrames);
+
+    std::FILE *_file;
+    uint32_t _channels;
+    double _sampleRate;
+    uint32_t _sampleBytes;
+    bool _isFloat;
+    long _dataOffset;
+    int64_t _lengthFrames;
+    int64_t _position;
+    const CPKernelTable &_kernels;
+    std::vector<uint8_t> _block;
+};
+
+#endif /* CPWavFileDecoder_hpp */
@@ -0,0 +1,186 @@
+//
+//  main.cpp
+//  CPAudioHeadless
+//
+//  Plays a WAV file through the engine with no UI, optionally with the CPU under load,
+//  and reports what the output backend measured.
+//
+//  CPAudioHeadless [--output null|wav|alsa] [--file out.wav] [--period frames] [--periods n]
+//                  [--seconds s] [--load threads] [--pipeline stages] [--background] [--no-realtime] track.wav
+//
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <thread>
+#include <vector>
+#include "CPAlsaOutput.hpp"
+#include "CPClockedOutput.hpp"
+#include "CPKernels.hpp"
+#include "CPPlayerEngine.hpp"
+#include "CPWavFileDecoder.hpp"
+
+static std::atomic<bool> trackEnded(false);
+
+static void completion(void *) {
+    trackEnded.store(true);
+}
+
+//Keeps a core busy so the render thread has to compete for it
+static void burnCPU(std::atomic<bool> *running) {
+    volatile float sink = 0;
+    float value = 1.0f;
+    while (running->load(std::memory_order_relaxed)) {
+        for (int i = 0; i < 10000; i++) {
+            value = std::sqrt(value * 1.0001f + 1.0f);
+        }
+        sink = value;
+    }
+    (void)sink;
+}
+
+static void sleepSeconds(double seconds) {
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+}
+
+int main(int argc, const char *argv[]) {
+    std::string outputName = "null";
+    std::string outputFile = "headless.wav";
+    std::string trackPath;
+    CPOutputConfig config;
+    double seconds = 10;
+    int loadThreads = 0;
+    uint32_t pipelineStages = 0;
+    bool background = false;
+    for (int arg = 1; arg < argc; arg++) {
+        bool hasValue = arg + 1 < argc;
+        if (strcmp(argv[arg], "--output") == 0 && hasValue) {
+            outputName = argv[++arg];
+        }
+        else if (strcmp(argv[arg], "--file") == 0 && hasValue) {
+            outputFile = argv[++arg];
+        }
+        else if (strcmp(argv[arg], "--period") == 0 && hasValue) {
+            config.periodFrames = (uint32_t)atoi(argv[++arg]);
+        }
+        else if (strcmp(argv[arg], "--periods") == 0 && hasValue) {
+            config.periods = (uint32_t)atoi(argv[++arg]);
+        }
+        else if (strcmp(argv[arg], "--seconds") == 0 && hasValue) {
+            seconds = atof(argv[++arg]);
+        }
+        else if (strcmp(argv[arg], "--load") == 0 && hasValue) {
+            loadThreads = atoi(argv[++arg]);
+        }
+        else if (strcmp(argv[arg], "--pipeline") == 0 && hasValue) {
+            pipelineStages = (uint32_t)atoi(argv[++arg]);
+        }
+        else if (strcmp(argv[arg], "--background") == 0) {
+            background = true;
+        }
+        else if (strcmp(argv[arg], "--no-realtime") == 0) {
+            config.realtimePriority = false;
+        }
+        else {
+            trackPath = argv[arg];
+        }
+    }
+
+    std::unique_ptr<CPAudioDecoder> decoder = CPWavFileDecoder::open(trackPath);
+    if (decoder == nullptr) {
+        fprintf(stderr, "Cannot open %s as a WAV file\n", trackPath.c_str());
+        return 1;
+    }
+    //No resampling here: the device runs at the file's rate
+    config.sampleRate = decoder->sampleRate();
+
+    std::unique_ptr<CPOutputDevice> output;
+    if (outputName == "wav") {
+        output.reset(new CPWavFileOutput(outputFile, CPWavFileOutput::EncodingFloat32, true));
+    }
+#if CP_HAS_ALSA
+    else if (outputName == "alsa") {
+        output.reset(new CPAlsaOutput());
+    }
+#endif
+    else if (outputName == "null") {
+        output.reset(new CPNullOutput());
+    }
+    else {
+        fprintf(stderr, "Unknown output %s\n", outputName.c_str());
+        return 1;
+    }
+
+    const float eqFrequencies[] = { 60, 150, 400, 1100, 3100, 8000, 16000 };
+    CPPlayerEngine engine(std::move(output), config, eqFrequencies, 7);
+    if (!engine.isOpen()) {
+        fprintf(stderr, "Cannot open the %s output\n", outputName.c_str());
+        return 1;
+    }
+    engine.setCompletionCallback(&completion, nullptr);
+    engine.setPipelineStages(pipelineStages);
+    engine.setRenderMode(background ? CPRenderModeBackground : CPRenderModeInteractive);
+
+    std::atomic<bool> loadRunning(true);
+    std::vector<std::thread> load;
+    for (int thread = 0; thread < loadThreads; thread++) {
+        load.emplace_back(&burnCPU, &loadRunning);
+    }
+
+    //The same calls the app makes: play, pause, resume, seek, then play out
+    bool ok = engine.load(std::move(decoder)) && engine.play();
+    sleepSeconds(std::min(1.0, seconds / 4));
+    engine.pause();
+    double pausedAt = engine.currentPlaybackTime();
+    sleepSeconds(0.2);
+    ok = ok && engine.currentPlaybackTime() == pausedAt && engine.play();
+    ok = ok && engine.setPlaybackTime(engine.duration() / 2);
+    //Wakeups and CPU time are counted from here, where the output's own counters restarted
+    auto playing = std::chrono::steady_clock::now();
+    std::clock_t cpuStart = std::clock();
+    uint64_t loaderWakeups = engine.source().stats().loaderWakeups;
+    auto deadline = playing + std::chrono::duration<double>(seconds);
+    while (ok && !trackEnded.load() && std::chrono::steady_clock::now() < deadline) {
+        sleepSeconds(0.05);
+    }
+    double played = std::chrono::duration<double>(std::chrono::steady_clock::now() - playing).count();
+    double cpuSeconds = (double)(std::clock() - cpuStart) / CLOCKS_PER_SEC;
+    CPOutputStats stats = engine.output().stats();
+    CPTrackSourceStats sourceStats = engine.source().stats();
+    loaderWakeups = sourceStats.loaderWakeups - loaderWakeups;
+    CPPipelineStats pipelineStats = engine.pipelineStats();
+    double position = engine.currentPlaybackTime();
+    double duration = engine.duration();
+    engine.stop();
+
+    loadRunning.store(false);
+    for (std::thread &thread : load) {
+        thread.join();
+    }
+
+    const CPOutputConfig &granted = engine.output().config();
+    printf("output            %s, %.0f Hz, %u x %u frames\n", outputName.c_str(), granted.sampleRate, granted.periods, granted.periodFrames);
+    printf("render mode       %s, %u frame blocks\n", background ? "background" : "interactive", kCPEngineBlockFrames);
+    printf("realtime          %s\n", stats.realtime ? "yes" : "no");
+    printf("kernels           %s\n", CPKernelISAName(CPKernels().isa));
+    printf("latency           %.2f ms\n", stats.latency * 1e3);
+    printf("callback jitter   %.3f ms mean, %.3f ms max\n", stats.jitter * 1e3, stats.maxJitter * 1e3);
+    printf("callbacks         %llu\n", (unsigned long long)stats.callbacks);
+    printf("xruns             %llu\n", (unsigned long long)stats.xruns);
+    printf("source underruns  %llu\n", (unsigned long long)sourceStats.underruns);
+    printf("wakeups           %.1f/s render, %.1f/s loader\n", stats.callbacks / played, loaderWakeups / played);
+    printf("cpu               %.1f ms per audio minute%s\n", cpuSeconds * 1e3 * 60 / played, loadThreads > 0 ? " (includes the load)" : "");
+    if (pipelineStages > 0) {
+        printf("pipeline          %u stages, %u blocks latency, %llu underruns, first stage load %.2f%s\n",
+               pipelineStats.stages, pipelineStats.latencyBlocks, (unsigned long long)pipelineStats.underruns,
+               pipelineStats.stageLoad[0], pipelineStats.realtime ? "" : " (not realtime)");
+    }
+    printf("time to audio     %.2f ms\n", engine.timeToFirstAudio() * 1e3);
+    printf("position          %.2f / %.2f s%s\n", position, duration, trackEnded.load() ? " (ended)" : "");
+    return ok ? 0 : 2;
+}
@@ -0,0 +1,148 @@
+//
+//  CPAudioFingerprintIndex.mm
+//
+//
+//  Acoustic fingerprints of library files, for duplicate detection at import
+//
+
+#import "include/CPAudioFingerprintIndex.h"
+#include "CPFingerprint.hpp"
+#include "CPExtAudioFileDecoder.h"
+
+//Stereo is enough to downmix from; ExtAudioFile converts straight to the analysis rate
+static const uint32_t kFingerprintChannels = 2;
+
+@interface CPAudioFingerprintMatch ()
+@property (readwrite, nonatomic, copy) NSString *key;
+@property (readwrite, nonatomic) float distance;
+@end
+
+@implementation CPAudioFingerprintMatch
+@end
+
+static CPFingerprintPool &fingerprintPool() {
+    //Created on first import, the workers then park between batches
+    static CPFingerprintPool pool;
+    return pool;
+}
+
+static NSData *fingerprintData(const CPFingerprint &fingerprint) {
+    std::vector<uint8_t> bytes = fingerprint.serialize();
+    return [NSData dataWithBytes:bytes.data() length:bytes.size()];
+}
+
+static bool fingerprintFromData(NSData *data, CPFingerprint &fingerprint) {
+    return CPFingerprint::deserialize((const uint8_t *)data.bytes, data.length, fingerprint);
+}
+
+@interface CPAudioFingerprintIndex ()
+{
+    CPFingerprintIndex index;
+    //Index ids by key and back; the index works on integers
+    NSMutableDictionary<NSString *, NSNumber *> *ids;
+    NSMutableDictionary<NSNumber *, NSString *> *keys;
+    uint64_t nextId;
+}
+@end
+
+@implementation CPAudioFingerprintIndex
+
++ (NSArray *)fingerprintsForFilesAtURLs:(NSArray<NSURL *> *)urls {
+    std::vector<CPFingerprintPool::Opener> tracks;
+    for (NSURL *url in urls) {
+        tracks.push_back([url] {
+            AudioStreamBasicDescription fileFormat;
+            return CPExtAudioFileDecoder::open((__bridge CFURLRef)url, kCPFingerprintSampleRate, kFingerprintChannels, &fileFormat);
+        });
+    }
+    std::vector<CPFingerprint> fingerprints = fingerprintPool().analyze(tracks);
+    NSMutableArray *results = [NSMutableArray arrayWithCapacity:urls.count];
+    for (NSUInteger i = 0; i < urls.count; i++) {
+        [results addObject:fingerprints[i].empty() ? (id)[NSNull null] : fingerprintData(fingerprints[i])];
+    }
+    return results;
+}
+
++ (NSData *)fingerprintForFileAtURL:(NSURL *)url {
+    id fingerprint = [self fingerprintsForFilesAtURLs:@[url]].firstObject;
+    return [fingerprint isKindOfClass:[NSData class]] ? fingerprint : nil;
+}
+
++ (double)durationOfFingerprint:(NSData *)fingerprint {
+    CPFingerprint decoded;
+    return fingerprintFromData(fingerprint, decoded) ? decoded.duration : 0;
+}
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        ids = [NSMutableDictionary dictionary];
+        keys = [NSMutableDictionary dictionary];
+        nextId = 1;
+    }
+    return self;
+}
+
+- (NSUInteger)count {
+    return index.size();
+}
+
+- (void)addFingerprint:(NSData *)fingerprint forKey:(NSString *)key {
+    CPFingerprint decoded;
+    if (!fingerprintFromData(fingerprint, decoded)) {
+        return;
+    }
+    uint64_t fingerprintId;
+    @synchronized (self) {
+        NSNumber *existing = ids[key];
+        fingerprintId = existing != nil ? existing.unsignedLongLongValue : nextId++;
+        ids[key] = @(fingerprintId);
+        keys[@(fingerprintId)] = [key copy];
+    }
+    index.add(fingerprintId, decoded);
+}
+
+- (void)removeFingerprintForKey:(NSString *)key {
+    NSNumber *fingerprintId;
+    @synchronized (self) {
+        fingerprintId = ids[key];
+        if (fingerprintId == nil) {
+            return;
+        }
+        [ids removeObjectForKey:key];
+        [keys removeObjectForKey:fingerprintId];
+    }
+    index.remove(fingerprintId.unsignedLongLongValue);
+}
+
+- (void)removeAllFingerprints {
+    @synchronized (self) {
+        [ids removeAllObjects];
+        [keys removeAllObjects];
+    }
+    index.clear();
+}
+
+- (NSArray<CPAudioFingerprintMatch *> *)matchesForFingerprint:(NSData *)fingerprint {
+    CPFingerprint decoded;
+    if (!fingerprintFromData(fingerprint, decoded)) {
+        return @[];
+    }
+    std::vector<CPFingerprintMatch> found = index.query(decoded);
+    NSMutableArray<CPAudioFingerprintMatch *> *matches = [NSMutableArray arrayWithCapacity:found.size()];
+    @synchronized (self) {
+        for (const CPFingerprintMatch &match : found) {
+            NSString *key = keys[@(match.id)];
+            if (key == nil) {
+                continue;
+            }
+            CPAudioFingerprintMatch *result = [[CPAudioFingerprintMatch alloc] init];
+            result.key = key;
+            result.distance = match.distance;
+            [matches addObject:result];
+        }
+    }
+    return matches;
+}
+
+@end
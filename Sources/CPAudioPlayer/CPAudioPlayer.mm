@@ -7,25 +7,84 @@
 //
 
 #import "include/CPAudioPlayer.h"
-#import "include/CPBandEqulizer.h"
 #import <AVFoundation/AVFoundation.h>
+#include <mach/mach_time.h>
+#include <mutex>
+#include "CPPlayerEngine.hpp"
+#include "CPRoomDelay.hpp"
+#include "CPStageGate.hpp"
+#include "CPDecodedAudioCache.hpp"
+#include "CPExtAudioFileDecoder.h"
+#include "CPRemoteIOOutput.h"
 
 //:TODO
 //Handle uninitilizing
 //...
 
+//Effect stages in processing order. None of them exist until one of their parameters first leaves neutral.
+typedef enum {
+    STAGE_IPOD_EQ = 0,
+    STAGE_BASS_BOOST,
+    STAGE_TREBLE,
+    STAGE_REVERB,
+    STAGE_DELAY,
+    STAGE_COUNT
+} CPStage;
+
+typedef struct {
+    OSType type;
+    OSType subType;
+    AudioUnit *unit;        //slot in CPPlayer the parameter accessors use, nullptr for native stages
+    Boolean warmUp;         //heavy enough to instantiate ahead of use on the warm-up queue
+    Boolean hasTail;        //keeps sounding after its input stops (delay, reverb)
+    Boolean instantiated;
+    CPStageGate *gate;      //whether the render thread runs the stage this block
+} CPGraphStage;
+
 @interface CPAudioPlayer ()
 
 @property (readwrite, nonatomic) double currentPlaybackTime;
 @property (strong, nonatomic, readwrite) NSURL *songUrl;
-@property (strong, nonatomic, readwrite) CPBandEqulizer *bandEq;
-@property (strong, nonatomic, readwrite) CPBandEqulizer *bassBooster;
+@property (strong, nonatomic, readwrite) NSArray *bandFrequencies;
+@property (readwrite, nonatomic) double launchDuration;
 @end
 
 @implementation CPAudioPlayer
 static CPAudioPlayer *globalPlayer;
 CPPlayer globalCPPlayer;
-AUNode testNode;
+static Float64 globalSampleRate;
+static CPGraphStage graphStages[STAGE_COUNT];
+//Serialises stage instantiation between the control thread and the warm-up queue
+static std::mutex graphLock;
+//Source, mixer and band EQ rendering into RemoteIO; each effect stage is one of its process callbacks
+static CPPlayerEngine *globalEngine = nullptr;
+static const UInt32 kEngineChannels = 2;
+static const UInt32 kEnginePeriodFrames = 1024;
+//Recently played and prefetched tracks, decoded. Outlives the engine's source, whose decoders may read from it.
+static CPDecodedAudioCache *globalCache = nullptr;
+static const size_t kDefaultDecodedCacheBytes = 64 << 20;
+//File formats of cached tracks, so a cache hit still reports the file's own format
+static NSMutableDictionary<NSString *, NSValue *> *cachedFileFormats;
+//Stages are pulled one engine block at a time, whatever slice RemoteIO asks for
+static const UInt32 kStageFramesPerSlice = kCPEngineBlockFrames;
+//Input handed to each effect stage as it renders. Per stage, as pipelined stages render on different threads.
+static float stageInputs[STAGE_COUNT][kEngineChannels][kStageFramesPerSlice];
+//Sample time each stage is rendered at (its rendering thread only)
+static Float64 stageSampleTimes[STAGE_COUNT];
+//Whether each stage processed its last block
+static std::atomic<bool> stageProcessing[STAGE_COUNT];
+//Fade completions by automation event id; events are posted to the main queue
+static NSMutableDictionary<NSNumber *, _fadeCompletionHandler> *fadeCompletions;
+static UInt32 lastFadeEvent = 0;
+//Event of the pending sleep fade (0 for none) and the gain it held before fading
+static UInt32 sleepFadeEvent = 0;
+static float sleepHoldGain = 1;
+//The room stage (STAGE_DELAY), rendered natively; created when the stage is first engaged
+static CPRoomDelay *globalRoom = nullptr;
+//Room size 1 is DELAY_TIME seconds; leaves headroom for modulation
+static const float kRoomMaxDelaySeconds = 0.25f;
+//Fade back to unity when a fade is cancelled
+static const double kCancelFadeSeconds = 0.05;
 
 static Boolean CheckError(OSStatus error, const char *operation) {
     if (error == noErr) return false;
@@ -43,250 +102,358 @@ static Boolean CheckError(OSStatus error, const char *operation) {
     return true;
 }
 
-void createAuGraph(CPPlayer *player) {
-    CheckError(NewAUGraph(&player->graph), "New graph creation failed");
-    AudioUnit convertrunit = nullptr;
-    AudioUnit bassBoostConvertrunit = nullptr;
-    AudioUnit trebleConvertrunit = nullptr;
-    AUNode filePlayerNode = createAndAddNodeToGraphWithType(kAudioUnitType_Generator, kAudioUnitSubType_AudioFilePlayer);
-    AUNode mixerNode= createAndAddNodeToGraphWithType(kAudioUnitType_Mixer, kAudioUnitSubType_MultiChannelMixer);
-    AUNode outputNode = createAndAddNodeToGraphWithType(kAudioUnitType_Output, kAudioUnitSubType_RemoteIO);
-    AUNode eqNode = createAndAddNodeToGraphWithType(kAudioUnitType_Effect, kAudioUnitSubType_AUiPodEQ);
-    AUNode bandEQNode = createAndAddNodeToGraphWithType(kAudioUnitType_Effect, kAudioUnitSubType_NBandEQ);
-    AUNode bassBoostNode = createAndAddNodeToGraphWithType(kAudioUnitType_Effect, kAudioUnitSubType_LowShelfFilter);
-    AUNode trebleNode = createAndAddNodeToGraphWithType(kAudioUnitType_Effect, kAudioUnitSubType_HighShelfFilter);
-    AUNode reverbNode = createAndAddNodeToGraphWithType(kAudioUnitType_Effect, kAudioUnitSubType_Reverb2);
-    AUNode delayNode = createAndAddNodeToGraphWithType(kAudioUnitType_Effect, kAudioUnitSubType_Delay);
-//    testNode = createAndAddNodeToGraphWithType(kAudioUnitType_Effect, kAudioUnitSubType_PeakLimiter);
-    AUNode converterNode = createAndAddNodeToGraphWithType(kAudioUnitType_FormatConverter, kAudioUnitSubType_AUConverter);
-    AUNode bassBoostConverterNode = createAndAddNodeToGraphWithType(kAudioUnitType_FormatConverter, kAudioUnitSubType_AUConverter);
-    AUNode trebleConverterNode = createAndAddNodeToGraphWithType(kAudioUnitType_FormatConverter, kAudioUnitSubType_AUConverter);
-    //Open graph befor accesing audiounits from the nodes
-    CheckError(AUGraphOpen(player->graph), "Failed opening graph");
-    //Config the audiounit
-    
-    configAudioUnitInNode(filePlayerNode, &player->filePlayerUnit);
-    configAudioUnitInNode(mixerNode, &player->mxUnit);
-    configAudioUnitInNode(bandEQNode, &player->bandEQUnit);
-    configAudioUnitInNode(reverbNode, &player->reverbUnit);
-    configAudioUnitInNode(delayNode, &player->delayUnit);
-    //configAudioUnitInNode(testNode, &player->testUnit);
-    configAudioUnitInNode(eqNode, &player->eqUnit);
-    configAudioUnitInNode(bassBoostNode, &player->bassBoostUnit);
-    configAudioUnitInNode(trebleNode, &player->treble);
-    configAudioUnitInNode(converterNode, &convertrunit);
-    configAudioUnitInNode(bassBoostConverterNode, &bassBoostConvertrunit);
-    configAudioUnitInNode(trebleConverterNode, &trebleConvertrunit);
-    
-    //some AU nodes take a stream format in float by default, while others take it in integers. So fix the issue by adding a converter
-    addConverterForNodes(player->eqUnit, player->bandEQUnit, convertrunit);
-    addConverterForNodes(player->bandEQUnit, player->bassBoostUnit, bassBoostConvertrunit);
-    addConverterForNodes(player->bassBoostUnit, player->treble, trebleConvertrunit);
-    //Connect Nodes
-    mapNodeToGraph(filePlayerNode, 0, mixerNode, 0);
-    mapNodeToGraph(mixerNode, 0, eqNode, 0);
-    mapNodeToGraph(eqNode, 0, converterNode, 0);
-    mapNodeToGraph(converterNode, 0, bandEQNode, 0);
-    mapNodeToGraph(bandEQNode, 0, bassBoostConverterNode, 0);
-    mapNodeToGraph(bassBoostConverterNode, 0, bassBoostNode, 0);
-    mapNodeToGraph(bassBoostNode, 0, trebleConverterNode, 0);
-    mapNodeToGraph(trebleConverterNode, 0, trebleNode, 0);
-    mapNodeToGraph(trebleNode, 0, reverbNode, 0);
-    mapNodeToGraph(reverbNode, 0, delayNode, 0);
-    mapNodeToGraph(delayNode, 0, outputNode, 0);
-    CheckError(AUGraphInitialize(player->graph), "Faile graph initilization");
-}
-
-AUNode createAndAddNodeToGraphWithType(OSType type, OSType subType)
+Float64 engineSampleRate() {
+    Float64 sampleRate = [AVAudioSession sharedInstance].sampleRate;
+    return sampleRate > 0 ? sampleRate : 44100.0;
+}
+
+double hostTimeToSeconds(uint64_t hostTime) {
+    static mach_timebase_info_data_t timebase;
+    if (timebase.denom == 0) {
+        mach_timebase_info(&timebase);
+    }
+    return (double)hostTime * timebase.numer / timebase.denom / 1e9;
+}
+
+//Non-interleaved float, the format the native stages process in place
+AudioStreamBasicDescription engineStreamFormat(Float64 sampleRate)
 {
-    AUNode theNode;
+    AudioStreamBasicDescription asbd = { 0 };
+    asbd.mSampleRate = sampleRate;
+    asbd.mFormatID = kAudioFormatLinearPCM;
+    asbd.mFormatFlags = kAudioFormatFlagsNativeFloatPacked | kAudioFormatFlagIsNonInterleaved;
+    asbd.mBitsPerChannel = 32;
+    asbd.mChannelsPerFrame = kEngineChannels;
+    asbd.mFramesPerPacket = 1;
+    asbd.mBytesPerFrame = sizeof(Float32);
+    asbd.mBytesPerPacket = sizeof(Float32);
+    return asbd;
+}
+
+//Called on the render thread when the current track has played out
+void trackEndCallback(void *refCon) {
+    dispatch_async(dispatch_get_main_queue(), ^{
+        if (globalPlayer && globalPlayer.songCompletion) {
+            globalPlayer.songCompletion();
+        }
+    });
+}
+
+//Called on the render thread when an automation segment carrying an event completes
+void automationEventCallback(void *refCon, uint32_t event) {
+    dispatch_async(dispatch_get_main_queue(), ^{
+        _fadeCompletionHandler completion = nil;
+        @synchronized (fadeCompletions) {
+            completion = fadeCompletions[@(event)];
+            [fadeCompletions removeObjectForKey:@(event)];
+        }
+        if (completion) {
+            completion();
+        }
+    });
+}
+
+//Registers a completion and returns the event id the lane reports it with, 0 for none
+UInt32 addFadeCompletion(_fadeCompletionHandler completion) {
+    @synchronized (fadeCompletions) {
+        //Replacing a fade drops its segments, so their completions never fire
+        [fadeCompletions removeAllObjects];
+        if (completion == nil) {
+            return 0;
+        }
+        lastFadeEvent = lastFadeEvent == UINT32_MAX ? 1 : lastFadeEvent + 1;
+        fadeCompletions[@(lastFadeEvent)] = [completion copy];
+        return lastFadeEvent;
+    }
+}
+
+AudioUnit newEffectUnit(OSType type, OSType subType)
+{
+    AudioUnit unit = nullptr;
     AudioComponentDescription unitDescription = {0};
     unitDescription.componentType          = type;
     unitDescription.componentSubType       = subType;
     unitDescription.componentManufacturer  = kAudioUnitManufacturer_Apple;
-    CheckError(AUGraphAddNode(globalCPPlayer.graph, &unitDescription, &theNode), "Failed add node to graph ");
-    return theNode;
+    AudioComponent component = AudioComponentFindNext(NULL, &unitDescription);
+    CheckError(AudioComponentInstanceNew(component, &unit), "Failed creating audio unit");
+    //Sized for the engine block; only RemoteIO has to take the long slices of sleep mode
+    UInt32 maxFPS = kStageFramesPerSlice;
+    CheckError(AudioUnitSetProperty(unit, kAudioUnitProperty_MaximumFramesPerSlice, kAudioUnitScope_Global, 0, &maxFPS, sizeof(maxFPS)), "Failed setting frame per slice");
+    return unit;
+}
+
+#pragma mark Lazy stages
+//Stage units are not connected to anything, the engine's process callback pulls them in order
+OSStatus stageInputCallback(void *                      inRefCon,
+                            AudioUnitRenderActionFlags *ioActionFlags,
+                            const AudioTimeStamp *      inTimeStamp,
+                            UInt32                      inBusNumber,
+                            UInt32                      inNumberFrames,
+                            AudioBufferList *           ioData) {
+    float (*input)[kStageFramesPerSlice] = stageInputs[(intptr_t)inRefCon];
+    for (UInt32 channel = 0; channel < ioData->mNumberBuffers; channel++) {
+        memcpy(ioData->mBuffers[channel].mData, input[MIN(channel, kEngineChannels - 1)], inNumberFrames * sizeof(float));
+    }
+    return noErr;
 }
 
-void addConverterForNodes(AudioUnit fromUnit, AudioUnit toUnit, AudioUnit converterUnit)
-{
-    //Set conveter unit input format as eq preset unit asbd
-    AudioStreamBasicDescription fromAsbd;
-    UInt32 streamFormatSize = sizeof(fromAsbd);
-    CheckError(AudioUnitGetProperty(fromUnit, kAudioUnitProperty_StreamFormat, kAudioUnitScope_Output, 0, &fromAsbd, &streamFormatSize), "Failed Converter getting output");
-    CheckError(AudioUnitSetProperty(converterUnit, kAudioUnitProperty_StreamFormat, kAudioUnitScope_Input, 0, &fromAsbd, streamFormatSize), "Failed Converter setting input");
-    //Set converter unit out put format as band eq unit asbd
-    AudioStreamBasicDescription toAsbd;
-    UInt32 bandstreamFormatSize = sizeof(toAsbd);
-    CheckError(AudioUnitGetProperty(toUnit, kAudioUnitProperty_StreamFormat, kAudioUnitScope_Input, 0, &toAsbd, &bandstreamFormatSize), "Failed Converter getting input");
-    CheckError(AudioUnitSetProperty(converterUnit, kAudioUnitProperty_StreamFormat, kAudioUnitScope_Output, 0, &toAsbd, bandstreamFormatSize), "Failed Converter setting output");
-}
-
-void configAudioUnitInNode(AUNode node, AudioUnit *audioUnit)
-{
-    CheckError(AUGraphNodeInfo(globalCPPlayer.graph, node, NULL, audioUnit), "Failed getting audio unit info from node");
-    //have to add maxFPS for all units to play audio in sleep mode.
-    if (audioUnit != nullptr) {
-        UInt32 maxFPS = 4096;
-        CheckError(AudioUnitSetProperty(*audioUnit, kAudioUnitProperty_MaximumFramesPerSlice, kAudioUnitScope_Global, 0, &maxFPS, sizeof(maxFPS)), "Failed setting frame per slice");
+void initGraphStages(CPPlayer *player) {
+    graphStages[STAGE_IPOD_EQ]    = CPGraphStage { kAudioUnitType_Effect, kAudioUnitSubType_AUiPodEQ, &player->eqUnit, true, false };
+    graphStages[STAGE_BASS_BOOST] = CPGraphStage { kAudioUnitType_Effect, kAudioUnitSubType_LowShelfFilter, &player->bassBoostUnit, false, false };
+    graphStages[STAGE_TREBLE]     = CPGraphStage { kAudioUnitType_Effect, kAudioUnitSubType_HighShelfFilter, &player->treble, false, false };
+    graphStages[STAGE_REVERB]     = CPGraphStage { kAudioUnitType_Effect, kAudioUnitSubType_Reverb2, &player->reverbUnit, true, true };
+    graphStages[STAGE_DELAY]      = CPGraphStage { 0, 0, nullptr, false, true };
+    for (int index = 0; index < STAGE_COUNT; index++) {
+        graphStages[index].gate = new CPStageGate(graphStages[index].hasTail, globalSampleRate);
     }
 }
 
-void mapNodeToGraph(AUNode sourceNode, UInt32 sourceBus, AUNode destNode, UInt32 destBus)
-{
-    CheckError(AUGraphConnectNodeInput(globalCPPlayer.graph, sourceNode, sourceBus, destNode, destBus), "Failed connecting nodes");
+//The engine must be gone first: its render thread pulls the units
+void disposeGraphStages() {
+    for (int index = 0; index < STAGE_COUNT; index++) {
+        if (graphStages[index].instantiated && graphStages[index].unit != nullptr) {
+            AudioUnitUninitialize(*graphStages[index].unit);
+            AudioComponentInstanceDispose(*graphStages[index].unit);
+            *graphStages[index].unit = nullptr;
+        }
+        delete graphStages[index].gate;
+    }
+    delete globalRoom;
+    globalRoom = nullptr;
+    memset(graphStages, 0, sizeof(graphStages));
 }
 
-void setUpFile(CPPlayer *player, CFURLRef songUrl, Boolean *isError) {
-    AudioFileOpenURL(songUrl, kAudioFileReadPermission, 0, &player->inputFile);
-    if (&player->inputFile != nil) {
-        UInt32 propSize = sizeof(player->asbd);
-        *isError = CheckError(AudioFileGetProperty(player->inputFile, kAudioFilePropertyDataFormat, &propSize, &player->asbd), "Failed geting [kAudioFilePropertyDataFormat]");
+//Creates the stage's unit, ready to be pulled. Caller holds graphLock.
+void instantiateStage(CPStage index) {
+    CPGraphStage *stage = &graphStages[index];
+    if (stage->instantiated) {
+        return;
     }
-    else {
-        *isError = true;
-    }
-}
-
-void prepareAudioFile(CPPlayer *player) {
-    //tell the player to load the file
-    CheckError(AudioUnitSetProperty(player->filePlayerUnit, kAudioUnitProperty_ScheduledFileIDs, kAudioUnitScope_Global, 0, &player->inputFile, sizeof(player->inputFile)), "Failed setting files to load for AU");
-    schedulePlayReginForUnit(player);
-    setAudioStartTimeStamp(player);
-    addRenderNotifier(player);
-}
-
-void prepareResumeAudioFile(CPPlayer *player) {
-    schedulePlayReginForUnit(player);
-    setAudioStartTimeStamp(player);
-}
-
-//Schedule audio file region
-void schedulePlayReginForUnit(CPPlayer *player) {
-    initilizeGraph();
-    //Set Prime for unit
-    UInt32 defaultVal = 0;
-    CheckError(AudioUnitSetProperty(player->filePlayerUnit, kAudioUnitProperty_ScheduledFilePrime, kAudioUnitScope_Global, 0, &defaultVal, sizeof(defaultVal)), "Failed setting [kAudioUnitProperty_ScheduledFilePrime]");
-    
-    //Setup audio file region
-    memset(&player->region.mTimeStamp, 0, sizeof(player->region.mTimeStamp));
-    player->region.mTimeStamp.mFlags = kAudioTimeStampSampleTimeValid;
-    player->region.mTimeStamp.mSampleTime = 0;
-    player->region.mCompletionProc = NULL;
-    player->region.mCompletionProcUserData = NULL;
-    player->region.mAudioFile = player->inputFile;
-    player->region.mLoopCount = 0;
-    player->region.mStartFrame = player->playBackStartFrame;
-    player->region.mFramesToPlay = (UInt32) - 1;
-    CheckError(AudioUnitSetProperty(player->filePlayerUnit, kAudioUnitProperty_ScheduledFileRegion, kAudioUnitScope_Global, 0, &player->region, sizeof(player->region)), "Failed setting [kAudioUnitProperty_ScheduledFileRegion]");
-}
-
-//Set up start time for audio -1 imediately start
-void setAudioStartTimeStamp(CPPlayer *player) {
-    AudioTimeStamp startTime;
-    memset(&startTime, 0, sizeof(startTime));
-    startTime.mFlags = kAudioTimeStampSampleTimeValid;
-    startTime.mSampleTime = -1;
-    CheckError(AudioUnitSetProperty(player->filePlayerUnit, kAudioUnitProperty_ScheduleStartTimeStamp, kAudioUnitScope_Global, 0, &startTime, sizeof(startTime)), "Failed setting [kAudioUnitProperty_ScheduleStartTimeStamp]");
-}
-
-void addRenderNotifier(CPPlayer *player) {
-    CheckError(AudioUnitAddRenderNotify(player->filePlayerUnit, &playRenderNotify, &player), "Failed add render notifier");
-}
-
-OSStatus playRenderNotify(void *                      inRefCon,
-                          AudioUnitRenderActionFlags *ioActionFlags,
-                          const AudioTimeStamp *      inTimeStamp,
-                          UInt32                      inBusNumber,
-                          UInt32                      inNumberFrames,
-                          AudioBufferList *           ioData) {
-    if (*ioActionFlags & kAudioUnitRenderAction_PostRender) {
-        float value;
-        AudioUnitGetParameter(globalCPPlayer.testUnit, kDynamicsProcessorParam_CompressionAmount, kAudioUnitScope_Global, 0, &value);
-        double currentPlayTime =  [globalPlayer currentPlaybackTime];
-        double totalDuration = globalPlayer.playBackduration;
-        if (currentPlayTime >= totalDuration) {
-            if (globalPlayer && globalPlayer.songCompletion) {
-                globalPlayer.songCompletion();
-                resetFilePlayerUnit(0.0);
-            }
-        }
+    if (index == STAGE_DELAY) {
+        //Native: the ring buffer is the only allocation the stage ever makes
+        globalRoom = new CPRoomDelay(globalSampleRate, kRoomMaxDelaySeconds, kEngineChannels);
+        stage->instantiated = true;
+        return;
     }
-    return noErr;
+    *stage->unit = newEffectUnit(stage->type, stage->subType);
+    //Every stage runs in the engine format, so no converter units are needed between them
+    AudioStreamBasicDescription format = engineStreamFormat(globalSampleRate);
+    CheckError(AudioUnitSetProperty(*stage->unit, kAudioUnitProperty_StreamFormat, kAudioUnitScope_Input, 0, &format, sizeof(format)), "Failed setting stage input format");
+    CheckError(AudioUnitSetProperty(*stage->unit, kAudioUnitProperty_StreamFormat, kAudioUnitScope_Output, 0, &format, sizeof(format)), "Failed setting stage output format");
+    AURenderCallbackStruct input = { &stageInputCallback, (void *)(intptr_t)index };
+    CheckError(AudioUnitSetProperty(*stage->unit, kAudioUnitProperty_SetRenderCallback, kAudioUnitScope_Input, 0, &input, sizeof(input)), "Failed setting stage input callback");
+    //Allocate the unit's resources now rather than on the render thread's first pull
+    CheckError(AudioUnitInitialize(*stage->unit), "Failed initializing stage");
+    if (index == STAGE_REVERB) {
+        //The reverb always ran at its (wet) defaults in the original graph, so it goes live as soon
+        //as it exists rather than waiting for a parameter change
+        float dryWet = 0;
+        AudioUnitGetParameter(*stage->unit, kReverb2Param_DryWetMix, kAudioUnitScope_Global, 0, &dryWet);
+        stage->gate->setNeutral(dryWet == 0);
+    }
+    stage->instantiated = true;
 }
 
-#pragma mark Utilities
-void initilizeGraph() {
-    Boolean isinitilized;
-    CheckError(AUGraphIsInitialized(globalCPPlayer.graph, &isinitilized), "Failed check in initilized");
-    if (!isinitilized) {
-        CheckError(AUGraphInitialize(globalCPPlayer.graph), "Failed un reinitilizing graph");
+//Instantiates the stage if needed and returns its unit, ready for setStageNeutral(index, false)
+AudioUnit engageStage(CPStage index) {
+    std::lock_guard<std::mutex> lock(graphLock);
+    instantiateStage(index);
+    return *graphStages[index].unit;
+}
+
+Boolean isStageInstantiated(CPStage index) {
+    std::lock_guard<std::mutex> lock(graphLock);
+    return graphStages[index].instantiated;
+}
+
+//Unit for reading parameters, instantiating the stage if needed
+AudioUnit stageUnit(CPStage index) {
+    return engageStage(index);
+}
+
+void setStageNeutral(CPStage index, Boolean neutral) {
+    if (!neutral) {
+        engageStage(index);
     }
+    graphStages[index].gate->setNeutral(neutral);
 }
 
-Boolean isAUGraphIsRunning(AUGraph graph) {
-    Boolean isRunning = NO;
-    if (graph != nil) {
-        CheckError(AUGraphIsRunning(graph, &isRunning), "Failed checking is Augraph is running");
+//Engine process callback for one stage, in place on `channels`. A neutral, idle stage costs one flag check.
+void renderStage(void *refCon, float *const *channels, UInt32 numChannels, UInt32 frames) {
+    CPStage index = (CPStage)(intptr_t)refCon;
+    CPStageGate *gate = graphStages[index].gate;
+    if (frames > kStageFramesPerSlice) {
+        //The engine only hands out blocks of kCPEngineBlockFrames, so this would be a bug; pass the block through
+        gate->countOversizeBlock();
+        stageProcessing[index].store(false, std::memory_order_relaxed);
+        return;
+    }
+    if (!gate->shouldProcess(channels, numChannels, frames)) {
+        stageProcessing[index].store(false, std::memory_order_relaxed);
+        return;
+    }
+    AudioTimeStamp timeStamp = { 0 };
+    timeStamp.mSampleTime = stageSampleTimes[index];
+    timeStamp.mFlags = kAudioTimeStampSampleTimeValid;
+    stageSampleTimes[index] += frames;
+    float (*stageInput)[kStageFramesPerSlice] = stageInputs[index];
+    const float *input[kEngineChannels];
+    for (UInt32 channel = 0; channel < numChannels; channel++) {
+        input[channel] = stageInput[channel];
+        memcpy(stageInput[channel], channels[channel], frames * sizeof(float));
     }
-    return isRunning;
+    if (index == STAGE_DELAY) {
+        //The ring still holds whatever played before the stage went idle
+        if (gate->resumed()) {
+            globalRoom->reset();
+        }
+        globalRoom->process(channels, numChannels, frames);
+        gate->observe(input, channels, numChannels, frames);
+        stageProcessing[index].store(true, std::memory_order_relaxed);
+        return;
+    }
+    struct {
+        AudioBufferList list;
+        AudioBuffer second;
+    } output;
+    output.list.mNumberBuffers = numChannels;
+    for (UInt32 channel = 0; channel < numChannels; channel++) {
+        output.list.mBuffers[channel] = AudioBuffer { 1, (UInt32)(frames * sizeof(float)), channels[channel] };
+    }
+    AudioUnitRenderActionFlags flags = 0;
+    if (AudioUnitRender(*graphStages[index].unit, &flags, &timeStamp, 0, frames, &output.list) != noErr) {
+        //Leave the block as the stage received it
+        for (UInt32 channel = 0; channel < numChannels; channel++) {
+            memcpy(channels[channel], stageInput[channel], frames * sizeof(float));
+        }
+        stageProcessing[index].store(false, std::memory_order_relaxed);
+        return;
+    }
+    gate->observe(input, channels, numChannels, frames);
+    stageProcessing[index].store(true, std::memory_order_relaxed);
 }
 
-void closeGraph(CPPlayer *player) {
-    reset(0.0);
-    CheckError(AUGraphClose(player->graph), "Failed closing audio graph");
+CPTrackSource *ensureSource() {
+    return &globalEngine->source();
 }
 
-//Reset file player unit & audio file, to clear some memory
-void reset(Float64 currentFrame) {
-    resetFilePlayerUnit(currentFrame);
-    resetAudioFile();
-    resetGraph();
+static dispatch_queue_t warmUpQueue() {
+    static dispatch_queue_t queue;
+    static dispatch_once_t once;
+    dispatch_once(&once, ^{
+        dispatch_queue_attr_t attributes = dispatch_queue_attr_make_with_qos_class(DISPATCH_QUEUE_SERIAL, QOS_CLASS_UTILITY, 0);
+        queue = dispatch_queue_create("CPAudioPlayer.warmup", attributes);
+    });
+    return queue;
 }
 
-void resetFilePlayerUnit(Float64 currentFrame) {
-    globalCPPlayer.playBackStartFrame = currentFrame;
-    CheckError(AudioUnitRemoveRenderNotify(globalCPPlayer.filePlayerUnit, &playRenderNotify, &globalCPPlayer), "Failed remove render notifier");
-    CheckError(AudioUnitReset(globalCPPlayer.filePlayerUnit, kAudioUnitScope_Global, 0), "Failed reset file player");
+//Off the launch path: source arena and loader thread, then the heavier effect units
+void warmUpEngine() {
+    ensureSource();
+    for (int index = 0; index < STAGE_COUNT; index++) {
+        std::lock_guard<std::mutex> lock(graphLock);
+        if (graphStages[index].warmUp && graphStages[index].gate != nullptr) {
+            instantiateStage((CPStage)index);
+        }
+    }
 }
 
-void resetAudioFile() {
-    if (globalCPPlayer.inputFile != nil) {
-        AudioFileClose(globalCPPlayer.inputFile);
-        globalCPPlayer.inputFile = nil;
+//Launch with source -> output only; effect stages are created the first time they are needed
+void createEngine(CPPlayer *player, NSArray *eqFrequencies) {
+    globalSampleRate = engineSampleRate();
+    float bandFrequencies[kCPEqualizerMaxBands];
+    UInt32 numBands = (UInt32)MIN(eqFrequencies.count, kCPEqualizerMaxBands);
+    for (UInt32 band = 0; band < numBands; band++) {
+        bandFrequencies[band] = [eqFrequencies[band] floatValue];
+    }
+    CPOutputConfig config;
+    config.sampleRate = globalSampleRate;
+    config.channels = kEngineChannels;
+    config.periodFrames = kEnginePeriodFrames;
+    std::unique_ptr<CPOutputDevice> output(new CPRemoteIOOutput());
+    globalEngine = new CPPlayerEngine(std::move(output), config, bandFrequencies, numBands);
+    if (!globalEngine->isOpen()) {
+        NSLog(@"Failed opening RemoteIO output");
     }
+    initGraphStages(player);
+    //One unit per stage, so a pipelined engine can spread them over its workers
+    globalEngine->setProcessCallback(&renderStage, (void *)(intptr_t)STAGE_IPOD_EQ);
+    for (int index = STAGE_IPOD_EQ + 1; index < STAGE_COUNT; index++) {
+        globalEngine->addProcessCallback(&renderStage, (void *)(intptr_t)index);
+    }
+    globalEngine->setCompletionCallback(&trackEndCallback, nullptr);
+    globalEngine->automation().setEventCallback(&automationEventCallback, nullptr);
 }
 
-void resetGraph() {
-    AUGraph graph = globalCPPlayer.graph;
-    if (isAUGraphIsRunning(graph)) {
-        CheckError(AUGraphStop(graph), "Failed stop AUGraph");
+//Tear down a previous player's engine and stages
+void disposeEngine(CPPlayer *player) {
+    if (globalEngine == nullptr) {
+        return;
+    }
+    //Let an in-flight warm-up finish before the engine goes away
+    dispatch_sync(warmUpQueue(), ^{});
+    delete globalEngine;
+    globalEngine = nullptr;
+    disposeGraphStages();
+    delete globalCache;
+    globalCache = nullptr;
+}
+
+//Cached tracks open without touching the file; anything else is captured into the cache as it plays
+std::unique_ptr<CPAudioDecoder> openDecoder(NSURL *url, double sampleRate, AudioStreamBasicDescription *fileFormat) {
+    NSString *path = url.URLByStandardizingPath.path;
+    std::string key = path.UTF8String;
+    std::unique_ptr<CPAudioDecoder> decoder = globalCache->open(key, sampleRate);
+    if (decoder != nullptr) {
+        @synchronized (cachedFileFormats) {
+            [cachedFileFormats[path] getValue:fileFormat];
+        }
+        return decoder;
+    }
+    //Multichannel files stay multichannel, the mixer downmixes them
+    decoder = CPExtAudioFileDecoder::open((__bridge CFURLRef)url, sampleRate, kCPMixerMaxChannels, fileFormat);
+    if (decoder == nullptr) {
+        return nullptr;
     }
-    CheckError(AUGraphUninitialize(graph), "Failed un uninitilizing graph");
+    @synchronized (cachedFileFormats) {
+        cachedFileFormats[path] = [NSValue valueWithBytes:fileFormat objCType:@encode(AudioStreamBasicDescription)];
+    }
+    return globalCache->capture(key, std::move(decoder));
 }
 
 - (instancetype)init {
     self = [super init];
     if (self) {
+        uint64_t launchStart = mach_absolute_time();
+        disposeEngine(&globalCPPlayer);
         globalCPPlayer = CPPlayer { 0 };
-        createAuGraph(&globalCPPlayer);
-        NSArray *eqFrequencies = @[@60, @150, @400, @1100, @3100, @8000, @16000];
-        _bandEq = [[CPBandEqulizer alloc]initWithBandEQUnitWitFrequency:eqFrequencies audioUnit:globalCPPlayer.bandEQUnit];
-        _bassBooster = [[CPBandEqulizer alloc]initWithBandEQUnitWitFrequency:@[@100] audioUnit:globalCPPlayer.bassBoostUnit];
-        globalCPPlayer.playBackStartFrame = 0.0;
+        globalCache = new CPDecodedAudioCache(kDefaultDecodedCacheBytes);
+        cachedFileFormats = [NSMutableDictionary dictionary];
+        fadeCompletions = [NSMutableDictionary dictionary];
+        _bandFrequencies = @[@60, @150, @400, @1100, @3100, @8000, @16000];
+        createEngine(&globalCPPlayer, _bandFrequencies);
         globalPlayer = self;
         [self setDefaultValueForUnits];
+        dispatch_async(warmUpQueue(), ^{
+            warmUpEngine();
+        });
+        _launchDuration = hostTimeToSeconds(mach_absolute_time() - launchStart);
         return self;
     }
     return nil;
 }
 
 - (void)setupAudioFileWithURL:(NSURL *)audioUrl playBackDuration:(double)playBackDuration isError:(Boolean *)isError {
-    _playBackduration = playBackDuration;
     _songUrl = audioUrl;
-    reset(0.0);
-    CFURLRef inputUrl = (__bridge CFURLRef)audioUrl;
-    setUpFile(&globalCPPlayer, inputUrl, isError);
+    //Hot switch: prime a spare source deck and crossfade to it, the output keeps running
+    CPTrackSource *source = ensureSource();
+    std::unique_ptr<CPAudioDecoder> decoder = openDecoder(audioUrl, source->sampleRate(), &globalCPPlayer.asbd);
+    *isError = !globalEngine->load(std::move(decoder));
+    if (*isError) {
+        NSLog(@"Failed opening audio file %@", audioUrl);
+        return;
+    }
+    _playBackduration = playBackDuration > 0 ? playBackDuration : (double)source->lengthFrames() / source->sampleRate();
 }
 
 - (void)handleSongPlayingCompletion:(_songPlayCompletionHandler)handler {
@@ -299,18 +466,19 @@ void resetGraph() {
 #pragma mark Audio Control
 - (BOOL)play {
     Boolean isError = false;
-    //Check if input file is there, else create inputfileid.
-    if (globalCPPlayer.inputFile == nil) {
+    //Check if a track is attached, else attach the last url again.
+    if (!ensureSource()->hasTrack()) {
         if (_songUrl != nil) {
             [self setupAudioFileWithURL:_songUrl playBackDuration:_playBackduration isError:&isError];
         }
+        else {
+            isError = true;
+        }
     }
     if (!isError) {
-        initilizeGraph();
-        prepareAudioFile(&globalCPPlayer);
-        CheckError(AUGraphStart(globalCPPlayer.graph), "Failed start AUGraph");
+        isError = !globalEngine->play();
     }
-    else {
+    if (isError) {
         NSLog(@"Error %s", __FUNCTION__);
     }
     Boolean isPlaySuccess = !isError;
@@ -318,38 +486,204 @@ void resetGraph() {
 }
 
 - (void)pause {
-    //Store the current frame so you can resume nicely
-    AudioTimeStamp ts;
-    UInt32 size = sizeof(ts);
-    AudioUnitGetProperty(globalCPPlayer.filePlayerUnit, kAudioUnitProperty_CurrentPlayTime, kAudioUnitScope_Global, 0, &ts, &size);
-    resetFilePlayerUnit(ts.mSampleTime + globalCPPlayer.playBackStartFrame);
-    resetGraph();
+    //The source keeps its position and buffered audio, so resume continues from the same frame
+    globalEngine->pause();
 }
 
 - (void)stop {
-    reset(0.0);
+    globalEngine->stop();
 }
 
 #pragma mark Playback time
 - (double)currentPlaybackTime {
-    //Get the current playback time by calculation playbackStartFrame + sampleTime. Playback start time changes when moving seekbar.
-    AudioTimeStamp ts;
-    UInt32 size = sizeof(ts);
-    AudioUnitGetProperty(globalCPPlayer.filePlayerUnit, kAudioUnitProperty_CurrentPlayTime, kAudioUnitScope_Global, 0, &ts, &size);
-    double currentTime = (double)(globalCPPlayer.playBackStartFrame + ts.mSampleTime) / globalCPPlayer.asbd.mSampleRate;
-    return currentTime;
+    return globalEngine->currentPlaybackTime();
 }
 
 - (void)setPlayBackTime:(double)time {
-    if (globalCPPlayer.inputFile == nil) {
-        return;
+    globalEngine->setPlaybackTime(time);
+}
+
+#pragma mark Track switching
+- (double)trackSwitchLatency {
+    return globalEngine->hasSource() ? globalEngine->source().stats().lastSwitchLatency : 0;
+}
+
+- (NSUInteger)trackSwitchAllocations {
+    return globalEngine->hasSource() ? (NSUInteger)globalEngine->source().stats().allocationsLastSwitch : 0;
+}
+
+#pragma mark Decoded audio cache
+- (void)prefetchAudioFileWithURL:(NSURL *)audioUrl {
+    std::string key = audioUrl.URLByStandardizingPath.path.UTF8String;
+    CPDecodedAudioCache *cache = globalCache;
+    double sampleRate = globalSampleRate;
+    //disposeEngine drains this queue before it deletes the cache
+    dispatch_async(warmUpQueue(), ^{
+        if (cache->contains(key)) {
+            return;
+        }
+        AudioStreamBasicDescription fileFormat;
+        std::unique_ptr<CPAudioDecoder> decoder = CPExtAudioFileDecoder::open((__bridge CFURLRef)audioUrl, sampleRate, kCPMixerMaxChannels, &fileFormat);
+        if (decoder == nullptr) {
+            return;
+        }
+        @synchronized (cachedFileFormats) {
+            cachedFileFormats[audioUrl.URLByStandardizingPath.path] = [NSValue valueWithBytes:&fileFormat objCType:@encode(AudioStreamBasicDescription)];
+        }
+        cache->prefetch(key, std::move(decoder));
+    });
+}
+
+- (NSUInteger)decodedCacheBudget {
+    return globalCache->budget();
+}
+
+- (void)setDecodedCacheBudget:(NSUInteger)decodedCacheBudget {
+    globalCache->setBudget(decodedCacheBudget);
+}
+
+- (double)decodedCacheHitRate {
+    CPDecodedAudioCacheStats stats = globalCache->stats();
+    uint64_t lookups = stats.hits + stats.misses;
+    return lookups > 0 ? (double)stats.hits / lookups : 0;
+}
+
+- (NSUInteger)decodedCacheBytes {
+    return globalCache->stats().bytesHeld;
+}
+
+- (double)decodeTimeSaved {
+    return globalCache->stats().decodeSecondsSaved;
+}
+
+#pragma mark Output
+- (NSUInteger)outputPeriodFrames {
+    return globalEngine->output().config().periodFrames;
+}
+
+- (void)setOutputPeriodFrames:(NSUInteger)outputPeriodFrames {
+    //RemoteIO is never asked for more than a slice; the stages take any period in engine blocks
+    globalEngine->setOutputPeriod((UInt32)MIN(MAX(outputPeriodFrames, 32), CPRemoteIOOutput::kMaximumFramesPerSlice), 1);
+}
+
+- (BOOL)backgroundRendering {
+    return globalEngine->renderMode() == CPRenderModeBackground;
+}
+
+- (void)setBackgroundRendering:(BOOL)backgroundRendering {
+    globalEngine->setRenderMode(backgroundRendering ? CPRenderModeBackground : CPRenderModeInteractive);
+}
+
+- (double)outputLatency {
+    return globalEngine->output().stats().latency;
+}
+
+- (double)outputJitter {
+    return globalEngine->output().stats().jitter;
+}
+
+- (NSUInteger)outputXruns {
+    return (NSUInteger)globalEngine->output().stats().xruns;
+}
+
+- (NSUInteger)pipelineStages {
+    return globalEngine->pipelineStages();
+}
+
+- (void)setPipelineStages:(NSUInteger)pipelineStages {
+    globalEngine->setPipelineStages((UInt32)MIN(pipelineStages, kCPPipelineMaxStages));
+}
+
+- (double)pipelineLatency {
+    return globalEngine->pipelineLatency();
+}
+
+- (NSUInteger)pipelineUnderruns {
+    return (NSUInteger)globalEngine->pipelineStats().underruns;
+}
+
+#pragma mark Gain automation
+- (float)automationGain {
+    return globalEngine->automation().gain();
+}
+
+- (void)fadeToGain:(float)gain duration:(double)seconds curve:(CPFadeCurve)curve completion:(_fadeCompletionHandler)completion {
+    CPGainCurve gainCurve = curve == CPFadeCurveExponential ? CPGainCurveExponential :
+        curve == CPFadeCurveSCurve ? CPGainCurveSCurve : CPGainCurveLinear;
+    globalEngine->automation().rampTo(MAX(gain, 0), seconds, gainCurve, addFadeCompletion(completion));
+}
+
+- (void)scheduleSleepAfter:(double)seconds fadeDuration:(double)fadeDuration completion:(_fadeCompletionHandler)completion {
+    fadeDuration = MIN(MAX(fadeDuration, 0), MAX(seconds, 0));
+    __weak CPAudioPlayer *weakSelf = self;
+    UInt32 event = addFadeCompletion(^{
+        CPAudioPlayer *player = weakSelf;
+        [player pause];
+        //Applied when playback resumes
+        globalEngine->automation().reset(1);
+        if (completion) {
+            completion();
+        }
+    });
+    CPGainAutomation &automation = globalEngine->automation();
+    @synchronized (fadeCompletions) {
+        sleepFadeEvent = event;
+        sleepHoldGain = automation.gain();
+    }
+    automation.rampTo(sleepHoldGain, seconds - fadeDuration, CPGainCurveHold);
+    automation.schedule(CPGainSegment { 0, fadeDuration, CPGainCurveSCurve, event });
+}
+
+- (void)cancelSleep {
+    float holdGain;
+    @synchronized (fadeCompletions) {
+        //Gone once it has fired, or once a later fade replaced it; leave that fade alone
+        if (sleepFadeEvent == 0 || fadeCompletions[@(sleepFadeEvent)] == nil) {
+            return;
+        }
+        [fadeCompletions removeObjectForKey:@(sleepFadeEvent)];
+        sleepFadeEvent = 0;
+        holdGain = sleepHoldGain;
+    }
+    globalEngine->automation().rampTo(holdGain, kCancelFadeSeconds);
+}
+
+- (void)cancelFade {
+    @synchronized (fadeCompletions) {
+        [fadeCompletions removeAllObjects];
     }
-    resetFilePlayerUnit(time * globalCPPlayer.asbd.mSampleRate);
-    if (isAUGraphIsRunning(globalCPPlayer.graph)) {
-        CheckError(AUGraphStop(globalCPPlayer.graph), "Failed stop AUGraph");
-        prepareResumeAudioFile(&globalCPPlayer);
-        CheckError(AUGraphStart(globalCPPlayer.graph), "Failed start AUGraph");
+    globalEngine->automation().rampTo(1, kCancelFadeSeconds);
+}
+
+#pragma mark Startup
+- (double)timeToFirstAudio {
+    //Published by the render thread once the first frame of the track has been rendered
+    return globalEngine->timeToFirstAudio();
+}
+
+- (NSUInteger)processingStageCount {
+    NSUInteger count = 0;
+    for (int index = 0; index < STAGE_COUNT; index++) {
+        count += stageProcessing[index].load(std::memory_order_relaxed);
     }
+    return count;
+}
+
+//Counted by the stage gates, which are created with the engine, so each player starts from zero
+- (NSUInteger)skippedStageBlocks {
+    NSUInteger count = 0;
+    for (int index = 0; index < STAGE_COUNT; index++) {
+        count += (NSUInteger)graphStages[index].gate->skippedBlocks();
+    }
+    return count;
+}
+
+- (NSUInteger)oversizeStageBlocks {
+    NSUInteger count = 0;
+    for (int index = 0; index < STAGE_COUNT; index++) {
+        count += (NSUInteger)graphStages[index].gate->oversizeBlocks();
+    }
+    return count;
 }
 
 #pragma mark AUDIO PRocessing
@@ -361,7 +695,8 @@ void resetGraph() {
 #pragma mark iPod Eq presets
 - (CFArrayRef)getEqulizerPresets {
     UInt32 size = sizeof(eqPresetArray);
-    CheckError(AudioUnitGetProperty(globalCPPlayer.eqUnit, kAudioUnitProperty_FactoryPresets, kAudioUnitScope_Global, 0, &eqPresetArray, &size), "Failed getting [kAudioUnitProperty_FactoryPresets]");
+    //Listing presets needs the unit, but it only joins the chain once a preset is applied
+    CheckError(AudioUnitGetProperty(stageUnit(STAGE_IPOD_EQ), kAudioUnitProperty_FactoryPresets, kAudioUnitScope_Global, 0, &eqPresetArray, &size), "Failed getting [kAudioUnitProperty_FactoryPresets]");
     return eqPresetArray;
 }
 
@@ -374,70 +709,123 @@ void resetGraph() {
 }
 
 - (void)setiPodEQPresetWithPreset:(AUPreset *)preset {
-    AudioUnitSetProperty(globalCPPlayer.eqUnit, kAudioUnitProperty_PresentPreset, kAudioUnitScope_Global, 0, preset, sizeof(AUPreset));
+    //The iPod EQ's "Disabled" and "Flat" presets leave the signal untouched
+    NSString *name = (__bridge NSString *)preset->presetName;
+    Boolean neutral = [name isEqualToString:@"Disabled"] || [name isEqualToString:@"Flat"];
+    if (neutral && !isStageInstantiated(STAGE_IPOD_EQ)) {
+        return;
+    }
+    AudioUnitSetProperty(engageStage(STAGE_IPOD_EQ), kAudioUnitProperty_PresentPreset, kAudioUnitScope_Global, 0, preset, sizeof(AUPreset));
+    setStageNeutral(STAGE_IPOD_EQ, neutral);
 }
 
 #pragma mark Band Equlizer
-- (void)setBandValue:(NSArray *)value {
-    for (int bandPosition = 0; bandPosition < value.count; bandPosition++) {
-        float bandValue = [value[bandPosition] floatValue];
-        [_bandEq setGainForBandAtPosition:bandPosition value:bandValue];
+- (void)setupEqualizerWithFrequencies:(NSArray *)frequencies {
+    _bandFrequencies = frequencies;
+    float bandFrequencies[kCPEqualizerMaxBands];
+    UInt32 numBands = (UInt32)MIN(frequencies.count, kCPEqualizerMaxBands);
+    for (UInt32 band = 0; band < numBands; band++) {
+        bandFrequencies[band] = [frequencies[band] floatValue];
+    }
+    globalEngine->setEqualizerFrequencies(bandFrequencies, numBands);
+}
+
+//Reads gains from `value`, keeping the current gain for bands it does not cover
+- (void)copyGains:(NSArray *)value into:(float *)gains {
+    for (UInt32 band = 0; band < globalEngine->equalizer().numBands(); band++) {
+        gains[band] = band < value.count ? [value[band] floatValue] : globalEngine->equalizer().gainForBand(band);
     }
 }
 
+- (void)setBandValue:(NSArray *)value {
+    //All bands change in one bank swap, so no intermediate curve is ever rendered
+    float gains[kCPEqualizerMaxBands];
+    [self copyGains:value into:gains];
+    globalEngine->equalizer().setGains(gains);
+}
+
 - (float)getValueForBand:(NSInteger)bandPosition {
-    return [_bandEq gainForBandAtPosition:bandPosition];
+    return globalEngine->equalizer().gainForBand((UInt32)bandPosition);
 }
 
 - (NSArray *)getAllBands {
-    return _bandEq.bands;
+    return _bandFrequencies;
+}
+
+- (NSInteger)compileBandPreset:(NSArray *)value {
+    float gains[kCPEqualizerMaxBands];
+    [self copyGains:value into:gains];
+    return globalEngine->equalizer().compileBank(gains);
+}
+
+- (BOOL)applyBandPreset:(NSInteger)preset {
+    return globalEngine->equalizer().applyBank((int)preset);
+}
+
+- (void)removeBandPreset:(NSInteger)preset {
+    globalEngine->equalizer().removeBank((int)preset);
 }
 
+//Room size 1 is a DELAY_TIME second delay at DELAY_WETDRYMIX percent wet, as it was on the Delay unit
 #define DELAY_WETDRYMIX 5.0
 #define DELAY_TIME 0.2
 - (float)getRommSize {
-    float value;
-    AudioUnitGetParameter(globalCPPlayer.delayUnit, kDelayParam_DelayTime, kAudioUnitScope_Global, 0, &value);
-    value =  value/DELAY_TIME;
-    return value;
+    if (!isStageInstantiated(STAGE_DELAY)) {
+        return 0.0;
+    }
+    return globalRoom->delayTime() / DELAY_TIME;
 }
 
 - (void)setRoomSize:(float)value {
-    
-    if ([self getRommSize] == value) {
+    if (value <= 0 && !isStageInstantiated(STAGE_DELAY)) {
         return;
     }
-    float wetDry = value * DELAY_WETDRYMIX;
-    if (wetDry>DELAY_WETDRYMIX) {
-        wetDry = DELAY_WETDRYMIX;
-    }
-    CheckError(AudioUnitSetParameter(globalCPPlayer.delayUnit, kDelayParam_WetDryMix, kAudioUnitScope_Global, 0, wetDry, 0),
-               "AudioUnitSetProperty[kDelayParam_WetDryMix -- Using Parameter] failed");
-    float time =  value*DELAY_TIME;
-    CheckError(AudioUnitSetParameter(globalCPPlayer.delayUnit, kDelayParam_DelayTime,
-                                     kAudioUnitScope_Global, 0, time, sizeof(UInt32)),
-               "AudioUnitSetProperty[kDelayParam_DelayTime] failed");
+    engageStage(STAGE_DELAY);
+    float wetDry = MIN(MAX(value, 0) * DELAY_WETDRYMIX, DELAY_WETDRYMIX);
+    globalRoom->setWetDryMix(wetDry / 100.0f);
+    //Glides to the new time on the render thread, so dragging the size never clicks
+    globalRoom->setDelayTime(MAX(value, 0) * DELAY_TIME);
+    //The delay rings out what it already holds before it goes idle
+    setStageNeutral(STAGE_DELAY, value <= 0);
 }
 
+#pragma mark Mixer
+//Balance, loudness gain and volume are folded into the source's mix matrix: no extra pass
 - (float)getChannelBalance {
-    float pan;
-    AudioUnitGetParameter(globalCPPlayer.mxUnit, kMultiChannelMixerParam_Pan, kAudioUnitScope_Input, 0, &pan);
-    return pan;
+    return globalEngine->mixer().balance();
 }
 
 - (void)setChannelBalance:(float)pan {
-    AudioUnitSetParameter(globalCPPlayer.mxUnit,
-                          kMultiChannelMixerParam_Pan,
-                          kAudioUnitScope_Input,
-                          0,
-                          pan,
-                          0);
+    globalEngine->mixer().setBalance(pan);
+}
+
+- (float)getVolume {
+    return globalEngine->mixer().volume();
+}
+
+- (void)setVolume:(float)volume {
+    globalEngine->mixer().setVolume(volume);
+}
+
+- (float)getLoudnessGain {
+    return globalEngine->mixer().preGain();
+}
+
+- (void)setLoudnessGain:(float)decibels {
+    globalEngine->mixer().setPreGain(decibels);
+}
+
+- (NSUInteger)trackChannels {
+    return globalEngine->hasSource() ? globalEngine->source().trackChannels() : 0;
 }
 
 
 static float boostValues = 10;
 -(float)getBassBoost
 {
+    if (!isStageInstantiated(STAGE_BASS_BOOST)) {
+        return 0.0;
+    }
     float value;
     AudioUnitGetParameter(globalCPPlayer.bassBoostUnit, kAULowShelfParam_Gain, kAudioUnitScope_Global, 0, &value);
     value = (value/boostValues<0)?0:value/boostValues;
@@ -445,20 +833,32 @@ static float boostValues = 10;
 }
 
 - (void)setbassBoost:(float)value {
-    
-    AudioUnitSetParameter(globalCPPlayer.bassBoostUnit, kAULowShelfParam_CutoffFrequency, kAudioUnitScope_Global, 0, 120, 0);
+    if (value <= 0 && !isStageInstantiated(STAGE_BASS_BOOST)) {
+        return;
+    }
+    AudioUnit unit = engageStage(STAGE_BASS_BOOST);
+    AudioUnitSetParameter(unit, kAULowShelfParam_CutoffFrequency, kAudioUnitScope_Global, 0, 120, 0);
     float gain = (value < 0)?0:value*boostValues;
-    AudioUnitSetParameter(globalCPPlayer.bassBoostUnit, kAULowShelfParam_Gain, kAudioUnitScope_Global, 0, gain, 0);
+    AudioUnitSetParameter(unit, kAULowShelfParam_Gain, kAudioUnitScope_Global, 0, gain, 0);
+    //A 0 dB shelf is a pass-through
+    setStageNeutral(STAGE_BASS_BOOST, gain == 0);
 }
 
 -(void)setTreble:(float)value
 {
+    if (value <= 0 && !isStageInstantiated(STAGE_TREBLE)) {
+        return;
+    }
     float treble = (value < 0)?0:value*boostValues;
-    AudioUnitSetParameter(globalCPPlayer.treble, kHighShelfParam_Gain, kAudioUnitScope_Global, 0, treble, 0);
+    AudioUnitSetParameter(engageStage(STAGE_TREBLE), kHighShelfParam_Gain, kAudioUnitScope_Global, 0, treble, 0);
+    setStageNeutral(STAGE_TREBLE, treble == 0);
 }
 
 -(float)getTreble
 {
+    if (!isStageInstantiated(STAGE_TREBLE)) {
+        return 0.0;
+    }
     float value;
     AudioUnitGetParameter(globalCPPlayer.treble, kHighShelfParam_Gain, kAudioUnitScope_Global, 0, &value);
     value = (value/boostValues<0)?0:value/boostValues;
@@ -468,7 +868,12 @@ static float boostValues = 10;
 -(void)setVauleForComponent:(NSString *)compenentId  parameter:(int)param value:(float)value
 {
     if ([compenentId isEqualToString:@"rvb2"]) {
-        AudioUnitSetParameter(globalCPPlayer.reverbUnit, param, kAudioUnitScope_Global, 0, value, 0);
+        AudioUnit unit = engageStage(STAGE_REVERB);
+        AudioUnitSetParameter(unit, param, kAudioUnitScope_Global, 0, value, 0);
+        //Only a fully dry reverb is neutral; it rings out before going idle
+        float dryWet = 0;
+        AudioUnitGetParameter(unit, kReverb2Param_DryWetMix, kAudioUnitScope_Global, 0, &dryWet);
+        setStageNeutral(STAGE_REVERB, dryWet == 0);
     }else if([compenentId isEqualToString:@"lmtr"]){
         AudioUnitSetParameter(globalCPPlayer.testUnit, param, kAudioUnitScope_Global, 0, value, 0);
     }
@@ -478,7 +883,8 @@ static float boostValues = 10;
 {
      float value = 0.0;
     if ([compenentId isEqualToString:@"rvb2"]) {
-        AudioUnitGetParameter(globalCPPlayer.reverbUnit, param, kAudioUnitScope_Global, 0, &value);
+        //Reverb2 defaults are not neutral, report the real unit values even before it first processes
+        AudioUnitGetParameter(stageUnit(STAGE_REVERB), param, kAudioUnitScope_Global, 0, &value);
 
     }else if([compenentId isEqualToString:@"lmtr"]){
         AudioUnitGetParameter(globalCPPlayer.testUnit, param, kAudioUnitScope_Global, 0, &value);
@@ -0,0 +1,38 @@
+//
+//  CPExtAudioFileDecoder.h
+//
+//
+//  ExtAudioFile backed decoder for the engine source stage
+//
+
+#import <AudioToolbox/AudioToolbox.h>
+#include <memory>
+#include "CPAudioDecoder.hpp"
+
+/**
+ Decodes any file ExtAudioFile can open, converting to non-interleaved float at the
+ engine sample rate. Files keep their channel count, reordered to WAVE/SMPTE order for the
+ mixer's downmix; files with more than `maxChannels` channels are converted to stereo.
+ */
+class CPExtAudioFileDecoder : public CPAudioDecoder {
+public:
+    /// Returns nullptr if the file cannot be opened. `fileFormat` receives the file's own format.
+    static std::unique_ptr<CPAudioDecoder> open(CFURLRef url, double sampleRate, uint32_t maxChannels, AudioStreamBasicDescription *fileFormat);
+    ~CPExtAudioFileDecoder() override;
+
+    uint32_t channels() const override { return _channels; }
+    double sampleRate() const override { return _sampleRate; }
+    int64_t lengthFrames() const override { return _lengthFrames; }
+    uint32_t read(float *const *channels, uint32_t frames) override;
+    bool seek(int64_t frame) override;
+
+private:
+    CPExtAudioFileDecoder(ExtAudioFileRef file, double sampleRate, uint32_t channels, double fileSampleRate, int64_t fileLengthFrames);
+
+    ExtAudioFileRef _file;
+    double _sampleRate;
+    uint32_t _channels;
+    double _fileSampleRate;
+    int64_t _lengthFrames;
+    AudioBufferList *_bufferList;
+};
@@ -0,0 +1,108 @@
+//
+//  CPExtAudioFileDecoder.mm
+//
+//
+//  ExtAudioFile backed decoder for the engine source stage
+//
+
+#include "CPExtAudioFileDecoder.h"
+#include <cmath>
+#include <cstdlib>
+#include "CPAllocationCount.hpp"
+
+//Client layouts in the order CPMatrixMixer expects (L R C LFE Ls Rs ...), by channel count
+static AudioChannelLayoutTag clientLayoutTag(uint32_t channels) {
+    switch (channels) {
+        case 3: return kAudioChannelLayoutTag_MPEG_3_0_A;
+        case 4: return kAudioChannelLayoutTag_Quadraphonic;
+        case 5: return kAudioChannelLayoutTag_MPEG_5_0_A;
+        case 6: return kAudioChannelLayoutTag_MPEG_5_1_A;
+        case 7: return kAudioChannelLayoutTag_MPEG_6_1_A;
+        case 8: return kAudioChannelLayoutTag_MPEG_7_1_C;
+        default: return 0;
+    }
+}
+
+std::unique_ptr<CPAudioDecoder> CPExtAudioFileDecoder::open(CFURLRef url, double sampleRate, uint32_t maxChannels, AudioStreamBasicDescription *fileFormat) {
+    ExtAudioFileRef file = nullptr;
+    if (ExtAudioFileOpenURL(url, &file) != noErr || file == nullptr) {
+        return nullptr;
+    }
+    AudioStreamBasicDescription format = { 0 };
+    UInt32 size = sizeof(format);
+    SInt64 fileLengthFrames = 0;
+    UInt32 lengthSize = sizeof(fileLengthFrames);
+    if (ExtAudioFileGetProperty(file, kExtAudioFileProperty_FileDataFormat, &size, &format) != noErr ||
+        ExtAudioFileGetProperty(file, kExtAudioFileProperty_FileLengthFrames, &lengthSize, &fileLengthFrames) != noErr) {
+        ExtAudioFileDispose(file);
+        return nullptr;
+    }
+
+    uint32_t channels = format.mChannelsPerFrame;
+    if (channels == 0 || channels > maxChannels) {
+        channels = 2;
+    }
+    //Let ExtAudioFile do the decode and sample rate conversion into the engine format
+    AudioStreamBasicDescription clientFormat = { 0 };
+    clientFormat.mSampleRate = sampleRate;
+    clientFormat.mFormatID = kAudioFormatLinearPCM;
+    clientFormat.mFormatFlags = kAudioFormatFlagsNativeFloatPacked | kAudioFormatFlagIsNonInterleaved;
+    clientFormat.mBitsPerChannel = 32;
+    clientFormat.mChannelsPerFrame = channels;
+    clientFormat.mFramesPerPacket = 1;
+    clientFormat.mBytesPerFrame = sizeof(Float32);
+    clientFormat.mBytesPerPacket = sizeof(Float32);
+    if (ExtAudioFileSetProperty(file, kExtAudioFileProperty_ClientDataFormat, sizeof(clientFormat), &clientFormat) != noErr) {
+        ExtAudioFileDispose(file);
+        return nullptr;
+    }
+    AudioChannelLayoutTag layoutTag = clientLayoutTag(channels);
+    if (layoutTag != 0) {
+        //Best effort: files without a layout of their own are read as they are
+        AudioChannelLayout layout = { 0 };
+        layout.mChannelLayoutTag = layoutTag;
+        ExtAudioFileSetProperty(file, kExtAudioFileProperty_ClientChannelLayout, sizeof(layout), &layout);
+    }
+    if (fileFormat != nullptr) {
+        *fileFormat = format;
+    }
+    CPCountAllocations();
+    return std::unique_ptr<CPAudioDecoder>(new CPExtAudioFileDecoder(file, sampleRate, channels, format.mSampleRate, fileLengthFrames));
+}
+
+CPExtAudioFileDecoder::CPExtAudioFileDecoder(ExtAudioFileRef file, double sampleRate, uint32_t channels, double fileSampleRate, int64_t fileLengthFrames)
+: _file(file),
+  _sampleRate(sampleRate),
+  _channels(channels),
+  _fileSampleRate(fileSampleRate),
+  _lengthFrames((int64_t)std::llround((double)fileLengthFrames * sampleRate / fileSampleRate))
+{
+    //One buffer list for the decoder's lifetime, reads only repoint it
+    _bufferList = (AudioBufferList *)calloc(1, offsetof(AudioBufferList, mBuffers) + sizeof(AudioBuffer) * channels);
+    _bufferList->mNumberBuffers = channels;
+    CPCountAllocations();
+}
+
+CPExtAudioFileDecoder::~CPExtAudioFileDecoder() {
+    ExtAudioFileDispose(_file);
+    free(_bufferList);
+}
+
+uint32_t CPExtAudioFileDecoder::read(float *const *channels, uint32_t frames) {
+    for (uint32_t channel = 0; channel < _channels; channel++) {
+        _bufferList->mBuffers[channel].mNumberChannels = 1;
+        _bufferList->mBuffers[channel].mDataByteSize = frames * sizeof(Float32);
+        _bufferList->mBuffers[channel].mData = channels[channel];
+    }
+    UInt32 read = frames;
+    if (ExtAudioFileRead(_file, &read, _bufferList) != noErr) {
+        return 0;
+    }
+    return read;
+}
+
+bool CPExtAudioFileDecoder::seek(int64_t frame) {
+    //ExtAudioFileSeek takes the position in file frames
+    SInt64 fileFrame = (SInt64)((double)frame * _fileSampleRate / _sampleRate);
+    return ExtAudioFileSeek(_file, fileFrame) == noErr;
+}
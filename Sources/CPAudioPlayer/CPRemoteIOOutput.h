@@ -0,0 +1,37 @@
+//
+//  CPRemoteIOOutput.h
+//
+//
+//  RemoteIO output backend for the engine
+//
+
+#import <AudioToolbox/AudioToolbox.h>
+#include "CPOutputDevice.hpp"
+
+/**
+ Renders from RemoteIO's own realtime thread. The period is requested as the session's preferred
+ IO buffer duration; the unit may still be asked for up to kMaximumFramesPerSlice frames (e.g. while
+ the screen is locked). Latency is the session's output latency plus one IO buffer; a gap in the
+ callback sample times counts as an xrun.
+ */
+class CPRemoteIOOutput : public CPOutputDevice {
+public:
+    static const UInt32 kMaximumFramesPerSlice = 4096;
+
+    CPRemoteIOOutput();
+    ~CPRemoteIOOutput() override;
+
+    bool open(const CPOutputConfig &config) override;
+    bool start() override;
+    void stop() override;
+    void close() override;
+    bool isRunning() const override;
+
+private:
+    static OSStatus renderCallback(void *refCon, AudioUnitRenderActionFlags *ioActionFlags, const AudioTimeStamp *inTimeStamp,
+                                   UInt32 inBusNumber, UInt32 inNumberFrames, AudioBufferList *ioData);
+    void measureLatency();
+
+    AudioUnit _unit;
+    Float64 _nextSampleTime;
+};
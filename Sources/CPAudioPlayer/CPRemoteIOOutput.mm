@@ -0,0 +1,135 @@
+//
+//  CPRemoteIOOutput.mm
+//
+//
+//  RemoteIO output backend for the engine
+//
+
+#include "CPRemoteIOOutput.h"
+#import <AVFoundation/AVFoundation.h>
+#include <algorithm>
+#include <cmath>
+
+static const UInt32 kMaxChannels = 8;
+
+CPRemoteIOOutput::CPRemoteIOOutput()
+: _unit(nullptr),
+  _nextSampleTime(-1)
+{
+}
+
+CPRemoteIOOutput::~CPRemoteIOOutput() {
+    close();
+}
+
+bool CPRemoteIOOutput::open(const CPOutputConfig &config) {
+    close();
+    if (config.channels == 0 || config.channels > kMaxChannels) {
+        return false;
+    }
+    _config = config;
+    AVAudioSession *session = [AVAudioSession sharedInstance];
+    [session setPreferredIOBufferDuration:(double)config.periodFrames / config.sampleRate error:nil];
+
+    AudioComponentDescription description = { 0 };
+    description.componentType = kAudioUnitType_Output;
+    description.componentSubType = kAudioUnitSubType_RemoteIO;
+    description.componentManufacturer = kAudioUnitManufacturer_Apple;
+    AudioComponent component = AudioComponentFindNext(NULL, &description);
+    if (component == NULL || AudioComponentInstanceNew(component, &_unit) != noErr) {
+        _unit = nullptr;
+        return false;
+    }
+    //Non-interleaved float, the format the engine renders in place
+    AudioStreamBasicDescription format = { 0 };
+    format.mSampleRate = config.sampleRate;
+    format.mFormatID = kAudioFormatLinearPCM;
+    format.mFormatFlags = kAudioFormatFlagsNativeFloatPacked | kAudioFormatFlagIsNonInterleaved;
+    format.mBitsPerChannel = 32;
+    format.mChannelsPerFrame = config.channels;
+    format.mFramesPerPacket = 1;
+    format.mBytesPerFrame = sizeof(Float32);
+    format.mBytesPerPacket = sizeof(Float32);
+    //have to add maxFPS to play audio in sleep mode.
+    UInt32 maxFPS = kMaximumFramesPerSlice;
+    AURenderCallbackStruct callback = { &CPRemoteIOOutput::renderCallback, this };
+    if (AudioUnitSetProperty(_unit, kAudioUnitProperty_StreamFormat, kAudioUnitScope_Input, 0, &format, sizeof(format)) != noErr ||
+        AudioUnitSetProperty(_unit, kAudioUnitProperty_MaximumFramesPerSlice, kAudioUnitScope_Global, 0, &maxFPS, sizeof(maxFPS)) != noErr ||
+        AudioUnitSetProperty(_unit, kAudioUnitProperty_SetRenderCallback, kAudioUnitScope_Input, 0, &callback, sizeof(callback)) != noErr ||
+        AudioUnitInitialize(_unit) != noErr) {
+        close();
+        return false;
+    }
+    //The session decides the real IO buffer; there is no separate buffer count to report
+    _config.periodFrames = (uint32_t)std::lround(session.IOBufferDuration * config.sampleRate);
+    _config.periods = 1;
+    measureLatency();
+    return true;
+}
+
+void CPRemoteIOOutput::measureLatency() {
+    AVAudioSession *session = [AVAudioSession sharedInstance];
+    setLatency(session.outputLatency + session.IOBufferDuration);
+}
+
+bool CPRemoteIOOutput::start() {
+    if (_unit == nullptr) {
+        return false;
+    }
+    if (isRunning()) {
+        return true;
+    }
+    resetStats();
+    _nextSampleTime = -1;
+    //The IO thread is already a time constraint thread
+    setRealtime(true);
+    measureLatency();
+    return AudioOutputUnitStart(_unit) == noErr;
+}
+
+void CPRemoteIOOutput::stop() {
+    if (_unit != nullptr) {
+        AudioOutputUnitStop(_unit);
+    }
+}
+
+void CPRemoteIOOutput::close() {
+    if (_unit == nullptr) {
+        return;
+    }
+    stop();
+    AudioUnitUninitialize(_unit);
+    AudioComponentInstanceDispose(_unit);
+    _unit = nullptr;
+}
+
+bool CPRemoteIOOutput::isRunning() const {
+    if (_unit == nullptr) {
+        return false;
+    }
+    UInt32 isRunning = 0;
+    UInt32 size = sizeof(isRunning);
+    AudioUnitGetProperty(_unit, kAudioOutputUnitProperty_IsRunning, kAudioUnitScope_Global, 0, &isRunning, &size);
+    return isRunning != 0;
+}
+
+OSStatus CPRemoteIOOutput::renderCallback(void *refCon, AudioUnitRenderActionFlags *ioActionFlags, const AudioTimeStamp *inTimeStamp,
+                                          UInt32 inBusNumber, UInt32 inNumberFrames, AudioBufferList *ioData) {
+    CPRemoteIOOutput *output = (CPRemoteIOOutput *)refCon;
+    if (ioData->mNumberBuffers != output->_config.channels) {
+        return kAudioUnitErr_FormatNotSupported;
+    }
+    //The device skipped ahead: the previous cycle was not delivered in time
+    if ((inTimeStamp->mFlags & kAudioTimeStampSampleTimeValid) != 0) {
+        if (output->_nextSampleTime >= 0 && inTimeStamp->mSampleTime > output->_nextSampleTime) {
+            output->addXrun();
+        }
+        output->_nextSampleTime = inTimeStamp->mSampleTime + inNumberFrames;
+    }
+    float *channels[kMaxChannels];
+    for (UInt32 channel = 0; channel < ioData->mNumberBuffers; channel++) {
+        channels[channel] = (float *)ioData->mBuffers[channel].mData;
+    }
+    output->render(channels, inNumberFrames);
+    return noErr;
+}
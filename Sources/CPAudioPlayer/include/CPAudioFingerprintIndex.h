@@ -0,0 +1,41 @@
+//
+//  CPAudioFingerprintIndex.h
+//
+//
+//  Acoustic fingerprints of library files, for duplicate detection at import
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/// An indexed entry whose audio matches a fingerprint
+@interface CPAudioFingerprintMatch : NSObject
+@property (readonly, nonatomic, copy) NSString *key;
+/// Fraction of fingerprint bits that differ, 0 for identical audio
+@property (readonly, nonatomic) float distance;
+@end
+
+/**
+ Fingerprints are computed in a single decode pass per file (the first ~30 s after any leading
+ silence, at 11025 Hz) on a shared pool of worker threads, and kept with the library as
+ compact data (~650 bytes). The index finds the entries that sound like a fingerprint in a
+ fraction of a millisecond, also for libraries of 100k songs.
+ */
+@interface CPAudioFingerprintIndex : NSObject
+/// Fingerprints the files in parallel. Entries are NSData, or NSNull where a file could not be decoded.
++ (NSArray *)fingerprintsForFilesAtURLs:(NSArray<NSURL *> *)urls;
++ (nullable NSData *)fingerprintForFileAtURL:(NSURL *)url;
+/// Track duration recorded in a fingerprint (seconds), 0 if the data isn't a fingerprint
++ (double)durationOfFingerprint:(NSData *)fingerprint;
+
+@property (readonly, nonatomic) NSUInteger count;
+/// Adds or replaces the fingerprint for `key`.
+- (void)addFingerprint:(NSData *)fingerprint forKey:(NSString *)key;
+- (void)removeFingerprintForKey:(NSString *)key;
+- (void)removeAllFingerprints;
+/// Indexed entries that sound like `fingerprint`, closest first
+- (NSArray<CPAudioFingerprintMatch *> *)matchesForFingerprint:(NSData *)fingerprint;
+@end
+
+NS_ASSUME_NONNULL_END
@@ -10,20 +10,12 @@
 #import <AudioToolbox/AudioToolbox.h>
 
 typedef struct {
-    AUGraph graph;
-    AudioFileID inputFile;
-    AudioStreamBasicDescription asbd;
-    AudioUnit bandEQUnit;
-    AudioUnit mxUnit;
+    AudioStreamBasicDescription asbd; //format of the current file
     AudioUnit eqUnit;
-    AudioUnit delayUnit;
     AudioUnit bassBoostUnit;
     AudioUnit treble;
-    AudioUnit filePlayerUnit;
     AudioUnit reverbUnit;
     AudioUnit testUnit;
-    Float64 playBackStartFrame; //indicating the frame the player should start playing, when pauesed & resume
-    ScheduledAudioFileRegion region;
 }CPPlayer;
 
 typedef enum {
@@ -32,6 +24,13 @@ typedef enum {
 }CHANNEL;
 
 typedef void (^_songPlayCompletionHandler)(void);
+typedef void (^_fadeCompletionHandler)(void);
+
+typedef NS_ENUM(NSInteger, CPFadeCurve) {
+    CPFadeCurveLinear = 0,      //linear in amplitude
+    CPFadeCurveExponential,     //linear in dB
+    CPFadeCurveSCurve           //raised cosine
+};
 
 NS_ASSUME_NONNULL_BEGIN
 
@@ -43,6 +42,83 @@ NS_ASSUME_NONNULL_BEGIN
 @property (nonatomic, strong, readonly)NSURL *songUrl;
 @property (readonly, nonatomic)double currentPlaybackTime;
 @property (nonatomic, copy, nullable)_songPlayCompletionHandler songCompletion;
+/**
+ Track switch instrumentation. Switching track or seeking while playing never rebuilds the graph:
+ latency is the time from the request to the first rendered frame of the new track (seconds),
+ allocations counts what the most recent switch allocated: the decoder, its buffers and the cache
+ capture for a new track, only the decoder for a cached one, nothing for a seek.
+ */
+@property (readonly, nonatomic)double trackSwitchLatency;
+@property (readonly, nonatomic)NSUInteger trackSwitchAllocations;
+/**
+ Startup instrumentation. The engine launches with only source -> output; effect units are added
+ when their parameters first leave neutral, heavy ones are warmed up in the background. The reverb
+ is wet by default, so it joins the chain as soon as its warm-up finishes.
+ launchDuration is the time spent in -init, timeToFirstAudio the time from -play on a stopped
+ player to the first rendered frame of the track (seconds, 0 until measured).
+ */
+@property (readonly, nonatomic)double launchDuration;
+@property (readonly, nonatomic)double timeToFirstAudio;
+/**
+ Effect stages that processed the last render cycle. Stages at neutral settings are skipped;
+ delay and reverb keep running until their tail has decayed, then go idle.
+ skippedStageBlocks counts stage blocks the gates skipped (neutral or idle stages), summed over
+ the stages. oversizeStageBlocks counts blocks that bypassed a stage for being longer than its
+ buffers; the engine never hands out longer blocks, so anything but 0 is a bug.
+ Both count from the creation of this player.
+ */
+@property (readonly, nonatomic)NSUInteger processingStageCount;
+@property (readonly, nonatomic)NSUInteger skippedStageBlocks;
+@property (readonly, nonatomic)NSUInteger oversizeStageBlocks;
+/**
+ Decoded-audio cache. Played and prefetched tracks are kept decoded (float16) up to the budget
+ in bytes, least recently used first out; a cached track starts and seeks without file I/O.
+ decodeTimeSaved is the decode time (seconds) the cache hits would otherwise have cost.
+ */
+@property (nonatomic)NSUInteger decodedCacheBudget;
+@property (readonly, nonatomic)double decodedCacheHitRate;
+@property (readonly, nonatomic)NSUInteger decodedCacheBytes;
+@property (readonly, nonatomic)double decodeTimeSaved;
+/**
+ Output backend. The engine renders into RemoteIO through a pluggable output device; the period
+ is requested as the session's IO buffer size (frames), the device reports what it granted.
+ outputLatency is the measured render-to-speaker latency, outputJitter the mean deviation of
+ render callbacks from their nominal period, outputXruns the cycles the device skipped (seconds / count).
+ */
+@property (nonatomic)NSUInteger outputPeriodFrames;
+@property (readonly, nonatomic)double outputLatency;
+@property (readonly, nonatomic)double outputJitter;
+@property (readonly, nonatomic)NSUInteger outputXruns;
+/**
+ Background rendering, for when no UI is visible. The engine asks for 4096 frame IO buffers and
+ refills its read-ahead in batches, so the render and loader threads wake about a tenth as often;
+ the cost is latency nobody is watching. outputPeriodFrames set meanwhile applies on the way back.
+ Either way the effect chain runs in fixed blocks of 512 frames, whatever size RemoteIO asks for.
+ */
+@property (nonatomic)BOOL backgroundRendering;
+/**
+ Pipelined rendering, for effect chains heavier than one core can render per period. With
+ pipelineStages > 0 the source and EQ, then the effect stages, are split over that many worker
+ threads with realtime priority, each a block behind the one before. pipelineLatency is the
+ output latency this adds (seconds, whole periods); currentPlaybackTime already accounts for it.
+ pipelineUnderruns counts periods no finished block was ready for. 0 renders in the output callback.
+ */
+@property (nonatomic)NSUInteger pipelineStages;
+@property (readonly, nonatomic)double pipelineLatency;
+@property (readonly, nonatomic)NSUInteger pipelineUnderruns;
+/**
+ Gain automation. Fades are ramps the engine applies per sample on the render thread after
+ everything else, so nothing wakes up until a fade completes; completions run on the main queue.
+ A sleep holds the gain for seconds - fadeDuration, fades to silence, then pauses the player and
+ restores the gain. Starting a fade or cancelling drops whatever was scheduled, without completion.
+ cancelSleep only drops a sleep that is still pending, returning to the gain it held; a fade that
+ has replaced it carries on.
+ */
+@property (readonly, nonatomic)float automationGain;
+-(void)fadeToGain:(float)gain duration:(double)seconds curve:(CPFadeCurve)curve completion:(nullable _fadeCompletionHandler)completion;
+-(void)scheduleSleepAfter:(double)seconds fadeDuration:(double)fadeDuration completion:(nullable _fadeCompletionHandler)completion;
+-(void)cancelSleep;
+-(void)cancelFade;
 
 /**
  Audio Controll & cycle methods
@@ -53,6 +129,8 @@ NS_ASSUME_NONNULL_BEGIN
 -(void)setupAudioFileWithURL:(NSURL *)audioUrl playBackDuration:(double)playBackDuration isError:(Boolean *)isError;
 -(void)handleSongPlayingCompletion:(_songPlayCompletionHandler)handler;
 -(void)setPlayBackTime:(double)time;
+/// Decodes the file into the cache on a background queue, e.g. for the next track in a queue.
+-(void)prefetchAudioFileWithURL:(NSURL *)audioUrl;
 /**
  Audio manipulation methods
  */
@@ -64,6 +142,14 @@ NS_ASSUME_NONNULL_BEGIN
 -(void)setBandValue:(NSArray *)value;
 -(float)getValueForBand:(NSInteger)bandPosition;
 -(NSArray *)getAllBands;
+/**
+ Band presets are compiled once into coefficient banks. Applying one swaps the whole curve
+ on the render thread in a single step (crossfaded), without recomputing coefficients.
+ compileBandPreset returns -1 when no more presets can be held.
+ */
+-(NSInteger)compileBandPreset:(NSArray *)value;
+-(BOOL)applyBandPreset:(NSInteger)preset;
+-(void)removeBandPreset:(NSInteger)preset;
 
 #pragma Room Size
 -(void)setRoomSize:(float)value;
@@ -75,6 +161,18 @@ NS_ASSUME_NONNULL_BEGIN
 -(void)setChannelBalance:(float)pan;
 -(float)getChannelBalance;
 
+#pragma mark Mixer
+/**
+ Linear output volume (0 ... 1) and loudness normalisation gain in dB. Like balance they
+ are applied by the native matrix mixer, which also downmixes 5.1 / 7.1 tracks to stereo.
+ */
+-(void)setVolume:(float)volume;
+-(float)getVolume;
+-(void)setLoudnessGain:(float)decibels;
+-(float)getLoudnessGain;
+/// Channel count of the current track before downmixing
+@property (readonly, nonatomic)NSUInteger trackChannels;
+
 //Bass boost
 -(void)setbassBoost:(float)value;
 -(float)getBassBoost;
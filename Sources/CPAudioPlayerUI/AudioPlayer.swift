@@ -11,6 +11,9 @@ import UniformTypeIdentifiers
 import CPAudioPlayer
 import AVFoundation
 import SwiftUI
+#if canImport(UIKit)
+import UIKit
+#endif
 
 // MARK: - Repeat Mode
 
@@ -45,6 +48,9 @@ public class AudioPlayer: NSObject, ObservableObject {
     /// Error message when file import fails
     @Published public var importError: String?
 
+    /// Songs from the most recent import that sound like songs already in the library
+    @Published public private(set) var importDuplicates: [DuplicateCandidate] = []
+
     // EQ bands
     @Published public var eqBands: [Float] = Array(repeating: 0, count: 7)
 
@@ -79,7 +85,10 @@ public class AudioPlayer: NSObject, ObservableObject {
     @Published public private(set) var sleepTimerActive: Bool = false
 
     /// Remaining time on sleep timer in seconds
-    @Published public private(set) var sleepTimerRemaining: TimeInterval = 0
+    public var sleepTimerRemaining: TimeInterval {
+        guard let end = sleepTimerEndDate else { return 0 }
+        return max(0, end.timeIntervalSinceNow)
+    }
 
     /// Total sleep timer duration that was set
     @Published public private(set) var sleepTimerDuration: TimeInterval = 0
@@ -106,11 +115,19 @@ public class AudioPlayer: NSObject, ObservableObject {
 
     private var player: CPAudioPlayer?
     private var playbackTimer: Timer?
-    private var sleepTimer: Timer?
-    private var fadeTimer: Timer?
-    private var originalVolume: Float = 1.0
+    /// Background / foreground notification tokens
+    private var applicationObservers: [NSObjectProtocol] = []
+    /// When the sleep timer runs out; the fade itself is scheduled in the engine
+    private var sleepTimerEndDate: Date?
+    private var sleepTimerFadeDuration: TimeInterval = 0
+    /// Length of the sleep fade
+    private static let sleepFadeDuration: TimeInterval = 30
     private static let customPresetsKey = "CPAudioPlayer.customPresets"
 
+    /// Compiled coefficient bank handles, keyed by preset name
+    private var presetBanks: [String: Int] = [:]
+    private var customPresetBanks: [String: Int] = [:]
+
     /// Default EQ frequencies in Hz
     public static let defaultFrequencies: [Float] = [60, 150, 400, 1100, 3100, 8000, 16000]
 
@@ -156,12 +173,32 @@ public class AudioPlayer: NSObject, ObservableObject {
     public override init() {
         super.init()
         player = CPAudioPlayer()
+        compilePresetBanks()
         loadCustomPresets()
+        observeApplicationState()
+        // Fingerprinting finishes after the import returns
+        libraryManager.$duplicateCandidates.assign(to: &$importDuplicates)
     }
 
     deinit {
         stopPlaybackTimer()
         cancelSleepTimer()
+        applicationObservers.forEach { NotificationCenter.default.removeObserver($0) }
+    }
+
+    /// With no UI visible the engine renders in large periods, waking far less often
+    private func observeApplicationState() {
+        #if canImport(UIKit)
+        let center = NotificationCenter.default
+        applicationObservers = [
+            center.addObserver(forName: UIApplication.didEnterBackgroundNotification, object: nil, queue: .main) { [weak self] _ in
+                self?.player?.backgroundRendering = true
+            },
+            center.addObserver(forName: UIApplication.willEnterForegroundNotification, object: nil, queue: .main) { [weak self] _ in
+                self?.player?.backgroundRendering = false
+            }
+        ]
+        #endif
     }
 
     // MARK: - Audio File Loading
@@ -372,6 +409,7 @@ public class AudioPlayer: NSObject, ObservableObject {
         if success {
             isPlaying = true
             startPlaybackTimer()
+            resumeSleepTimer()
         }
         return success
     }
@@ -439,7 +477,7 @@ public class AudioPlayer: NSObject, ObservableObject {
     /// - Parameter name: Preset name from available presets
     public func applyPreset(_ name: String) {
         guard let values = Self.presets[name] else { return }
-        setEQBands(values)
+        applyBank(presetBanks[name], values: values)
     }
 
     /// Reset all EQ bands to 0 dB
@@ -464,6 +502,32 @@ public class AudioPlayer: NSObject, ObservableObject {
         player?.setBandValue(nsArray)
     }
 
+    /// Publish a precompiled bank, falling back to a live band update if it is not available
+    private func applyBank(_ bank: Int?, values: [Float]) {
+        guard let bank = bank, player?.applyBandPreset(bank) == true else {
+            setEQBands(values)
+            return
+        }
+        var bands = eqBands
+        for i in 0..<min(values.count, bands.count) {
+            bands[i] = values[i]
+        }
+        eqBands = bands
+    }
+
+    /// Compile a preset into a coefficient bank, returning its handle
+    private func compileBank(_ values: [Float]) -> Int? {
+        guard let player = player else { return nil }
+        let bank = player.compileBandPreset(values.map { NSNumber(value: $0) })
+        return bank >= 0 ? bank : nil
+    }
+
+    private func compilePresetBanks() {
+        for (name, values) in Self.presets {
+            presetBanks[name] = compileBank(values)
+        }
+    }
+
     private func syncFromPlayer() {
         guard let player = player else { return }
 
@@ -524,41 +588,20 @@ public class AudioPlayer: NSObject, ObservableObject {
         cancelSleepTimer()
 
         sleepTimerDuration = duration
-        sleepTimerRemaining = duration
+        sleepTimerEndDate = Date(timeIntervalSinceNow: duration)
+        sleepTimerFadeDuration = fadeOut ? min(Self.sleepFadeDuration, duration) : 0
         sleepTimerActive = true
-        originalVolume = player?.getVolume() ?? 1.0
-
-        // Update remaining time every second
-        sleepTimer = Timer.scheduledTimer(withTimeInterval: 1.0, repeats: true) { [weak self] _ in
-            guard let self = self else { return }
-            self.sleepTimerRemaining -= 1
-
-            // Start fade out in last 30 seconds
-            if fadeOut && self.sleepTimerRemaining <= 30 && self.sleepTimerRemaining > 0 {
-                let fadeProgress = Float(self.sleepTimerRemaining) / 30.0
-                self.player?.setVolume(self.originalVolume * fadeProgress)
-            }
-
-            if self.sleepTimerRemaining <= 0 {
-                self.executeSleepTimerEnd()
-            }
-        }
+        scheduleSleep(after: duration)
     }
 
     /// Cancel the sleep timer
     public func cancelSleepTimer() {
-        sleepTimer?.invalidate()
-        sleepTimer = nil
-        fadeTimer?.invalidate()
-        fadeTimer = nil
+        if sleepTimerActive {
+            player?.cancelSleep()
+        }
         sleepTimerActive = false
-        sleepTimerRemaining = 0
+        sleepTimerEndDate = nil
         sleepTimerDuration = 0
-
-        // Restore original volume
-        if originalVolume > 0 {
-            player?.setVolume(originalVolume)
-        }
     }
 
     /// Formatted sleep timer remaining string (m:ss)
@@ -568,10 +611,28 @@ public class AudioPlayer: NSObject, ObservableObject {
         return String(format: "%d:%02d", mins, secs)
     }
 
+    /// The engine holds, fades and pauses on its own and reports back once
+    private func scheduleSleep(after seconds: TimeInterval) {
+        player?.scheduleSleep(after: seconds, fadeDuration: min(sleepTimerFadeDuration, seconds)) { [weak self] in
+            self?.executeSleepTimerEnd()
+        }
+    }
+
+    /// The engine only counts time while rendering, so re-arm it with what is left on the clock
+    private func resumeSleepTimer() {
+        guard sleepTimerActive else { return }
+        if sleepTimerRemaining > 0 {
+            scheduleSleep(after: sleepTimerRemaining)
+        } else {
+            cancelSleepTimer()
+        }
+    }
+
     private func executeSleepTimerEnd() {
+        sleepTimerActive = false
+        sleepTimerEndDate = nil
+        sleepTimerDuration = 0
         pause()
-        cancelSleepTimer()
-        player?.setVolume(originalVolume)
     }
 
     // MARK: - Custom Presets
@@ -582,6 +643,10 @@ public class AudioPlayer: NSObject, ObservableObject {
         var presets = customPresets
         presets[name] = eqBands
         customPresets = presets
+        if let bank = customPresetBanks[name] {
+            player?.removeBandPreset(bank)
+        }
+        customPresetBanks[name] = compileBank(eqBands)
         persistCustomPresets()
     }
 
@@ -591,6 +656,9 @@ public class AudioPlayer: NSObject, ObservableObject {
         var presets = customPresets
         presets.removeValue(forKey: name)
         customPresets = presets
+        if let bank = customPresetBanks.removeValue(forKey: name) {
+            player?.removeBandPreset(bank)
+        }
         persistCustomPresets()
     }
 
@@ -600,7 +668,7 @@ public class AudioPlayer: NSObject, ObservableObject {
     @discardableResult
     public func applyCustomPreset(_ name: String) -> Bool {
         guard let values = customPresets[name] else { return false }
-        setEQBands(values)
+        applyBank(customPresetBanks[name], values: values)
         return true
     }
 
@@ -617,6 +685,9 @@ public class AudioPlayer: NSObject, ObservableObject {
         if let data = UserDefaults.standard.data(forKey: Self.customPresetsKey),
            let presets = try? JSONDecoder().decode([String: [Float]].self, from: data) {
             customPresets = presets
+            for (name, values) in presets {
+                customPresetBanks[name] = compileBank(values)
+            }
         }
     }
 
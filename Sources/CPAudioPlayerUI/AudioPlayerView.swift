@@ -292,10 +292,12 @@ struct TransportSection: View {
                             .foregroundColor(player.sleepTimerActive ? accentColor : .gray)
 
                         if player.sleepTimerActive {
-                            Text(player.sleepTimerRemainingFormatted)
-                                .font(.system(size: 8, weight: .bold, design: .monospaced))
-                                .foregroundColor(accentColor)
-                                .offset(y: 16)
+                            TimelineView(.periodic(from: .now, by: 1)) { _ in
+                                Text(player.sleepTimerRemainingFormatted)
+                                    .font(.system(size: 8, weight: .bold, design: .monospaced))
+                                    .foregroundColor(accentColor)
+                            }
+                            .offset(y: 16)
                         }
                     }
                 }
@@ -704,9 +706,12 @@ struct SleepTimerView: View {
                                 .font(.headline)
                                 .foregroundColor(accentColor)
 
-                            Text(player.sleepTimerRemainingFormatted)
-                                .font(.system(size: 48, weight: .light, design: .monospaced))
-                                .foregroundColor(.primary)
+                            // Redrawn once a second while visible; nothing ticks while it isn't
+                            TimelineView(.periodic(from: .now, by: 1)) { _ in
+                                Text(player.sleepTimerRemainingFormatted)
+                                    .font(.system(size: 48, weight: .light, design: .monospaced))
+                                    .foregroundColor(.primary)
+                            }
 
                             Text("Music will fade out and stop")
                                 .font(.caption)
@@ -8,6 +8,7 @@
 import Foundation
 import AVFoundation
 import UniformTypeIdentifiers
+import CPAudioPlayer
 
 // MARK: - Song Metadata Model
 
@@ -29,6 +30,8 @@ public struct SongMetadata: Codable, Identifiable, Equatable {
     public let sampleRate: Int
     public let channels: Int
     public let bitrate: Int
+    /// Acoustic fingerprint, computed at import (see CPAudioFingerprintIndex)
+    public var fingerprint: Data?
 
     /// The actual file URL in the documents directory
     public var fileURL: URL? {
@@ -93,7 +96,8 @@ public struct SongMetadata: Codable, Identifiable, Equatable {
         dateModified: Date = Date(),
         sampleRate: Int = 0,
         channels: Int = 2,
-        bitrate: Int = 0
+        bitrate: Int = 0,
+        fingerprint: Data? = nil
     ) {
         self.id = id
         self.fileName = fileName
@@ -111,9 +115,21 @@ public struct SongMetadata: Codable, Identifiable, Equatable {
         self.sampleRate = sampleRate
         self.channels = channels
         self.bitrate = bitrate
+        self.fingerprint = fingerprint
     }
 }
 
+// MARK: - Duplicate Candidate
+
+/// A newly imported song that sounds like a song already in the library
+public struct DuplicateCandidate: Identifiable, Equatable {
+    public var id: UUID { song.id }
+    public let song: SongMetadata
+    public let existing: SongMetadata
+    /// Fraction of fingerprint bits that differ, 0 for identical audio
+    public let distance: Float
+}
+
 // MARK: - Library Manager
 
 /// Manages the audio file library with persistent metadata storage
@@ -124,12 +140,17 @@ public class LibraryManager: ObservableObject {
     @Published public private(set) var songs: [SongMetadata] = []
     @Published public private(set) var isLoading: Bool = false
     @Published public var lastError: String?
+    /// Songs from the most recent import that sound like songs already in the library
+    @Published public private(set) var duplicateCandidates: [DuplicateCandidate] = []
 
     // MARK: - Private Properties
 
     private static let metadataFileName = "library_metadata.json"
     private static let audioDirectoryName = "ImportedAudio"
 
+    /// Fingerprints of all songs, keyed by song ID
+    private let fingerprintIndex = CPAudioFingerprintIndex()
+
     /// Supported audio file extensions
     public static let supportedExtensions: Set<String> = [
         "mp3", "m4a", "wav", "aiff", "aac", "caf", "flac", "ogg", "wma", "alac"
@@ -212,6 +233,7 @@ public class LibraryManager: ObservableObject {
 
             // Verify files still exist and remove orphaned entries
             validateLibrary()
+            indexFingerprints()
         } catch {
             lastError = "Failed to load library: \(error.localizedDescription)"
             migrateExistingFiles()
@@ -264,6 +286,7 @@ public class LibraryManager: ObservableObject {
 
         songs.sort { $0.dateAdded > $1.dateAdded }
         saveLibrary()
+        indexFingerprints()
     }
 
     /// Validate that all library entries have corresponding files
@@ -274,6 +297,9 @@ public class LibraryManager: ObservableObject {
         }
 
         if validSongs.count != songs.count {
+            for song in songs where !validSongs.contains(where: { $0.id == song.id }) {
+                fingerprintIndex.removeFingerprint(forKey: song.id.uuidString)
+            }
             songs = validSongs
             saveLibrary()
         }
@@ -286,6 +312,42 @@ public class LibraryManager: ObservableObject {
     /// - Returns: The imported song metadata, or nil if import failed
     @discardableResult
     public func importFile(from url: URL) -> SongMetadata? {
+        guard let metadata = copyIntoLibrary(from: url) else {
+            return nil
+        }
+
+        // Add to library
+        songs.insert(metadata, at: 0)
+        saveLibrary()
+        fingerprintInBackground([metadata.id], reportDuplicates: true)
+
+        return metadata
+    }
+
+    /// Import multiple files
+    /// - Parameter urls: Array of security-scoped URLs
+    /// - Returns: Array of successfully imported song metadata. Songs that sound like songs
+    ///   already in the library are imported too and reported in `duplicateCandidates` once
+    ///   they have been fingerprinted.
+    public func importFiles(from urls: [URL]) -> [SongMetadata] {
+        var imported: [SongMetadata] = []
+
+        for url in urls {
+            if let metadata = copyIntoLibrary(from: url) {
+                imported.append(metadata)
+            }
+        }
+
+        songs.insert(contentsOf: imported.reversed(), at: 0)
+        saveLibrary()
+        // One parallel fingerprinting pass over the whole batch
+        fingerprintInBackground(imported.map { $0.id }, reportDuplicates: true)
+
+        return imported
+    }
+
+    /// Copy a file into the audio directory and read its metadata
+    private func copyIntoLibrary(from url: URL) -> SongMetadata? {
         lastError = nil
 
         // Start accessing security-scoped resource
@@ -320,10 +382,6 @@ public class LibraryManager: ObservableObject {
             // Extract embedded metadata if available
             extractEmbeddedMetadata(for: &metadata, from: destinationURL)
 
-            // Add to library
-            songs.insert(metadata, at: 0)
-            saveLibrary()
-
             return metadata
         } catch {
             lastError = "Failed to import file: \(error.localizedDescription)"
@@ -331,19 +389,63 @@ public class LibraryManager: ObservableObject {
         }
     }
 
-    /// Import multiple files
-    /// - Parameter urls: Array of security-scoped URLs
-    /// - Returns: Array of successfully imported song metadata
-    public func importFiles(from urls: [URL]) -> [SongMetadata] {
-        var imported: [SongMetadata] = []
+    // MARK: - Fingerprints
 
-        for url in urls {
-            if let metadata = importFile(from: url) {
-                imported.append(metadata)
+    /// Fingerprint library songs in one parallel pass on a background queue, then add them to the
+    /// index on the main queue. With `reportDuplicates`, the ones that sound like a song already in
+    /// the library (or earlier in the batch) replace `duplicateCandidates`.
+    private func fingerprintInBackground(_ ids: [UUID], reportDuplicates: Bool) {
+        if reportDuplicates {
+            duplicateCandidates = []
+        }
+        let targets = ids.compactMap { id in songs.first { $0.id == id }?.fileURL.map { (id, $0) } }
+        guard !targets.isEmpty else { return }
+
+        DispatchQueue.global(qos: .utility).async { [weak self] in
+            let fingerprints = CPAudioFingerprintIndex.fingerprintsForFiles(at: targets.map { $0.1 })
+            DispatchQueue.main.async {
+                self?.addFingerprints(fingerprints, for: targets.map { $0.0 }, reportDuplicates: reportDuplicates)
             }
         }
+    }
 
-        return imported
+    private func addFingerprints(_ fingerprints: [Any], for ids: [UUID], reportDuplicates: Bool) {
+        var duplicates: [DuplicateCandidate] = []
+
+        for (id, fingerprint) in zip(ids, fingerprints) {
+            // Deleted while it was being fingerprinted
+            guard let data = fingerprint as? Data,
+                  let index = songs.firstIndex(where: { $0.id == id }) else { continue }
+            songs[index].fingerprint = data
+
+            if reportDuplicates {
+                for match in fingerprintIndex.matches(forFingerprint: data) {
+                    if let existing = songs.first(where: { $0.id.uuidString == match.key }) {
+                        duplicates.append(DuplicateCandidate(song: songs[index], existing: existing, distance: match.distance))
+                        break
+                    }
+                }
+            }
+            fingerprintIndex.addFingerprint(data, forKey: id.uuidString)
+        }
+
+        if reportDuplicates {
+            duplicateCandidates = duplicates
+        }
+        saveLibrary()
+    }
+
+    /// Index the stored fingerprints, then fingerprint songs imported before fingerprints existed
+    private func indexFingerprints() {
+        fingerprintIndex.removeAllFingerprints()
+        for song in songs {
+            if let fingerprint = song.fingerprint {
+                fingerprintIndex.addFingerprint(fingerprint, forKey: song.id.uuidString)
+            }
+        }
+
+        let missing = songs.filter { $0.fingerprint == nil }.map { $0.id }
+        fingerprintInBackground(missing, reportDuplicates: false)
     }
 
     /// Generate a unique filename to avoid conflicts
@@ -549,6 +651,7 @@ public class LibraryManager: ObservableObject {
 
         do {
             try FileManager.default.removeItem(at: url)
+            fingerprintIndex.removeFingerprint(forKey: id.uuidString)
             songs.remove(at: index)
             saveLibrary()
             return true
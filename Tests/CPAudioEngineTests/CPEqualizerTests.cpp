@@ -0,0 +1,82 @@
+//
+//  CPEqualizerTests.cpp
+//  CPAudioEngineTests
+//
+//  Live band edits racing the renderer's bank swaps and crossfades
+//
+
+#include "CPTestHarness.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <thread>
+#include <vector>
+#include "CPEqualizer.hpp"
+
+static const double kSampleRate = 48000;
+static const float kFrequencies[3] = { 100, 1000, 8000 };
+//Shorter than the crossfade, so most edits land while one is running
+static const uint32_t kBlockFrames = 16;
+
+static void sine(std::vector<float> &left, std::vector<float> &right, uint64_t start) {
+    for (uint32_t frame = 0; frame < left.size(); frame++) {
+        left[frame] = right[frame] = 0.5f * (float)std::sin(2 * M_PI * 1000 * (double)(start + frame) / kSampleRate);
+    }
+}
+
+//Gains of edit `edit`, every one different from the last
+static void editGains(uint32_t edit, float *gains) {
+    gains[0] = (float)(edit % 7) - 3;
+    gains[1] = (float)(edit % 11) - 5 + 0.25f;
+    gains[2] = (float)(edit % 5) - 2;
+}
+
+CP_TEST(CPEqualizerTests, testRapidEditsDuringCrossfadeLastEditWins) {
+    CPEqualizer equalizer(kFrequencies, 3, kSampleRate);
+    std::atomic<bool> rendering(true);
+    std::thread renderer([&] {
+        std::vector<float> left(kBlockFrames), right(kBlockFrames);
+        float *channels[2] = { left.data(), right.data() };
+        uint64_t position = 0;
+        while (rendering.load()) {
+            sine(left, right, position);
+            equalizer.process(channels, 2, kBlockFrames);
+            position += kBlockFrames;
+        }
+    });
+
+    //Back to back edits; each must become the published bank even while every other bank is in use
+    const uint32_t kEdits = 20000;
+    float gains[3];
+    uint32_t dropped = 0;
+    for (uint32_t edit = 1; edit <= kEdits; edit++) {
+        editGains(edit, gains);
+        equalizer.setGains(gains);
+        dropped += equalizer.gainForBand(0) != gains[0] || equalizer.gainForBand(1) != gains[1] || equalizer.gainForBand(2) != gains[2];
+    }
+    rendering.store(false);
+    renderer.join();
+    CP_EXPECT_EQ(dropped, 0u);
+
+    //Once settled, the renderer runs the last edit: the same as an equalizer that only ever had it
+    CPEqualizer reference(kFrequencies, 3, kSampleRate);
+    editGains(kEdits, gains);
+    reference.setGains(gains);
+    std::vector<float> left(kBlockFrames), right(kBlockFrames), referenceLeft(kBlockFrames), referenceRight(kBlockFrames);
+    float *channels[2] = { left.data(), right.data() };
+    float *referenceChannels[2] = { referenceLeft.data(), referenceRight.data() };
+    float worst = 0;
+    for (uint64_t position = 0; position < (uint64_t)kSampleRate; position += kBlockFrames) {
+        sine(left, right, position);
+        sine(referenceLeft, referenceRight, position);
+        equalizer.process(channels, 2, kBlockFrames);
+        reference.process(referenceChannels, 2, kBlockFrames);
+        //Filter memory differs at first and decays; judge the last tenth of a second
+        if (position >= (uint64_t)(0.9 * kSampleRate)) {
+            for (uint32_t frame = 0; frame < kBlockFrames; frame++) {
+                worst = std::max(worst, std::fabs(left[frame] - referenceLeft[frame]));
+            }
+        }
+    }
+    CP_EXPECT_LT(worst, 1e-4f);
+}
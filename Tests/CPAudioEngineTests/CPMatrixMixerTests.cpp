@@ -0,0 +1,85 @@
+//
+//  CPMatrixMixerTests.cpp
+//  CPAudioEngineTests
+//
+//  Downmix coefficients checked on rendered samples
+//
+
+#include "CPTestHarness.hpp"
+#include <algorithm>
+#include <cmath>
+#include "CPMatrixMixer.hpp"
+
+static const uint32_t kFrames = 256;
+
+//Renders one block of constant `levels` through `mixer`
+static void mixConstant(CPMatrixMixer &mixer, const float *levels, uint32_t inChannels, float output[][kFrames]) {
+    static float input[kCPMixerMaxChannels][kFrames];
+    const float *in[kCPMixerMaxChannels];
+    float *out[kCPMixerMaxChannels];
+    for (uint32_t channel = 0; channel < inChannels; channel++) {
+        std::fill(input[channel], input[channel] + kFrames, levels[channel]);
+        in[channel] = input[channel];
+    }
+    for (uint32_t channel = 0; channel < mixer.outChannels(); channel++) {
+        out[channel] = output[channel];
+    }
+    mixer.beginBlock(kFrames);
+    mixer.mix(in, inChannels, out, 0, kFrames, 1.0f, 0.0f, 0);
+}
+
+CP_TEST(CPMatrixMixerTests, testFiveOneDownmixSamples) {
+    CPMatrixMixer mixer(2);
+    float output[2][kFrames];
+    //L R C LFE Ls Rs, each on its own so every coefficient shows up in the output
+    const float levels[6] = { 0.5f, 0.25f, 0.125f, 1.0f, 0.0625f, 0.03125f };
+    mixConstant(mixer, levels, 6, output);
+    //Rows are 1 + 2 * -3 dB before normalising; LFE is dropped
+    const float row = 1.0f + 2.0f * 0.70710678f;
+    float left = (levels[0] + 0.70710678f * (levels[2] + levels[4])) / row;
+    float right = (levels[1] + 0.70710678f * (levels[2] + levels[5])) / row;
+    for (uint32_t frame = 0; frame < kFrames; frame++) {
+        CP_EXPECT_NEAR(output[0][frame], left, 1e-6);
+        CP_EXPECT_NEAR(output[1][frame], right, 1e-6);
+    }
+}
+
+CP_TEST(CPMatrixMixerTests, testDownmixCannotClip) {
+    const float fullScale[kCPMixerMaxChannels] = { 1, 1, 1, 1, 1, 1, 1, 1 };
+    for (uint32_t outChannels = 1; outChannels <= 2; outChannels++) {
+        CPMatrixMixer mixer(outChannels);
+        float output[2][kFrames];
+        for (uint32_t inChannels = 1; inChannels <= kCPMixerMaxChannels; inChannels++) {
+            mixConstant(mixer, fullScale, inChannels, output);
+            for (uint32_t channel = 0; channel < outChannels; channel++) {
+                CP_EXPECT_LE(output[channel][kFrames - 1], 1.0f + 1e-6f);
+            }
+            float gains[kCPMixerMaxChannels][kCPMixerMaxChannels];
+            mixer.matrix(inChannels, gains);
+            for (uint32_t out = 0; out < outChannels; out++) {
+                float sum = 0;
+                for (uint32_t in = 0; in < inChannels; in++) {
+                    sum += gains[out][in];
+                }
+                CP_EXPECT_LE(sum, 1.0f + 1e-6f);
+            }
+        }
+    }
+}
+
+CP_TEST(CPMatrixMixerTests, testStereoPassesThroughAndBalanceScalesRows) {
+    CPMatrixMixer mixer(2);
+    float output[2][kFrames];
+    const float levels[2] = { 0.5f, -0.25f };
+    mixConstant(mixer, levels, 2, output);
+    CP_EXPECT_EQ(output[0][0], 0.5f);
+    CP_EXPECT_EQ(output[1][0], -0.25f);
+
+    //The block picking up new settings ramps to them, the next one is settled
+    mixer.setBalance(0.5f);
+    mixer.setVolume(0.5f);
+    mixConstant(mixer, levels, 2, output);
+    mixConstant(mixer, levels, 2, output);
+    CP_EXPECT_NEAR(output[0][0], 0.5f * 0.5f * 0.5f, 1e-6);
+    CP_EXPECT_NEAR(output[1][0], -0.25f * 0.5f, 1e-6);
+}
@@ -0,0 +1,175 @@
+//
+//  CPPlayerEngineTests.cpp
+//  CPAudioEngineTests
+//
+//  The engine end to end on the null and WAV outputs: pipeline teardown, seeks in the background
+//  mode, fixed blocks under odd periods
+//
+
+#include "CPTestHarness.hpp"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <vector>
+#include <thread>
+#include "CPClockedOutput.hpp"
+#include "CPPlayerEngine.hpp"
+
+static const double kSampleRate = 44100;
+static const float kEqFrequencies[] = { 60, 400, 3100, 16000 };
+
+/// An endless-enough stereo tone, decoded from nothing
+class CPToneDecoder : public CPAudioDecoder {
+public:
+    CPToneDecoder(double seconds) : _length((int64_t)(seconds * kSampleRate)), _position(0) {}
+
+    uint32_t channels() const override { return 2; }
+    double sampleRate() const override { return kSampleRate; }
+    int64_t lengthFrames() const override { return _length; }
+
+    uint32_t read(float *const *channels, uint32_t frames) override {
+        frames = (uint32_t)std::min<int64_t>(frames, _length - _position);
+        for (uint32_t frame = 0; frame < frames; frame++) {
+            float sample = 0.25f * (float)std::sin(2 * M_PI * 440 * (double)(_position + frame) / kSampleRate);
+            channels[0][frame] = channels[1][frame] = sample;
+        }
+        _position += frames;
+        return frames;
+    }
+
+    bool seek(int64_t frame) override {
+        if (frame < 0 || frame > _length) {
+            return false;
+        }
+        _position = frame;
+        return true;
+    }
+
+private:
+    int64_t _length;
+    int64_t _position;
+};
+
+static void sleepSeconds(double seconds) {
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+}
+
+//A unit with some weight, so workers are caught holding blocks
+static void busyUnit(void *, float *const *channels, uint32_t numChannels, uint32_t frames) {
+    for (uint32_t pass = 0; pass < 20; pass++) {
+        for (uint32_t channel = 0; channel < numChannels; channel++) {
+            for (uint32_t frame = 0; frame < frames; frame++) {
+                channels[channel][frame] = channels[channel][frame] * 0.999f + 1e-7f;
+            }
+        }
+    }
+}
+
+//Smallest and largest block a unit was handed
+struct CPBlockSizes {
+    std::atomic<uint32_t> smallest{UINT32_MAX};
+    std::atomic<uint32_t> largest{0};
+};
+
+static void recordBlockSize(void *refCon, float *const *, uint32_t, uint32_t frames) {
+    CPBlockSizes *sizes = (CPBlockSizes *)refCon;
+    sizes->smallest.store(std::min(sizes->smallest.load(), frames));
+    sizes->largest.store(std::max(sizes->largest.load(), frames));
+}
+
+static std::unique_ptr<CPPlayerEngine> makeEngine(std::unique_ptr<CPOutputDevice> output, uint32_t periodFrames) {
+    CPOutputConfig config;
+    config.sampleRate = kSampleRate;
+    config.channels = 2;
+    config.periodFrames = periodFrames;
+    config.realtimePriority = false;
+    return std::unique_ptr<CPPlayerEngine>(new CPPlayerEngine(std::move(output), config, kEqFrequencies, 4));
+}
+
+static std::unique_ptr<CPPlayerEngine> makeEngine(bool paced, uint32_t periodFrames = 512) {
+    return makeEngine(std::unique_ptr<CPOutputDevice>(new CPNullOutput(paced)), periodFrames);
+}
+
+CP_TEST(CPPlayerEngineTests, testPipelineTeardownWhileRendering) {
+    //Unpaced, the output pulls as fast as the workers render, so there is always a block in a stage
+    for (uint32_t round = 0; round < 20; round++) {
+        std::unique_ptr<CPPlayerEngine> engine = makeEngine(false);
+        engine->addProcessCallback(&busyUnit, nullptr);
+        engine->addProcessCallback(&busyUnit, nullptr);
+        CP_EXPECT_TRUE(engine->setPipelineStages(3));
+        CP_EXPECT_TRUE(engine->load(std::unique_ptr<CPAudioDecoder>(new CPToneDecoder(600))));
+        CP_EXPECT_TRUE(engine->play());
+        sleepSeconds(0.005);
+        //Rebuilding and tearing down both drop a pipeline whose workers are mid-block
+        CP_EXPECT_TRUE(engine->setPipelineStages(round % 2 == 0 ? 2 : 1));
+        sleepSeconds(0.005);
+        engine.reset();
+    }
+}
+
+CP_TEST(CPPlayerEngineTests, testBackgroundSeekAfterResumeDoesNotUnderrun) {
+    //Each switch must be primed well past the long background period, or the first callbacks
+    //after it outrun the loader
+    for (uint32_t round = 0; round < 3; round++) {
+        std::unique_ptr<CPPlayerEngine> engine = makeEngine(true);
+        CP_EXPECT_TRUE(engine->setRenderMode(CPRenderModeBackground));
+        CP_EXPECT_TRUE(engine->load(std::unique_ptr<CPAudioDecoder>(new CPToneDecoder(30))));
+        CP_EXPECT_TRUE(engine->play());
+        sleepSeconds(1.0);
+        engine->pause();
+        CP_EXPECT_TRUE(engine->play());
+        CP_EXPECT_TRUE(engine->setPlaybackTime(2.0));
+        sleepSeconds(0.5);
+        CP_EXPECT_TRUE(engine->setPlaybackTime(20.0));
+        sleepSeconds(0.5);
+        engine->stop();
+        CP_EXPECT_EQ(engine->source().stats().underruns, 0u, "round %u", round);
+    }
+}
+
+CP_TEST(CPPlayerEngineTests, testOddPeriodsRenderWholeBlocks) {
+    for (uint32_t stages = 0; stages <= 1; stages++) {
+        CPBlockSizes sizes;
+        std::unique_ptr<CPPlayerEngine> engine = makeEngine(true, 1000);
+        engine->addProcessCallback(&recordBlockSize, &sizes);
+        CP_EXPECT_TRUE(engine->setPipelineStages(stages));
+        CP_EXPECT_TRUE(engine->load(std::unique_ptr<CPAudioDecoder>(new CPToneDecoder(30))));
+        CP_EXPECT_TRUE(engine->play());
+        sleepSeconds(0.3);
+        engine->pause();
+        CP_EXPECT_EQ(sizes.smallest.load(), kCPEngineBlockFrames, "%u stages", stages);
+        CP_EXPECT_EQ(sizes.largest.load(), kCPEngineBlockFrames, "%u stages", stages);
+    }
+}
+
+CP_TEST(CPPlayerEngineTests, testCarriedBlocksPlayInOrder) {
+    //1000 frame callbacks end partway through every other block; the bounce must still be the tone
+    const std::string path = CPTest::temporaryPath("CPPlayerEngineCarry.wav");
+    std::unique_ptr<CPPlayerEngine> engine = makeEngine(std::unique_ptr<CPOutputDevice>(new CPWavFileOutput(path, CPWavFileOutput::EncodingFloat32, true)), 1000);
+    CP_EXPECT_TRUE(engine->load(std::unique_ptr<CPAudioDecoder>(new CPToneDecoder(30))));
+    CP_EXPECT_TRUE(engine->play());
+    sleepSeconds(0.5);
+    engine.reset();
+
+    std::FILE *file = std::fopen(path.c_str(), "rb");
+    CP_EXPECT_TRUE(file != nullptr);
+    if (file == nullptr) {
+        return;
+    }
+    std::fseek(file, 44, SEEK_SET);
+    std::vector<float> samples(2 * (size_t)kSampleRate);
+    size_t frames = std::fread(samples.data(), 2 * sizeof(float), samples.size() / 2, file);
+    std::fclose(file);
+    std::remove(path.c_str());
+    CP_EXPECT_GT(frames, 10000u);
+    //Past the start's de-click fade every frame is the tone's own
+    uint32_t mismatched = 0;
+    for (size_t frame = 2048; frame < frames; frame++) {
+        float expected = 0.25f * (float)std::sin(2 * M_PI * 440 * (double)frame / kSampleRate);
+        if (std::fabs(samples[2 * frame] - expected) > 1e-4f || std::fabs(samples[2 * frame + 1] - expected) > 1e-4f) {
+            mismatched++;
+        }
+    }
+    CP_EXPECT_EQ(mismatched, 0u);
+}
@@ -0,0 +1,120 @@
+//
+//  CPRoomDelayTests.cpp
+//  CPAudioEngineTests
+//
+//  Delay line timing, interpolation, glides and the no-allocation rule of the render path
+//
+
+#include "CPTestHarness.hpp"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "CPRoomDelay.hpp"
+
+static const double kSampleRate = 48000;
+static const uint32_t kBlockFrames = 512;
+
+//Runs `signal` through `room` in place, in kBlockFrames blocks, the same signal on both channels
+static void render(CPRoomDelay &room, std::vector<float> &signal) {
+    std::vector<float> right(signal);
+    for (size_t done = 0; done < signal.size(); done += kBlockFrames) {
+        uint32_t frames = (uint32_t)std::min<size_t>(kBlockFrames, signal.size() - done);
+        float *channels[2] = { signal.data() + done, right.data() + done };
+        room.process(channels, 2, frames);
+    }
+}
+
+//Wet only, no feedback: the output is the input delayed
+static void makeTap(CPRoomDelay &room, float seconds) {
+    room.setDelayTime(seconds);
+    room.setFeedback(0);
+    room.setWetDryMix(1);
+}
+
+CP_TEST(CPRoomDelayTests, testImpulseComesOutAtTheDelayTime) {
+    CPRoomDelay room(kSampleRate, 0.25f);
+    makeTap(room, 0.01f);
+    std::vector<float> signal(2048, 0.0f);
+    signal[0] = 1;
+    render(room, signal);
+    const uint32_t expected = (uint32_t)std::lround(0.01 * kSampleRate);
+    for (uint32_t frame = 0; frame < signal.size(); frame++) {
+        CP_EXPECT_NEAR(signal[frame], frame == expected ? 1.0f : 0.0f, 1e-6, "frame %u", frame);
+    }
+}
+
+CP_TEST(CPRoomDelayTests, testFractionalDelayMatchesReference) {
+    CPRoomDelay room(kSampleRate, 0.25f);
+    const double delay = 100.37;
+    makeTap(room, (float)(delay / kSampleRate));
+    const double frequency = 1000;
+    std::vector<float> signal(8192);
+    for (uint32_t frame = 0; frame < signal.size(); frame++) {
+        signal[frame] = (float)std::sin(2 * M_PI * frequency * frame / kSampleRate);
+    }
+    render(room, signal);
+    //Past the delay, the sine is read between samples; the four tap interpolation is this close at 1 kHz
+    float worst = 0;
+    for (uint32_t frame = 200; frame < signal.size(); frame++) {
+        float reference = (float)std::sin(2 * M_PI * frequency * (frame - delay) / kSampleRate);
+        worst = std::max(worst, std::fabs(signal[frame] - reference));
+    }
+    CP_EXPECT_LT(worst, 1e-3f);
+}
+
+CP_TEST(CPRoomDelayTests, testDelayChangeGlides) {
+    CPRoomDelay room(kSampleRate, 0.25f);
+    makeTap(room, 0.05f);
+    const double frequency = 440;
+    std::vector<float> signal((size_t)kSampleRate);
+    for (uint32_t frame = 0; frame < signal.size(); frame++) {
+        signal[frame] = (float)std::sin(2 * M_PI * frequency * frame / kSampleRate);
+    }
+    //Half a second in, double the delay; a jump in the read position would step the output by up to 2
+    std::vector<float> first(signal.begin(), signal.begin() + signal.size() / 2);
+    std::vector<float> second(signal.begin() + signal.size() / 2, signal.end());
+    render(room, first);
+    room.setDelayTime(0.1f);
+    render(room, second);
+    first.insert(first.end(), second.begin(), second.end());
+    //A unit sine moves at most 2 pi f / fs per sample; the glide bends the pitch by at most 10%
+    const float bound = (float)(1.1 * 2 * M_PI * frequency / kSampleRate) * 1.05f;
+    float worst = 0;
+    for (size_t frame = 1; frame < first.size(); frame++) {
+        worst = std::max(worst, std::fabs(first[frame] - first[frame - 1]));
+    }
+    CP_EXPECT_LT(worst, bound);
+}
+
+CP_TEST(CPRoomDelayTests, testProcessDoesNotAllocate) {
+    CPRoomDelay room(kSampleRate, 0.25f);
+    makeTap(room, 0.1f);
+    room.setFeedback(0.5f);
+    room.setModulation(0.002f, 0.5f);
+    std::vector<float> left(kBlockFrames, 0.25f), right(kBlockFrames, -0.25f);
+    float *channels[2] = { left.data(), right.data() };
+    CPTest::AllocationCounter allocations;
+    allocations.start();
+    for (uint32_t block = 0; block < 100; block++) {
+        if (block == 50) {
+            room.setDelayTime(0.2f);
+            room.reset();
+        }
+        //Odd sizes too, for the partial chunk path
+        room.process(channels, 2, block % 2 == 0 ? kBlockFrames : 77);
+    }
+    CP_EXPECT_EQ(allocations.stop(), 0u);
+}
+
+CP_TEST(CPRoomDelayTests, testResetEmptiesTheRing) {
+    CPRoomDelay room(kSampleRate, 0.25f);
+    makeTap(room, 0.01f);
+    std::vector<float> signal(kBlockFrames, 0.5f);
+    render(room, signal);
+    room.reset();
+    std::vector<float> silence(2048, 0.0f);
+    render(room, silence);
+    for (float sample : silence) {
+        CP_EXPECT_EQ(sample, 0.0f);
+    }
+}
@@ -0,0 +1,82 @@
+//
+//  CPStageGateTests.cpp
+//  CPAudioEngineTests
+//
+//  Which blocks a stage gate skips, and that it counts them
+//
+
+#include "CPTestHarness.hpp"
+#include <vector>
+#include "CPStageGate.hpp"
+
+static const double kSampleRate = 48000;
+static const uint32_t kBlockFrames = 512;
+
+struct CPGateBlock {
+    std::vector<float> left, right;
+    float *channels[2];
+
+    CPGateBlock(float level) : left(kBlockFrames, level), right(kBlockFrames, level) {
+        channels[0] = left.data();
+        channels[1] = right.data();
+    }
+};
+
+CP_TEST(CPStageGateTests, testNeutralStageSkipsEveryBlock) {
+    CPStageGate gate(false, kSampleRate);
+    CPGateBlock block(0.5f);
+    for (uint32_t index = 0; index < 10; index++) {
+        CP_EXPECT_FALSE(gate.shouldProcess(block.channels, 2, kBlockFrames));
+    }
+    CP_EXPECT_EQ(gate.skippedBlocks(), 10u);
+
+    gate.setNeutral(false);
+    for (uint32_t index = 0; index < 10; index++) {
+        CP_EXPECT_TRUE(gate.shouldProcess(block.channels, 2, kBlockFrames));
+    }
+    CP_EXPECT_EQ(gate.skippedBlocks(), 10u);
+    CP_EXPECT_EQ(gate.oversizeBlocks(), 0u);
+}
+
+CP_TEST(CPStageGateTests, testTailStageRunsOutItsHoldThenSkips) {
+    const double holdSeconds = 0.1;
+    CPStageGate gate(true, kSampleRate, holdSeconds);
+    CPGateBlock loud(0.5f), silent(0.0f), ringing(0.01f);
+    gate.setNeutral(false);
+    CP_EXPECT_TRUE(gate.shouldProcess(loud.channels, 2, kBlockFrames));
+    CP_EXPECT_TRUE(gate.resumed());
+    gate.observe(loud.channels, loud.channels, 2, kBlockFrames);
+
+    //Silent input, but the stage is still adding a tail: keeps running
+    for (uint32_t index = 0; index < 20; index++) {
+        CP_EXPECT_TRUE(gate.shouldProcess(silent.channels, 2, kBlockFrames));
+        gate.observe(silent.channels, ringing.channels, 2, kBlockFrames);
+    }
+    CP_EXPECT_EQ(gate.skippedBlocks(), 0u);
+
+    //The tail has died away: it runs for the hold time, then idles and every block is skipped
+    const uint32_t holdBlocks = (uint32_t)((kSampleRate * holdSeconds + kBlockFrames - 1) / kBlockFrames);
+    uint32_t ran = 0;
+    for (uint32_t index = 0; index < holdBlocks + 10; index++) {
+        if (gate.shouldProcess(silent.channels, 2, kBlockFrames)) {
+            gate.observe(silent.channels, silent.channels, 2, kBlockFrames);
+            ran++;
+        }
+    }
+    CP_EXPECT_EQ(ran, holdBlocks);
+    CP_EXPECT_EQ(gate.skippedBlocks(), 10u);
+
+    //Audible input wakes it again
+    CP_EXPECT_TRUE(gate.shouldProcess(loud.channels, 2, kBlockFrames));
+    CP_EXPECT_TRUE(gate.resumed());
+    CP_EXPECT_EQ(gate.skippedBlocks(), 10u);
+}
+
+CP_TEST(CPStageGateTests, testOversizeBlocksAreCountedApart) {
+    CPStageGate gate(false, kSampleRate);
+    gate.setNeutral(false);
+    gate.countOversizeBlock();
+    gate.countOversizeBlock();
+    CP_EXPECT_EQ(gate.oversizeBlocks(), 2u);
+    CP_EXPECT_EQ(gate.skippedBlocks(), 0u);
+}
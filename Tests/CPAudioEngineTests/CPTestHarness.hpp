@@ -0,0 +1,79 @@
+//
+//  CPTestHarness.hpp
+//  CPAudioEngineTests
+//
+//  Minimal test registry and checks, so the engine tests build anywhere the engine does
+//
+
+#ifndef CPTestHarness_hpp
+#define CPTestHarness_hpp
+
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace CPTest {
+
+typedef void (*TestFunction)();
+
+struct Test {
+    const char *suite;
+    const char *name;
+    TestFunction function;
+};
+
+std::vector<Test> &registry();
+
+struct Registrar {
+    Registrar(const char *suite, const char *name, TestFunction function) {
+        registry().push_back(Test { suite, name, function });
+    }
+};
+
+/// Records a failed check; `format` (may be empty) adds printf-style context.
+void fail(const char *file, int line, const char *expression, const char *values, const char *format, ...);
+void failCompare(const char *file, int line, const char *expression, double a, double b, const char *format, ...);
+
+/// A path for scratch files, under $TMPDIR or /tmp
+std::string temporaryPath(const char *name);
+
+/// Counts operator new calls made on the calling thread between start() and stop(), to check
+/// that render and switch paths don't allocate.
+class AllocationCounter {
+public:
+    void start();
+    uint64_t stop();
+};
+
+}
+
+/// Defines and registers `Suite.name`; ctest runs each suite as its own test.
+#define CP_TEST(suite, name) \
+    static void suite##_##name(); \
+    static CPTest::Registrar suite##_##name##_registrar(#suite, #name, &suite##_##name); \
+    static void suite##_##name()
+
+//Checks keep going after a failure, like XCTAssert; an optional format string and arguments follow
+#define CP_EXPECT_TRUE(condition, ...) \
+    do { if (!(condition)) CPTest::fail(__FILE__, __LINE__, #condition, "", "" __VA_ARGS__); } while (0)
+#define CP_EXPECT_FALSE(condition, ...) \
+    do { if (condition) CPTest::fail(__FILE__, __LINE__, "!(" #condition ")", "", "" __VA_ARGS__); } while (0)
+#define CP_EXPECT_COMPARE(a, op, b, ...) \
+    do { \
+        auto cpValueA = (a); auto cpValueB = (b); \
+        if (!(cpValueA op cpValueB)) CPTest::failCompare(__FILE__, __LINE__, #a " " #op " " #b, (double)cpValueA, (double)cpValueB, "" __VA_ARGS__); \
+    } while (0)
+#define CP_EXPECT_EQ(a, b, ...) CP_EXPECT_COMPARE(a, ==, b, __VA_ARGS__)
+#define CP_EXPECT_NE(a, b, ...) CP_EXPECT_COMPARE(a, !=, b, __VA_ARGS__)
+#define CP_EXPECT_LT(a, b, ...) CP_EXPECT_COMPARE(a, <, b, __VA_ARGS__)
+#define CP_EXPECT_LE(a, b, ...) CP_EXPECT_COMPARE(a, <=, b, __VA_ARGS__)
+#define CP_EXPECT_GT(a, b, ...) CP_EXPECT_COMPARE(a, >, b, __VA_ARGS__)
+#define CP_EXPECT_GE(a, b, ...) CP_EXPECT_COMPARE(a, >=, b, __VA_ARGS__)
+#define CP_EXPECT_NEAR(a, b, accuracy, ...) \
+    do { \
+        double cpValueA = (double)(a), cpValueB = (double)(b); \
+        if (!(std::fabs(cpValueA - cpValueB) <= (double)(accuracy))) CPTest::failCompare(__FILE__, __LINE__, #a " ~ " #b, cpValueA, cpValueB, "" __VA_ARGS__); \
+    } while (0)
+
+#endif /* CPTestHarness_hpp */
@@ -0,0 +1,120 @@
+//
+//  CPTestMain.cpp
+//  CPAudioEngineTests
+//
+//  Runs the registered engine tests: CPAudioEngineTests [suite or suite.name ...]
+//
+
+#include "CPTestHarness.hpp"
+#include <atomic>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+static uint64_t gFailures = 0;
+static thread_local bool gCountAllocations = false;
+static thread_local uint64_t gAllocations = 0;
+
+//Counting only where a test asked for it; everything else allocates as usual
+void *operator new(size_t size) {
+    if (gCountAllocations) {
+        gAllocations++;
+    }
+    if (void *memory = std::malloc(size == 0 ? 1 : size)) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void *memory, size_t) noexcept {
+    std::free(memory);
+}
+
+namespace CPTest {
+
+std::vector<Test> &registry() {
+    static std::vector<Test> tests;
+    return tests;
+}
+
+static void report(const char *file, int line, const char *expression, const char *values, const char *format, va_list arguments) {
+    gFailures++;
+    std::fprintf(stderr, "%s:%d: failed: %s%s", file, line, expression, values);
+    if (format[0] != '\0') {
+        std::fprintf(stderr, " (");
+        std::vfprintf(stderr, format, arguments);
+        std::fprintf(stderr, ")");
+    }
+    std::fprintf(stderr, "\n");
+}
+
+void fail(const char *file, int line, const char *expression, const char *values, const char *format, ...) {
+    va_list arguments;
+    va_start(arguments, format);
+    report(file, line, expression, values, format, arguments);
+    va_end(arguments);
+}
+
+void failCompare(const char *file, int line, const char *expression, double a, double b, const char *format, ...) {
+    char values[96];
+    std::snprintf(values, sizeof(values), ", %.9g vs %.9g", a, b);
+    va_list arguments;
+    va_start(arguments, format);
+    report(file, line, expression, values, format, arguments);
+    va_end(arguments);
+}
+
+std::string temporaryPath(const char *name) {
+    const char *directory = std::getenv("TMPDIR");
+    std::string path = directory != nullptr && directory[0] != '\0' ? directory : "/tmp";
+    if (path.back() != '/') {
+        path += '/';
+    }
+    return path + name;
+}
+
+void AllocationCounter::start() {
+    gAllocations = 0;
+    gCountAllocations = true;
+}
+
+uint64_t AllocationCounter::stop() {
+    gCountAllocations = false;
+    return gAllocations;
+}
+
+}
+
+//`filter` names a suite, or one test as suite.name
+static bool matches(const CPTest::Test &test, const char *filter) {
+    size_t suite = std::strlen(test.suite);
+    if (std::strncmp(filter, test.suite, suite) != 0) {
+        return false;
+    }
+    return filter[suite] == '\0' || (filter[suite] == '.' && std::strcmp(filter + suite + 1, test.name) == 0);
+}
+
+int main(int argc, const char *argv[]) {
+    uint32_t ran = 0;
+    for (const CPTest::Test &test : CPTest::registry()) {
+        bool selected = argc < 2;
+        for (int arg = 1; arg < argc && !selected; arg++) {
+            selected = matches(test, argv[arg]);
+        }
+        if (!selected) {
+            continue;
+        }
+        uint64_t failuresBefore = gFailures;
+        test.function();
+        std::printf("%-6s %s.%s\n", gFailures == failuresBefore ? "ok" : "FAILED", test.suite, test.name);
+        ran++;
+    }
+    std::printf("%u tests, %llu failed checks\n", ran, (unsigned long long)gFailures);
+    return ran > 0 && gFailures == 0 ? 0 : 1;
+}
@@ -0,0 +1,101 @@
+//
+//  CPTrackSourceTests.cpp
+//  CPAudioEngineTests
+//
+//  What track switches cost: the source's allocation count against the heap's own
+//
+
+#include "CPTestHarness.hpp"
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <vector>
+#include "CPAllocationCount.hpp"
+#include "CPDecodedAudioCache.hpp"
+#include "CPMatrixMixer.hpp"
+#include "CPTrackSource.hpp"
+#include "CPWavFileDecoder.hpp"
+
+static const double kSampleRate = 44100;
+static const uint32_t kToneFrames = 44100;
+
+//One second of a stereo 16 bit tone
+static bool writeTone(const std::string &path) {
+    std::FILE *file = std::fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        return false;
+    }
+    auto put = [file](uint32_t value, uint32_t bytes) {
+        for (uint32_t byte = 0; byte < bytes; byte++) {
+            std::fputc((int)((value >> (8 * byte)) & 0xff), file);
+        }
+    };
+    uint32_t dataBytes = kToneFrames * 2 * 2;
+    std::fwrite("RIFF", 1, 4, file);
+    put(36 + dataBytes, 4);
+    std::fwrite("WAVEfmt ", 1, 8, file);
+    put(16, 4);
+    put(1, 2);
+    put(2, 2);
+    put((uint32_t)kSampleRate, 4);
+    put((uint32_t)kSampleRate * 4, 4);
+    put(4, 2);
+    put(16, 2);
+    std::fwrite("data", 1, 4, file);
+    put(dataBytes, 4);
+    for (uint32_t frame = 0; frame < kToneFrames; frame++) {
+        int16_t sample = (int16_t)std::lrint(8000 * std::sin(2 * M_PI * 440 * frame / kSampleRate));
+        put((uint16_t)sample, 2);
+        put((uint16_t)sample, 2);
+    }
+    return std::fclose(file) == 0;
+}
+
+CP_TEST(CPTrackSourceTests, testSwitchAllocationsMatchTheHeap) {
+    const std::string path = CPTest::temporaryPath("CPTrackSourceTone.wav");
+    CP_EXPECT_TRUE(writeTone(path));
+    CPMatrixMixer mixer(2);
+    CPTrackSource source(kSampleRate, mixer);
+    CPDecodedAudioCache cache(64 << 20);
+    CPTest::AllocationCounter heap;
+
+    //Cold: the decoder and the block it reads the file through
+    heap.start();
+    bool attached = source.attach(CPWavFileDecoder::open(path));
+    uint64_t coldHeap = heap.stop();
+    CP_EXPECT_TRUE(attached);
+    CP_EXPECT_EQ(source.stats().allocationsLastSwitch, 2u);
+    CP_EXPECT_EQ(source.stats().allocationsLastSwitch, coldHeap);
+    uint64_t total = source.stats().allocationsLastSwitch;
+
+    //Warm: seeking reuses the decoder and a spare deck's ring, the heap is not touched at all
+    heap.start();
+    attached = source.seek(kToneFrames / 2);
+    uint64_t warmHeap = heap.stop();
+    CP_EXPECT_TRUE(attached);
+    CP_EXPECT_EQ(warmHeap, 0u);
+    CP_EXPECT_EQ(source.stats().allocationsLastSwitch, 0u);
+
+    //Captured while it plays: the wrapper, the track, its planes and their first growth
+    heap.start();
+    attached = source.attach(cache.capture(path, CPWavFileDecoder::open(path)));
+    uint64_t captureHeap = heap.stop();
+    CP_EXPECT_TRUE(attached);
+    CP_EXPECT_GE(source.stats().allocationsLastSwitch, 3u + 2u + 2u);
+    CP_EXPECT_LE(source.stats().allocationsLastSwitch, captureHeap);
+    total += source.stats().allocationsLastSwitch;
+
+    //Cached: only the decoder reading the track. The prefetch belongs to no switch (it runs on its
+    //own queue in the player), so its count is taken here
+    CP_EXPECT_TRUE(cache.prefetch(path, CPWavFileDecoder::open(path)));
+    CPTakeAllocations();
+    heap.start();
+    attached = source.attach(cache.open(path, kSampleRate));
+    uint64_t cachedHeap = heap.stop();
+    CP_EXPECT_TRUE(attached);
+    CP_EXPECT_EQ(source.stats().allocationsLastSwitch, 1u);
+    CP_EXPECT_EQ(source.stats().allocationsLastSwitch, cachedHeap);
+    total += source.stats().allocationsLastSwitch;
+    CP_EXPECT_EQ(source.stats().allocations, total);
+    std::remove(path.c_str());
+}
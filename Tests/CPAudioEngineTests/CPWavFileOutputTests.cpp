@@ -0,0 +1,133 @@
+//
+//  CPWavFileOutputTests.cpp
+//  CPAudioEngineTests
+//
+//  Offline bounces through the WAV file output, read back byte by byte
+//
+
+#include "CPTestHarness.hpp"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include "CPClockedOutput.hpp"
+
+static const uint32_t kChannels = 2;
+static const uint32_t kBounceFrames = 44100;
+
+//Sample `frame` of `channel`: a ramp per channel, so misplaced or dropped frames show
+static float testSample(uint64_t frame, uint32_t channel) {
+    return (float)((frame * 7 + channel * 500) % 1000) / 1000.0f - 0.5f;
+}
+
+static void renderRamp(void *refCon, float *const *channels, uint32_t numChannels, uint32_t frames) {
+    uint64_t *position = (uint64_t *)refCon;
+    for (uint32_t channel = 0; channel < numChannels; channel++) {
+        for (uint32_t frame = 0; frame < frames; frame++) {
+            channels[channel][frame] = testSample(*position + frame, channel);
+        }
+    }
+    *position += frames;
+}
+
+static uint32_t readLE(const uint8_t *bytes, uint32_t count) {
+    uint32_t value = 0;
+    for (uint32_t byte = 0; byte < count; byte++) {
+        value |= (uint32_t)bytes[byte] << (8 * byte);
+    }
+    return value;
+}
+
+//Bounces at least kBounceFrames of the ramp and returns the file's bytes
+static std::vector<uint8_t> bounce(const std::string &path, CPWavFileOutput::Encoding encoding, uint64_t *framesWritten) {
+    uint64_t position = 0;
+    CPWavFileOutput output(path, encoding);
+    output.setRenderCallback(&renderRamp, &position);
+    CPOutputConfig config;
+    config.channels = kChannels;
+    config.realtimePriority = false;
+    if (!output.open(config) || !output.start()) {
+        return {};
+    }
+    while (output.framesWritten() < kBounceFrames) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    output.stop();
+    output.close();
+    *framesWritten = output.framesWritten();
+
+    std::vector<uint8_t> bytes;
+    std::FILE *file = std::fopen(path.c_str(), "rb");
+    if (file != nullptr) {
+        uint8_t chunk[4096];
+        size_t read;
+        while ((read = std::fread(chunk, 1, sizeof(chunk), file)) > 0) {
+            bytes.insert(bytes.end(), chunk, chunk + read);
+        }
+        std::fclose(file);
+    }
+    std::remove(path.c_str());
+    return bytes;
+}
+
+CP_TEST(CPWavFileOutputTests, testFloatBounceHeaderAndSamples) {
+    uint64_t frames = 0;
+    std::vector<uint8_t> file = bounce(CPTest::temporaryPath("CPWavFileOutputFloat.wav"),
+                                       CPWavFileOutput::EncodingFloat32, &frames);
+    CP_EXPECT_GE(frames, kBounceFrames);
+    uint32_t dataBytes = (uint32_t)frames * kChannels * 4;
+    CP_EXPECT_EQ(file.size(), 44 + dataBytes);
+    if (file.size() != 44 + dataBytes) {
+        return;
+    }
+    CP_EXPECT_TRUE(memcmp(file.data(), "RIFF", 4) == 0);
+    CP_EXPECT_EQ(readLE(&file[4], 4), 36 + dataBytes);
+    CP_EXPECT_TRUE(memcmp(&file[8], "WAVEfmt ", 8) == 0);
+    CP_EXPECT_EQ(readLE(&file[16], 4), 16u);
+    CP_EXPECT_EQ(readLE(&file[20], 2), 3u);               //IEEE float
+    CP_EXPECT_EQ(readLE(&file[22], 2), kChannels);
+    CP_EXPECT_EQ(readLE(&file[24], 4), 44100u);
+    CP_EXPECT_EQ(readLE(&file[28], 4), 44100u * kChannels * 4);
+    CP_EXPECT_EQ(readLE(&file[32], 2), kChannels * 4);
+    CP_EXPECT_EQ(readLE(&file[34], 2), 32u);
+    CP_EXPECT_TRUE(memcmp(&file[36], "data", 4) == 0);
+    CP_EXPECT_EQ(readLE(&file[40], 4), dataBytes);
+
+    //Interleaved, exactly as rendered
+    const float *samples = (const float *)&file[44];
+    uint64_t mismatches = 0;
+    for (uint64_t frame = 0; frame < frames; frame++) {
+        for (uint32_t channel = 0; channel < kChannels; channel++) {
+            mismatches += samples[frame * kChannels + channel] != testSample(frame, channel);
+        }
+    }
+    CP_EXPECT_EQ(mismatches, 0u);
+}
+
+CP_TEST(CPWavFileOutputTests, testPCM16BounceHeaderAndSamples) {
+    uint64_t frames = 0;
+    std::vector<uint8_t> file = bounce(CPTest::temporaryPath("CPWavFileOutputPCM16.wav"),
+                                       CPWavFileOutput::EncodingPCM16, &frames);
+    uint32_t dataBytes = (uint32_t)frames * kChannels * 2;
+    CP_EXPECT_EQ(file.size(), 44 + dataBytes);
+    if (file.size() != 44 + dataBytes) {
+        return;
+    }
+    CP_EXPECT_EQ(readLE(&file[20], 2), 1u);               //PCM
+    CP_EXPECT_EQ(readLE(&file[32], 2), kChannels * 2);
+    CP_EXPECT_EQ(readLE(&file[34], 2), 16u);
+    CP_EXPECT_EQ(readLE(&file[40], 4), dataBytes);
+
+    const int16_t *samples = (const int16_t *)&file[44];
+    uint64_t mismatches = 0;
+    for (uint64_t frame = 0; frame < frames; frame++) {
+        for (uint32_t channel = 0; channel < kChannels; channel++) {
+            long expected = std::lrintf(testSample(frame, channel) * 32767.0f);
+            mismatches += std::labs(samples[frame * kChannels + channel] - expected) > 1;
+        }
+    }
+    CP_EXPECT_EQ(mismatches, 0u);
+}
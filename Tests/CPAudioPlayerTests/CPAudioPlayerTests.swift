@@ -1,4 +1,5 @@
 import XCTest
+import AVFoundation
 @testable import CPAudioPlayer
 @testable import CPAudioPlayerUI
 
@@ -47,10 +48,393 @@ final class CPAudioPlayerTests: XCTestCase {
         XCTAssertEqual(player.eqBands[2], 2)
     }
 
+    func testApplyCustomPreset() throws {
+        let player = AudioPlayer()
+        player.setEQBands([1, 2, 3, 4, 5, 6, 7])
+        player.saveCustomPreset(name: "Test Preset")
+        player.resetEQ()
+        XCTAssertTrue(player.applyCustomPreset("Test Preset"))
+        XCTAssertEqual(player.eqBands, [1, 2, 3, 4, 5, 6, 7])
+        player.deleteCustomPreset(name: "Test Preset")
+        XCTAssertFalse(player.applyCustomPreset("Test Preset"))
+    }
+
+    func testBandPresetBanks() throws {
+        let player = CPAudioPlayer()
+        let rock = player.compileBandPreset([4, 2, -1, 0, 2, 4, 5])
+        let flat = player.compileBandPreset([0, 0, 0, 0, 0, 0, 0])
+        XCTAssertGreaterThanOrEqual(rock, 0)
+        XCTAssertNotEqual(rock, flat)
+
+        XCTAssertTrue(player.applyBandPreset(rock))
+        XCTAssertEqual(player.getValueForBand(0), 4)
+        XCTAssertEqual(player.getValueForBand(6), 5)
+
+        player.removeBandPreset(rock)
+        XCTAssertFalse(player.applyBandPreset(rock))
+        XCTAssertFalse(player.applyBandPreset(-1))
+    }
+
+    func testHotTrackSwitch() throws {
+        let first = try makeToneFile(named: "first", frequency: 440)
+        let second = try makeToneFile(named: "second", frequency: 660)
+        let player = CPAudioPlayer()
+
+        var isError: DarwinBoolean = false
+        player.setupAudioFile(with: first, playBackDuration: 0, isError: &isError)
+        XCTAssertFalse(isError.boolValue)
+        XCTAssertEqual(player.playBackduration, 2, accuracy: 0.01)
+        XCTAssertTrue(player.play())
+        RunLoop.current.run(until: Date(timeIntervalSinceNow: 0.2))
+
+        player.setupAudioFile(with: second, playBackDuration: 0, isError: &isError)
+        XCTAssertFalse(isError.boolValue)
+        RunLoop.current.run(until: Date(timeIntervalSinceNow: 0.2))
+        XCTAssertGreaterThan(player.trackSwitchLatency, 0)
+        XCTAssertLessThan(player.trackSwitchLatency, 0.1)
+        //A new track costs its decoder, buffer list and capture; a seek reuses all of them
+        XCTAssertGreaterThan(player.trackSwitchAllocations, 0)
+        XCTAssertLessThan(player.currentPlaybackTime, 0.5)
+        player.setPlayBackTime(1)
+        XCTAssertEqual(player.trackSwitchAllocations, 0)
+        player.stop()
+    }
+
+    func testLazyStartup() throws {
+        let tone = try makeToneFile(named: "startup", frequency: 440)
+        let player = CPAudioPlayer()
+        XCTAssertGreaterThan(player.launchDuration, 0)
+        XCTAssertEqual(player.timeToFirstAudio, 0)
+        //Neutral values leave the effect stages out of the chain
+        XCTAssertEqual(player.getBassBoost(), 0)
+        XCTAssertEqual(player.getChannelBalance(), 0)
+
+        var isError: DarwinBoolean = false
+        player.setupAudioFile(with: tone, playBackDuration: 0, isError: &isError)
+        XCTAssertTrue(player.play())
+        RunLoop.current.run(until: Date(timeIntervalSinceNow: 0.2))
+        XCTAssertGreaterThan(player.timeToFirstAudio, 0)
+        XCTAssertLessThan(player.timeToFirstAudio, 0.2)
+        //The reverb is wet out of the box and plays from launch, as it always has
+        XCTAssertGreaterThan(player.getVauleForComponent("rvb2", parameter: Int32(kReverb2Param_DryWetMix)), 0)
+        XCTAssertEqual(player.processingStageCount, 1)
+
+        //Engaging a stage while playing keeps the track going
+        player.setbassBoost(0.5)
+        XCTAssertEqual(player.getBassBoost(), 0.5, accuracy: 0.01)
+        RunLoop.current.run(until: Date(timeIntervalSinceNow: 0.1))
+        XCTAssertGreaterThan(player.currentPlaybackTime, 0.2)
+        player.stop()
+    }
+
+    func testNeutralStagesAreSkipped() throws {
+        let tone = try makeToneFile(named: "neutral", frequency: 440)
+        let player = CPAudioPlayer()
+        //A fully dry reverb is neutral too
+        player.setVauleForComponent("rvb2", parameter: Int32(kReverb2Param_DryWetMix), value: 0)
+        var isError: DarwinBoolean = false
+        player.setupAudioFile(with: tone, playBackDuration: 0, isError: &isError)
+        XCTAssertTrue(player.play())
+        RunLoop.current.run(until: Date(timeIntervalSinceNow: 0.1))
+        XCTAssertEqual(player.processingStageCount, 0)
+        //Every stage skipped every block so far
+        XCTAssertGreaterThan(player.skippedStageBlocks, 0)
+
+        player.setTreble(0.5)
+        RunLoop.current.run(until: Date(timeIntervalSinceNow: 0.1))
+        XCTAssertEqual(player.processingStageCount, 1)
+
+        //Back to neutral: the shelf has no tail and is skipped straight away
+        player.setTreble(0)
+        RunLoop.current.run(until: Date(timeIntervalSinceNow: 0.1))
+        XCTAssertEqual(player.processingStageCount, 0)
+
+        //The delay rings out before it idles
+        player.setRoomSize(1)
+        RunLoop.current.run(until: Date(timeIntervalSinceNow: 0.1))
+        player.setRoomSize(0)
+        XCTAssertEqual(player.processingStageCount, 1)
+        RunLoop.current.run(until: Date(timeIntervalSinceNow: 0.5))
+        XCTAssertEqual(player.processingStageCount, 0)
+        XCTAssertEqual(player.oversizeStageBlocks, 0)
+        player.stop()
+
+        //Counted per player, not carried over from this one
+        let next = CPAudioPlayer()
+        XCTAssertEqual(next.skippedStageBlocks, 0)
+        XCTAssertEqual(next.oversizeStageBlocks, 0)
+    }
+
+    func testDecodedAudioCache() throws {
+        //Short enough for the loader to decode each track to the end straight away
+        let first = try makeToneFile(named: "cached-first", frequency: 440, seconds: 1)
+        let second = try makeToneFile(named: "cached-second", frequency: 660, seconds: 1)
+        let player = CPAudioPlayer()
+        XCTAssertEqual(player.decodedCacheBytes, 0)
+
+        //Play the first track through so it is captured, then prefetch the second
+        var isError: DarwinBoolean = false
+        player.setupAudioFile(with: first, playBackDuration: 0, isError: &isError)
+        XCTAssertTrue(player.play())
+        player.prefetchAudioFile(with: second)
+        RunLoop.current.run(until: Date(timeIntervalSinceNow: 0.5))
+        //1 s of stereo float16, twice
+        XCTAssertGreaterThanOrEqual(player.decodedCacheBytes, 2 * 2 * 2 * 44100)
+
+        player.setupAudioFile(with: second, playBackDuration: 0, isError: &isError)
+        XCTAssertFalse(isError.boolValue)
+        player.setupAudioFile(with: first, playBackDuration: 0, isError: &isError)
+        XCTAssertFalse(isError.boolValue)
+        XCTAssertEqual(player.playBackduration, 1, accuracy: 0.01)
+        XCTAssertGreaterThan(player.decodedCacheHitRate, 0.5)
+        XCTAssertGreaterThan(player.decodeTimeSaved, 0)
+
+        player.decodedCacheBudget = 0
+        XCTAssertEqual(player.decodedCacheBytes, 0)
+        player.stop()
+    }
+
+    func testMixerVolumeBalanceAndDownmix() throws {
+        let surround = try makeToneFile(named: "surround", frequency: 440, seconds: 1, layout: kAudioChannelLayoutTag_MPEG_5_1_A)
+        let player = CPAudioPlayer()
+        XCTAssertEqual(player.getVolume(), 1)
+        player.setVolume(0.5)
+        player.setChannelBalance(-0.25)
+        player.setLoudnessGain(-6)
+        XCTAssertEqual(player.getVolume(), 0.5)
+        XCTAssertEqual(player.getChannelBalance(), -0.25)
+        XCTAssertEqual(player.getLoudnessGain(), -6)
+
+        //5.1 files keep their channels up to the mixer, which folds them down to stereo
+        //(the fold-down itself is checked sample by sample in CPMatrixMixerTests)
+        var isError: DarwinBoolean = false
+        player.setupAudioFile(with: surround, playBackDuration: 0, isError: &isError)
+        XCTAssertFalse(isError.boolValue)
+        XCTAssertEqual(player.trackChannels, 6)
+        XCTAssertTrue(player.play())
+        RunLoop.current.run(until: Date(timeIntervalSinceNow: 0.2))
+        XCTAssertGreaterThan(player.currentPlaybackTime, 0)
+        player.stop()
+    }
+
+    func testOutputBackendMeasurements() throws {
+        let tone = try makeToneFile(named: "output", frequency: 440, seconds: 1)
+        let player = CPAudioPlayer()
+        XCTAssertGreaterThan(player.outputPeriodFrames, 0)
+        XCTAssertGreaterThan(player.outputLatency, 0)
+
+        //A new period re-opens the device; playback carries on across it
+        player.outputPeriodFrames = 512
+        var isError: DarwinBoolean = false
+        player.setupAudioFile(with: tone, playBackDuration: 0, isError: &isError)
+        XCTAssertTrue(player.play())
+        RunLoop.current.run(until: Date(timeIntervalSinceNow: 0.3))
+        XCTAssertGreaterThan(player.currentPlaybackTime, 0)
+        XCTAssertGreaterThan(player.outputLatency, 0)
+        XCTAssertLessThan(player.outputLatency, 0.5)
+        XCTAssertLessThan(player.outputJitter, 0.05)
+        player.stop()
+    }
+
+    func testBackgroundRendering() throws {
+        let tone = try makeToneFile(named: "background", frequency: 440, seconds: 2)
+        let player = CPAudioPlayer()
+        XCTAssertFalse(player.backgroundRendering)
+        player.outputPeriodFrames = 512
+        let interactivePeriod = player.outputPeriodFrames
+        var isError: DarwinBoolean = false
+        player.setupAudioFile(with: tone, playBackDuration: 0, isError: &isError)
+        XCTAssertTrue(player.play())
+
+        //Longer periods, playback carries on across the switch both ways
+        player.backgroundRendering = true
+        XCTAssertTrue(player.backgroundRendering)
+        XCTAssertGreaterThan(player.outputPeriodFrames, interactivePeriod)
+        RunLoop.current.run(until: Date(timeIntervalSinceNow: 0.4))
+        let position = player.currentPlaybackTime
+        XCTAssertGreaterThan(position, 0)
+        player.backgroundRendering = false
+        XCTAssertEqual(player.outputPeriodFrames, interactivePeriod)
+        RunLoop.current.run(until: Date(timeIntervalSinceNow: 0.2))
+        XCTAssertGreaterThan(player.currentPlaybackTime, position)
+        player.stop()
+    }
+
+    func testPipelinedRendering() throws {
+        let tone = try makeToneFile(named: "pipeline", frequency: 440, seconds: 2)
+        let player = CPAudioPlayer()
+        XCTAssertEqual(player.pipelineStages, 0)
+        XCTAssertEqual(player.pipelineLatency, 0)
+
+        //A bass boost gives the chain a second unit to put on the second stage
+        player.setbassBoost(6)
+        player.pipelineStages = 2
+        XCTAssertEqual(player.pipelineStages, 2)
+        XCTAssertEqual(player.pipelineLatency, Double(3 * player.outputPeriodFrames) / AVAudioSession.sharedInstance().sampleRate, accuracy: 0.001)
+        var isError: DarwinBoolean = false
+        player.setupAudioFile(with: tone, playBackDuration: 0, isError: &isError)
+        XCTAssertTrue(player.play())
+        RunLoop.current.run(until: Date(timeIntervalSinceNow: 0.5))
+        XCTAssertGreaterThan(player.currentPlaybackTime, 0.2)
+        //The bass boost and the default reverb
+        XCTAssertEqual(player.processingStageCount, 2)
+
+        //Paused, the position stays put although the source has rendered ahead of it
+        player.pause()
+        let pausedAt = player.currentPlaybackTime
+        RunLoop.current.run(until: Date(timeIntervalSinceNow: 0.1))
+        XCTAssertEqual(player.currentPlaybackTime, pausedAt)
+        player.pipelineStages = 0
+        XCTAssertEqual(player.currentPlaybackTime, pausedAt, accuracy: 0.001)
+        player.stop()
+    }
+
+    func testSleepFadeRunsInEngine() throws {
+        let tone = try makeToneFile(named: "sleep", frequency: 440)
+        let player = CPAudioPlayer()
+        XCTAssertEqual(player.automationGain, 1)
+        var isError: DarwinBoolean = false
+        player.setupAudioFile(with: tone, playBackDuration: 0, isError: &isError)
+        XCTAssertTrue(player.play())
+
+        //Hold, fade, pause: one completion and no timers
+        var slept = false
+        player.scheduleSleep(after: 0.4, fadeDuration: 0.2) { slept = true }
+        RunLoop.current.run(until: Date(timeIntervalSinceNow: 0.3))
+        XCTAssertFalse(slept)
+        XCTAssertLessThan(player.automationGain, 1)
+        RunLoop.current.run(until: Date(timeIntervalSinceNow: 0.4))
+        XCTAssertTrue(slept)
+        let pausedAt = player.currentPlaybackTime
+        RunLoop.current.run(until: Date(timeIntervalSinceNow: 0.1))
+        XCTAssertEqual(player.currentPlaybackTime, pausedAt)
+
+        //Resuming starts back at unity
+        XCTAssertTrue(player.play())
+        RunLoop.current.run(until: Date(timeIntervalSinceNow: 0.1))
+        XCTAssertEqual(player.automationGain, 1)
+
+        var faded = false
+        player.fade(toGain: 0.25, duration: 0.1, curve: .exponential) { faded = true }
+        RunLoop.current.run(until: Date(timeIntervalSinceNow: 0.3))
+        XCTAssertTrue(faded)
+        XCTAssertEqual(player.automationGain, 0.25, accuracy: 0.001)
+
+        //A cancelled sleep goes back to the gain it held
+        var sleptAgain = false
+        player.scheduleSleep(after: 0.4, fadeDuration: 0.3) { sleptAgain = true }
+        RunLoop.current.run(until: Date(timeIntervalSinceNow: 0.2))
+        player.cancelSleep()
+        RunLoop.current.run(until: Date(timeIntervalSinceNow: 0.4))
+        XCTAssertFalse(sleptAgain)
+        XCTAssertEqual(player.automationGain, 0.25, accuracy: 0.001)
+        player.stop()
+    }
+
+    func testCancelSleepLeavesOtherFades() throws {
+        let tone = try makeToneFile(named: "sleep-cancel", frequency: 440)
+        let player = CPAudioPlayer()
+        var isError: DarwinBoolean = false
+        player.setupAudioFile(with: tone, playBackDuration: 0, isError: &isError)
+        XCTAssertTrue(player.play())
+
+        //A fade started after the sleep replaces it; cancelling the sleep must not touch that fade
+        var slept = false
+        var faded = false
+        player.scheduleSleep(after: 0.5, fadeDuration: 0.2) { slept = true }
+        player.fade(toGain: 0.5, duration: 0.2, curve: .linear) { faded = true }
+        player.cancelSleep()
+        RunLoop.current.run(until: Date(timeIntervalSinceNow: 0.4))
+        XCTAssertTrue(faded)
+        XCTAssertFalse(slept)
+        XCTAssertEqual(player.automationGain, 0.5, accuracy: 0.001)
+
+        //No completion replaces one that was registered
+        faded = false
+        player.fade(toGain: 0.75, duration: 0.1, curve: .linear) { faded = true }
+        player.fade(toGain: 1, duration: 0.1, curve: .linear, completion: nil)
+        RunLoop.current.run(until: Date(timeIntervalSinceNow: 0.3))
+        XCTAssertFalse(faded)
+        XCTAssertEqual(player.automationGain, 1, accuracy: 0.001)
+        player.stop()
+    }
+
+    func testFingerprintMatchesCopies() throws {
+        let melody = [60, 64, 67, 72, 71, 67, 64, 62]
+        let original = try makeMelodyFile(named: "print-original", notes: melody, seconds: 5)
+        let copy = try makeMelodyFile(named: "print-copy", notes: melody, seconds: 5, sampleRate: 48000)
+        let other = try makeMelodyFile(named: "print-other", notes: [57, 60, 65, 69, 67, 64, 62, 59], seconds: 5)
+        let longer = try makeMelodyFile(named: "print-longer", notes: melody, seconds: 8)
+        let prints = CPAudioFingerprintIndex.fingerprintsForFiles(at: [original, copy, other, longer])
+        XCTAssertEqual(prints.count, 4)
+        let originalPrint = try XCTUnwrap(prints[0] as? Data)
+        let copyPrint = try XCTUnwrap(prints[1] as? Data)
+        let otherPrint = try XCTUnwrap(prints[2] as? Data)
+        let longerPrint = try XCTUnwrap(prints[3] as? Data)
+        XCTAssertEqual(CPAudioFingerprintIndex.duration(ofFingerprint: originalPrint), 5, accuracy: 0.01)
+        XCTAssertEqual(CPAudioFingerprintIndex.duration(ofFingerprint: otherPrint), 5, accuracy: 0.01)
+
+        //The copy at another rate matches; another tune of the same length and the same tune
+        //at another length don't
+        let index = CPAudioFingerprintIndex()
+        index.addFingerprint(originalPrint, forKey: "original")
+        XCTAssertEqual(index.count, 1)
+        XCTAssertEqual(index.matches(forFingerprint: copyPrint).first?.key, "original")
+        XCTAssertTrue(index.matches(forFingerprint: otherPrint).isEmpty)
+        XCTAssertTrue(index.matches(forFingerprint: longerPrint).isEmpty)
+        index.removeFingerprint(forKey: "original")
+        XCTAssertTrue(index.matches(forFingerprint: copyPrint).isEmpty)
+    }
+
     func testTimeFormatting() throws {
         let player = AudioPlayer()
         // Test formatting through convenience extension
         XCTAssertEqual(player.currentTimeFormatted, "0:00")
         XCTAssertEqual(player.durationFormatted, "0:00")
     }
+
+    private func makeToneFile(named name: String, frequency: Double, seconds: Double = 2, sampleRate: Double = 44100,
+                              layout: AudioChannelLayoutTag = kAudioChannelLayoutTag_Stereo) throws -> URL {
+        let url = FileManager.default.temporaryDirectory.appendingPathComponent("\(name).caf")
+        let format = AVAudioFormat(standardFormatWithSampleRate: sampleRate, channelLayout: AVAudioChannelLayout(layoutTag: layout)!)
+        let frames = AVAudioFrameCount(seconds * format.sampleRate)
+        let buffer = AVAudioPCMBuffer(pcmFormat: format, frameCapacity: frames)!
+        buffer.frameLength = frames
+        for channel in 0..<Int(format.channelCount) {
+            let samples = buffer.floatChannelData![channel]
+            for frame in 0..<Int(frames) {
+                samples[frame] = Float(sin(2 * Double.pi * frequency * Double(frame) / format.sampleRate) * 0.5)
+            }
+        }
+        let file = try AVAudioFile(forWriting: url, settings: format.settings)
+        try file.write(from: buffer)
+        return url
+    }
+
+    /// Quarter second notes (MIDI numbers, repeated to fill `seconds`), each with three
+    /// harmonics and a decaying envelope, so fingerprints see moving spectra rather than one peak
+    private func makeMelodyFile(named name: String, notes: [Int], seconds: Double, sampleRate: Double = 44100) throws -> URL {
+        let url = FileManager.default.temporaryDirectory.appendingPathComponent("\(name).caf")
+        let format = AVAudioFormat(standardFormatWithSampleRate: sampleRate, channels: 2)!
+        let frames = AVAudioFrameCount(seconds * format.sampleRate)
+        let noteFrames = Int(0.25 * format.sampleRate)
+        let buffer = AVAudioPCMBuffer(pcmFormat: format, frameCapacity: frames)!
+        buffer.frameLength = frames
+        for frame in 0..<Int(frames) {
+            let note = notes[(frame / noteFrames) % notes.count]
+            let frequency = 440 * pow(2, Double(note - 69) / 12)
+            let time = Double(frame) / format.sampleRate
+            var sample = 0.0
+            for harmonic in 1...3 {
+                sample += sin(2 * Double.pi * frequency * Double(harmonic) * time) / Double(harmonic)
+            }
+            let value = Float(sample * exp(-4 * Double(frame % noteFrames) / format.sampleRate) * 0.3)
+            for channel in 0..<Int(format.channelCount) {
+                buffer.floatChannelData![channel][frame] = value
+            }
+        }
+        let file = try AVAudioFile(forWriting: url, settings: format.settings)
+        try file.write(from: buffer)
+        return url
+    }
 }